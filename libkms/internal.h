@@ -83,4 +83,6 @@ drm_private int exynos_create(int fd, struct kms_driver **out);
 
 int mediatek_create(int fd, struct kms_driver **out);
 
+drm_private int rockchip_create(int fd, struct kms_driver **out);
+
 #endif
@@ -0,0 +1,282 @@
+/* rockchip.c
+ *
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "internal.h"
+
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include "xf86drm.h"
+
+#include "libdrm_macros.h"
+#include "libdrm_lists.h"
+#include "rockchip_drm.h"
+
+/* The VOP fetches scanout lines in 64 byte bursts */
+#define ROCKCHIP_KMS_PITCH_ALIGN	64
+
+/*
+ * Destroyed buffers are kept for reuse, most recently destroyed first, as
+ * long as there are at most ROCKCHIP_KMS_CACHE_MAX of them and they take
+ * at most ROCKCHIP_KMS_CACHE_MAX_BYTES together.
+ */
+#define ROCKCHIP_KMS_CACHE_MAX		8
+#define ROCKCHIP_KMS_CACHE_MAX_BYTES	(32 * 1024 * 1024)
+
+struct rockchip_kms
+{
+	struct kms_driver base;
+	drmMMListHead cache;
+	unsigned cache_nr;
+	size_t cache_bytes;
+};
+
+struct rockchip_bo
+{
+	struct kms_bo base;
+	drmMMListHead link;
+	unsigned map_count;
+};
+
+static int
+rockchip_get_prop(struct kms_driver *kms, unsigned key, unsigned *out)
+{
+	switch (key) {
+	case KMS_BO_TYPE:
+		*out = KMS_BO_TYPE_SCANOUT_X8R8G8B8 | KMS_BO_TYPE_CURSOR_64X64_A8R8G8B8;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void
+rockchip_bo_free(struct rockchip_bo *bo)
+{
+	struct drm_gem_close arg;
+
+	if (bo->base.ptr)
+		drm_munmap(bo->base.ptr, bo->base.size);
+
+	memset(&arg, 0, sizeof(arg));
+	arg.handle = bo->base.handle;
+
+	drmIoctl(bo->base.kms->fd, DRM_IOCTL_GEM_CLOSE, &arg);
+	free(bo);
+}
+
+static void
+rockchip_cache_del(struct rockchip_kms *kms, struct rockchip_bo *bo)
+{
+	DRMLISTDEL(&bo->link);
+	kms->cache_nr--;
+	kms->cache_bytes -= bo->base.size;
+}
+
+static int
+rockchip_destroy(struct kms_driver *_kms)
+{
+	struct rockchip_kms *kms = (struct rockchip_kms *)_kms;
+	struct rockchip_bo *bo, *tmp;
+
+	DRMLISTFOREACHENTRYSAFE(bo, tmp, &kms->cache, link) {
+		rockchip_cache_del(kms, bo);
+		rockchip_bo_free(bo);
+	}
+
+	free(kms);
+	return 0;
+}
+
+static int
+rockchip_bo_create(struct kms_driver *_kms,
+		   const unsigned width, const unsigned height,
+		   const enum kms_bo_type type, const unsigned *attr,
+		   struct kms_bo **out)
+{
+	struct rockchip_kms *kms = (struct rockchip_kms *)_kms;
+	struct drm_rockchip_gem_create arg;
+	unsigned size, pitch;
+	struct rockchip_bo *bo;
+	int i, ret;
+
+	for (i = 0; attr[i]; i += 2) {
+		switch (attr[i]) {
+		case KMS_WIDTH:
+		case KMS_HEIGHT:
+		case KMS_BO_TYPE:
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	if (type == KMS_BO_TYPE_CURSOR_64X64_A8R8G8B8) {
+		pitch = 64 * 4;
+		size = 64 * 64 * 4;
+	} else if (type == KMS_BO_TYPE_SCANOUT_X8R8G8B8) {
+		pitch = width * 4;
+		pitch = (pitch + ROCKCHIP_KMS_PITCH_ALIGN - 1) &
+			~(ROCKCHIP_KMS_PITCH_ALIGN - 1);
+		size = pitch * height;
+	} else {
+		return -EINVAL;
+	}
+
+	/* A buffer of the same layout may have been destroyed lately */
+	DRMLISTFOREACHENTRY(bo, &kms->cache, link) {
+		if (bo->base.size == size && bo->base.pitch == pitch) {
+			rockchip_cache_del(kms, bo);
+			bo->map_count = 0;
+			*out = &bo->base;
+			return 0;
+		}
+	}
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		return -ENOMEM;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.size = size;
+
+	ret = drmIoctl(kms->base.fd, DRM_IOCTL_ROCKCHIP_GEM_CREATE, &arg);
+	if (ret) {
+		ret = -errno;
+		goto err_free;
+	}
+
+	bo->base.kms = &kms->base;
+	bo->base.handle = arg.handle;
+	bo->base.size = size;
+	bo->base.pitch = pitch;
+
+	*out = &bo->base;
+
+	return 0;
+
+err_free:
+	free(bo);
+	return ret;
+}
+
+static int
+rockchip_bo_get_prop(struct kms_bo *bo, unsigned key, unsigned *out)
+{
+	switch (key) {
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+rockchip_bo_map(struct kms_bo *_bo, void **out)
+{
+	struct rockchip_bo *bo = (struct rockchip_bo *)_bo;
+	struct drm_rockchip_gem_map_off arg;
+	void *map = NULL;
+	int ret;
+
+	if (bo->base.ptr) {
+		bo->map_count++;
+		*out = bo->base.ptr;
+		return 0;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	arg.handle = bo->base.handle;
+
+	ret = drmIoctl(bo->base.kms->fd, DRM_IOCTL_ROCKCHIP_GEM_MAP_OFFSET, &arg);
+	if (ret)
+		return -errno;
+
+	map = drm_mmap(0, bo->base.size, PROT_READ | PROT_WRITE, MAP_SHARED, bo->base.kms->fd, arg.offset);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	bo->base.ptr = map;
+	bo->map_count++;
+	*out = bo->base.ptr;
+
+	return 0;
+}
+
+static int
+rockchip_bo_unmap(struct kms_bo *_bo)
+{
+	struct rockchip_bo *bo = (struct rockchip_bo *)_bo;
+	bo->map_count--;
+	return 0;
+}
+
+/*
+ * The buffer goes to the cache, mapping included, and the least recently
+ * destroyed ones are closed to make room. A buffer coming out of it still
+ * holds what was drawn into it before.
+ */
+static int
+rockchip_bo_destroy(struct kms_bo *_bo)
+{
+	struct rockchip_kms *kms = (struct rockchip_kms *)_bo->kms;
+	struct rockchip_bo *bo = (struct rockchip_bo *)_bo;
+	struct rockchip_bo *old;
+
+	if (bo->base.size > ROCKCHIP_KMS_CACHE_MAX_BYTES) {
+		rockchip_bo_free(bo);
+		return 0;
+	}
+
+	while (kms->cache_nr == ROCKCHIP_KMS_CACHE_MAX ||
+	       kms->cache_bytes + bo->base.size > ROCKCHIP_KMS_CACHE_MAX_BYTES) {
+		old = DRMLISTENTRY(struct rockchip_bo, kms->cache.prev, link);
+		rockchip_cache_del(kms, old);
+		rockchip_bo_free(old);
+	}
+
+	DRMLISTADD(&bo->link, &kms->cache);
+	kms->cache_nr++;
+	kms->cache_bytes += bo->base.size;
+
+	return 0;
+}
+
+drm_private int
+rockchip_create(int fd, struct kms_driver **out)
+{
+	struct rockchip_kms *kms;
+
+	kms = calloc(1, sizeof(*kms));
+	if (!kms)
+		return -ENOMEM;
+
+	kms->base.fd = fd;
+	DRMINITLISTHEAD(&kms->cache);
+
+	kms->base.bo_create = rockchip_bo_create;
+	kms->base.bo_map = rockchip_bo_map;
+	kms->base.bo_unmap = rockchip_bo_unmap;
+	kms->base.bo_get_prop = rockchip_bo_get_prop;
+	kms->base.bo_destroy = rockchip_bo_destroy;
+	kms->base.get_prop = rockchip_get_prop;
+	kms->base.destroy = rockchip_destroy;
+	*out = &kms->base;
+
+	return 0;
+}
@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "xf86drm.h"
+
+#include "rockchip_drm_priv.h"
+#include "rockchip_dma_buf.h"
+#include "rockchip_timeline.h"
+
+/*
+ * @refcnt: held by its RGA context and by the buffer objects it used last.
+ * @lock: protects @completed.
+ * @cond: broadcast whenever @completed moves.
+ * @completed: last submission done.
+ */
+struct rockchip_timeline {
+	atomic_t		refcnt;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	uint64_t		completed;
+};
+
+/*
+ * Buffer objects sharing one dma-buf, which is all an RGA context is given,
+ * found by the inode of the dma-buf. Before Linux 5.3 all dma-bufs share
+ * one inode, and so one entry, where each buffer object is told apart by
+ * comparing its dma-buf with kcmp().
+ */
+struct rockchip_bo_busy_entry {
+	unsigned long		ino;
+	drmMMListHead		bos;
+};
+
+/*
+ * Buffer objects with a dma-buf, by its inode. Taken before the device
+ * vma_lock.
+ */
+static pthread_mutex_t rockchip_bo_busy_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *rockchip_bo_busy_table;
+static atomic_t rockchip_bo_busy_nr;
+
+drm_private struct rockchip_timeline *rockchip_timeline_create(void)
+{
+	struct rockchip_timeline *tl;
+	pthread_condattr_t attr;
+
+	tl = calloc(1, sizeof(*tl));
+	if (!tl)
+		return NULL;
+
+	atomic_set(&tl->refcnt, 1);
+	pthread_mutex_init(&tl->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&tl->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	return tl;
+}
+
+static struct rockchip_timeline *
+rockchip_timeline_ref(struct rockchip_timeline *tl)
+{
+	atomic_inc(&tl->refcnt);
+
+	return tl;
+}
+
+drm_private void rockchip_timeline_put(struct rockchip_timeline *tl)
+{
+	if (!tl || !atomic_dec_and_test(&tl->refcnt))
+		return;
+
+	pthread_cond_destroy(&tl->cond);
+	pthread_mutex_destroy(&tl->lock);
+	free(tl);
+}
+
+/*
+ * Mark submission @seq, and thereby every one before it, as done.
+ */
+drm_private void rockchip_timeline_signal(struct rockchip_timeline *tl,
+					  uint64_t seq)
+{
+	pthread_mutex_lock(&tl->lock);
+	if (seq > tl->completed) {
+		tl->completed = seq;
+		pthread_cond_broadcast(&tl->cond);
+	}
+	pthread_mutex_unlock(&tl->lock);
+}
+
+drm_private uint64_t rockchip_timeline_completed(struct rockchip_timeline *tl)
+{
+	uint64_t completed;
+
+	pthread_mutex_lock(&tl->lock);
+	completed = tl->completed;
+	pthread_mutex_unlock(&tl->lock);
+
+	return completed;
+}
+
+/*
+ * Wait until submission @seq is done, at most @timeout_ns nanoseconds
+ * unless it is negative.
+ *
+ * if done, return 0 else -ETIMEDOUT.
+ */
+drm_private int rockchip_timeline_wait(struct rockchip_timeline *tl,
+				       uint64_t seq, int64_t timeout_ns)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	if (timeout_ns > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ns / 1000000000;
+		deadline.tv_nsec += timeout_ns % 1000000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&tl->lock);
+	while (tl->completed < seq && ret != ETIMEDOUT) {
+		if (!timeout_ns)
+			ret = ETIMEDOUT;
+		else if (timeout_ns < 0)
+			pthread_cond_wait(&tl->cond, &tl->lock);
+		else
+			ret = pthread_cond_timedwait(&tl->cond, &tl->lock,
+						     &deadline);
+	}
+	ret = tl->completed < seq ? -ETIMEDOUT : 0;
+	pthread_mutex_unlock(&tl->lock);
+
+	return ret;
+}
+
+/*
+ * Whether @fd is the dma-buf of @priv. Without kcmp(), dma-bufs sharing
+ * one inode can't be told apart and none is tracked.
+ */
+static int rockchip_bo_busy_match(struct rockchip_bo_priv *priv, int fd)
+{
+	if (priv->busy_fd < 0)
+		return 1;
+
+#ifdef SYS_kcmp
+	/* KCMP_FILE, whether both fds are the same open file */
+	return syscall(SYS_kcmp, getpid(), getpid(), 0, fd,
+		       priv->busy_fd) == 0;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Record that submission @seq of @tl reads, or writes if @write is
+ * non-zero, the dma-buf @fd. Nothing is recorded for dma-bufs no buffer
+ * object was exported as or imported from.
+ *
+ * Only the context that used a buffer object last is tracked, so one that
+ * a different context still reads or writes is first waited for, or its
+ * pending submissions would be forgotten.
+ */
+drm_private void rockchip_bo_mark_dmabuf(int fd, struct rockchip_timeline *tl,
+					 uint64_t seq, int write)
+{
+	struct rockchip_bo_busy_entry *entry;
+	struct rockchip_device_priv *dev;
+	struct rockchip_timeline *old;
+	struct rockchip_bo_priv *priv;
+	uint64_t pending;
+	struct stat st;
+	void *value;
+
+	if (!atomic_read(&rockchip_bo_busy_nr) || fstat(fd, &st))
+		return;
+
+retry:
+	old = NULL;
+
+	pthread_mutex_lock(&rockchip_bo_busy_lock);
+	if (!rockchip_bo_busy_table ||
+	    drmHashLookup(rockchip_bo_busy_table, st.st_ino, &value))
+		goto out;
+
+	entry = value;
+	DRMLISTFOREACHENTRY(priv, &entry->bos, busy_link) {
+		if (!rockchip_bo_busy_match(priv, fd))
+			continue;
+
+		dev = to_device_priv(priv->base.dev);
+
+		pthread_mutex_lock(&dev->vma_lock);
+		if (priv->timeline != tl) {
+			pending = priv->last_read > priv->last_write ?
+				  priv->last_read : priv->last_write;
+			if (priv->timeline && pending &&
+			    rockchip_timeline_completed(priv->timeline) <
+			    pending) {
+				old = rockchip_timeline_ref(priv->timeline);
+				pthread_mutex_unlock(&dev->vma_lock);
+				goto out;
+			}
+
+			rockchip_timeline_put(priv->timeline);
+			priv->timeline = rockchip_timeline_ref(tl);
+			priv->last_read = 0;
+			priv->last_write = 0;
+		}
+		if (write)
+			priv->last_write = seq;
+		else
+			priv->last_read = seq;
+		pthread_mutex_unlock(&dev->vma_lock);
+	}
+out:
+	pthread_mutex_unlock(&rockchip_bo_busy_lock);
+
+	/* Submissions are always signaled, by the thread running them */
+	if (old) {
+		rockchip_timeline_wait(old, pending, -1);
+		rockchip_timeline_put(old);
+		goto retry;
+	}
+}
+
+/*
+ * Make a buffer object found by its dma-buf @fd, once it was exported as
+ * or imported from one.
+ */
+drm_private void rockchip_bo_busy_track(struct rockchip_bo *bo, int fd)
+{
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+	struct rockchip_bo_busy_entry *entry;
+	struct stat st;
+	void *value;
+	int dup_fd = -1;
+
+	/* A dma-buf without an inode of its own is kept to compare with */
+	if (rockchip_dma_buf_stat(fd, &st)) {
+		if (fstat(fd, &st))
+			return;
+		dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		if (dup_fd < 0)
+			return;
+	}
+
+	pthread_mutex_lock(&rockchip_bo_busy_lock);
+	if (priv->busy_ino)
+		goto out;
+
+	if (!rockchip_bo_busy_table)
+		rockchip_bo_busy_table = drmHashCreate();
+	if (!rockchip_bo_busy_table)
+		goto out;
+
+	if (!drmHashLookup(rockchip_bo_busy_table, st.st_ino, &value)) {
+		entry = value;
+	} else {
+		entry = calloc(1, sizeof(*entry));
+		if (!entry)
+			goto out;
+		entry->ino = st.st_ino;
+		DRMINITLISTHEAD(&entry->bos);
+		drmHashInsert(rockchip_bo_busy_table, entry->ino, entry);
+	}
+
+	DRMLISTADDTAIL(&priv->busy_link, &entry->bos);
+	priv->busy_ino = entry->ino;
+	priv->busy_fd = dup_fd;
+	dup_fd = -1;
+	atomic_inc(&rockchip_bo_busy_nr);
+out:
+	pthread_mutex_unlock(&rockchip_bo_busy_lock);
+
+	if (dup_fd >= 0)
+		close(dup_fd);
+}
+
+/*
+ * Forget a buffer object that is being freed.
+ */
+drm_private void rockchip_bo_busy_fini(struct rockchip_bo *bo)
+{
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+	struct rockchip_bo_busy_entry *entry;
+	void *value;
+
+	if (!priv->busy_ino)
+		return;
+
+	pthread_mutex_lock(&rockchip_bo_busy_lock);
+	DRMLISTDEL(&priv->busy_link);
+	if (!drmHashLookup(rockchip_bo_busy_table, priv->busy_ino, &value)) {
+		entry = value;
+		if (DRMLISTEMPTY(&entry->bos)) {
+			drmHashDelete(rockchip_bo_busy_table, entry->ino);
+			free(entry);
+		}
+	}
+	priv->busy_ino = 0;
+	if (priv->busy_fd >= 0)
+		close(priv->busy_fd);
+
+	if (atomic_dec_and_test(&rockchip_bo_busy_nr)) {
+		drmHashDestroy(rockchip_bo_busy_table);
+		rockchip_bo_busy_table = NULL;
+	}
+	pthread_mutex_unlock(&rockchip_bo_busy_lock);
+
+	/* Nobody can mark it any more */
+	rockchip_timeline_put(priv->timeline);
+	priv->timeline = NULL;
+}
+
+/*
+ * Find the submission @bo waits for before the cpu may access it for @op.
+ * Must be called with the device vma_lock held.
+ */
+static uint64_t rockchip_bo_busy_seq(struct rockchip_bo_priv *priv,
+				     uint32_t op)
+{
+	if (!priv->timeline)
+		return 0;
+
+	/* Reading only conflicts with the RGA writing */
+	if (!(op & ROCKCHIP_BO_CPU_WRITE))
+		return priv->last_write;
+
+	return priv->last_read > priv->last_write ? priv->last_read :
+						    priv->last_write;
+}
+
+/*
+ * Check whether the RGA still uses a buffer.
+ *
+ * @bo: a rockchip buffer object.
+ * @op: ROCKCHIP_BO_CPU_READ to check whether the RGA still writes it,
+ *	ROCKCHIP_BO_CPU_WRITE to check whether it still reads or writes it.
+ *
+ * the RGA finds buffers by dma-buf, so only buffer objects exported with
+ * rockchip_bo_to_dmabuf() or imported with rockchip_bo_from_dmabuf() are
+ * ever busy, and only for the context that used them last. this never
+ * blocks on the RGA.
+ *
+ * if busy, return 1 else 0.
+ */
+int rockchip_bo_busy(struct rockchip_bo *bo, uint32_t op)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+	uint64_t seq;
+	int busy = 0;
+
+	pthread_mutex_lock(&dev->vma_lock);
+	seq = rockchip_bo_busy_seq(priv, op);
+	if (seq)
+		busy = rockchip_timeline_completed(priv->timeline) < seq;
+	pthread_mutex_unlock(&dev->vma_lock);
+
+	return busy;
+}
+
+/*
+ * Wait until the RGA no longer uses a buffer.
+ *
+ * @bo: a rockchip buffer object.
+ * @op: as for rockchip_bo_busy().
+ * @timeout_ns: nanoseconds to wait at most, negative to wait for as long
+ *	as it takes.
+ *
+ * unlike rga_wait(), submissions after the last one using @bo are not
+ * waited for.
+ *
+ * if idle, return 0 else -ETIMEDOUT.
+ */
+int rockchip_bo_wait(struct rockchip_bo *bo, uint32_t op, int64_t timeout_ns)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+	struct rockchip_timeline *tl = NULL;
+	uint64_t seq;
+	int ret = 0;
+
+	pthread_mutex_lock(&dev->vma_lock);
+	seq = rockchip_bo_busy_seq(priv, op);
+	if (seq)
+		tl = rockchip_timeline_ref(priv->timeline);
+	pthread_mutex_unlock(&dev->vma_lock);
+
+	if (tl) {
+		ret = rockchip_timeline_wait(tl, seq, timeout_ns);
+		rockchip_timeline_put(tl);
+	}
+
+	return ret;
+}
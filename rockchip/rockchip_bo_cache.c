@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "rockchip_drm_priv.h"
+
+static void rockchip_bo_cache_add_bucket(struct rockchip_bo_cache *cache,
+					 size_t size)
+{
+	struct rockchip_bo_bucket *bucket = &cache->buckets[cache->bucket_nr++];
+
+	bucket->size = size;
+	DRMINITLISTHEAD(&bucket->list);
+}
+
+/*
+ * Create an empty buffer object cache.
+ *
+ * buckets are 4KiB apart up to 16KiB, then four per power of two, so a
+ * buffer object is at most 25% larger than what was asked for.
+ */
+static struct rockchip_bo_cache *rockchip_bo_cache_create(void)
+{
+	struct rockchip_bo_cache *cache;
+	size_t size;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	rockchip_bo_cache_add_bucket(cache, 4096);
+	rockchip_bo_cache_add_bucket(cache, 4096 * 2);
+	rockchip_bo_cache_add_bucket(cache, 4096 * 3);
+
+	for (size = 4 * 4096; size <= ROCKCHIP_BO_CACHE_MAX_SIZE; size *= 2) {
+		rockchip_bo_cache_add_bucket(cache, size);
+		if (size == ROCKCHIP_BO_CACHE_MAX_SIZE)
+			break;
+		rockchip_bo_cache_add_bucket(cache, size + size / 4);
+		rockchip_bo_cache_add_bucket(cache, size + size * 2 / 4);
+		rockchip_bo_cache_add_bucket(cache, size + size * 3 / 4);
+	}
+
+	return cache;
+}
+
+/*
+ * Get the smallest bucket holding @size bytes, NULL if it is too large
+ * to be cached.
+ */
+drm_private struct rockchip_bo_bucket *
+rockchip_bo_cache_bucket(struct rockchip_bo_cache *cache, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->bucket_nr; i++)
+		if (cache->buckets[i].size >= size)
+			return &cache->buckets[i];
+
+	return NULL;
+}
+
+/*
+ * Close buffer objects cached since before @time, oldest first.
+ */
+static void rockchip_bo_cache_trim(struct rockchip_bo_cache *cache,
+				   uint64_t time)
+{
+	struct rockchip_bo_priv *priv, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < cache->bucket_nr; i++) {
+		DRMLISTFOREACHENTRYSAFE(priv, tmp, &cache->buckets[i].list,
+					link) {
+			if (priv->free_us >= time)
+				break;
+
+			DRMLISTDEL(&priv->link);
+			cache->stats.cached--;
+			cache->stats.cached_bytes -= priv->base.size;
+			cache->stats.evictions++;
+			rockchip_bo_free(&priv->base);
+		}
+	}
+}
+
+/*
+ * The cache functions below must be called with the device lock held for
+ * writing.
+ */
+
+/*
+ * Take the most recently cached buffer object of @bucket created with
+ * @flags out of the cache, preferring one whose framebuffer matches @fb,
+ * or one without a framebuffer if @fb is NULL.
+ */
+drm_private struct rockchip_bo *
+rockchip_bo_cache_get(struct rockchip_bo_cache *cache,
+		      struct rockchip_bo_bucket *bucket, uint32_t flags,
+		      const struct rockchip_bo_fb *fb)
+{
+	struct rockchip_bo_priv *priv, *found = NULL;
+	drmMMListHead *item;
+
+	for (item = bucket->list.prev; item != &bucket->list;
+	     item = item->prev) {
+		priv = DRMLISTENTRY(struct rockchip_bo_priv, item, link);
+		if (priv->base.flags != flags)
+			continue;
+
+		if (!found)
+			found = priv;
+		if (fb ? priv->fb.id && rockchip_bo_fb_match(&priv->fb, fb) :
+			 !priv->fb.id) {
+			found = priv;
+			break;
+		}
+	}
+
+	if (found) {
+		priv = found;
+		DRMLISTDEL(&priv->link);
+		cache->stats.cached--;
+		cache->stats.cached_bytes -= priv->base.size;
+		cache->stats.hits++;
+
+		return &priv->base;
+	}
+
+	cache->stats.misses++;
+
+	return NULL;
+}
+
+/*
+ * Keep a destroyed buffer object for reuse.
+ *
+ * if cached, return 1 else 0 and the caller frees it.
+ */
+drm_private int rockchip_bo_cache_put(struct rockchip_bo_cache *cache,
+				      struct rockchip_bo *bo)
+{
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+	struct rockchip_bo_bucket *bucket;
+	uint64_t now = rockchip_bo_time_us();
+
+	rockchip_bo_cache_trim(cache, now - ROCKCHIP_BO_CACHE_TIMEOUT_US);
+
+	if (!priv->reusable)
+		return 0;
+
+	bucket = rockchip_bo_cache_bucket(cache, bo->size);
+	if (!bucket || bucket->size != bo->size)
+		return 0;
+
+	rockchip_bo_vma_idle(bo);
+	priv->free_us = now;
+	DRMLISTADDTAIL(&priv->link, &bucket->list);
+	cache->stats.cached++;
+	cache->stats.cached_bytes += bo->size;
+
+	return 1;
+}
+
+drm_private void rockchip_bo_cache_destroy(struct rockchip_bo_cache *cache)
+{
+	rockchip_bo_cache_trim(cache, UINT64_MAX);
+	free(cache);
+}
+
+/*
+ * Enable or disable reuse of destroyed buffer objects.
+ *
+ * @dev: a rockchip device object.
+ * @enable: non-zero to cache buffer objects destroyed from now on.
+ *
+ * once enabled, rockchip_bo_create() rounds sizes up to the next cache
+ * bucket and may return a cached buffer object of the same size and
+ * flags, with its previous contents still in place. its cpu mappings are
+ * kept too, unless the vma cache needs the room. buffer objects that got
+ * a global name or were opened from one are never cached. disabling
+ * closes all cached buffer objects.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_device_set_bo_cache(struct rockchip_device *dev, int enable)
+{
+	struct rockchip_device_priv *priv = to_device_priv(dev);
+	int ret = 0;
+
+	pthread_rwlock_wrlock(&priv->lock);
+	if (!enable) {
+		if (dev->bo_cache)
+			rockchip_bo_cache_destroy(dev->bo_cache);
+		dev->bo_cache = NULL;
+	} else if (!dev->bo_cache) {
+		dev->bo_cache = rockchip_bo_cache_create();
+		if (!dev->bo_cache)
+			ret = -ENOMEM;
+	}
+	pthread_rwlock_unlock(&priv->lock);
+
+	return ret;
+}
+
+/*
+ * Get the buffer object cache counters of a device.
+ *
+ * @dev: a rockchip device object.
+ * @stats: filled with the counters since the cache was enabled.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_device_get_bo_cache_stats(struct rockchip_device *dev,
+				       struct rockchip_bo_cache_stats *stats)
+{
+	struct rockchip_device_priv *priv = to_device_priv(dev);
+	int ret = 0;
+
+	pthread_rwlock_rdlock(&priv->lock);
+	if (dev->bo_cache)
+		*stats = dev->bo_cache->stats;
+	else
+		ret = -ENOENT;
+	pthread_rwlock_unlock(&priv->lock);
+
+	return ret;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "drm_fourcc.h"
+
+#include "rockchip_drm_priv.h"
+
+/*
+ * @cpp: bytes per pixel of the first plane.
+ * @planes: 1 for RGB, 2 for semi-planar YUV whose second plane holds
+ *	two bytes per chroma sample.
+ * @hsub, @vsub: chroma subsampling.
+ */
+struct rockchip_bo_fb_format {
+	uint32_t		format;
+	uint8_t			cpp;
+	uint8_t			planes;
+	uint8_t			hsub, vsub;
+};
+
+static const struct rockchip_bo_fb_format rockchip_bo_fb_formats[] = {
+	{ DRM_FORMAT_XRGB8888, 4, 1, 1, 1 },
+	{ DRM_FORMAT_ARGB8888, 4, 1, 1, 1 },
+	{ DRM_FORMAT_XBGR8888, 4, 1, 1, 1 },
+	{ DRM_FORMAT_ABGR8888, 4, 1, 1, 1 },
+	{ DRM_FORMAT_RGB888, 3, 1, 1, 1 },
+	{ DRM_FORMAT_BGR888, 3, 1, 1, 1 },
+	{ DRM_FORMAT_RGB565, 2, 1, 1, 1 },
+	{ DRM_FORMAT_BGR565, 2, 1, 1, 1 },
+	{ DRM_FORMAT_NV12, 1, 2, 2, 2 },
+	{ DRM_FORMAT_NV21, 1, 2, 2, 2 },
+	{ DRM_FORMAT_NV16, 1, 2, 2, 1 },
+	{ DRM_FORMAT_NV61, 1, 2, 2, 1 },
+};
+
+static uint32_t rockchip_bo_fb_pitch(uint32_t bytes)
+{
+	return (bytes + ROCKCHIP_BO_FB_PITCH_ALIGN - 1) &
+	       ~(ROCKCHIP_BO_FB_PITCH_ALIGN - 1);
+}
+
+/*
+ * Lay out a framebuffer.
+ *
+ * @format: DRM fourcc of the framebuffer.
+ * @width, @height: size of the framebuffer in pixels.
+ * @pitches, @offsets: filled with the bytes per line and the start of
+ *	every plane, 0 for planes the format does not have.
+ * @size: filled with the bytes the framebuffer needs.
+ *
+ * lines are aligned for the display controller and the RGA, the planes
+ * follow each other. this is the layout rockchip_bo_create_fb() uses.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_fb_layout(uint32_t format, uint32_t width, uint32_t height,
+			  uint32_t pitches[4], uint32_t offsets[4], size_t *size)
+{
+	const struct rockchip_bo_fb_format *fmt = NULL;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(rockchip_bo_fb_formats) /
+			sizeof(rockchip_bo_fb_formats[0]); i++) {
+		if (rockchip_bo_fb_formats[i].format == format) {
+			fmt = &rockchip_bo_fb_formats[i];
+			break;
+		}
+	}
+
+	if (!fmt || !width || !height || width > ROCKCHIP_BO_FB_MAX_SIZE ||
+	    height > ROCKCHIP_BO_FB_MAX_SIZE) {
+		fprintf(stderr, "invalid framebuffer layout.\n");
+		return -EINVAL;
+	}
+
+	memset(pitches, 0, 4 * sizeof(pitches[0]));
+	memset(offsets, 0, 4 * sizeof(offsets[0]));
+
+	pitches[0] = rockchip_bo_fb_pitch(width * fmt->cpp);
+	*size = (size_t)pitches[0] * height;
+
+	if (fmt->planes > 1) {
+		pitches[1] = rockchip_bo_fb_pitch((width + fmt->hsub - 1) /
+						  fmt->hsub * 2);
+		offsets[1] = *size;
+		*size += (size_t)pitches[1] *
+			 ((height + fmt->vsub - 1) / fmt->vsub);
+	}
+
+	return 0;
+}
+
+/*
+ * Create a rockchip buffer object registered as a framebuffer.
+ *
+ * @dev: rockchip drm device object.
+ * @width, @height: size of the framebuffer in pixels.
+ * @format: DRM fourcc of the framebuffer.
+ * @flags: as for rockchip_bo_create().
+ *
+ * the buffer object is laid out by rockchip_bo_fb_layout(), its layout is
+ * recorded like rockchip_bo_set_layout() does and the framebuffer id is
+ * in @fb_id. the framebuffer is removed with the buffer object. with the
+ * buffer object cache enabled, a cached buffer object that was registered
+ * with the same size and format is preferred and comes back with its
+ * framebuffer, without any ioctl.
+ *
+ * if true, return a rockchip buffer object else NULL.
+ */
+struct rockchip_bo *rockchip_bo_create_fb(struct rockchip_device *dev,
+					  uint32_t width, uint32_t height,
+					  uint32_t format, uint32_t flags)
+{
+	struct rockchip_bo_fb fb = {
+		.format = format,
+		.width = width,
+		.height = height,
+	};
+	uint32_t handles[4] = { 0 }, pitches[4], offsets[4];
+	struct rockchip_bo_priv *priv;
+	struct rockchip_bo *bo;
+	unsigned int i;
+	size_t size;
+
+	if (rockchip_bo_fb_layout(format, width, height, pitches, offsets,
+				  &size))
+		return NULL;
+
+	bo = rockchip_bo_create_cached(dev, size, flags, &fb);
+	if (!bo)
+		return NULL;
+
+	priv = to_bo_priv(bo);
+	if (priv->fb.id && !rockchip_bo_fb_match(&priv->fb, &fb)) {
+		drmModeRmFB(dev->fd, priv->fb.id);
+		priv->fb.id = 0;
+	}
+
+	if (!priv->fb.id) {
+		for (i = 0; i < 4 && pitches[i]; i++)
+			handles[i] = bo->handle;
+
+		if (drmModeAddFB2(dev->fd, width, height, format, handles,
+				  pitches, offsets, &fb.id, 0)) {
+			fprintf(stderr, "failed to add framebuffer[%s].\n",
+				strerror(errno));
+			rockchip_bo_destroy(bo);
+			return NULL;
+		}
+		priv->fb = fb;
+	}
+
+	bo->format = format;
+	bo->width = width;
+	bo->height = height;
+	bo->pitch = pitches[0];
+	bo->fb_id = priv->fb.id;
+
+	return bo;
+}
+
+/*
+ * Remove the framebuffer of a buffer object that is being freed.
+ */
+drm_private void rockchip_bo_fb_fini(struct rockchip_bo *bo)
+{
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+
+	if (priv->fb.id)
+		drmModeRmFB(bo->dev->fd, priv->fb.id);
+	priv->fb.id = 0;
+}
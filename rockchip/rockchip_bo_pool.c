@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rockchip_drm_priv.h"
+
+/*
+ * Buffer objects of one size and flags kept ready.
+ *
+ * @count: how many the pool thread keeps ready.
+ * @ready, @ready_nr: those ready, the most recent one last.
+ */
+struct rockchip_bo_pool_class {
+	size_t			size;
+	uint32_t		flags;
+	unsigned int		count;
+	struct rockchip_bo	*ready[ROCKCHIP_BO_POOL_MAX_READY];
+	unsigned int		ready_nr;
+};
+
+/*
+ * @lock: protects everything below.
+ * @cond: wakes the pool thread up when buffer objects were taken, classes
+ *	added or the pool is destroyed.
+ * @stalled: the last allocation failed, wait for a change before trying
+ *	again.
+ */
+struct rockchip_bo_pool {
+	struct rockchip_device		*dev;
+	pthread_t			thread;
+	pthread_mutex_t			lock;
+	pthread_cond_t			cond;
+	int				quit;
+	int				stalled;
+	struct rockchip_bo_pool_class	classes[ROCKCHIP_BO_POOL_CLASSES];
+	unsigned int			class_nr;
+	struct rockchip_bo_pool_stats	stats;
+};
+
+/* Must be called with the pool lock held */
+static struct rockchip_bo_pool_class *
+rockchip_bo_pool_short(struct rockchip_bo_pool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->class_nr; i++)
+		if (pool->classes[i].ready_nr < pool->classes[i].count)
+			return &pool->classes[i];
+
+	return NULL;
+}
+
+/*
+ * Fill up the classes one buffer object at a time, allocating without the
+ * lock so that rockchip_bo_pool_get() never waits for the kernel.
+ */
+static void *rockchip_bo_pool_thread(void *data)
+{
+	struct rockchip_bo_pool *pool = data;
+	struct rockchip_bo_pool_class *class;
+	struct rockchip_bo *bo;
+	uint64_t start, us;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->quit) {
+		class = pool->stalled ? NULL : rockchip_bo_pool_short(pool);
+		if (!class) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		/* Classes are never removed, @class stays valid */
+		start = rockchip_bo_time_us();
+		bo = rockchip_bo_create(pool->dev, class->size, class->flags);
+		us = rockchip_bo_time_us() - start;
+
+		pthread_mutex_lock(&pool->lock);
+		if (!bo) {
+			pool->stats.alloc_failures++;
+			pool->stalled = 1;
+			continue;
+		}
+
+		pool->stats.allocs++;
+		pool->stats.alloc_us += us;
+		if (us > pool->stats.alloc_max_us)
+			pool->stats.alloc_max_us = us;
+
+		/* @count may have been lowered meanwhile */
+		if (class->ready_nr >= class->count) {
+			rockchip_bo_destroy(bo);
+			continue;
+		}
+
+		class->ready[class->ready_nr++] = bo;
+		pool->stats.ready++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/*
+ * Create a pre-allocation pool.
+ *
+ * @dev: a rockchip device object.
+ *
+ * the pool allocates buffer objects of the sizes and flags added with
+ * rockchip_bo_pool_add() on a thread of its own, so that
+ * rockchip_bo_pool_get() hands them out without waiting for the kernel,
+ * e.g. for contiguous buffers, whose allocation may take milliseconds
+ * once memory is fragmented.
+ *
+ * if true, return the pool else NULL.
+ */
+struct rockchip_bo_pool *rockchip_bo_pool_create(struct rockchip_device *dev)
+{
+	struct rockchip_bo_pool *pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool) {
+		fprintf(stderr, "failed to create bo pool[%s].\n",
+				strerror(errno));
+		return NULL;
+	}
+
+	pool->dev = rockchip_device_ref(dev);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	if (pthread_create(&pool->thread, NULL, rockchip_bo_pool_thread,
+			   pool)) {
+		fprintf(stderr, "failed to start bo pool thread.\n");
+		pthread_cond_destroy(&pool->cond);
+		pthread_mutex_destroy(&pool->lock);
+		rockchip_device_destroy(pool->dev);
+		free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/*
+ * Destroy a pre-allocation pool.
+ *
+ * @pool: the pool.
+ *
+ * buffer objects still ready are destroyed, those handed out stay valid.
+ */
+void rockchip_bo_pool_destroy(struct rockchip_bo_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	pthread_join(pool->thread, NULL);
+
+	for (i = 0; i < pool->class_nr; i++)
+		while (pool->classes[i].ready_nr)
+			rockchip_bo_destroy(pool->classes[i].ready[
+					--pool->classes[i].ready_nr]);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	rockchip_device_destroy(pool->dev);
+	free(pool);
+}
+
+/*
+ * Keep buffer objects of a size and flags ready.
+ *
+ * @pool: the pool.
+ * @size: bytes of the buffer objects.
+ * @flags: as for rockchip_bo_create().
+ * @count: buffer objects kept ready, up to ROCKCHIP_BO_POOL_MAX_READY.
+ *	whenever fewer are left, the pool thread allocates more.
+ *
+ * adding a size and flags again changes their @count.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_pool_add(struct rockchip_bo_pool *pool, size_t size,
+			 uint32_t flags, unsigned int count)
+{
+	struct rockchip_bo_pool_class *class;
+	unsigned int i;
+	int ret = 0;
+
+	if (!size || count > ROCKCHIP_BO_POOL_MAX_READY) {
+		fprintf(stderr, "invalid bo pool class.\n");
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < pool->class_nr; i++) {
+		class = &pool->classes[i];
+		if (class->size == size && class->flags == flags)
+			break;
+	}
+
+	if (i == pool->class_nr) {
+		if (pool->class_nr == ROCKCHIP_BO_POOL_CLASSES) {
+			ret = -ENOSPC;
+			goto out;
+		}
+		class = &pool->classes[pool->class_nr++];
+		class->size = size;
+		class->flags = flags;
+	}
+
+	class->count = count;
+	while (class->ready_nr > count) {
+		rockchip_bo_destroy(class->ready[--class->ready_nr]);
+		pool->stats.ready--;
+	}
+
+	pool->stalled = 0;
+	pthread_cond_signal(&pool->cond);
+out:
+	pthread_mutex_unlock(&pool->lock);
+
+	return ret;
+}
+
+/*
+ * Get a buffer object from the pool.
+ *
+ * @pool: the pool.
+ * @size: bytes needed.
+ * @flags: as for rockchip_bo_create().
+ *
+ * a ready buffer object with the same flags and the smallest size of at
+ * least @size is handed out right away, the pool thread then allocates a
+ * replacement. without one, the buffer object is allocated in place, which
+ * counts as a miss. like new buffer objects, the contents are undefined.
+ * drop it with rockchip_bo_destroy().
+ *
+ * if true, return a rockchip buffer object else NULL.
+ */
+struct rockchip_bo *rockchip_bo_pool_get(struct rockchip_bo_pool *pool,
+					 size_t size, uint32_t flags)
+{
+	struct rockchip_bo_pool_class *class, *best = NULL;
+	struct rockchip_bo *bo = NULL;
+	uint64_t start;
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < pool->class_nr; i++) {
+		class = &pool->classes[i];
+		if (class->flags != flags || class->size < size ||
+		    !class->ready_nr)
+			continue;
+		if (!best || class->size < best->size)
+			best = class;
+	}
+
+	if (best) {
+		bo = best->ready[--best->ready_nr];
+		pool->stats.hits++;
+		pool->stats.ready--;
+	} else {
+		pool->stats.misses++;
+	}
+
+	pool->stalled = 0;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (bo)
+		return bo;
+
+	start = rockchip_bo_time_us();
+	bo = rockchip_bo_create(pool->dev, size, flags);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stats.miss_us += rockchip_bo_time_us() - start;
+	pthread_mutex_unlock(&pool->lock);
+
+	return bo;
+}
+
+/*
+ * Get the counters of a pre-allocation pool.
+ *
+ * @pool: the pool.
+ * @stats: filled with the counters since the pool was created.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_pool_get_stats(struct rockchip_bo_pool *pool,
+			       struct rockchip_bo_pool_stats *stats)
+{
+	pthread_mutex_lock(&pool->lock);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "rockchip_drm_priv.h"
+
+/*
+ * A buffer object carved into chunks of one size class.
+ *
+ * @link: position in the list of its size class, slabs with free chunks
+ *	come first.
+ * @bo, @vaddr, @fd: the buffer object, its mapping and a dma-buf of it.
+ * @order: log2 of the chunk size.
+ * @chunk_nr: chunks in the buffer object.
+ * @free_nr, @free: indices of the free chunks, the next one to hand out
+ *	last.
+ */
+struct rockchip_bo_slab_page {
+	drmMMListHead		link;
+	struct rockchip_bo	*bo;
+	void			*vaddr;
+	int			fd;
+	unsigned int		order;
+	unsigned int		chunk_nr;
+	unsigned int		free_nr;
+	uint16_t		free[];
+};
+
+/*
+ * @lock: protects everything below.
+ * @classes: slabs of every size class.
+ */
+struct rockchip_bo_slab {
+	struct rockchip_device		*dev;
+	uint32_t			flags;
+	pthread_mutex_t			lock;
+	drmMMListHead			classes[ROCKCHIP_BO_SLAB_CLASSES];
+	struct rockchip_bo_slab_stats	stats;
+};
+
+/*
+ * Create, map and export a buffer object, as the backing of a slab or of
+ * an allocation too large for one.
+ */
+static int rockchip_bo_slab_bo(struct rockchip_bo_slab *slab, size_t size,
+			       struct rockchip_bo **bo, void **vaddr, int *fd)
+{
+	*bo = rockchip_bo_create(slab->dev, size, slab->flags);
+	if (!*bo)
+		return -ENOMEM;
+
+	*vaddr = rockchip_bo_map(*bo);
+	if (!*vaddr || rockchip_bo_to_dmabuf(*bo, fd)) {
+		rockchip_bo_destroy(*bo);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void rockchip_bo_slab_bo_free(struct rockchip_bo *bo, void *vaddr,
+				     int fd)
+{
+	close(fd);
+	rockchip_bo_unmap(bo, vaddr);
+	rockchip_bo_destroy(bo);
+}
+
+/* Must be called with the slab lock held */
+static struct rockchip_bo_slab_page *
+rockchip_bo_slab_page_create(struct rockchip_bo_slab *slab, unsigned int order)
+{
+	unsigned int i, nr = ROCKCHIP_BO_SLAB_SIZE >> order;
+	struct rockchip_bo_slab_page *page;
+
+	page = calloc(1, sizeof(*page) + nr * sizeof(page->free[0]));
+	if (!page)
+		return NULL;
+
+	if (rockchip_bo_slab_bo(slab, ROCKCHIP_BO_SLAB_SIZE, &page->bo,
+				&page->vaddr, &page->fd)) {
+		free(page);
+		return NULL;
+	}
+
+	page->order = order;
+	page->chunk_nr = nr;
+
+	/* Hand out the lowest offsets first */
+	for (i = 0; i < nr; i++)
+		page->free[i] = nr - 1 - i;
+	page->free_nr = nr;
+
+	slab->stats.slabs++;
+	slab->stats.slab_bytes += ROCKCHIP_BO_SLAB_SIZE;
+
+	return page;
+}
+
+/* Must be called with the slab lock held */
+static void rockchip_bo_slab_page_destroy(struct rockchip_bo_slab *slab,
+					  struct rockchip_bo_slab_page *page)
+{
+	DRMLISTDEL(&page->link);
+	rockchip_bo_slab_bo_free(page->bo, page->vaddr, page->fd);
+	slab->stats.slabs--;
+	slab->stats.slab_bytes -= ROCKCHIP_BO_SLAB_SIZE;
+	free(page);
+}
+
+/*
+ * Create a suballocator for small buffers.
+ *
+ * @dev: rockchip drm device object.
+ * @flags: memory type of the buffer objects small buffers are carved out
+ *	of, as for rockchip_bo_create().
+ *
+ * small images such as icons, cursors and glyph atlases each cost a gem
+ * object, an ioctl and a page run of their own when created with
+ * rockchip_bo_create(). the suballocator carves them out of shared
+ * buffer objects of ROCKCHIP_BO_SLAB_SIZE bytes instead, one per size
+ * class of a power of two from 1KiB to 256KiB. it is thread-safe.
+ *
+ * if true, return the suballocator else NULL.
+ */
+struct rockchip_bo_slab *rockchip_bo_slab_create(struct rockchip_device *dev,
+						 uint32_t flags)
+{
+	struct rockchip_bo_slab *slab;
+	unsigned int i;
+
+	slab = calloc(1, sizeof(*slab));
+	if (!slab) {
+		fprintf(stderr, "failed to create slab[%s].\n",
+				strerror(errno));
+		return NULL;
+	}
+
+	slab->dev = dev;
+	slab->flags = flags;
+	pthread_mutex_init(&slab->lock, NULL);
+	for (i = 0; i < ROCKCHIP_BO_SLAB_CLASSES; i++)
+		DRMINITLISTHEAD(&slab->classes[i]);
+
+	return slab;
+}
+
+/*
+ * Destroy a suballocator.
+ *
+ * @slab: the suballocator.
+ *
+ * small buffers still allocated from it are gone with it, those with a
+ * buffer object of their own must still be freed.
+ */
+void rockchip_bo_slab_destroy(struct rockchip_bo_slab *slab)
+{
+	struct rockchip_bo_slab_page *page, *tmp;
+	unsigned int i;
+
+	if (!slab)
+		return;
+
+	for (i = 0; i < ROCKCHIP_BO_SLAB_CLASSES; i++)
+		DRMLISTFOREACHENTRYSAFE(page, tmp, &slab->classes[i], link)
+			rockchip_bo_slab_page_destroy(slab, page);
+
+	pthread_mutex_destroy(&slab->lock);
+	free(slab);
+}
+
+/*
+ * Allocate a small buffer.
+ *
+ * @slab: the suballocator.
+ * @size: bytes needed.
+ * @sub: filled with the buffer object, offset and mapping of the buffer.
+ *
+ * buffers larger than the largest size class get a buffer object of
+ * their own, at offset 0. like new buffer objects, the contents are
+ * undefined.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_slab_alloc(struct rockchip_bo_slab *slab, size_t size,
+			   struct rockchip_bo_suballoc *sub)
+{
+	struct rockchip_bo_slab_page *page;
+	unsigned int order = ROCKCHIP_BO_SLAB_MIN_ORDER, i;
+	drmMMListHead *list;
+
+	memset(sub, 0, sizeof(*sub));
+	sub->fd = -1;
+
+	if (!size)
+		return -EINVAL;
+
+	if (size > (1u << ROCKCHIP_BO_SLAB_MAX_ORDER)) {
+		if (rockchip_bo_slab_bo(slab, size, &sub->bo, &sub->vaddr,
+					&sub->fd))
+			return -ENOMEM;
+
+		sub->size = size;
+
+		pthread_mutex_lock(&slab->lock);
+		slab->stats.allocs++;
+		slab->stats.large++;
+		pthread_mutex_unlock(&slab->lock);
+
+		return 0;
+	}
+
+	while ((1u << order) < size)
+		order++;
+	list = &slab->classes[order - ROCKCHIP_BO_SLAB_MIN_ORDER];
+
+	pthread_mutex_lock(&slab->lock);
+
+	page = DRMLISTEMPTY(list) ? NULL :
+	       DRMLISTENTRY(struct rockchip_bo_slab_page, list->next, link);
+	if (!page || !page->free_nr) {
+		page = rockchip_bo_slab_page_create(slab, order);
+		if (!page) {
+			pthread_mutex_unlock(&slab->lock);
+			return -ENOMEM;
+		}
+		DRMLISTADD(&page->link, list);
+	}
+
+	i = page->free[--page->free_nr];
+
+	/* Full slabs go behind the ones with free chunks */
+	if (!page->free_nr) {
+		DRMLISTDEL(&page->link);
+		DRMLISTADDTAIL(&page->link, list);
+	}
+
+	slab->stats.allocs++;
+	slab->stats.used_bytes += 1u << order;
+
+	pthread_mutex_unlock(&slab->lock);
+
+	sub->bo = page->bo;
+	sub->offset = (size_t)i << order;
+	sub->size = 1u << order;
+	sub->vaddr = (char *)page->vaddr + sub->offset;
+	sub->fd = page->fd;
+	sub->page = page;
+
+	return 0;
+}
+
+/*
+ * Free a small buffer.
+ *
+ * @slab: the suballocator it came from.
+ * @sub: a buffer filled in by rockchip_bo_slab_alloc(), cleared on return.
+ *
+ * a slab left without any allocation is destroyed, unless it is the only
+ * one of its size class.
+ */
+void rockchip_bo_slab_free(struct rockchip_bo_slab *slab,
+			   struct rockchip_bo_suballoc *sub)
+{
+	struct rockchip_bo_slab_page *page = sub->page;
+	drmMMListHead *list;
+
+	if (!sub->bo)
+		return;
+
+	if (!page) {
+		rockchip_bo_slab_bo_free(sub->bo, sub->vaddr, sub->fd);
+
+		pthread_mutex_lock(&slab->lock);
+		slab->stats.frees++;
+		pthread_mutex_unlock(&slab->lock);
+
+		memset(sub, 0, sizeof(*sub));
+		sub->fd = -1;
+		return;
+	}
+
+	list = &slab->classes[page->order - ROCKCHIP_BO_SLAB_MIN_ORDER];
+
+	pthread_mutex_lock(&slab->lock);
+
+	page->free[page->free_nr++] = sub->offset >> page->order;
+	DRMLISTDEL(&page->link);
+	DRMLISTADD(&page->link, list);
+
+	slab->stats.frees++;
+	slab->stats.used_bytes -= sub->size;
+
+	if (page->free_nr == page->chunk_nr && page->link.next != list)
+		rockchip_bo_slab_page_destroy(slab, page);
+
+	pthread_mutex_unlock(&slab->lock);
+
+	memset(sub, 0, sizeof(*sub));
+	sub->fd = -1;
+}
+
+/*
+ * Get the counters of a suballocator.
+ *
+ * @slab: the suballocator.
+ * @stats: filled with the counters since it was created.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_slab_get_stats(struct rockchip_bo_slab *slab,
+			       struct rockchip_bo_slab_stats *stats)
+{
+	pthread_mutex_lock(&slab->lock);
+	*stats = slab->stats;
+	pthread_mutex_unlock(&slab->lock);
+
+	return 0;
+}
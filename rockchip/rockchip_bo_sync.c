@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+
+#include <xf86drm.h>
+
+#include "rockchip_drm.h"
+#include "rockchip_drm_priv.h"
+#include "rockchip_dma_buf.h"
+
+#define ROCKCHIP_BO_CPU_MASK	(ROCKCHIP_BO_CPU_READ | ROCKCHIP_BO_CPU_WRITE)
+
+/*
+ * Whether cpu accesses to @bo need cache maintenance. Buffers created here
+ * without ROCKCHIP_BO_CACHABLE have uncached or write-combined mappings,
+ * the cache attributes of foreign ones are unknown.
+ */
+static int rockchip_bo_needs_sync(struct rockchip_bo *bo)
+{
+	return to_bo_priv(bo)->foreign || (bo->flags & ROCKCHIP_BO_CACHABLE);
+}
+
+/*
+ * Get the dma-buf of @bo used for the sync ioctl, exported on first use
+ * and kept until @bo is freed. For an imported buffer this is the
+ * dma-buf of its exporter, which does the cache maintenance.
+ *
+ * if true, return the file descriptor else negative.
+ */
+static int rockchip_bo_sync_fd(struct rockchip_bo *bo)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+	int fd, ret;
+
+	pthread_mutex_lock(&dev->vma_lock);
+	if (priv->sync_fd < 0 &&
+	    !drmPrimeHandleToFD(bo->dev->fd, bo->handle, DRM_CLOEXEC, &fd))
+		priv->sync_fd = fd;
+	ret = priv->sync_fd < 0 ? -errno : priv->sync_fd;
+	pthread_mutex_unlock(&dev->vma_lock);
+
+	if (ret < 0)
+		fprintf(stderr, "failed to export gem object[%s].\n",
+			strerror(-ret));
+
+	return ret;
+}
+
+static int rockchip_bo_dmabuf_sync(struct rockchip_bo *bo, uint64_t flags,
+				   uint32_t op)
+{
+	struct rockchip_dma_buf_sync sync = {
+		.flags = flags,
+	};
+	int fd;
+
+	if (op & ROCKCHIP_BO_CPU_READ)
+		sync.flags |= ROCKCHIP_DMA_BUF_SYNC_READ;
+	if (op & ROCKCHIP_BO_CPU_WRITE)
+		sync.flags |= ROCKCHIP_DMA_BUF_SYNC_WRITE;
+
+	fd = rockchip_bo_sync_fd(bo);
+	if (fd < 0)
+		return fd;
+
+	if (drmIoctl(fd, ROCKCHIP_DMA_BUF_IOCTL_SYNC, &sync)) {
+		int ret = -errno;
+
+		/* Kernels before 4.6 lack the ioctl, the caller falls back */
+		if (ret != -ENOTTY)
+			fprintf(stderr, "failed to sync dma-buf[%s].\n",
+				strerror(-ret));
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Stat the dma-buf @fd, for identifying it by its inode. Only kernels that
+ * give every dma-buf an inode of its own allow that.
+ *
+ * if true, return 0 else negative.
+ */
+drm_private int rockchip_dma_buf_stat(int fd, struct stat *st)
+{
+	struct statfs sfs;
+
+	if (fstatfs(fd, &sfs) || fstat(fd, st))
+		return -errno;
+
+	if (sfs.f_type != ROCKCHIP_DMA_BUF_MAGIC)
+		return -ENOTUNIQ;
+
+	return 0;
+}
+
+#if defined(__aarch64__)
+/*
+ * Clean and invalidate the data cache lines covering @size bytes from
+ * @start to the point of coherency. Linux lets user space do this on
+ * arm64, and reports the smallest line size in CTR_EL0.
+ */
+static void rockchip_bo_flush_lines(char *start, size_t size)
+{
+	uintptr_t addr, end = (uintptr_t)start + size;
+	uint64_t ctr;
+	size_t line;
+
+	__asm__ volatile("mrs %0, ctr_el0" : "=r" (ctr));
+	line = 4 << ((ctr >> 16) & 0xf);
+
+	for (addr = (uintptr_t)start & ~(line - 1); addr < end; addr += line)
+		__asm__ volatile("dc civac, %0" : : "r" (addr) : "memory");
+	__asm__ volatile("dsb sy" : : : "memory");
+}
+
+/*
+ * Flush a range of @bo through a cpu mapping covering it. vma_lock keeps
+ * the mapping from being unmapped meanwhile.
+ *
+ * if flushed, return 0 else negative.
+ */
+static int rockchip_bo_flush_range(struct rockchip_bo *bo, size_t offset,
+				   size_t size)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+	struct rockchip_bo_vma *vma;
+	int ret = -ENOENT;
+
+	pthread_mutex_lock(&dev->vma_lock);
+	DRMLISTFOREACHENTRY(vma, &to_bo_priv(bo)->vmas, link) {
+		if (offset < vma->offset ||
+		    offset + size > vma->offset + vma->size)
+			continue;
+
+		rockchip_bo_flush_lines((char *)vma->addr +
+					(offset - vma->offset), size);
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&dev->vma_lock);
+
+	return ret;
+}
+#else
+static int rockchip_bo_flush_range(struct rockchip_bo *bo, size_t offset,
+				   size_t size)
+{
+	return -ENOTSUP;
+}
+#endif
+
+/*
+ * Bracket cpu accesses to a range of @bo. Ranges short of the whole
+ * buffer only flush their own cache lines where user space can, the
+ * whole buffer goes through the dma-buf sync ioctl.
+ */
+static int rockchip_bo_cpu_access(struct rockchip_bo *bo, size_t offset,
+				  size_t size, uint32_t op, int start)
+{
+	int ret;
+
+	if (!op || (op & ~ROCKCHIP_BO_CPU_MASK) || !size ||
+	    offset > bo->size || size > bo->size - offset) {
+		fprintf(stderr, "invalid cpu access.\n");
+		return -EINVAL;
+	}
+
+	/* The RGA may still be writing what the cpu is about to see */
+	if (start) {
+		ret = rockchip_bo_wait(bo, op, -1);
+		if (ret)
+			return ret;
+	}
+
+	if (!rockchip_bo_needs_sync(bo))
+		return 0;
+
+	if (size < bo->size && !rockchip_bo_flush_range(bo, offset, size))
+		return 0;
+
+	ret = rockchip_bo_dmabuf_sync(bo, start ?
+				      ROCKCHIP_DMA_BUF_SYNC_START :
+				      ROCKCHIP_DMA_BUF_SYNC_END, op);
+	if (ret != -ENOTTY)
+		return ret;
+
+	/* Without the ioctl only user space can maintain the caches */
+	if (!rockchip_bo_flush_range(bo, 0, bo->size))
+		return 0;
+
+	fprintf(stderr, "no cache maintenance for cached buffers.\n");
+
+	return ret;
+}
+
+/*
+ * Prepare a buffer for cpu access.
+ *
+ * @bo: a rockchip buffer object.
+ * @op: ROCKCHIP_BO_CPU_READ and/or ROCKCHIP_BO_CPU_WRITE.
+ *
+ * it first waits for the RGA to be done with the buffer, see
+ * rockchip_bo_wait(). on cached buffers, stale cache lines are then
+ * invalidated so that the cpu sees what devices wrote, uncached and
+ * write-combined buffers need no cache maintenance. every call must be
+ * followed by rockchip_bo_cpu_fini() with the same @op once the cpu is
+ * done.
+ *
+ * on kernels without the dma-buf sync ioctl, cached and imported buffers
+ * fail with -ENOTTY unless the cpu maintains its caches from user space
+ * through a mapping of the whole buffer.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_cpu_prep(struct rockchip_bo *bo, uint32_t op)
+{
+	return rockchip_bo_cpu_access(bo, 0, bo->size, op, 1);
+}
+
+/*
+ * Finish cpu access to a buffer.
+ *
+ * @bo: a rockchip buffer object.
+ * @op: the @op given to rockchip_bo_cpu_prep().
+ *
+ * on cached buffers, what the cpu wrote is cleaned from its caches so
+ * that devices see it.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_cpu_fini(struct rockchip_bo *bo, uint32_t op)
+{
+	return rockchip_bo_cpu_access(bo, 0, bo->size, op, 0);
+}
+
+/*
+ * Prepare a range of a buffer for cpu access.
+ *
+ * @bo: a rockchip buffer object.
+ * @offset: first byte of the range.
+ * @size: bytes in the range.
+ * @op: ROCKCHIP_BO_CPU_READ and/or ROCKCHIP_BO_CPU_WRITE.
+ *
+ * like rockchip_bo_cpu_prep(), but where the cpu allows it from user
+ * space and a mapping from rockchip_bo_map() or rockchip_bo_map_range()
+ * covers the range, only its cache lines are maintained, which is much
+ * cheaper for a small part of a large buffer. pair it with
+ * rockchip_bo_cpu_fini_range() for the same range.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_cpu_prep_range(struct rockchip_bo *bo, size_t offset,
+			       size_t size, uint32_t op)
+{
+	return rockchip_bo_cpu_access(bo, offset, size, op, 1);
+}
+
+/*
+ * Finish cpu access to a range of a buffer.
+ *
+ * @bo: a rockchip buffer object.
+ * @offset, @size, @op: those given to rockchip_bo_cpu_prep_range().
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_cpu_fini_range(struct rockchip_bo *bo, size_t offset,
+			       size_t size, uint32_t op)
+{
+	return rockchip_bo_cpu_access(bo, offset, size, op, 0);
+}
+
+/*
+ * Close the sync dma-buf of a buffer object that is being freed.
+ */
+drm_private void rockchip_bo_sync_fini(struct rockchip_bo *bo)
+{
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+
+	if (priv->sync_fd >= 0)
+		close(priv->sync_fd);
+	priv->sync_fd = -1;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "rockchip_drm_priv.h"
+
+#define ROCKCHIP_BO_TABLE_MIN_BITS	6
+
+static inline uint32_t rockchip_bo_table_key(struct rockchip_bo_table *table,
+					     struct rockchip_bo_priv *priv)
+{
+	return table->by_name ? priv->base.name : priv->base.handle;
+}
+
+static inline struct rockchip_bo_priv **
+rockchip_bo_table_next(struct rockchip_bo_table *table,
+		       struct rockchip_bo_priv *priv)
+{
+	return table->by_name ? &priv->name_next : &priv->handle_next;
+}
+
+static inline unsigned int rockchip_bo_table_hash(struct rockchip_bo_table *table,
+						  uint32_t key)
+{
+	return (key * 0x9e3779b1u) >> (32 - table->bits);
+}
+
+drm_private int rockchip_bo_table_init(struct rockchip_bo_table *table,
+				       int by_name)
+{
+	table->bits = ROCKCHIP_BO_TABLE_MIN_BITS;
+	table->nr = 0;
+	table->by_name = by_name;
+	table->buckets = calloc(1u << table->bits, sizeof(*table->buckets));
+
+	return table->buckets ? 0 : -ENOMEM;
+}
+
+drm_private void rockchip_bo_table_fini(struct rockchip_bo_table *table)
+{
+	free(table->buckets);
+	table->buckets = NULL;
+}
+
+/*
+ * Find the buffer object of @key. This only reads the table, so it may
+ * run concurrently with other lookups.
+ */
+drm_private struct rockchip_bo *
+rockchip_bo_table_find(struct rockchip_bo_table *table, uint32_t key)
+{
+	struct rockchip_bo_priv *priv;
+
+	priv = table->buckets[rockchip_bo_table_hash(table, key)];
+	for (; priv; priv = *rockchip_bo_table_next(table, priv))
+		if (rockchip_bo_table_key(table, priv) == key)
+			return &priv->base;
+
+	return NULL;
+}
+
+/* Double the buckets once there are more entries than buckets */
+static void rockchip_bo_table_grow(struct rockchip_bo_table *table)
+{
+	struct rockchip_bo_priv **old = table->buckets, *priv, *next;
+	unsigned int i, old_nr = 1u << table->bits;
+	struct rockchip_bo_priv **buckets;
+
+	buckets = calloc(old_nr * 2, sizeof(*buckets));
+	if (!buckets)
+		return;
+
+	table->buckets = buckets;
+	table->bits++;
+
+	for (i = 0; i < old_nr; i++) {
+		for (priv = old[i]; priv; priv = next) {
+			unsigned int h;
+
+			next = *rockchip_bo_table_next(table, priv);
+			h = rockchip_bo_table_hash(table,
+					rockchip_bo_table_key(table, priv));
+			*rockchip_bo_table_next(table, priv) = buckets[h];
+			buckets[h] = priv;
+		}
+	}
+
+	free(old);
+}
+
+drm_private void rockchip_bo_table_insert(struct rockchip_bo_table *table,
+					  struct rockchip_bo *bo)
+{
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+	unsigned int h;
+
+	if (++table->nr > (1u << table->bits))
+		rockchip_bo_table_grow(table);
+
+	h = rockchip_bo_table_hash(table, rockchip_bo_table_key(table, priv));
+	*rockchip_bo_table_next(table, priv) = table->buckets[h];
+	table->buckets[h] = priv;
+}
+
+drm_private void rockchip_bo_table_remove(struct rockchip_bo_table *table,
+					  struct rockchip_bo *bo)
+{
+	struct rockchip_bo_priv *priv = to_bo_priv(bo), **link;
+
+	link = &table->buckets[rockchip_bo_table_hash(table,
+				rockchip_bo_table_key(table, priv))];
+	for (; *link; link = rockchip_bo_table_next(table, *link)) {
+		if (*link == priv) {
+			*link = *rockchip_bo_table_next(table, priv);
+			table->nr--;
+			return;
+		}
+	}
+}
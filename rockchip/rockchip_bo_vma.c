@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+
+#include "rockchip_drm.h"
+#include "rockchip_drm_priv.h"
+
+/*
+ * Map the first @size bytes of @bo, page aligned.
+ *
+ * rockchip kernels before "drm/rockchip: Respect page offset for PRIME
+ * mmap calls" map every buffer from its start whatever the offset, so
+ * ranges are always mapped from the start of the buffer.
+ */
+static void *rockchip_bo_vma_mmap(struct rockchip_bo *bo, size_t size)
+{
+	struct rockchip_device *dev = bo->dev;
+	struct drm_rockchip_gem_map_off req = {
+		.handle = bo->handle,
+	};
+	void *addr;
+
+	if (drmIoctl(dev->fd, DRM_IOCTL_ROCKCHIP_GEM_MAP_OFFSET, &req)) {
+		fprintf(stderr, "failed to ioctl gem map offset[%s].\n",
+			strerror(errno));
+		return NULL;
+	}
+
+	addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd,
+		    req.offset);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "failed to mmap buffer[%s].\n",
+			strerror(errno));
+		return NULL;
+	}
+
+	return addr;
+}
+
+/* Must be called with vma_lock held */
+static void rockchip_bo_vma_unmap(struct rockchip_device_priv *dev,
+				  struct rockchip_bo_vma *vma)
+{
+	struct rockchip_bo *bo = vma->bo;
+
+	munmap(vma->addr, vma->size);
+	if (bo->vaddr == vma->addr)
+		bo->vaddr = NULL;
+
+	DRMLISTDEL(&vma->link);
+	DRMLISTDEL(&vma->idle);
+	dev->vma_count--;
+	dev->map_stats.vmas--;
+	dev->map_stats.vma_bytes -= vma->size;
+	free(vma);
+}
+
+/*
+ * Unmap idle mappings, least recently used first, until no more than
+ * vma_max are left. Mappings in use are never unmapped, so there may be
+ * more of them. Must be called with vma_lock held.
+ */
+static void rockchip_bo_vma_purge(struct rockchip_device_priv *dev)
+{
+	struct rockchip_bo_vma *vma;
+
+	if (dev->vma_max < 0)
+		return;
+
+	while (dev->vma_count > (unsigned int)dev->vma_max &&
+	       !DRMLISTEMPTY(&dev->vma_idle)) {
+		vma = DRMLISTENTRY(struct rockchip_bo_vma, dev->vma_idle.next,
+				   idle);
+		to_bo_priv(vma->bo)->evicted = 1;
+		dev->map_stats.evictions++;
+		rockchip_bo_vma_unmap(dev, vma);
+	}
+}
+
+/*
+ * Mark all mappings of a buffer object idle, e.g. when it enters the
+ * buffer object cache, so that they may be unmapped by the vma cache.
+ */
+drm_private void rockchip_bo_vma_idle(struct rockchip_bo *bo)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+	struct rockchip_bo_vma *vma;
+
+	pthread_mutex_lock(&dev->vma_lock);
+	DRMLISTFOREACHENTRY(vma, &to_bo_priv(bo)->vmas, link) {
+		if (!vma->users)
+			continue;
+
+		vma->users = 0;
+		DRMLISTADDTAIL(&vma->idle, &dev->vma_idle);
+	}
+	rockchip_bo_vma_purge(dev);
+	pthread_mutex_unlock(&dev->vma_lock);
+}
+
+/*
+ * Unmap all mappings of a buffer object that is being freed.
+ */
+drm_private void rockchip_bo_vma_fini(struct rockchip_bo *bo)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+	struct rockchip_bo_vma *vma, *tmp;
+
+	pthread_mutex_lock(&dev->vma_lock);
+	DRMLISTFOREACHENTRYSAFE(vma, tmp, &to_bo_priv(bo)->vmas, link)
+		rockchip_bo_vma_unmap(dev, vma);
+	pthread_mutex_unlock(&dev->vma_lock);
+}
+
+/*
+ * Mmap a range of a buffer to user space.
+ *
+ * @bo: a rockchip buffer object.
+ * @offset: first byte of the buffer to be mapped.
+ * @size: bytes to be mapped.
+ *
+ * a mapping already in place covering the range is reused, else the
+ * buffer is mapped from its start to the end of the range, which keeps
+ * the address space used for large buffers accessed near their start
+ * small. every successful call must be undone with rockchip_bo_unmap()
+ * for the mapping to become idle.
+ *
+ * if true, user pointer to @offset else NULL.
+ */
+void *rockchip_bo_map_range(struct rockchip_bo *bo, size_t offset,
+			    size_t size)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+	struct rockchip_bo_priv *priv = to_bo_priv(bo);
+	size_t page = sysconf(_SC_PAGESIZE);
+	struct rockchip_bo_vma *vma;
+	void *addr = NULL;
+	size_t end;
+
+	if (!size || offset > bo->size || size > bo->size - offset) {
+		fprintf(stderr, "invalid map range.\n");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&dev->vma_lock);
+
+	DRMLISTFOREACHENTRY(vma, &priv->vmas, link) {
+		if (vma->offset <= offset &&
+		    offset + size <= vma->offset + vma->size) {
+			dev->map_stats.hits++;
+			goto found;
+		}
+	}
+
+	end = (offset + size + page - 1) & ~(page - 1);
+
+	vma = calloc(1, sizeof(*vma));
+	if (!vma)
+		goto out;
+
+	vma->addr = rockchip_bo_vma_mmap(bo, end);
+	if (!vma->addr) {
+		free(vma);
+		goto out;
+	}
+
+	vma->bo = bo;
+	vma->offset = 0;
+	vma->size = end;
+	DRMINITLISTHEAD(&vma->idle);
+	DRMLISTADD(&vma->link, &priv->vmas);
+
+	dev->vma_count++;
+	dev->map_stats.maps++;
+	if (priv->evicted)
+		dev->map_stats.remaps++;
+	dev->map_stats.vmas++;
+	dev->map_stats.vma_bytes += vma->size;
+
+	if (vma->size >= bo->size)
+		bo->vaddr = vma->addr;
+
+found:
+	if (!vma->users++)
+		DRMLISTDELINIT(&vma->idle);
+	addr = (char *)vma->addr + (offset - vma->offset);
+
+	rockchip_bo_vma_purge(dev);
+out:
+	pthread_mutex_unlock(&dev->vma_lock);
+
+	return addr;
+}
+
+/*
+ * Give back a mapping of a buffer.
+ *
+ * @bo: a rockchip buffer object.
+ * @ptr: a pointer returned by rockchip_bo_map() or rockchip_bo_map_range()
+ *	for @bo.
+ *
+ * once all users gave a mapping back it stays in place, but may be
+ * unmapped to keep the number of mappings within the vma cache size.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_unmap(struct rockchip_bo *bo, void *ptr)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+	struct rockchip_bo_vma *vma;
+	int ret = -EINVAL;
+
+	pthread_mutex_lock(&dev->vma_lock);
+	DRMLISTFOREACHENTRY(vma, &to_bo_priv(bo)->vmas, link) {
+		if ((char *)ptr < (char *)vma->addr ||
+		    (char *)ptr >= (char *)vma->addr + vma->size)
+			continue;
+
+		if (vma->users && !--vma->users) {
+			DRMLISTADDTAIL(&vma->idle, &dev->vma_idle);
+			rockchip_bo_vma_purge(dev);
+		}
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&dev->vma_lock);
+
+	return ret;
+}
+
+/*
+ * Limit the number of cpu mappings of a device.
+ *
+ * @dev: a rockchip device object.
+ * @limit: mappings kept in place, -1 for no limit, the default.
+ *
+ * idle mappings, those given back with rockchip_bo_unmap(), are unmapped
+ * least recently used first to stay within @limit. this bounds the vmas
+ * and address space used by processes with many buffer objects.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_device_set_vma_cache_size(struct rockchip_device *dev, int limit)
+{
+	struct rockchip_device_priv *priv = to_device_priv(dev);
+
+	pthread_mutex_lock(&priv->vma_lock);
+	priv->vma_max = limit;
+	rockchip_bo_vma_purge(priv);
+	pthread_mutex_unlock(&priv->vma_lock);
+
+	return 0;
+}
+
+/*
+ * Get the cpu mapping counters of a device.
+ *
+ * @dev: a rockchip device object.
+ * @stats: filled with the counters since the device was created.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_device_get_map_stats(struct rockchip_device *dev,
+				  struct rockchip_bo_map_stats *stats)
+{
+	struct rockchip_device_priv *priv = to_device_priv(dev);
+
+	pthread_mutex_lock(&priv->vma_lock);
+	*stats = priv->map_stats;
+	pthread_mutex_unlock(&priv->vma_lock);
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _ROCKCHIP_DMA_BUF_H_
+#define _ROCKCHIP_DMA_BUF_H_
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "libdrm_macros.h"
+
+/*
+ * dma-buf CPU access bracketing, see linux/dma-buf.h. Defined here so the
+ * library still builds against kernel headers older than 4.6.
+ */
+struct rockchip_dma_buf_sync {
+	uint64_t flags;
+};
+
+#define ROCKCHIP_DMA_BUF_SYNC_READ	(1 << 0)
+#define ROCKCHIP_DMA_BUF_SYNC_WRITE	(2 << 0)
+#define ROCKCHIP_DMA_BUF_SYNC_START	(0 << 2)
+#define ROCKCHIP_DMA_BUF_SYNC_END	(1 << 2)
+#define ROCKCHIP_DMA_BUF_IOCTL_SYNC	_IOW('b', 0, struct rockchip_dma_buf_sync)
+
+/*
+ * Filesystem type of dma-bufs since Linux 5.3, which gives each its own
+ * inode. Older kernels put them all behind the one anon inode.
+ */
+#define ROCKCHIP_DMA_BUF_MAGIC		0x444d4142	/* "DMAB" */
+
+drm_private int rockchip_dma_buf_stat(int fd, struct stat *st);
+
+#endif
@@ -33,14 +33,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-#include <sys/mman.h>
 #include <linux/stddef.h>
 
 #include <xf86drm.h>
 
 #include "rockchip_drm.h"
 #include "rockchip_drmif.h"
+#include "rockchip_drm_priv.h"
 
 /*
  * Create rockchip drm device object.
@@ -51,16 +53,48 @@
  */
 struct rockchip_device *rockchip_device_create(int fd)
 {
+	struct rockchip_device_priv *priv;
 	struct rockchip_device *dev;
 
-	dev = calloc(1, sizeof(*dev));
-	if (!dev) {
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
 		fprintf(stderr, "failed to create device[%s].\n",
 				strerror(errno));
 		return NULL;
 	}
 
+	dev = &priv->base;
 	dev->fd = fd;
+	atomic_set(&priv->refcnt, 1);
+
+	if (rockchip_bo_table_init(&priv->handles, 0) ||
+	    rockchip_bo_table_init(&priv->names, 1)) {
+		fprintf(stderr, "failed to create bo tables.\n");
+		rockchip_bo_table_fini(&priv->handles);
+		free(priv);
+		return NULL;
+	}
+
+	pthread_rwlock_init(&priv->lock, NULL);
+	pthread_mutex_init(&priv->vma_lock, NULL);
+	DRMINITLISTHEAD(&priv->vma_idle);
+	priv->vma_max = -1;
+
+	return dev;
+}
+
+/*
+ * Take another reference to a rockchip drm device object.
+ *
+ * @dev: rockchip drm device object.
+ *
+ * every reference is dropped with rockchip_device_destroy().
+ *
+ * return @dev.
+ */
+struct rockchip_device *rockchip_device_ref(struct rockchip_device *dev)
+{
+	atomic_inc(&to_device_priv(dev)->refcnt);
 
 	return dev;
 }
@@ -69,10 +103,41 @@ struct rockchip_device *rockchip_device_create(int fd)
  * Destroy rockchip drm device object
  *
  * @dev: rockchip drm device object.
+ *
+ * this drops one reference. every live buffer object also holds one, so
+ * the device goes away with the last of them.
  */
 void rockchip_device_destroy(struct rockchip_device *dev)
 {
-	free(dev);
+	struct rockchip_device_priv *priv = to_device_priv(dev);
+
+	if (!atomic_dec_and_test(&priv->refcnt))
+		return;
+
+	if (dev->bo_cache)
+		rockchip_bo_cache_destroy(dev->bo_cache);
+	rockchip_bo_table_fini(&priv->handles);
+	rockchip_bo_table_fini(&priv->names);
+	pthread_rwlock_destroy(&priv->lock);
+	pthread_mutex_destroy(&priv->vma_lock);
+	free(priv);
+}
+
+/*
+ * Add a new buffer object to the tables of its device and hand out its
+ * first reference. Must be called with the device lock held for writing.
+ *
+ * @bo: a rockchip buffer object with a valid gem handle.
+ */
+static void rockchip_bo_track(struct rockchip_bo *bo)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+
+	atomic_set(&to_bo_priv(bo)->refcnt, 1);
+	rockchip_bo_table_insert(&dev->handles, bo);
+	if (bo->name)
+		rockchip_bo_table_insert(&dev->names, bo);
+	rockchip_device_ref(bo->dev);
 }
 
 /*
@@ -91,6 +156,21 @@ void rockchip_device_destroy(struct rockchip_device *dev)
 struct rockchip_bo *rockchip_bo_create(struct rockchip_device *dev,
 					size_t size, uint32_t flags)
 {
+	return rockchip_bo_create_cached(dev, size, flags, NULL);
+}
+
+/*
+ * rockchip_bo_create(), preferring a cached buffer object whose
+ * framebuffer matches @fb. without @fb, a cached buffer object loses its
+ * framebuffer.
+ */
+drm_private struct rockchip_bo *
+rockchip_bo_create_cached(struct rockchip_device *dev, size_t size,
+			  uint32_t flags, const struct rockchip_bo_fb *fb)
+{
+	struct rockchip_device_priv *dev_priv = to_device_priv(dev);
+	struct rockchip_bo_bucket *bucket = NULL;
+	struct rockchip_bo_priv *priv;
 	struct rockchip_bo *bo;
 	struct drm_rockchip_gem_create req = {
 		.size = size,
@@ -102,14 +182,43 @@ struct rockchip_bo *rockchip_bo_create(struct rockchip_device *dev,
 		return NULL;
 	}
 
-	bo = calloc(1, sizeof(*bo));
-	if (!bo) {
+	pthread_rwlock_wrlock(&dev_priv->lock);
+	if (dev->bo_cache) {
+		bucket = rockchip_bo_cache_bucket(dev->bo_cache, size);
+		if (bucket) {
+			bo = rockchip_bo_cache_get(dev->bo_cache, bucket,
+						   flags, fb);
+			if (bo) {
+				if (!fb)
+					rockchip_bo_fb_fini(bo);
+				bo->format = 0;
+				bo->width = 0;
+				bo->height = 0;
+				bo->pitch = 0;
+				bo->fb_id = 0;
+				rockchip_bo_track(bo);
+				pthread_rwlock_unlock(&dev_priv->lock);
+				return bo;
+			}
+
+			size = bucket->size;
+			req.size = size;
+		}
+	}
+	pthread_rwlock_unlock(&dev_priv->lock);
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
 		fprintf(stderr, "failed to create bo[%s].\n",
 				strerror(errno));
 		goto fail;
 	}
 
+	bo = &priv->base;
+	DRMINITLISTHEAD(&priv->vmas);
+	priv->sync_fd = -1;
 	bo->dev = dev;
+	priv->reusable = !!bucket;
 
 	if (drmIoctl(dev->fd, DRM_IOCTL_ROCKCHIP_GEM_CREATE, &req)){
 		fprintf(stderr, "failed to create gem object[%s].\n",
@@ -121,36 +230,222 @@ struct rockchip_bo *rockchip_bo_create(struct rockchip_device *dev,
 	bo->size = size;
 	bo->flags = flags;
 
+	pthread_rwlock_wrlock(&dev_priv->lock);
+	rockchip_bo_track(bo);
+	pthread_rwlock_unlock(&dev_priv->lock);
+
 	return bo;
 
 err_free_bo:
-	free(bo);
+	free(priv);
 fail:
 	return NULL;
 }
 
+/*
+ * Unmap and close a buffer object for good. Must be called with the
+ * device lock held for writing, so that the gem handle cannot be handed
+ * out again while it is still found in the tables.
+ *
+ * @bo: a rockchip buffer object no longer tracked by its device.
+ */
+drm_private void rockchip_bo_free(struct rockchip_bo *bo)
+{
+	rockchip_bo_vma_fini(bo);
+	rockchip_bo_sync_fini(bo);
+	rockchip_bo_fb_fini(bo);
+	rockchip_bo_busy_fini(bo);
+
+	if (bo->handle) {
+		struct drm_gem_close req = {
+			.handle = bo->handle,
+		};
+
+		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	}
+
+	free(to_bo_priv(bo));
+}
+
+/*
+ * Take another reference to a rockchip buffer object.
+ *
+ * @bo: a rockchip buffer object.
+ *
+ * every reference is dropped with rockchip_bo_destroy().
+ *
+ * return @bo.
+ */
+struct rockchip_bo *rockchip_bo_ref(struct rockchip_bo *bo)
+{
+	atomic_inc(&to_bo_priv(bo)->refcnt);
+
+	return bo;
+}
+
 /*
  * Destroy a rockchip buffer object.
  *
  * @bo: a rockchip buffer object to be destroyed.
+ *
+ * this drops one reference, the buffer object goes away with the last
+ * one. with the buffer object cache enabled, it may then be kept for
+ * reuse by rockchip_bo_create() instead.
  */
 void rockchip_bo_destroy(struct rockchip_bo *bo)
 {
+	struct rockchip_bo_priv *priv;
+	struct rockchip_device_priv *dev;
+
 	if (!bo)
 		return;
 
-	if (bo->vaddr)
-		munmap(bo->vaddr, bo->size);
+	priv = to_bo_priv(bo);
+	dev = to_device_priv(bo->dev);
 
-	if (bo->handle) {
-		struct drm_gem_close req = {
-			.handle = bo->handle,
-		};
+	/* Drop all but the last reference without the lock */
+	if (!atomic_add_unless(&priv->refcnt, -1, 1))
+		return;
 
-		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	/*
+	 * Lookups take references under the read lock, so once the count
+	 * drops to zero under the write lock nobody can find it anymore.
+	 */
+	pthread_rwlock_wrlock(&dev->lock);
+	if (!atomic_dec_and_test(&priv->refcnt)) {
+		pthread_rwlock_unlock(&dev->lock);
+		return;
+	}
+
+	rockchip_bo_table_remove(&dev->handles, bo);
+	if (bo->name)
+		rockchip_bo_table_remove(&dev->names, bo);
+
+	if (!bo->dev->bo_cache ||
+	    !rockchip_bo_cache_put(bo->dev->bo_cache, bo))
+		rockchip_bo_free(bo);
+	pthread_rwlock_unlock(&dev->lock);
+
+	rockchip_device_destroy(&dev->base);
+}
+
+/*
+ * Get the buffer object of a gem handle.
+ *
+ * @dev: a rockchip device object.
+ * @handle: a gem handle of this device.
+ *
+ * only buffer objects created or opened through @dev are known. the
+ * buffer object is returned with a new reference, drop it with
+ * rockchip_bo_destroy().
+ *
+ * if true, return the rockchip buffer object else NULL.
+ */
+struct rockchip_bo *rockchip_bo_lookup(struct rockchip_device *dev,
+				       uint32_t handle)
+{
+	struct rockchip_device_priv *priv = to_device_priv(dev);
+	struct rockchip_bo *bo;
+
+	if (!handle)
+		return NULL;
+
+	pthread_rwlock_rdlock(&priv->lock);
+	bo = rockchip_bo_table_find(&priv->handles, handle);
+	if (bo)
+		rockchip_bo_ref(bo);
+	pthread_rwlock_unlock(&priv->lock);
+
+	return bo;
+}
+
+/*
+ * Get the size and memory type of a gem object.
+ *
+ * @dev: a rockchip device object.
+ * @handle: a gem handle of this device.
+ * @size: size of the gem object.
+ * @flags: memory type and cache attributes it was created with, see
+ *	e_rockchip_gem_mem_type. 0 when unknown.
+ *
+ * buffer objects of @dev are answered from their cached metadata. For
+ * any other handle the size is read from a dma-buf exported for it, as
+ * the kernel driver has no query for it, and the flags are unknown.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_get_info(struct rockchip_device *dev, uint32_t handle,
+			 size_t *size, uint32_t *flags)
+{
+	struct rockchip_device_priv *priv = to_device_priv(dev);
+	struct rockchip_bo *bo;
+	off_t end;
+	int ret, fd;
+
+	pthread_rwlock_rdlock(&priv->lock);
+	bo = handle ? rockchip_bo_table_find(&priv->handles, handle) : NULL;
+	if (bo) {
+		if (size)
+			*size = bo->size;
+		if (flags)
+			*flags = bo->flags;
+	}
+	pthread_rwlock_unlock(&priv->lock);
+
+	if (bo)
+		return 0;
+
+	ret = drmPrimeHandleToFD(dev->fd, handle, DRM_CLOEXEC, &fd);
+	if (ret) {
+		fprintf(stderr, "failed to export gem object[%s].\n",
+				strerror(errno));
+		return -errno;
+	}
+
+	end = lseek(fd, 0, SEEK_END);
+	ret = end < 0 ? -errno : 0;
+	close(fd);
+	if (ret) {
+		fprintf(stderr, "failed to get gem object size[%s].\n",
+				strerror(-ret));
+		return ret;
+	}
+
+	if (size)
+		*size = end;
+	if (flags)
+		*flags = 0;
+
+	return 0;
+}
+
+/*
+ * Record the layout of the contents of a buffer object.
+ *
+ * @bo: a rockchip buffer object.
+ * @format: DRM fourcc of the contents.
+ * @width, @height: size of the contents in pixels.
+ * @pitch: bytes per line of the first plane.
+ *
+ * the layout is a hint kept with the buffer object for the code sharing
+ * it, it does not change the gem object.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_set_layout(struct rockchip_bo *bo, uint32_t format,
+			   uint32_t width, uint32_t height, uint32_t pitch)
+{
+	if ((uint64_t)pitch * height > bo->size) {
+		fprintf(stderr, "layout exceeds the buffer.\n");
+		return -EINVAL;
 	}
 
-	free(bo);
+	bo->format = format;
+	bo->width = width;
+	bo->height = height;
+	bo->pitch = pitch;
+
+	return 0;
 }
 
 
@@ -162,6 +457,8 @@ void rockchip_bo_destroy(struct rockchip_bo *bo)
  *
  * this interface is used to get a rockchip buffer object from a gem
  * global object name sent by another process for buffer sharing.
+ * opening a name again returns the same buffer object with one more
+ * reference.
  *
  * if true, return a rockchip buffer object else NULL.
  *
@@ -169,18 +466,44 @@ void rockchip_bo_destroy(struct rockchip_bo *bo)
 struct rockchip_bo *rockchip_bo_from_name(struct rockchip_device *dev,
 						uint32_t name)
 {
+	struct rockchip_device_priv *dev_priv = to_device_priv(dev);
+	struct rockchip_bo_priv *priv;
 	struct rockchip_bo *bo;
 	struct drm_gem_open req = {
 		.name = name,
 	};
 
-	bo = calloc(1, sizeof(*bo));
-	if (!bo) {
+	pthread_rwlock_rdlock(&dev_priv->lock);
+	bo = rockchip_bo_table_find(&dev_priv->names, name);
+	if (bo)
+		rockchip_bo_ref(bo);
+	pthread_rwlock_unlock(&dev_priv->lock);
+
+	if (bo)
+		return bo;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
 		fprintf(stderr, "failed to allocate bo[%s].\n",
 				strerror(errno));
 		return NULL;
 	}
 
+	DRMINITLISTHEAD(&priv->vmas);
+	priv->sync_fd = -1;
+
+	pthread_rwlock_wrlock(&dev_priv->lock);
+
+	/* Someone else may have opened it in the meantime */
+	bo = rockchip_bo_table_find(&dev_priv->names, name);
+	if (bo) {
+		rockchip_bo_ref(bo);
+		pthread_rwlock_unlock(&dev_priv->lock);
+		free(priv);
+		return bo;
+	}
+
+	bo = &priv->base;
 	if (drmIoctl(dev->fd, DRM_IOCTL_GEM_OPEN, &req)) {
 		fprintf(stderr, "failed to open gem object[%s].\n",
 				strerror(errno));
@@ -189,12 +512,17 @@ struct rockchip_bo *rockchip_bo_from_name(struct rockchip_device *dev,
 
 	bo->dev = dev;
 	bo->name = name;
+	priv->foreign = 1;
 	bo->handle = req.handle;
+	bo->size = req.size;
+	rockchip_bo_track(bo);
+	pthread_rwlock_unlock(&dev_priv->lock);
 
 	return bo;
 
 err_free_bo:
-	free(bo);
+	pthread_rwlock_unlock(&dev_priv->lock);
+	free(priv);
 	return NULL;
 }
 
@@ -211,6 +539,8 @@ err_free_bo:
  */
 int rockchip_bo_get_name(struct rockchip_bo *bo, uint32_t *name)
 {
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+
 	if (!bo->name) {
 		struct drm_gem_flink req = {
 			.handle = bo->handle,
@@ -224,7 +554,14 @@ int rockchip_bo_get_name(struct rockchip_bo *bo, uint32_t *name)
 			return ret;
 		}
 
-		bo->name = req.name;
+		pthread_rwlock_wrlock(&dev->lock);
+		if (!bo->name) {
+			bo->name = req.name;
+			rockchip_bo_table_insert(&dev->names, bo);
+		}
+		/* Others may hold it by name now, it must not be reused */
+		to_bo_priv(bo)->reusable = 0;
+		pthread_rwlock_unlock(&dev->lock);
 	}
 
 	*name = bo->name;
@@ -232,6 +569,123 @@ int rockchip_bo_get_name(struct rockchip_bo *bo, uint32_t *name)
 	return 0;
 }
 
+/*
+ * Get a rockchip buffer object from a dma-buf.
+ *
+ * @dev: a rockchip device object.
+ * @fd: a dma-buf file descriptor, e.g. exported by a decoder or another
+ *	process. the caller keeps its own reference to it.
+ *
+ * the kernel hands out one gem handle per buffer, so importing a dma-buf
+ * whose handle already has a buffer object returns that buffer object
+ * with one more reference, instead of a second one whose destruction
+ * would close the handle under the first.
+ *
+ * if true, return a rockchip buffer object else NULL.
+ */
+struct rockchip_bo *rockchip_bo_from_dmabuf(struct rockchip_device *dev,
+					    int fd)
+{
+	struct rockchip_device_priv *dev_priv = to_device_priv(dev);
+	struct rockchip_bo_priv *priv;
+	struct rockchip_bo *bo;
+	uint32_t handle;
+	off_t size;
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size <= 0) {
+		fprintf(stderr, "failed to get dma-buf size[%s].\n",
+				strerror(errno));
+		return NULL;
+	}
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
+		fprintf(stderr, "failed to allocate bo[%s].\n",
+				strerror(errno));
+		return NULL;
+	}
+
+	DRMINITLISTHEAD(&priv->vmas);
+	priv->sync_fd = -1;
+
+	/*
+	 * The handle is looked up under the write lock, so it cannot be
+	 * closed by the destruction of its buffer object in between.
+	 */
+	pthread_rwlock_wrlock(&dev_priv->lock);
+
+	if (drmPrimeFDToHandle(dev->fd, fd, &handle)) {
+		fprintf(stderr, "failed to import dma-buf[%s].\n",
+				strerror(errno));
+		pthread_rwlock_unlock(&dev_priv->lock);
+		free(priv);
+		return NULL;
+	}
+
+	bo = rockchip_bo_table_find(&dev_priv->handles, handle);
+	if (bo) {
+		rockchip_bo_ref(bo);
+		/* Others may hold it through the dma-buf */
+		to_bo_priv(bo)->reusable = 0;
+		pthread_rwlock_unlock(&dev_priv->lock);
+		free(priv);
+		rockchip_bo_busy_track(bo, fd);
+		return bo;
+	}
+
+	bo = &priv->base;
+	bo->dev = dev;
+	bo->handle = handle;
+	priv->foreign = 1;
+	bo->size = size;
+	rockchip_bo_track(bo);
+	pthread_rwlock_unlock(&dev_priv->lock);
+
+	rockchip_bo_busy_track(bo, fd);
+
+	return bo;
+}
+
+/*
+ * Export a rockchip buffer object as a dma-buf.
+ *
+ * @bo: a rockchip buffer object.
+ * @fd: the new dma-buf file descriptor, owned by the caller.
+ *
+ * the dma-buf is close-on-exec and, where the kernel allows it, mappable
+ * for writing.
+ *
+ * if true, return 0 else negative.
+ */
+int rockchip_bo_to_dmabuf(struct rockchip_bo *bo, int *fd)
+{
+	struct rockchip_device_priv *dev = to_device_priv(bo->dev);
+	int ret;
+
+	ret = drmPrimeHandleToFD(bo->dev->fd, bo->handle,
+				 DRM_CLOEXEC | O_RDWR, fd);
+	/* Kernels before 4.6 refuse O_RDWR */
+	if (ret && errno == EINVAL)
+		ret = drmPrimeHandleToFD(bo->dev->fd, bo->handle,
+					 DRM_CLOEXEC, fd);
+	if (ret) {
+		fprintf(stderr, "failed to export gem object[%s].\n",
+				strerror(errno));
+		return -errno;
+	}
+
+	/* Others may hold it through the dma-buf now */
+	pthread_rwlock_wrlock(&dev->lock);
+	to_bo_priv(bo)->reusable = 0;
+	pthread_rwlock_unlock(&dev->lock);
+
+	/* So that rockchip_bo_busy() sees what the RGA does with it */
+	rockchip_bo_busy_track(bo, *fd);
+
+	return 0;
+}
+
 uint32_t rockchip_bo_handle(struct rockchip_bo *bo)
 {
 	return bo->handle;
@@ -243,32 +697,12 @@ uint32_t rockchip_bo_handle(struct rockchip_bo *bo)
  * @bo: a rockchip buffer object including a gem object handle to be mmapped
  *	to user space.
  *
+ * the mapping stays in place until @bo is destroyed, or, once given back
+ * with rockchip_bo_unmap(), until the vma cache needs the room.
+ *
  * if true, user pointer mmaped else NULL.
  */
 void *rockchip_bo_map(struct rockchip_bo *bo)
 {
-	if (!bo->vaddr) {
-		struct rockchip_device *dev = bo->dev;
-		struct drm_rockchip_gem_map_off req = {
-			.handle = bo->handle,
-		};
-		int ret;
-
-		ret = drmIoctl(dev->fd, DRM_IOCTL_ROCKCHIP_GEM_MAP_OFFSET, &req);
-		if (ret) {
-			fprintf(stderr, "failed to ioctl gem map offset[%s].\n",
-				strerror(errno));
-			return NULL;
-		}
-
-		bo->vaddr = mmap(0, bo->size, PROT_READ | PROT_WRITE,
-			   MAP_SHARED, dev->fd, req.offset);
-		if (bo->vaddr == MAP_FAILED) {
-			fprintf(stderr, "failed to mmap buffer[%s].\n",
-				strerror(errno));
-			return NULL;
-		}
-	}
-
-	return bo->vaddr;
+	return rockchip_bo_map_range(bo, 0, bo->size);
 }
@@ -32,6 +32,22 @@
 #include <stdint.h>
 #include "drm.h"
 
+/*
+ * Memory types of a gem object, the flags of drm_rockchip_gem_create.
+ *
+ * @ROCKCHIP_BO_CONTIG: physically contiguous memory, else pages are
+ *	scattered and reached through the iommu.
+ * @ROCKCHIP_BO_CACHABLE: cached cpu mappings, else uncached.
+ * @ROCKCHIP_BO_WC: write-combined cpu mappings.
+ */
+enum e_rockchip_gem_mem_type {
+	ROCKCHIP_BO_CONTIG	= 1 << 0,
+	ROCKCHIP_BO_CACHABLE	= 1 << 1,
+	ROCKCHIP_BO_WC		= 1 << 2,
+	ROCKCHIP_BO_MASK	= ROCKCHIP_BO_CONTIG | ROCKCHIP_BO_CACHABLE |
+				  ROCKCHIP_BO_WC,
+};
+
 /**
  * User-desired buffer creation information structure.
  *
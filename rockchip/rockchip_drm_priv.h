@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _ROCKCHIP_DRM_PRIV_H_
+#define _ROCKCHIP_DRM_PRIV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "libdrm_lists.h"
+#include "xf86atomic.h"
+
+#include "rockchip_drmif.h"
+
+/*
+ * Buffer object cache: freed buffer objects are kept in buckets of
+ * rounded up sizes, from 4KiB to ROCKCHIP_BO_CACHE_MAX_SIZE, and closed
+ * once they stayed unused for ROCKCHIP_BO_CACHE_TIMEOUT_US.
+ */
+#define ROCKCHIP_BO_CACHE_MAX_SIZE	(64 * 1024 * 1024)
+#define ROCKCHIP_BO_CACHE_BUCKETS	56
+#define ROCKCHIP_BO_CACHE_TIMEOUT_US	1000000
+
+/*
+ * Suballocator: small buffers of 2^ROCKCHIP_BO_SLAB_MIN_ORDER up to
+ * 2^ROCKCHIP_BO_SLAB_MAX_ORDER bytes are carved out of buffer objects of
+ * ROCKCHIP_BO_SLAB_SIZE, one size class per buffer object.
+ */
+#define ROCKCHIP_BO_SLAB_SIZE		(1024 * 1024)
+#define ROCKCHIP_BO_SLAB_MIN_ORDER	10
+#define ROCKCHIP_BO_SLAB_MAX_ORDER	18
+#define ROCKCHIP_BO_SLAB_CLASSES	\
+	(ROCKCHIP_BO_SLAB_MAX_ORDER - ROCKCHIP_BO_SLAB_MIN_ORDER + 1)
+
+/*
+ * Pre-allocation pool: sizes and flags it keeps buffer objects ready for,
+ * and how many of each it keeps at most.
+ */
+#define ROCKCHIP_BO_POOL_CLASSES	8
+#define ROCKCHIP_BO_POOL_MAX_READY	16
+
+static inline uint64_t rockchip_bo_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Framebuffer layout: lines are aligned for the bursts of the display
+ * controller and the RGA, and no side may be larger than
+ * ROCKCHIP_BO_FB_MAX_SIZE pixels.
+ */
+#define ROCKCHIP_BO_FB_PITCH_ALIGN	64
+#define ROCKCHIP_BO_FB_MAX_SIZE		16384
+
+/*
+ * A framebuffer registered for a buffer object by rockchip_bo_create_fb(),
+ * kept while the buffer object is cached so that it can be scanned out
+ * again without new ioctls.
+ *
+ * @id: the framebuffer, 0 for none.
+ * @format, @width, @height: what it was registered with.
+ */
+struct rockchip_bo_fb {
+	uint32_t		id;
+	uint32_t		format;
+	uint32_t		width;
+	uint32_t		height;
+};
+
+static inline int rockchip_bo_fb_match(const struct rockchip_bo_fb *a,
+				       const struct rockchip_bo_fb *b)
+{
+	return a->format == b->format && a->width == b->width &&
+	       a->height == b->height;
+}
+
+/*
+ * Library side of a buffer object.
+ *
+ * @base: the part callers see, always first.
+ * @link: position in a cache bucket while cached.
+ * @free_us: when it entered the cache.
+ * @reusable: whether it may be cached once destroyed, i.e. it was sized
+ *	by a bucket and never shared with anyone else.
+ * @refcnt: references held by callers, the last one destroys it.
+ * @handle_next, @name_next: chains of the device's handle and name tables.
+ * @vmas: its cpu mappings, see struct rockchip_bo_vma.
+ * @evicted: whether one of its mappings was unmapped by the vma cache.
+ * @foreign: whether it was opened by name or imported from a dma-buf, so
+ *	its cache attributes are unknown.
+ * @sync_fd: dma-buf bracketing cpu accesses, -1 until first needed.
+ *	Protected by the device vma_lock.
+ * @fb: its framebuffer, if any.
+ * @busy_ino: inode of its dma-buf once exported or imported, else 0.
+ * @busy_fd: that dma-buf, kept where the kernel has one inode for all
+ *	dma-bufs to tell them apart, else -1. Valid along with @busy_ino.
+ * @busy_link: position among the buffer objects of that dma-buf.
+ * @timeline: RGA context that last read or wrote it, if any.
+ * @last_read, @last_write: submissions of @timeline reading and writing
+ *	it last. Protected by the device vma_lock, along with @timeline.
+ */
+struct rockchip_bo_priv {
+	struct rockchip_bo	base;
+	drmMMListHead		link;
+	uint64_t		free_us;
+	int			reusable;
+	atomic_t		refcnt;
+	struct rockchip_bo_priv	*handle_next;
+	struct rockchip_bo_priv	*name_next;
+	drmMMListHead		vmas;
+	int			evicted;
+	int			foreign;
+	int			sync_fd;
+	struct rockchip_bo_fb	fb;
+	unsigned long		busy_ino;
+	int			busy_fd;
+	drmMMListHead		busy_link;
+	struct rockchip_timeline *timeline;
+	uint64_t		last_read;
+	uint64_t		last_write;
+};
+
+static inline struct rockchip_bo_priv *to_bo_priv(struct rockchip_bo *bo)
+{
+	return (struct rockchip_bo_priv *)bo;
+}
+
+/*
+ * A cpu mapping of a buffer object or of a range of it.
+ *
+ * @bo: the buffer object mapped.
+ * @link: position in the mappings of its buffer object.
+ * @idle: position in the idle mappings of the device while unused.
+ * @offset, @size: the mapped range of the buffer object, in whole pages.
+ * @addr: start of the mapping.
+ * @users: mappings handed out and not yet given back by rockchip_bo_unmap().
+ */
+struct rockchip_bo_vma {
+	struct rockchip_bo	*bo;
+	drmMMListHead		link;
+	drmMMListHead		idle;
+	size_t			offset;
+	size_t			size;
+	void			*addr;
+	unsigned int		users;
+};
+
+/*
+ * Buffer objects of a device by gem handle or by global name. Unlike a
+ * drmHash, whose lookups reorder its chains, finding an entry only reads
+ * the table, so lookups can share a read lock.
+ */
+struct rockchip_bo_table {
+	struct rockchip_bo_priv	**buckets;
+	unsigned int		bits;
+	unsigned int		nr;
+	int			by_name;
+};
+
+drm_private int rockchip_bo_table_init(struct rockchip_bo_table *table,
+				       int by_name);
+drm_private void rockchip_bo_table_fini(struct rockchip_bo_table *table);
+drm_private struct rockchip_bo *
+rockchip_bo_table_find(struct rockchip_bo_table *table, uint32_t key);
+drm_private void rockchip_bo_table_insert(struct rockchip_bo_table *table,
+					  struct rockchip_bo *bo);
+drm_private void rockchip_bo_table_remove(struct rockchip_bo_table *table,
+					  struct rockchip_bo *bo);
+
+/*
+ * Library side of a device.
+ *
+ * @base: the part callers see, always first.
+ * @refcnt: references held by callers and by live buffer objects.
+ * @lock: protects the tables and the buffer object cache. Lookups take
+ *	it for reading; adding, removing and closing buffer objects take
+ *	it for writing, so a gem handle is never closed while it can still
+ *	be found.
+ * @handles, @names: its buffer objects by gem handle and global name.
+ * @vma_lock: protects the cpu mappings of its buffer objects and the
+ *	fields below. Taken inside @lock, never the other way round.
+ * @vma_idle: mappings nobody uses, least recently used first.
+ * @vma_max: mappings kept before idle ones are unmapped, -1 for no limit.
+ * @vma_count: mappings in place, used or idle.
+ * @map_stats: see rockchip_device_get_map_stats().
+ */
+struct rockchip_device_priv {
+	struct rockchip_device	base;
+	atomic_t		refcnt;
+	pthread_rwlock_t	lock;
+	struct rockchip_bo_table handles;
+	struct rockchip_bo_table names;
+	pthread_mutex_t		vma_lock;
+	drmMMListHead		vma_idle;
+	int			vma_max;
+	unsigned int		vma_count;
+	struct rockchip_bo_map_stats map_stats;
+};
+
+static inline struct rockchip_device_priv *
+to_device_priv(struct rockchip_device *dev)
+{
+	return (struct rockchip_device_priv *)dev;
+}
+
+struct rockchip_bo_bucket {
+	size_t			size;
+	drmMMListHead		list;
+};
+
+struct rockchip_bo_cache {
+	struct rockchip_bo_bucket	buckets[ROCKCHIP_BO_CACHE_BUCKETS];
+	unsigned int			bucket_nr;
+	struct rockchip_bo_cache_stats	stats;
+};
+
+drm_private struct rockchip_bo *
+rockchip_bo_create_cached(struct rockchip_device *dev, size_t size,
+			  uint32_t flags, const struct rockchip_bo_fb *fb);
+drm_private void rockchip_bo_free(struct rockchip_bo *bo);
+
+drm_private struct rockchip_bo_bucket *
+rockchip_bo_cache_bucket(struct rockchip_bo_cache *cache, size_t size);
+drm_private struct rockchip_bo *
+rockchip_bo_cache_get(struct rockchip_bo_cache *cache,
+		      struct rockchip_bo_bucket *bucket, uint32_t flags,
+		      const struct rockchip_bo_fb *fb);
+drm_private int rockchip_bo_cache_put(struct rockchip_bo_cache *cache,
+				      struct rockchip_bo *bo);
+drm_private void rockchip_bo_cache_destroy(struct rockchip_bo_cache *cache);
+
+drm_private void rockchip_bo_vma_idle(struct rockchip_bo *bo);
+drm_private void rockchip_bo_vma_fini(struct rockchip_bo *bo);
+
+drm_private void rockchip_bo_sync_fini(struct rockchip_bo *bo);
+drm_private void rockchip_bo_fb_fini(struct rockchip_bo *bo);
+
+drm_private void rockchip_bo_busy_track(struct rockchip_bo *bo, int fd);
+drm_private void rockchip_bo_busy_fini(struct rockchip_bo *bo);
+
+#endif
@@ -32,8 +32,53 @@
 #include <stdint.h>
 #include "rockchip_drm.h"
 
+struct rockchip_bo_cache;
+struct rockchip_bo_slab;
+struct rockchip_bo_pool;
+
+/*
+ * Rockchip device object.
+ *
+ * @fd: file descriptor of the rockchip drm device.
+ * @bo_cache: destroyed buffer objects kept for reuse, NULL if disabled.
+ */
 struct rockchip_device {
 	int fd;
+	struct rockchip_bo_cache *bo_cache;
+};
+
+/*
+ * Buffer object cache counters, see rockchip_device_get_bo_cache_stats().
+ *
+ * @hits, @misses: rockchip_bo_create() calls served from the cache or not.
+ * @evictions: cached buffer objects closed after staying unused.
+ * @cached, @cached_bytes: buffer objects currently in the cache.
+ */
+struct rockchip_bo_cache_stats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long cached;
+	unsigned long long cached_bytes;
+};
+
+/*
+ * Cpu mapping counters, see rockchip_device_get_map_stats().
+ *
+ * @hits: map calls served by a mapping already in place.
+ * @maps: map calls that had to create a new mapping.
+ * @remaps: the part of @maps for buffer objects that had a mapping
+ *	unmapped by the vma cache before.
+ * @evictions: idle mappings unmapped to stay within the vma cache size.
+ * @vmas, @vma_bytes: mappings currently in place.
+ */
+struct rockchip_bo_map_stats {
+	unsigned long long hits;
+	unsigned long long maps;
+	unsigned long long remaps;
+	unsigned long long evictions;
+	unsigned long long vmas;
+	unsigned long long vma_bytes;
 };
 
 /*
@@ -43,8 +88,11 @@ struct rockchip_device {
  * @handle: a gem handle to gem object created.
  * @flags: indicate memory allocation and cache attribute types.
  * @size: size to the buffer created.
- * @vaddr: user space address to a gem buffer mmaped.
+ * @vaddr: user space address to a gem buffer mmaped, NULL while the whole
+ *	buffer is not mapped.
  * @name: a gem global handle from flink request.
+ * @format, @width, @height, @pitch: layout of the contents, when known.
+ * @fb_id: framebuffer registered by rockchip_bo_create_fb(), else 0.
  */
 struct rockchip_bo {
 	struct rockchip_device	*dev;
@@ -53,6 +101,84 @@ struct rockchip_bo {
 	size_t			size;
 	void			*vaddr;
 	uint32_t		name;
+	uint32_t		format;
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		pitch;
+	uint32_t		fb_id;
+};
+
+/*
+ * Directions of cpu accesses, see rockchip_bo_cpu_prep() and
+ * rockchip_bo_busy().
+ *
+ * @ROCKCHIP_BO_CPU_READ: the cpu reads what a device wrote.
+ * @ROCKCHIP_BO_CPU_WRITE: the cpu writes what a device reads.
+ */
+enum e_rockchip_bo_cpu_op {
+	ROCKCHIP_BO_CPU_READ	= 1 << 0,
+	ROCKCHIP_BO_CPU_WRITE	= 1 << 1,
+};
+
+/*
+ * A small buffer carved out of a larger buffer object, see
+ * rockchip_bo_slab_alloc().
+ *
+ * @bo: buffer object holding it, shared with other small buffers.
+ * @offset: where it starts in @bo, a multiple of @size.
+ * @size: usable size, the requested size rounded up to its size class.
+ * @vaddr: cpu address of its first byte.
+ * @fd: dma-buf of @bo, owned by the allocator, e.g. for rga_image.bo[0]
+ *	along with @offset as rga_image.offset.
+ * @page: private to the allocator.
+ */
+struct rockchip_bo_suballoc {
+	struct rockchip_bo	*bo;
+	size_t			offset;
+	size_t			size;
+	void			*vaddr;
+	int			fd;
+	void			*page;
+};
+
+/*
+ * Suballocator counters, see rockchip_bo_slab_get_stats().
+ *
+ * @allocs, @frees: rockchip_bo_slab_alloc() and rockchip_bo_slab_free()
+ *	calls.
+ * @large: the part of @allocs too large for a size class, which got a
+ *	buffer object of their own.
+ * @slabs, @slab_bytes: buffer objects currently carved up.
+ * @used_bytes: bytes of them currently allocated.
+ */
+struct rockchip_bo_slab_stats {
+	unsigned long long allocs;
+	unsigned long long frees;
+	unsigned long long large;
+	unsigned long long slabs;
+	unsigned long long slab_bytes;
+	unsigned long long used_bytes;
+};
+
+/*
+ * Pre-allocation pool counters, see rockchip_bo_pool_get_stats().
+ *
+ * @hits: rockchip_bo_pool_get() calls served by a ready buffer object.
+ * @misses: calls that found none ready and allocated one themselves.
+ * @miss_us: time those calls spent allocating.
+ * @allocs, @alloc_failures: allocations of the pool thread.
+ * @alloc_us, @alloc_max_us: total and longest time of one of them.
+ * @ready: buffer objects currently ready.
+ */
+struct rockchip_bo_pool_stats {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long miss_us;
+	unsigned long long allocs;
+	unsigned long long alloc_failures;
+	unsigned long long alloc_us;
+	unsigned long long alloc_max_us;
+	unsigned long long ready;
 };
 
 /*
@@ -60,6 +186,14 @@ struct rockchip_bo {
  */
 struct rockchip_device *rockchip_device_create(int fd);
 void rockchip_device_destroy(struct rockchip_device *dev);
+struct rockchip_device *rockchip_device_ref(struct rockchip_device *dev);
+int rockchip_device_set_bo_cache(struct rockchip_device *dev, int enable);
+int rockchip_device_get_bo_cache_stats(struct rockchip_device *dev,
+			struct rockchip_bo_cache_stats *stats);
+int rockchip_device_set_vma_cache_size(struct rockchip_device *dev,
+			int limit);
+int rockchip_device_get_map_stats(struct rockchip_device *dev,
+			struct rockchip_bo_map_stats *stats);
 
 /*
  * buffer-object related functions:
@@ -69,9 +203,58 @@ struct rockchip_bo *rockchip_bo_create(struct rockchip_device *dev,
 int rockchip_bo_get_info(struct rockchip_device *dev, uint32_t handle,
 			size_t *size, uint32_t *flags);
 void rockchip_bo_destroy(struct rockchip_bo *bo);
+struct rockchip_bo *rockchip_bo_ref(struct rockchip_bo *bo);
+struct rockchip_bo *rockchip_bo_lookup(struct rockchip_device *dev,
+			uint32_t handle);
+int rockchip_bo_set_layout(struct rockchip_bo *bo, uint32_t format,
+			uint32_t width, uint32_t height, uint32_t pitch);
 struct rockchip_bo *rockchip_bo_from_name(struct rockchip_device *dev,
 			uint32_t name);
 int rockchip_bo_get_name(struct rockchip_bo *bo, uint32_t *name);
+struct rockchip_bo *rockchip_bo_from_dmabuf(struct rockchip_device *dev,
+			int fd);
+int rockchip_bo_to_dmabuf(struct rockchip_bo *bo, int *fd);
 uint32_t rockchip_bo_handle(struct rockchip_bo *bo);
 void *rockchip_bo_map(struct rockchip_bo *bo);
+void *rockchip_bo_map_range(struct rockchip_bo *bo, size_t offset,
+			size_t size);
+int rockchip_bo_unmap(struct rockchip_bo *bo, void *ptr);
+int rockchip_bo_fb_layout(uint32_t format, uint32_t width, uint32_t height,
+			uint32_t pitches[4], uint32_t offsets[4], size_t *size);
+struct rockchip_bo *rockchip_bo_create_fb(struct rockchip_device *dev,
+			uint32_t width, uint32_t height, uint32_t format,
+			uint32_t flags);
+int rockchip_bo_cpu_prep(struct rockchip_bo *bo, uint32_t op);
+int rockchip_bo_cpu_fini(struct rockchip_bo *bo, uint32_t op);
+int rockchip_bo_cpu_prep_range(struct rockchip_bo *bo, size_t offset,
+			size_t size, uint32_t op);
+int rockchip_bo_cpu_fini_range(struct rockchip_bo *bo, size_t offset,
+			size_t size, uint32_t op);
+int rockchip_bo_busy(struct rockchip_bo *bo, uint32_t op);
+int rockchip_bo_wait(struct rockchip_bo *bo, uint32_t op, int64_t timeout_ns);
+
+/*
+ * suballocation related functions:
+ */
+struct rockchip_bo_slab *rockchip_bo_slab_create(struct rockchip_device *dev,
+			uint32_t flags);
+void rockchip_bo_slab_destroy(struct rockchip_bo_slab *slab);
+int rockchip_bo_slab_alloc(struct rockchip_bo_slab *slab, size_t size,
+			struct rockchip_bo_suballoc *sub);
+void rockchip_bo_slab_free(struct rockchip_bo_slab *slab,
+			struct rockchip_bo_suballoc *sub);
+int rockchip_bo_slab_get_stats(struct rockchip_bo_slab *slab,
+			struct rockchip_bo_slab_stats *stats);
+
+/*
+ * pre-allocation related functions:
+ */
+struct rockchip_bo_pool *rockchip_bo_pool_create(struct rockchip_device *dev);
+void rockchip_bo_pool_destroy(struct rockchip_bo_pool *pool);
+int rockchip_bo_pool_add(struct rockchip_bo_pool *pool, size_t size,
+			uint32_t flags, unsigned int count);
+struct rockchip_bo *rockchip_bo_pool_get(struct rockchip_bo_pool *pool,
+			size_t size, uint32_t flags);
+int rockchip_bo_pool_get_stats(struct rockchip_bo_pool *pool,
+			struct rockchip_bo_pool_stats *stats);
 #endif /* ROCKCHIP_DRMIF_H_ */
@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <sys/mman.h>
 #include <linux/stddef.h>
@@ -29,6 +31,8 @@
 
 #include "rockchip_drm.h"
 #include "rockchip_rga.h"
+#include "rockchip_rga_priv.h"
+#include "rockchip_timeline.h"
 #include "rga_reg.h"
 
 enum rga_base_addr_reg {
@@ -247,8 +251,9 @@ rga_get_addr_offset(struct rga_image *img, unsigned int x, unsigned int y,
 	uv_stride = img->stride / x_div;
 	pixel_width = img->stride / img->width;
 
-	lt->y_off = y * img->stride + x * pixel_width;
-	lt->u_off = img->width * img->height + (y / y_div) * uv_stride + x / x_div;
+	lt->y_off = img->offset + y * img->stride + x * pixel_width;
+	lt->u_off = img->offset + img->width * img->height +
+		    (y / y_div) * uv_stride + x / x_div;
 	lt->v_off = lt->u_off + img->width * img->height / 4;
 
 	lb->y_off = lt->y_off + (h - 1) * img->stride;
@@ -360,18 +365,6 @@ static void rga_add_base_addr(struct rga_context *ctx, struct rga_image *img,
 	}
 }
 
-/*
- * rga_reset - reset rga hardware.
- *
- * @ctx: a pointer to rga_context structure.
- *
- */
-static void rga_reset(struct rga_context *ctx)
-{
-	ctx->cmd_nr = 0;
-	ctx->cmd_buf_nr = 0;
-}
-
 /*
  * rga_flush - submit all commands and values in user side command buffer
  *		to command queue aware of rga dma.
@@ -384,6 +377,7 @@ static void rga_reset(struct rga_context *ctx)
 static int rga_flush(struct rga_context *ctx)
 {
 	int ret;
+	uint64_t start;
 	struct drm_rockchip_rga_set_cmdlist cmdlist = {0};
 
 	if (ctx->cmd_nr == 0 && ctx->cmd_buf_nr == 0)
@@ -402,96 +396,38 @@ static int rga_flush(struct rga_context *ctx)
 	ctx->cmd_nr = 0;
 	ctx->cmd_buf_nr = 0;
 
+	start = rga_time_us();
 	ret = drmIoctl(ctx->fd, DRM_IOCTL_ROCKCHIP_RGA_SET_CMDLIST, &cmdlist);
-	if (ret < 0) {
-		fprintf(stderr, "failed to set cmdlist.\n");
-		return ret;
-	}
-
-	ctx->cmdlist_nr++;
-
-	return ret;
-}
-
-/**
- * rga_init - create a new rga context and get hardware version.
- *
- * fd: a file descriptor to an opened drm device.
- */
-struct rga_context *rga_init(int fd)
-{
-	struct drm_rockchip_rga_get_ver ver;
-	struct rga_context *ctx;
-	int ret;
-
-	ctx = calloc(1, sizeof(*ctx));
-	if (!ctx) {
-		fprintf(stderr, "failed to allocate context.\n");
-		return NULL;
-	}
-
-	ctx->fd = fd;
-
-	ret = drmIoctl(fd, DRM_IOCTL_ROCKCHIP_RGA_GET_VER, &ver);
-	if (ret < 0) {
-		fprintf(stderr, "failed to get version.\n");
-		free(ctx);
-		return NULL;
-	}
-
-	ctx->major = ver.major;
-	ctx->minor = ver.minor;
-
-	return ctx;
-}
+	start = rga_time_us() - start;
 
-void rga_fini(struct rga_context *ctx)
-{
-	if (ctx)
-		free(ctx);
-}
-
-/**
- * rga_exec - start the dma to process all commands summited by rga_flush().
- *
- * @ctx: a pointer to rga_context structure.
- */
-int rga_exec(struct rga_context *ctx)
-{
-	struct drm_rockchip_rga_exec exec;
-	int ret;
+	rga_stats_hist(ctx->stats.submit_us, start);
+	rga_trace(ctx, RGA_TRACE_SUBMIT, 1, start, ret);
+	rga_record_cmdlist(ctx->record, &cmdlist, ret);
 
-	if (ctx->cmdlist_nr == 0)
-		return -EINVAL;
-
-	exec.async = 0;
-
-	ret = drmIoctl(ctx->fd, DRM_IOCTL_ROCKCHIP_RGA_EXEC, &exec);
 	if (ret < 0) {
-		fprintf(stderr, "failed to execute.\n");
+		fprintf(stderr, "failed to set cmdlist.\n");
+		ctx->stats.submit_failures++;
 		return ret;
 	}
 
-	ctx->cmdlist_nr = 0;
+	ctx->stats.cmdlists++;
+	ctx->stats.regs += cmdlist.cmd_nr + cmdlist.cmd_buf_nr;
+	ctx->cmdlist_nr++;
 
 	return ret;
 }
 
-/**
- * rga_solid_fill - fill given buffer with given color data.
+/*
+ * rga_hw_solid_fill - encode a queued fill into an RGA cmdlist.
  *
  * @ctx: a pointer to rga_context structure.
- * @img: a pointer to rga_image structure including image and buffer
- *	information.
- * @x: x start position to buffer filled with given color data.
- * @y: y start position to buffer filled with given color data.
- * @w: width value to buffer filled with given color data.
- * @h: height value to buffer filled with given color data.
+ * @op: a fill operation with an already clipped window.
  */
-int rga_solid_fill(struct rga_context *ctx, struct rga_image *img,
-		   unsigned int x, unsigned int y, unsigned int w,
-		   unsigned int h)
+static int rga_hw_solid_fill(struct rga_context *ctx, struct rga_op *op)
 {
+	struct rga_image *img = &op->dst;
+	unsigned int x = op->dst_x, y = op->dst_y;
+	unsigned int w = op->dst_w, h = op->dst_h;
 	union rga_mode_ctrl mode;
 	union rga_dst_info dst_info;
 	union rga_dst_vir_info dst_vir_info;
@@ -499,11 +435,6 @@ int rga_solid_fill(struct rga_context *ctx, struct rga_image *img,
 
 	struct rga_corners_addr_offset offsets;
 
-	if (x + w > img->width)
-		w = img->width - x;
-	if (y + h > img->height)
-		h = img->height - y;
-
 	/* Init the operation registers to zero */
 	mode.val = 0;
 	dst_info.val = 0;
@@ -573,19 +504,27 @@ int rga_solid_fill(struct rga_context *ctx, struct rga_image *img,
 
 
 	/* Start to flush RGA device */
-	rga_flush(ctx);
-
-	return 0;
+	return rga_flush(ctx);
 }
 
-int rga_multiple_transform(struct rga_context *ctx, struct rga_image *src,
-			   struct rga_image *dst, unsigned int src_x,
-			   unsigned int src_y, unsigned int src_w,
-			   unsigned int src_h, unsigned int dst_x,
-			   unsigned int dst_y, unsigned int dst_w,
-			   unsigned int dst_h, unsigned int degree,
-			   unsigned int x_mirr, unsigned int y_mirr)
+
+/*
+ * rga_hw_multiple_transform - encode a queued transform into an RGA cmdlist.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @op: a transform operation with already clipped windows.
+ */
+static int rga_hw_multiple_transform(struct rga_context *ctx,
+				     struct rga_op *op)
 {
+	struct rga_image *src = &op->src, *dst = &op->dst;
+	unsigned int src_x = op->src_x, src_y = op->src_y;
+	unsigned int src_w = op->src_w, src_h = op->src_h;
+	unsigned int dst_x = op->dst_x, dst_y = op->dst_y;
+	unsigned int dst_w = op->dst_w, dst_h = op->dst_h;
+	unsigned int degree = op->degree;
+	unsigned int x_mirr = op->x_mirr, y_mirr = op->y_mirr;
+
 	union rga_mode_ctrl mode;
 	union rga_src_info src_info;
 	union rga_dst_info dst_info;
@@ -602,34 +541,6 @@ int rga_multiple_transform(struct rga_context *ctx, struct rga_image *src,
 
 	unsigned int scale_dst_w, scale_dst_h;
 
-	if (degree != 0 && degree != 90 && degree != 180 && degree != 270) {
-		fprintf(stderr, "invalid rotate degree.\n");
-		rga_reset(ctx);
-		return -EINVAL;
-	}
-
-	if (src_w < 32 || src_h < 34 || dst_w < 32 || dst_h < 34) {
-		fprintf(stderr, "invalid src/dst width or height.\n");
-		rga_reset(ctx);
-		return -EINVAL;
-	}
-
-	if (src_x + src_w > src->width)
-		src_w = src->width - src_x;
-	if (src_y + src_h > src->height)
-		src_h = src->height - src_y;
-
-	if (dst_x + dst_w > dst->width)
-		dst_w = dst->width - dst_x;
-	if (dst_y + dst_h > dst->height)
-		dst_h = dst->height - dst_y;
-
-	if (src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0) {
-		fprintf(stderr, "invalid width or height.\n");
-		rga_reset(ctx);
-		return -EINVAL;
-	}
-
 	/* Init RGA registers values to zero */
 	mode.val = 0;
 	x_factor.val = 0;
@@ -787,7 +698,1138 @@ int rga_multiple_transform(struct rga_context *ctx, struct rga_image *src,
 
 
 	/* Start to flush RGA device */
-	rga_flush(ctx);
+	return rga_flush(ctx);
+}
+
+
+/*
+ * rga_queue_op - reserve the next slot of the operation queue.
+ *
+ * @ctx: a pointer to rga_context structure.
+ */
+static struct rga_op *rga_queue_op(struct rga_context *ctx)
+{
+	struct rga_op *op;
+
+	/*
+	 * Only counted here, the cmdlists may be built on the thread of
+	 * rga_exec_async() and their overflows fail the operation instead.
+	 */
+	if (ctx->op_nr >= RGA_MAX_CMD_LIST_NR) {
+		fprintf(stderr, "Overflow cmdlist.\n");
+		ctx->stats.overflows++;
+		return NULL;
+	}
+
+	op = &ctx->ops[ctx->op_nr++];
+	memset(op, 0, sizeof(*op));
+
+	return op;
+}
+
+/*
+ * rga_hw_supported - check whether the RGA itself can run an operation.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @op: a queued operation.
+ */
+static int rga_hw_supported(struct rga_context *ctx, const struct rga_op *op)
+{
+	if (!ctx->has_hw)
+		return 0;
+
+	if (op->dst.buf_type == RGA_IMGBUF_USERPTR ||
+	    rga_get_color_format(op->dst.color_mode) < 0)
+		return 0;
+
+	if (op->type == RGA_OP_FILL)
+		return 1;
+
+	/* Read from a converted copy, see rga_preconv_op() */
+	if (!rga_preconv_needed(op) &&
+	    (op->src.buf_type == RGA_IMGBUF_USERPTR ||
+	     rga_get_color_format(op->src.color_mode) < 0))
+		return 0;
+
+	return op->src_w >= RGA_HW_MIN_WIDTH && op->src_h >= RGA_HW_MIN_HEIGHT &&
+	       op->dst_w >= RGA_HW_MIN_WIDTH && op->dst_h >= RGA_HW_MIN_HEIGHT;
+}
+
+/*
+ * rga_select_backend - decide where a queued operation runs.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @op: a queued operation.
+ *
+ * Returns RGA_BACKEND_HW or RGA_BACKEND_CPU, or a negative errno when
+ * neither backend can run the operation.
+ */
+static int rga_select_backend(struct rga_context *ctx, const struct rga_op *op)
+{
+	int hw = rga_hw_supported(ctx, op);
+	int cpu = rga_cpu_supported(op);
+
+	switch (ctx->backend) {
+	case RGA_BACKEND_HW:
+		if (hw)
+			return RGA_BACKEND_HW;
+		break;
+	case RGA_BACKEND_CPU:
+		if (cpu)
+			return RGA_BACKEND_CPU;
+		break;
+	case RGA_BACKEND_AUTO:
+	default:
+		if (hw && cpu) {
+			if (ctx->hybrid && rga_hybrid_candidate(ctx->hybrid, op))
+				return RGA_BACKEND_HW;
+			return rga_cost_choose(ctx->cost, op);
+		}
+		if (hw)
+			return RGA_BACKEND_HW;
+		if (cpu) {
+			if (ctx->has_hw)
+				rga_cost_stats(ctx->cost)->hw_unsupported++;
+			return RGA_BACKEND_CPU;
+		}
+		break;
+	}
+
+	fprintf(stderr, "no backend for rga operation.\n");
+	return -EINVAL;
+}
+
+/*
+ * rga_hw_queue - encode an operation and hand its cmdlist to the kernel.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @op: a queued operation.
+ */
+static int rga_hw_queue(struct rga_context *ctx, struct rga_op *op)
+{
+	rga_sched_hold(ctx);
+
+	if (op->type == RGA_OP_FILL)
+		return rga_hw_solid_fill(ctx, op);
+
+	return rga_hw_multiple_transform(ctx, op);
+}
+
+/*
+ * rga_hw_exec - run the cmdlists queued so far and give the RGA up.
+ *
+ * @ctx: a pointer to rga_context structure.
+ */
+static int rga_hw_exec(struct rga_context *ctx)
+{
+	struct drm_rockchip_rga_exec exec = {
+		.async = 0,
+	};
+	int ret = 0;
+
+	if (ctx->cmdlist_nr)
+		ret = drmIoctl(ctx->fd, DRM_IOCTL_ROCKCHIP_RGA_EXEC, &exec);
+	ctx->cmdlist_nr = 0;
+
+	rga_sched_drop(ctx);
+
+	return ret;
+}
+
+/*
+ * rga_cpu_exec - run an operation on the CPU engine and account its time.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @op: a queued operation.
+ */
+static int rga_cpu_exec(struct rga_context *ctx, const struct rga_op *op)
+{
+	uint64_t start = rga_time_us();
+	int ret;
+
+	ret = rga_cpu_exec_op(ctx->import, op);
+	start = rga_time_us() - start;
+
+	rga_stats_hist(ctx->stats.cpu_us, start);
+	rga_trace(ctx, RGA_TRACE_CPU_OP, 1, start, ret);
+
+	if (ret) {
+		ctx->stats.cpu_failures++;
+		return ret;
+	}
+
+	rga_cost_update(ctx->cost, op, RGA_BACKEND_CPU, start);
+	rga_stats_op(ctx, op);
+
+	return 0;
+}
+
+/*
+ * rga_hw_account - share the time of one RGA batch among its operations
+ *	in proportion to their pixel counts.
+ */
+static void rga_hw_account(struct rga_context *ctx, unsigned int first,
+			   unsigned int end, uint64_t us)
+{
+	unsigned long long total = 0;
+	unsigned int i;
+
+	for (i = first; i < end; i++) {
+		total += rga_cost_pixels(&ctx->exec_ops[i]);
+		rga_stats_op(ctx, &ctx->exec_ops[i]);
+	}
+
+	if (!total)
+		return;
+
+	for (i = first; i < end; i++)
+		rga_cost_update(ctx->cost, &ctx->exec_ops[i], RGA_BACKEND_HW,
+				us * rga_cost_pixels(&ctx->exec_ops[i]) / total);
+}
+
+/*
+ * rga_hw_submit - execute the cmdlists queued for ops[first, end).
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @first: index of the first operation of the batch.
+ * @end: index after the last operation of the batch.
+ *
+ * If the RGA refuses the batch, it is run again on the CPU engine.
+ */
+static int rga_hw_submit(struct rga_context *ctx, unsigned int first,
+			 unsigned int end)
+{
+	uint64_t start;
+	unsigned int i;
+	int ret;
+
+	if (ctx->cmdlist_nr == 0) {
+		rga_sched_drop(ctx);
+		return 0;
+	}
+
+	start = rga_time_us();
+	ret = rga_hw_exec(ctx);
+	start = rga_time_us() - start;
+
+	rga_stats_hist(ctx->stats.hw_us, start);
+	rga_trace(ctx, RGA_TRACE_HW_EXEC, end - first, start, ret);
+	rga_record_exec(ctx->record, 0, end - first, start, ret);
+
+	if (ret == 0) {
+		rga_hw_account(ctx, first, end, start);
+		return 0;
+	}
+
+	ctx->stats.exec_failures++;
+
+	for (i = first; i < end; i++) {
+		if (!rga_cpu_supported(&ctx->exec_ops[i])) {
+			fprintf(stderr, "failed to execute.\n");
+			return ret;
+		}
+	}
+
+	fprintf(stderr, "failed to execute, falling back to cpu.\n");
+	rga_cost_stats(ctx->cost)->hw_fallback += end - first;
+	rga_trace(ctx, RGA_TRACE_FALLBACK, end - first, 0, ret);
+
+	for (i = first; i < end; i++) {
+		ret = rga_cpu_exec(ctx, &ctx->exec_ops[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * rga_hybrid_exec - run one transform split between the RGA and the CPU.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @op: a queued operation accepted by rga_hybrid_candidate().
+ *
+ * The CPU bands are posted first so the workers run while this thread
+ * waits for the RGA band; rga_hybrid_wait() is the single join point.
+ */
+static int rga_hybrid_exec(struct rga_context *ctx, struct rga_op *op)
+{
+	struct rga_op hw_op;
+	unsigned int hw_rows;
+	uint64_t start, hw_us, cpu_us;
+	int ret, cpu_ret;
+
+	hw_rows = rga_hybrid_hw_rows(ctx->hybrid, op);
+	rga_op_band(op, 0, hw_rows, &hw_op);
+	rga_hybrid_post(ctx->hybrid, op, hw_rows);
+
+	start = rga_time_us();
+
+	ret = rga_hw_queue(ctx, &hw_op);
+	if (ret == 0) {
+		ret = rga_hw_exec(ctx);
+
+		hw_us = rga_time_us() - start;
+		rga_stats_hist(ctx->stats.hw_us, hw_us);
+		rga_trace(ctx, RGA_TRACE_HW_EXEC, 1, hw_us, ret);
+		rga_record_exec(ctx->record, 0, 1, hw_us, ret);
+		if (ret)
+			ctx->stats.exec_failures++;
+	}
+
+	if (ret) {
+		rga_sched_drop(ctx);
+		fprintf(stderr, "failed to execute, falling back to cpu.\n");
+		rga_cost_stats(ctx->cost)->hw_fallback++;
+		rga_trace(ctx, RGA_TRACE_FALLBACK, 1, 0, ret);
+		ret = rga_cpu_exec_op(ctx->import, &hw_op);
+		hw_us = 0;
+	}
+
+	cpu_ret = rga_hybrid_wait(ctx->hybrid, &cpu_us);
+	if (ret)
+		return ret;
+	if (cpu_ret)
+		return cpu_ret;
+
+	rga_hybrid_update(ctx->hybrid, hw_rows, hw_us, op->dst_h - hw_rows,
+			  cpu_us);
+	rga_cost_stats(ctx->cost)->hybrid_ops++;
+	rga_stats_op(ctx, op);
+
+	return 0;
+}
+
+/*
+ * rga_sliced_exec - run a background operation on the RGA one slice of
+ *	destination rows at a time, giving the RGA up between slices.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @op: a queued operation accepted by rga_sched_slice_rows().
+ * @rows: rows per slice.
+ */
+static int rga_sliced_exec(struct rga_context *ctx, struct rga_op *op,
+			   unsigned int rows)
+{
+	unsigned int first, last;
+	uint64_t start, total = 0;
+	struct rga_op slice;
+	int ret;
+
+	for (first = 0; first < op->dst_h; first = last) {
+		last = first + rows;
+		if (op->dst_h - last < rows)
+			last = op->dst_h;
+
+		rga_op_band(op, first, last, &slice);
+		rga_bw_throttle(ctx);
+
+		start = rga_time_us();
+		ret = rga_hw_queue(ctx, &slice);
+		if (ret == 0)
+			ret = rga_hw_exec(ctx);
+		else
+			rga_sched_drop(ctx);
+		start = rga_time_us() - start;
+
+		rga_stats_hist(ctx->stats.hw_us, start);
+		rga_trace(ctx, RGA_TRACE_HW_EXEC, 1, start, ret);
+		rga_record_exec(ctx->record, 0, 1, start, ret);
+		ctx->stats.sched_slices++;
+
+		if (ret) {
+			ctx->stats.exec_failures++;
+			fprintf(stderr, "failed to execute, falling back to cpu.\n");
+			rga_cost_stats(ctx->cost)->hw_fallback++;
+			rga_trace(ctx, RGA_TRACE_FALLBACK, 1, 0, ret);
+			ret = rga_cpu_exec_op(ctx->import, &slice);
+			if (ret) {
+				ctx->stats.cpu_failures++;
+				return ret;
+			}
+			continue;
+		}
+
+		total += start;
+	}
+
+	rga_cost_update(ctx->cost, op, RGA_BACKEND_HW, total);
+	rga_stats_op(ctx, op);
+
+	return 0;
+}
+
+/**
+ * rga_init - create a new rga context and get hardware version.
+ *
+ * fd: a file descriptor to an opened drm device.
+ *
+ * If the device has no RGA the context is still created, and every
+ * operation is carried out by the CPU engine.
+ */
+struct rga_context *rga_init(int fd)
+{
+	struct drm_rockchip_rga_get_ver ver;
+	struct rga_context *ctx;
+	int ret;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		fprintf(stderr, "failed to allocate context.\n");
+		return NULL;
+	}
+
+	ctx->ops = calloc(RGA_MAX_CMD_LIST_NR, sizeof(*ctx->ops));
+	ctx->exec_ops = calloc(RGA_MAX_CMD_LIST_NR, sizeof(*ctx->exec_ops));
+	ctx->cost = rga_cost_create();
+	ctx->import = rga_import_create();
+	ctx->timeline = rockchip_timeline_create();
+	if (!ctx->ops || !ctx->exec_ops || !ctx->cost || !ctx->import ||
+	    !ctx->timeline) {
+		fprintf(stderr, "failed to allocate context.\n");
+		rockchip_timeline_put(ctx->timeline);
+		rga_import_destroy(ctx->import);
+		rga_cost_destroy(ctx->cost);
+		free(ctx->exec_ops);
+		free(ctx->ops);
+		free(ctx);
+		return NULL;
+	}
+
+	ctx->fd = fd;
+	ctx->backend = RGA_BACKEND_AUTO;
+	ctx->priority = RGA_PRIORITY_NORMAL;
+
+	ret = drmIoctl(fd, DRM_IOCTL_ROCKCHIP_RGA_GET_VER, &ver);
+	if (ret < 0) {
+		fprintf(stderr, "failed to get version, using cpu engine.\n");
+	} else {
+		ctx->major = ver.major;
+		ctx->minor = ver.minor;
+		ctx->has_hw = 1;
+	}
+
+	ctx->record = rga_record_open(ctx);
+
+	return ctx;
+}
+
+void rga_fini(struct rga_context *ctx)
+{
+	if (ctx) {
+		rga_async_destroy(ctx->async);
+		rga_record_close(ctx->record);
+		rga_hybrid_destroy(ctx->hybrid);
+		rga_preconv_destroy(ctx);
+		rga_import_destroy(ctx->import);
+		rga_cost_destroy(ctx->cost);
+		rockchip_timeline_put(ctx->timeline);
+		free(ctx->exec_ops);
+		free(ctx->ops);
+		free(ctx);
+	}
+}
+
+/**
+ * rga_set_backend - restrict where operations of a context run.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @backend: RGA_BACKEND_AUTO picks the RGA whenever it can run an
+ *	operation and the CPU engine otherwise, RGA_BACKEND_HW and
+ *	RGA_BACKEND_CPU force one of them.
+ */
+int rga_set_backend(struct rga_context *ctx, enum e_rga_backend backend)
+{
+	if (backend == RGA_BACKEND_HW && !ctx->has_hw)
+		return -ENODEV;
+
+	ctx->backend = backend;
+
+	return 0;
+}
+
+/**
+ * rga_set_hybrid - split large transforms between the RGA and the CPU.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @threads: number of CPU worker threads, 0 turns hybrid execution off.
+ *
+ * With RGA_BACKEND_AUTO, a transform of at least 1280x720 destination
+ * pixels that is not scaled is cut into horizontal bands. The RGA
+ * converts the top band while the workers convert the rest, and the split
+ * is tuned from the measured throughput of both sides after every such
+ * operation.
+ */
+int rga_set_hybrid(struct rga_context *ctx, unsigned int threads)
+{
+	if (!ctx->has_hw)
+		return -ENODEV;
+
+	rga_hybrid_destroy(ctx->hybrid);
+	ctx->hybrid = NULL;
+
+	if (threads == 0)
+		return 0;
+
+	ctx->hybrid = rga_hybrid_create(ctx->import, threads);
+	if (!ctx->hybrid)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Calibration buffers are GEM objects for the RGA and plain memory for
+ * the CPU engine, sized for the largest calibration operation.
+ */
+#define RGA_CALIB_SMALL		64
+#define RGA_CALIB_LARGE		1024
+#define RGA_CALIB_LOOPS		3
+
+struct rga_calib_buf {
+	void				*ptr;
+	uint32_t			handle;
+	int				fd;
+};
+
+static int rga_calib_alloc(struct rga_context *ctx, int hw,
+			   struct rga_calib_buf *buf, struct rga_image *img)
+{
+	size_t size = RGA_CALIB_LARGE * RGA_CALIB_LARGE * 4;
+
+	memset(buf, 0, sizeof(*buf));
+	buf->fd = -1;
+
+	memset(img, 0, sizeof(*img));
+	img->color_mode = DRM_FORMAT_ARGB8888;
+	img->width = RGA_CALIB_LARGE;
+	img->height = RGA_CALIB_LARGE;
+	img->stride = RGA_CALIB_LARGE * 4;
+
+	if (hw) {
+		struct drm_rockchip_gem_create req = {
+			.size = size,
+		};
+
+		if (drmIoctl(ctx->fd, DRM_IOCTL_ROCKCHIP_GEM_CREATE, &req))
+			return -errno;
+		buf->handle = req.handle;
+
+		if (drmPrimeHandleToFD(ctx->fd, buf->handle, DRM_CLOEXEC,
+				       &buf->fd))
+			return -errno;
+
+		img->buf_type = RGA_IMGBUF_GEM;
+		img->bo[0] = buf->fd;
+	} else {
+		buf->ptr = calloc(1, size);
+		if (!buf->ptr)
+			return -ENOMEM;
+
+		img->buf_type = RGA_IMGBUF_USERPTR;
+		img->user_ptr[0].userptr = (unsigned long)buf->ptr;
+		img->user_ptr[0].size = size;
+	}
+
+	return 0;
+}
+
+static void rga_calib_free(struct rga_context *ctx, struct rga_calib_buf *buf)
+{
+	struct drm_gem_close req = {
+		.handle = buf->handle,
+	};
+
+	if (buf->fd >= 0) {
+		rga_import_release(ctx->import, buf->fd);
+		close(buf->fd);
+	}
+	if (buf->handle)
+		drmIoctl(ctx->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	free(buf->ptr);
+}
+
+/*
+ * rga_calib_run - best of a few runs of one operation on one backend, fed
+ *	into the cost model like any other measurement.
+ */
+static int rga_calib_run(struct rga_context *ctx, struct rga_op *op, int hw,
+			 uint64_t *us)
+{
+	uint64_t start, best = UINT64_MAX;
+	int i, ret;
+
+	for (i = 0; i < RGA_CALIB_LOOPS; i++) {
+		start = rga_time_us();
+
+		if (hw) {
+			ret = rga_hw_queue(ctx, op);
+			if (ret == 0)
+				ret = rga_hw_exec(ctx);
+			else
+				rga_sched_drop(ctx);
+		} else {
+			ret = rga_cpu_exec_op(ctx->import, op);
+		}
+		if (ret)
+			return ret;
+
+		start = rga_time_us() - start;
+		if (start < best)
+			best = start;
+	}
+
+	rga_cost_update(ctx->cost, op, hw ? RGA_BACKEND_HW : RGA_BACKEND_CPU,
+			best);
+	*us = best;
+
+	return 0;
+}
+
+static int rga_calib_backend(struct rga_context *ctx, int hw)
+{
+	static const unsigned int sizes[] = { RGA_CALIB_SMALL, RGA_CALIB_LARGE };
+	enum e_rga_backend backend = hw ? RGA_BACKEND_HW : RGA_BACKEND_CPU;
+	struct rga_calib_buf src_buf, dst_buf;
+	uint64_t fill_us[2], copy_us[2];
+	struct rga_op op;
+	unsigned int i;
+	int ret;
+
+	ret = rga_calib_alloc(ctx, hw, &src_buf, &op.src);
+	if (ret)
+		goto free_src;
+
+	ret = rga_calib_alloc(ctx, hw, &dst_buf, &op.dst);
+	if (ret)
+		goto free_dst;
+
+	for (i = 0; i < 2; i++) {
+		op.type = RGA_OP_FILL;
+		op.src_x = op.src_y = op.dst_x = op.dst_y = 0;
+		op.src_w = op.src_h = op.dst_w = op.dst_h = sizes[i];
+		op.degree = op.x_mirr = op.y_mirr = 0;
+
+		ret = rga_calib_run(ctx, &op, hw, &fill_us[i]);
+		if (ret)
+			break;
+
+		op.type = RGA_OP_TRANSFORM;
+		ret = rga_calib_run(ctx, &op, hw, &copy_us[i]);
+		if (ret)
+			break;
+	}
+
+	if (ret == 0) {
+		rga_cost_seed(ctx->cost, backend, RGA_OP_FILL,
+			      sizes[0] * sizes[0], fill_us[0],
+			      sizes[1] * sizes[1], fill_us[1]);
+		rga_cost_seed(ctx->cost, backend, RGA_OP_TRANSFORM,
+			      sizes[0] * sizes[0], copy_us[0],
+			      sizes[1] * sizes[1], copy_us[1]);
+	}
+
+free_dst:
+	rga_calib_free(ctx, &dst_buf);
+free_src:
+	rga_calib_free(ctx, &src_buf);
+
+	return ret;
+}
+
+/**
+ * rga_calibrate - measure both backends and seed the cost model.
+ *
+ * @ctx: a pointer to rga_context structure.
+ *
+ * Runs small and large ARGB8888 fills and copies on the CPU engine and,
+ * when present, on the RGA, and seeds fills and transforms from their own
+ * timings. Without calibration the model starts from built-in estimates
+ * and learns from rga_exec() alone. The measurements are not counted in
+ * the dispatch statistics.
+ */
+int rga_calibrate(struct rga_context *ctx)
+{
+	struct rga_dispatch_stats saved = *rga_cost_stats(ctx->cost);
+	struct rga_stats saved_stats = ctx->stats;
+	struct rga_record *record = ctx->record;
+	int ret;
+
+	ctx->record = NULL;
+
+	ret = rga_calib_backend(ctx, 0);
+	if (ret == 0 && ctx->has_hw)
+		ret = rga_calib_backend(ctx, 1);
+
+	*rga_cost_stats(ctx->cost) = saved;
+	ctx->stats = saved_stats;
+	ctx->record = record;
+
+	if (ret)
+		fprintf(stderr, "failed to calibrate.\n");
+
+	return ret;
+}
+
+/**
+ * rga_get_dispatch_stats - report where rga_exec() ran operations.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @stats: filled with the counters since rga_init().
+ */
+int rga_get_dispatch_stats(struct rga_context *ctx,
+			   struct rga_dispatch_stats *stats)
+{
+	*stats = *rga_cost_stats(ctx->cost);
+
+	return 0;
+}
+
+drm_private int rga_buf_alloc(struct rga_context *ctx, size_t size,
+			      struct rga_buf **bufp)
+{
+	struct rga_buf *buf;
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return -ENOMEM;
+
+	buf->size = size;
+	buf->fd = -1;
+
+	if (ctx->has_hw) {
+		struct drm_rockchip_gem_create req = {
+			.size = size,
+		};
+
+		if (drmIoctl(ctx->fd, DRM_IOCTL_ROCKCHIP_GEM_CREATE, &req))
+			goto err;
+		buf->handle = req.handle;
+
+		if (drmPrimeHandleToFD(ctx->fd, buf->handle, DRM_CLOEXEC,
+				       &buf->fd))
+			goto err;
+	} else {
+		buf->ptr = calloc(1, size);
+		if (!buf->ptr)
+			goto err;
+	}
+
+	*bufp = buf;
+
+	return 0;
+
+err:
+	fprintf(stderr, "failed to allocate rga buffer.\n");
+	if (buf->handle) {
+		struct drm_gem_close req = {
+			.handle = buf->handle,
+		};
+
+		drmIoctl(ctx->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	}
+	free(buf);
+
+	return -ENOMEM;
+}
+
+drm_private void rga_buf_free(struct rga_context *ctx, struct rga_buf *buf)
+{
+	struct drm_gem_close req = {
+		.handle = buf->handle,
+	};
+
+	if (buf->fd >= 0) {
+		rga_import_release(ctx->import, buf->fd);
+		close(buf->fd);
+	}
+	if (buf->handle)
+		drmIoctl(ctx->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	free(buf->ptr);
+	free(buf);
+}
+
+/*
+ * rga_buf_bind - point the buffer fields of @img at @buf.
+ */
+drm_private void rga_buf_bind(struct rga_buf *buf, struct rga_image *img)
+{
+	if (buf->fd >= 0) {
+		img->buf_type = RGA_IMGBUF_GEM;
+		img->bo[0] = buf->fd;
+	} else {
+		img->buf_type = RGA_IMGBUF_USERPTR;
+		img->user_ptr[0].userptr = (unsigned long)buf->ptr;
+		img->user_ptr[0].size = buf->size;
+	}
+	img->offset = 0;
+}
+
+/**
+ * rga_release_image - drop what the context cached about an image buffer.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @img: an image whose buffer the application is about to free.
+ *
+ * The context keeps dma-bufs it has used mapped, and thereby allocated,
+ * until they become the least recently used ones. Call this before
+ * closing the last fd of a buffer to free it right away.
+ */
+int rga_release_image(struct rga_context *ctx, struct rga_image *img)
+{
+	if (img->buf_type == RGA_IMGBUF_GEM)
+		rga_import_release(ctx->import, img->bo[0]);
+
+	return 0;
+}
+
+/*
+ * rga_exec_ops - run the first @op_nr operations of ctx->exec_ops.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @op_nr: operations handed over by rga_submit().
+ *
+ * Consecutive RGA operations are submitted as one batch, operations
+ * assigned to the CPU engine run in order between those batches.
+ */
+drm_private int rga_exec_ops(struct rga_context *ctx, unsigned int op_nr)
+{
+	unsigned int i, rows, batch = 0, preconv = 0;
+	uint64_t start;
+	int ret = 0;
+
+	ctx->stats.execs++;
+	rga_trace(ctx, RGA_TRACE_EXEC_BEGIN, op_nr, 0, 0);
+	rga_record_ops(ctx->record, ctx->exec_ops, op_nr);
+	start = rga_time_us();
+
+	for (i = 0; i < op_nr; i++) {
+		struct rga_op *op = &ctx->exec_ops[i];
+		int backend = rga_select_backend(ctx, op);
+
+		/* Between RGA submissions, hold background jobs to the budget */
+		if (!ctx->sched_held)
+			rga_bw_throttle(ctx);
+
+		if (backend < 0) {
+			ret = backend;
+			break;
+		}
+
+		if (backend == RGA_BACKEND_HW && rga_preconv_needed(op)) {
+			/* Every staging buffer may still be read, run them */
+			if (preconv == RGA_PRECONV_SLOTS) {
+				ret = rga_hw_submit(ctx, batch, i);
+				if (ret)
+					break;
+				batch = i;
+				preconv = 0;
+			}
+
+			ret = rga_preconv_op(ctx, op, preconv++);
+			if (ret)
+				break;
+		}
+
+		if (backend == RGA_BACKEND_HW && ctx->hybrid &&
+		    ctx->backend == RGA_BACKEND_AUTO &&
+		    rga_cpu_supported(op) &&
+		    rga_hybrid_candidate(ctx->hybrid, op)) {
+			ret = rga_hw_submit(ctx, batch, i);
+			if (ret)
+				break;
+
+			ret = rga_hybrid_exec(ctx, op);
+			if (ret)
+				break;
+
+			batch = i + 1;
+			continue;
+		}
+
+		if (backend == RGA_BACKEND_HW &&
+		    ctx->priority == RGA_PRIORITY_BACKGROUND &&
+		    (rows = rga_sched_slice_rows(op))) {
+			ret = rga_hw_submit(ctx, batch, i);
+			if (ret)
+				break;
+
+			ret = rga_sliced_exec(ctx, op, rows);
+			if (ret)
+				break;
+
+			batch = i + 1;
+			continue;
+		}
+
+		if (backend == RGA_BACKEND_HW) {
+			if (rga_hw_queue(ctx, op) == 0) {
+				if (ctx->priority != RGA_PRIORITY_BACKGROUND ||
+				    (i + 1 - batch < RGA_SCHED_BG_OPS &&
+				     !rga_sched_contended(ctx)))
+					continue;
+
+				/* Keep background submissions short */
+				ret = rga_hw_submit(ctx, batch, i + 1);
+				if (ret)
+					break;
+
+				batch = i + 1;
+				continue;
+			}
+
+			/* The kernel refused the cmdlist, the RGA is busy */
+			if (!rga_cpu_supported(op)) {
+				ret = -EBUSY;
+				break;
+			}
+			rga_cost_stats(ctx->cost)->hw_fallback++;
+			rga_trace(ctx, RGA_TRACE_FALLBACK, 1, 0, -EBUSY);
+		}
+
+		ret = rga_hw_submit(ctx, batch, i);
+		if (ret)
+			break;
+
+		ret = rga_cpu_exec(ctx, op);
+		if (ret)
+			break;
+
+		batch = i + 1;
+	}
+
+	if (ret)
+		rga_hw_submit(ctx, batch, batch);
+	else
+		ret = rga_hw_submit(ctx, batch, i);
+
+	start = rga_time_us() - start;
+	rga_stats_hist(ctx->stats.exec_us, start);
+	if (ctx->deadline_us && start > ctx->deadline_us)
+		ctx->stats.deadline_misses++;
+	rga_trace(ctx, RGA_TRACE_EXEC_END, op_nr, start, ret);
+	rga_record_exec(ctx->record, 1, op_nr, start, ret);
+
+	return ret;
+}
+
+/*
+ * rga_submit - hand the queued operations over to ctx->exec_ops as the
+ *	next submission of the context, and note the dma-bufs they read
+ *	and write as busy until it is done.
+ *
+ * @ctx: a pointer to rga_context structure, with nothing in flight.
+ * @op_nr: filled with the operations handed over.
+ */
+static uint64_t rga_submit(struct rga_context *ctx, unsigned int *op_nr)
+{
+	struct rga_op *ops = ctx->exec_ops;
+	uint64_t seq = ++ctx->submit_seq;
+	unsigned int i;
+
+	ctx->exec_ops = ctx->ops;
+	ctx->ops = ops;
+	*op_nr = ctx->op_nr;
+	ctx->op_nr = 0;
+
+	for (i = 0; i < *op_nr; i++) {
+		struct rga_op *op = &ctx->exec_ops[i];
+
+		if (op->src.buf_type == RGA_IMGBUF_GEM)
+			rockchip_bo_mark_dmabuf(op->src.bo[0], ctx->timeline,
+						seq, 0);
+		if (op->dst.buf_type == RGA_IMGBUF_GEM)
+			rockchip_bo_mark_dmabuf(op->dst.bo[0], ctx->timeline,
+						seq, 1);
+	}
+
+	return seq;
+}
+
+/**
+ * rga_exec - run all operations queued since the last rga_exec() or
+ *	rga_exec_async().
+ *
+ * @ctx: a pointer to rga_context structure.
+ *
+ * Returns once they are done, after waiting for an asynchronous
+ * submission still in flight.
+ */
+int rga_exec(struct rga_context *ctx)
+{
+	unsigned int op_nr;
+	uint64_t seq;
+	int ret;
+
+	if (ctx->op_nr == 0)
+		return -EINVAL;
+
+	rga_async_idle(ctx, 0);
+
+	seq = rga_submit(ctx, &op_nr);
+	ret = rga_exec_ops(ctx, op_nr);
+	rockchip_timeline_signal(ctx->timeline, seq);
+
+	return ret;
+}
+
+/**
+ * rga_exec_async - start all operations queued since the last rga_exec()
+ *	or rga_exec_async() and return without waiting for them.
+ *
+ * @ctx: a pointer to rga_context structure.
+ *
+ * They run on a thread of the context while the next ones are queued,
+ * after a submission still in flight. Buffer objects they read or write
+ * stay busy until they are done, see rockchip_bo_busy() and
+ * rockchip_bo_wait(), and rga_wait() waits for all of them and returns
+ * their errors. Until then the context must not be reconfigured, nor
+ * its counters read.
+ */
+int rga_exec_async(struct rga_context *ctx)
+{
+	unsigned int op_nr;
+	uint64_t seq;
+
+	if (ctx->op_nr == 0)
+		return -EINVAL;
+
+	/* Without a thread, run them right away */
+	if (!ctx->async && rga_async_create(ctx))
+		return rga_exec(ctx);
+
+	rga_async_idle(ctx, 0);
+
+	seq = rga_submit(ctx, &op_nr);
+	rga_async_queue(ctx, op_nr, seq);
+
+	return 0;
+}
+
+/**
+ * rga_wait - wait until everything started by rga_exec_async() is done.
+ *
+ * @ctx: a pointer to rga_context structure.
+ *
+ * Returns the first error of those submissions since the last call.
+ */
+int rga_wait(struct rga_context *ctx)
+{
+	return rga_async_idle(ctx, 1);
+}
+
+/**
+ * rga_solid_fill - fill given buffer with given color data.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @img: a pointer to rga_image structure including image and buffer
+ *	information.
+ * @x: x start position to buffer filled with given color data.
+ * @y: y start position to buffer filled with given color data.
+ * @w: width value to buffer filled with given color data.
+ * @h: height value to buffer filled with given color data.
+ */
+int rga_solid_fill(struct rga_context *ctx, struct rga_image *img,
+		   unsigned int x, unsigned int y, unsigned int w,
+		   unsigned int h)
+{
+	struct rga_op *op;
+
+	if (x >= img->width || y >= img->height) {
+		fprintf(stderr, "invalid fill position.\n");
+		return -EINVAL;
+	}
+
+	if (x + w > img->width)
+		w = img->width - x;
+	if (y + h > img->height)
+		h = img->height - y;
+
+	op = rga_queue_op(ctx);
+	if (!op)
+		return -EINVAL;
+
+	op->type = RGA_OP_FILL;
+	op->dst = *img;
+	op->dst_x = x;
+	op->dst_y = y;
+	op->dst_w = w;
+	op->dst_h = h;
+
+	return 0;
+}
+
+/**
+ * rga_multiple_transform - copy contents in source buffer to destination
+ *	buffer with scaling, rotation, mirroring and color space conversion.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @src: a pointer to rga_image structure including image and buffer
+ *	information to source.
+ * @dst: a pointer to rga_image structure including image and buffer
+ *	information to destination.
+ * @src_x, @src_y, @src_w, @src_h: source window.
+ * @dst_x, @dst_y, @dst_w, @dst_h: destination window.
+ * @degree: clockwise rotate degree (0, 90, 180, 270).
+ * @x_mirr, @y_mirr: mirror the rotated output horizontally / vertically.
+ *
+ * Windows smaller than the RGA minimum of 32x34 are accepted and handled
+ * by the CPU engine when rga_exec() runs.
+ */
+int rga_multiple_transform(struct rga_context *ctx, struct rga_image *src,
+			   struct rga_image *dst, unsigned int src_x,
+			   unsigned int src_y, unsigned int src_w,
+			   unsigned int src_h, unsigned int dst_x,
+			   unsigned int dst_y, unsigned int dst_w,
+			   unsigned int dst_h, unsigned int degree,
+			   unsigned int x_mirr, unsigned int y_mirr)
+{
+	struct rga_op *op;
+
+	if (degree != 0 && degree != 90 && degree != 180 && degree != 270) {
+		fprintf(stderr, "invalid rotate degree.\n");
+		return -EINVAL;
+	}
+
+	if (src_x >= src->width || src_y >= src->height ||
+	    dst_x >= dst->width || dst_y >= dst->height) {
+		fprintf(stderr, "invalid src/dst position.\n");
+		return -EINVAL;
+	}
+
+	if (src_x + src_w > src->width)
+		src_w = src->width - src_x;
+	if (src_y + src_h > src->height)
+		src_h = src->height - src_y;
+
+	if (dst_x + dst_w > dst->width)
+		dst_w = dst->width - dst_x;
+	if (dst_y + dst_h > dst->height)
+		dst_h = dst->height - dst_y;
+
+	if (src_w == 0 || src_h == 0 || dst_w == 0 || dst_h == 0) {
+		fprintf(stderr, "invalid width or height.\n");
+		return -EINVAL;
+	}
+
+	op = rga_queue_op(ctx);
+	if (!op)
+		return -EINVAL;
+
+	op->type = RGA_OP_TRANSFORM;
+	op->src = *src;
+	op->dst = *dst;
+	op->src_x = src_x;
+	op->src_y = src_y;
+	op->src_w = src_w;
+	op->src_h = src_h;
+	op->dst_x = dst_x;
+	op->dst_y = dst_y;
+	op->dst_w = dst_w;
+	op->dst_h = dst_h;
+	op->degree = degree;
+	op->x_mirr = x_mirr;
+	op->y_mirr = y_mirr;
 
 	return 0;
 }
@@ -900,7 +1942,6 @@ int rga_copy(struct rga_context *ctx, struct rga_image *src,
 
 	if (w <= 0 || h <= 0) {
 		fprintf(stderr, "invalid width or height.\n");
-		rga_reset(ctx);
 		return -EINVAL;
 	}
 
@@ -24,6 +24,188 @@ enum e_rga_buf_type {
 #define RGA_MAX_GEM_CMD_NR	10
 #define RGA_MAX_CMD_LIST_NR     64
 
+/*
+ * Where queued operations are executed, see rga_set_backend().
+ */
+enum e_rga_backend {
+	RGA_BACKEND_AUTO,
+	RGA_BACKEND_HW,
+	RGA_BACKEND_CPU,
+};
+
+/*
+ * Job classes, see rga_set_priority().
+ */
+enum e_rga_priority {
+	RGA_PRIORITY_REALTIME,
+	RGA_PRIORITY_NORMAL,
+	RGA_PRIORITY_BACKGROUND,
+	RGA_PRIORITY_NR,
+};
+
+/*
+ * Where rga_exec() sent operations, see rga_get_dispatch_stats().
+ *
+ * @hw_ops, @cpu_ops: operations completed by each backend.
+ * @hybrid_ops: operations split between the RGA and the CPU workers.
+ * @model_hw, @model_cpu: RGA_BACKEND_AUTO decisions of the cost model.
+ * @explored: decisions sent to the backend the model considered slower,
+ *	to keep its estimate current.
+ * @hw_unsupported: operations the RGA cannot run (format, size, userptr).
+ * @hw_fallback: operations the kernel refused and the CPU completed.
+ */
+struct rga_dispatch_stats {
+	unsigned long long		hw_ops;
+	unsigned long long		cpu_ops;
+	unsigned long long		hybrid_ops;
+	unsigned long long		model_hw;
+	unsigned long long		model_cpu;
+	unsigned long long		explored;
+	unsigned long long		hw_unsupported;
+	unsigned long long		hw_fallback;
+};
+
+/*
+ * Performance counters of a context, see rga_get_stats().
+ *
+ * Latency histograms have one bucket per power of two microseconds:
+ * bucket i counts [2^i, 2^(i+1)) us, bucket 0 also counts anything
+ * faster and the last bucket anything slower.
+ */
+#define RGA_STATS_HIST_NR	20
+
+enum e_rga_stats_op {
+	RGA_STATS_FILL,
+	RGA_STATS_COPY,
+	RGA_STATS_SCALE,
+	RGA_STATS_ROTATE,
+	RGA_STATS_CSC,
+	RGA_STATS_OP_NR,
+};
+
+/*
+ * @ops: completed operations by kind; a transform counts as CSC when the
+ *	formats differ, else ROTATE when rotated or mirrored, else SCALE.
+ * @execs: calls of rga_exec().
+ * @cmdlists, @regs: cmdlists and register writes handed to the kernel.
+ * @bytes_read, @bytes_written: memory traffic estimated from the windows,
+ *	their formats and the rotation, in whole DDR bursts.
+ * @overflows: operations refused because the queue was full.
+ * @submit_failures, @exec_failures: failed SET_CMDLIST / EXEC ioctls.
+ * @cpu_failures: operations the CPU engine failed.
+ * @exec_us: latency of rga_exec().
+ * @submit_us: latency of the SET_CMDLIST ioctl.
+ * @hw_us: latency of the EXEC ioctl, one sample per RGA batch.
+ * @cpu_us: latency of one operation on the CPU engine.
+ * @import_hits, @import_misses: CPU engine mappings found in / added to
+ *	the import cache, @import_evictions: mappings dropped to make room.
+ * @imports, @import_bytes: dma-bufs currently mapped by the cache.
+ * @deadline_misses: rga_exec() calls slower than the deadline.
+ * @sched_slices: RGA submissions of background operations cut in slices.
+ * @sched_yields: times the RGA was given up to a waiting higher class.
+ * @sched_wait_us: time spent waiting for the RGA to become free.
+ * @preconv_ops: packed YUV sources converted on the CPU for the RGA.
+ * @preconv_us: time one such conversion took.
+ * @bw_throttles: background jobs held back by the bandwidth budget.
+ * @bw_throttle_us: time one such job was held back.
+ * @upload_waits: rga_upload_image() calls that had to run the queued
+ *	operations to free space in the upload ring.
+ */
+struct rga_stats {
+	unsigned long long		ops[RGA_STATS_OP_NR];
+	unsigned long long		execs;
+	unsigned long long		cmdlists;
+	unsigned long long		regs;
+	unsigned long long		bytes_read;
+	unsigned long long		bytes_written;
+	unsigned long long		overflows;
+	unsigned long long		submit_failures;
+	unsigned long long		exec_failures;
+	unsigned long long		cpu_failures;
+	unsigned long long		exec_us[RGA_STATS_HIST_NR];
+	unsigned long long		submit_us[RGA_STATS_HIST_NR];
+	unsigned long long		hw_us[RGA_STATS_HIST_NR];
+	unsigned long long		cpu_us[RGA_STATS_HIST_NR];
+	unsigned long long		import_hits;
+	unsigned long long		import_misses;
+	unsigned long long		import_evictions;
+	unsigned long long		imports;
+	unsigned long long		import_bytes;
+	unsigned long long		deadline_misses;
+	unsigned long long		sched_slices;
+	unsigned long long		sched_yields;
+	unsigned long long		sched_wait_us[RGA_STATS_HIST_NR];
+	unsigned long long		preconv_ops;
+	unsigned long long		preconv_us[RGA_STATS_HIST_NR];
+	unsigned long long		bw_throttles;
+	unsigned long long		bw_throttle_us[RGA_STATS_HIST_NR];
+	unsigned long long		upload_waits;
+};
+
+/*
+ * Estimated memory traffic of all contexts of the process, summed per
+ * second, see rga_get_bw_stats().
+ *
+ * @budget: bytes per second set with rga_set_bw_budget(), 0 for none.
+ * @read, @written: bytes of the current second so far.
+ * @last_read, @last_written: bytes of the last complete second.
+ * @peak: highest read plus written bytes of a complete second.
+ * @throttles, @throttle_us: background jobs held back by the budget and
+ *	the total time they waited.
+ */
+struct rga_bw_stats {
+	unsigned long long		budget;
+	unsigned long long		read;
+	unsigned long long		written;
+	unsigned long long		last_read;
+	unsigned long long		last_written;
+	unsigned long long		peak;
+	unsigned long long		throttles;
+	unsigned long long		throttle_us;
+};
+
+/*
+ * Trace points, reported to the hook set with rga_set_trace_hook() and,
+ * when built with <sys/sdt.h>, as USDT probes of provider libdrm_rockchip.
+ *
+ * @RGA_TRACE_EXEC_BEGIN: rga_exec() starts, @ops operations queued.
+ * @RGA_TRACE_EXEC_END: rga_exec() returns @ret after @us.
+ * @RGA_TRACE_SUBMIT: one SET_CMDLIST ioctl took @us.
+ * @RGA_TRACE_HW_EXEC: an RGA batch of @ops operations took @us.
+ * @RGA_TRACE_CPU_OP: one operation on the CPU engine took @us.
+ * @RGA_TRACE_FALLBACK: @ops operations refused by the RGA move to the CPU.
+ */
+enum e_rga_trace_event {
+	RGA_TRACE_EXEC_BEGIN,
+	RGA_TRACE_EXEC_END,
+	RGA_TRACE_SUBMIT,
+	RGA_TRACE_HW_EXEC,
+	RGA_TRACE_CPU_OP,
+	RGA_TRACE_FALLBACK,
+};
+
+struct rga_trace_info {
+	enum e_rga_trace_event		event;
+	unsigned int			ops;
+	unsigned long long		us;
+	int				ret;
+};
+
+typedef void (*rga_trace_hook_t)(void *data,
+				 const struct rga_trace_info *info);
+
+struct rga_op;
+struct rga_hybrid;
+struct rga_cost;
+struct rga_record;
+struct rga_import;
+struct rga_preconv;
+struct rga_scene;
+struct rga_graph;
+struct rga_capture;
+struct rga_upload;
+struct drm_clip_rect;
+
 struct rga_image {
 	unsigned int			color_mode;
 	unsigned int			width;
@@ -33,6 +215,44 @@ struct rga_image {
 	enum e_rga_buf_type		buf_type;
 	unsigned int			bo[RGA_PLANE_MAX_NR];
 	struct drm_rockchip_rga_userptr	user_ptr[RGA_PLANE_MAX_NR];
+	/* bytes from the start of the buffer to the image, for suballocations */
+	unsigned int			offset;
+};
+
+struct rga_rect {
+	unsigned int			x, y;
+	unsigned int			w, h;
+};
+
+/*
+ * A frame returned by rga_capture_frame(). @img is one of the capture's
+ * ring buffers and keeps its contents until the ring wraps around.
+ *
+ * @sequence: vblank the frame was captured after.
+ * @timestamp_us: CLOCK_MONOTONIC time of that vblank.
+ * @missed: vblanks that went by after the one the frame was due at.
+ */
+struct rga_capture_frame {
+	struct rga_image		*img;
+	unsigned int			sequence;
+	unsigned long long		timestamp_us;
+	unsigned int			missed;
+};
+
+/*
+ * One layer of an rga_scene, drawn like rga_multiple_transform() would.
+ *
+ * @src: source image, NULL to fill @dst_rect with @fill_color.
+ * @src_rect, @dst_rect: source and destination windows.
+ * @degree, @x_mirr, @y_mirr: as for rga_multiple_transform().
+ */
+struct rga_layer {
+	struct rga_image		*src;
+	unsigned int			fill_color;
+	struct rga_rect			src_rect;
+	struct rga_rect			dst_rect;
+	unsigned int			degree;
+	unsigned int			x_mirr, y_mirr;
 };
 
 struct rga_context {
@@ -44,14 +264,138 @@ struct rga_context {
 	unsigned int			cmd_nr;
 	unsigned int			cmd_buf_nr;
 	unsigned int			cmdlist_nr;
+	struct rga_op			*ops;
+	unsigned int			op_nr;
+	enum e_rga_backend		backend;
+	int				has_hw;
+	struct rga_hybrid		*hybrid;
+	struct rga_cost			*cost;
+	struct rga_stats		stats;
+	rga_trace_hook_t		trace_hook;
+	void				*trace_data;
+	struct rga_record		*record;
+	struct rga_import		*import;
+	enum e_rga_priority		priority;
+	unsigned int			deadline_us;
+	int				sched_held;
+	struct rga_preconv		*preconv;
+	/* operations being executed, swapped with @ops on submission */
+	struct rga_op			*exec_ops;
+	struct rga_async		*async;
+	struct rockchip_timeline	*timeline;
+	/* rga_exec() and rga_exec_async() calls so far */
+	unsigned long long		submit_seq;
 };
 
 struct rga_context *rga_init(int fd);
 
 void rga_fini(struct rga_context *ctx);
 
+int rga_set_backend(struct rga_context *ctx, enum e_rga_backend backend);
+
+int rga_set_hybrid(struct rga_context *ctx, unsigned int threads);
+
+int rga_set_priority(struct rga_context *ctx, enum e_rga_priority priority,
+		     unsigned int deadline_us);
+
+int rga_set_bw_budget(struct rga_context *ctx,
+		      unsigned long long bytes_per_sec);
+
+int rga_get_bw_stats(struct rga_context *ctx, struct rga_bw_stats *stats);
+
+int rga_calibrate(struct rga_context *ctx);
+
+int rga_get_dispatch_stats(struct rga_context *ctx,
+			   struct rga_dispatch_stats *stats);
+
+int rga_get_stats(struct rga_context *ctx, struct rga_stats *stats);
+
+void rga_reset_stats(struct rga_context *ctx);
+
+int rga_set_trace_hook(struct rga_context *ctx, rga_trace_hook_t hook,
+		       void *data);
+
+int rga_release_image(struct rga_context *ctx, struct rga_image *img);
+
+struct rga_scene *rga_scene_create(struct rga_context *ctx,
+				   unsigned int width, unsigned int height,
+				   unsigned int bg_color);
+
+void rga_scene_destroy(struct rga_scene *scene);
+
+int rga_scene_add_layer(struct rga_scene *scene,
+			const struct rga_layer *layer);
+
+int rga_scene_set_layer(struct rga_scene *scene, int id,
+			const struct rga_layer *layer);
+
+int rga_scene_damage_layer(struct rga_scene *scene, int id,
+			   const struct rga_rect *rect);
+
+int rga_scene_damage(struct rga_scene *scene, const struct rga_rect *rect);
+
+int rga_scene_render(struct rga_scene *scene, struct rga_image *dst,
+		     unsigned int age);
+
+unsigned int rga_scene_get_clips(struct rga_scene *scene,
+				 struct drm_clip_rect **clips);
+
+int rga_scene_dirty_fb(struct rga_scene *scene, int fd, unsigned int fb_id);
+
+struct rga_graph *rga_graph_create(struct rga_context *ctx);
+
+void rga_graph_destroy(struct rga_graph *graph);
+
+void rga_graph_reset(struct rga_graph *graph);
+
+int rga_graph_add_image(struct rga_graph *graph, struct rga_image *img);
+
+int rga_graph_add_intermediate(struct rga_graph *graph,
+			       unsigned int color_mode, unsigned int width,
+			       unsigned int height);
+
+int rga_graph_add_fill(struct rga_graph *graph, int dst,
+		       const struct rga_rect *rect, unsigned int color);
+
+int rga_graph_add_transform(struct rga_graph *graph, int src,
+			    const struct rga_rect *src_rect, int dst,
+			    const struct rga_rect *dst_rect,
+			    unsigned int degree, unsigned int x_mirr,
+			    unsigned int y_mirr);
+
+int rga_graph_run(struct rga_graph *graph);
+
+struct rga_capture *rga_capture_create(struct rga_context *ctx,
+				       unsigned int crtc_id, unsigned int width,
+				       unsigned int height,
+				       unsigned int ring_nr);
+
+void rga_capture_destroy(struct rga_capture *cap);
+
+int rga_capture_set_source(struct rga_capture *cap, struct rga_image *img);
+
+int rga_capture_set_interval(struct rga_capture *cap, unsigned int vblanks);
+
+void rga_capture_flush(struct rga_capture *cap);
+
+int rga_capture_frame(struct rga_capture *cap,
+		      struct rga_capture_frame *frame);
+
+struct rga_upload *rga_upload_create(struct rga_context *ctx,
+				     unsigned int size);
+
+void rga_upload_destroy(struct rga_upload *up);
+
+int rga_upload_image(struct rga_upload *up, unsigned int color_mode,
+		     unsigned int width, unsigned int height,
+		     struct rga_image *img, void **ptr);
+
 int rga_exec(struct rga_context *ctx);
 
+int rga_exec_async(struct rga_context *ctx);
+
+int rga_wait(struct rga_context *ctx);
+
 int rga_solid_fill(struct rga_context *ctx, struct rga_image *img,
 		   unsigned int x, unsigned int y, unsigned int w,
 		   unsigned int h);
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+#include "rockchip_timeline.h"
+
+/*
+ * Asynchronous execution of a context, one submission at a time.
+ *
+ * @thread: runs what rga_exec_async() hands over.
+ * @lock: protects the fields below.
+ * @cond: broadcast when a submission is handed over or done.
+ * @op_nr: operations of the submission in flight, 0 while idle.
+ * @seq: its sequence number.
+ * @ret: first error not returned by rga_wait() yet.
+ * @quit: set by rga_async_destroy() to stop @thread.
+ */
+struct rga_async {
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	unsigned int		op_nr;
+	uint64_t		seq;
+	int			ret;
+	int			quit;
+};
+
+static void *rga_async_thread(void *data)
+{
+	struct rga_context *ctx = data;
+	struct rga_async *async = ctx->async;
+	unsigned int op_nr;
+	uint64_t seq;
+	int ret;
+
+	pthread_mutex_lock(&async->lock);
+	for (;;) {
+		while (!async->op_nr && !async->quit)
+			pthread_cond_wait(&async->cond, &async->lock);
+		if (!async->op_nr)
+			break;
+
+		op_nr = async->op_nr;
+		seq = async->seq;
+		pthread_mutex_unlock(&async->lock);
+
+		ret = rga_exec_ops(ctx, op_nr);
+		rockchip_timeline_signal(ctx->timeline, seq);
+
+		pthread_mutex_lock(&async->lock);
+		if (!async->ret)
+			async->ret = ret;
+		async->op_nr = 0;
+		pthread_cond_broadcast(&async->cond);
+	}
+	pthread_mutex_unlock(&async->lock);
+
+	return NULL;
+}
+
+/*
+ * rga_async_create - start the thread running asynchronous submissions
+ *	of a context.
+ */
+drm_private int rga_async_create(struct rga_context *ctx)
+{
+	struct rga_async *async;
+
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return -ENOMEM;
+
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->cond, NULL);
+	ctx->async = async;
+
+	if (pthread_create(&async->thread, NULL, rga_async_thread, ctx)) {
+		ctx->async = NULL;
+		pthread_cond_destroy(&async->cond);
+		pthread_mutex_destroy(&async->lock);
+		free(async);
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/*
+ * rga_async_destroy - run what is still in flight and stop the thread.
+ */
+drm_private void rga_async_destroy(struct rga_async *async)
+{
+	if (!async)
+		return;
+
+	pthread_mutex_lock(&async->lock);
+	async->quit = 1;
+	pthread_cond_broadcast(&async->cond);
+	pthread_mutex_unlock(&async->lock);
+
+	pthread_join(async->thread, NULL);
+	pthread_cond_destroy(&async->cond);
+	pthread_mutex_destroy(&async->lock);
+	free(async);
+}
+
+/*
+ * rga_async_queue - hand the first @op_nr operations of ctx->exec_ops
+ *	over to the thread as submission @seq. Nothing may be in flight.
+ */
+drm_private void rga_async_queue(struct rga_context *ctx, unsigned int op_nr,
+				 uint64_t seq)
+{
+	struct rga_async *async = ctx->async;
+
+	pthread_mutex_lock(&async->lock);
+	async->op_nr = op_nr;
+	async->seq = seq;
+	pthread_cond_broadcast(&async->cond);
+	pthread_mutex_unlock(&async->lock);
+}
+
+/*
+ * rga_async_idle - wait for the submission in flight, if any, and return
+ *	the first error of asynchronous submissions not returned yet,
+ *	forgetting it if @clear is set.
+ */
+drm_private int rga_async_idle(struct rga_context *ctx, int clear)
+{
+	struct rga_async *async = ctx->async;
+	int ret;
+
+	if (!async)
+		return 0;
+
+	pthread_mutex_lock(&async->lock);
+	while (async->op_nr)
+		pthread_cond_wait(&async->cond, &async->lock);
+	ret = async->ret;
+	if (clear)
+		async->ret = 0;
+	pthread_mutex_unlock(&async->lock);
+
+	return ret;
+}
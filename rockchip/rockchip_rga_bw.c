@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * Process-wide DDR traffic of all contexts, summed over windows of
+ * RGA_BW_WINDOW_US. Like the RGA itself, memory bandwidth is shared by
+ * every context, so the budget is too.
+ */
+static struct {
+	pthread_mutex_t		lock;
+	unsigned long long	budget;
+	uint64_t		start;
+	unsigned long long	read, written;
+	unsigned long long	last_read, last_written;
+	unsigned long long	peak;
+	unsigned long long	throttles;
+	unsigned long long	throttle_us;
+} rga_bw = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+ * rga_bw_rows - bytes fetched for @rows rows of @bytes bytes starting
+ *	@offset bytes into each row, in whole bursts.
+ *
+ * With @seg non-zero every row is fetched in pieces of @seg bytes, each
+ * taking whole bursts of its own.
+ */
+static unsigned long long rga_bw_rows(unsigned int offset, unsigned int bytes,
+				      unsigned int rows, unsigned int seg)
+{
+	unsigned int first, last;
+
+	if (seg)
+		return (unsigned long long)rows * ((bytes + seg - 1) / seg) *
+		       ((seg + RGA_BW_BURST - 1) & ~(RGA_BW_BURST - 1));
+
+	first = offset & ~(RGA_BW_BURST - 1);
+	last = (offset + bytes + RGA_BW_BURST - 1) & ~(RGA_BW_BURST - 1);
+
+	return (unsigned long long)(last - first) * rows;
+}
+
+/*
+ * rga_bw_window - bytes moved to access a window of an image.
+ *
+ * @fourcc: format of the image.
+ * @x, @y, @w, @h: the window.
+ * @seg_px: pixels per fetch when the rows are not read in one go, else 0.
+ */
+static unsigned long long rga_bw_window(uint32_t fourcc, unsigned int x,
+					unsigned int y, unsigned int w,
+					unsigned int h, unsigned int seg_px)
+{
+	const struct rga_format *fmt = rga_format_lookup(fourcc);
+	unsigned long long bytes;
+	unsigned int cw, ch;
+
+	if (!fmt || !w || !h)
+		return 0;
+
+	bytes = rga_bw_rows(x * fmt->cpp, w * fmt->cpp, h, seg_px * fmt->cpp);
+	if (fmt->planes == 1)
+		return bytes;
+
+	/* Interleaved chroma, two bytes per subsampled pixel */
+	cw = (x + w + fmt->xsub - 1) / fmt->xsub - x / fmt->xsub;
+	ch = (y + h + fmt->ysub - 1) / fmt->ysub - y / fmt->ysub;
+	bytes += rga_bw_rows(x / fmt->xsub * 2, cw * 2, ch,
+			     seg_px ? seg_px / fmt->xsub * 2 : 0);
+
+	return bytes;
+}
+
+/*
+ * rga_bw_op_bytes - estimate the DDR traffic of one operation.
+ *
+ * Windows are counted in whole bursts. A transform rotated by 90 or 270
+ * degrees walks its source in columns of RGA_BW_ROT_TILE pixels, so each
+ * source row is fetched in pieces of that width.
+ */
+drm_private void rga_bw_op_bytes(const struct rga_op *op,
+				 unsigned long long *read,
+				 unsigned long long *written)
+{
+	int rot = (op->degree == 90 || op->degree == 270);
+
+	*read = 0;
+	if (op->type == RGA_OP_TRANSFORM)
+		*read = rga_bw_window(op->src.color_mode, op->src_x, op->src_y,
+				      op->src_w, op->src_h,
+				      rot ? RGA_BW_ROT_TILE : 0);
+
+	*written = rga_bw_window(op->dst.color_mode, op->dst_x, op->dst_y,
+				 op->dst_w, op->dst_h, 0);
+}
+
+/* Must be called with rga_bw.lock held */
+static void rga_bw_roll(uint64_t now)
+{
+	uint64_t elapsed = now - rga_bw.start;
+
+	if (elapsed < RGA_BW_WINDOW_US)
+		return;
+
+	if (rga_bw.read + rga_bw.written > rga_bw.peak)
+		rga_bw.peak = rga_bw.read + rga_bw.written;
+
+	/* An idle window in between leaves nothing for the last one */
+	if (elapsed < 2 * RGA_BW_WINDOW_US) {
+		rga_bw.last_read = rga_bw.read;
+		rga_bw.last_written = rga_bw.written;
+	} else {
+		rga_bw.last_read = 0;
+		rga_bw.last_written = 0;
+	}
+
+	rga_bw.read = 0;
+	rga_bw.written = 0;
+	rga_bw.start = now - elapsed % RGA_BW_WINDOW_US;
+}
+
+/*
+ * rga_bw_charge - add the traffic of a completed operation to the current
+ *	window.
+ */
+drm_private void rga_bw_charge(unsigned long long read,
+			       unsigned long long written)
+{
+	pthread_mutex_lock(&rga_bw.lock);
+	rga_bw_roll(rga_time_us());
+	rga_bw.read += read;
+	rga_bw.written += written;
+	pthread_mutex_unlock(&rga_bw.lock);
+}
+
+/*
+ * rga_bw_throttle - hold a background job of @ctx back until the next
+ *	window while the current one has used up the budget.
+ *
+ * Must not be called while @ctx holds the RGA.
+ */
+drm_private void rga_bw_throttle(struct rga_context *ctx)
+{
+	uint64_t start = 0, end;
+	struct timespec ts;
+
+	if (ctx->priority != RGA_PRIORITY_BACKGROUND)
+		return;
+
+	pthread_mutex_lock(&rga_bw.lock);
+
+	for (;;) {
+		rga_bw_roll(rga_time_us());
+		if (!rga_bw.budget ||
+		    rga_bw.read + rga_bw.written < rga_bw.budget)
+			break;
+
+		if (!start) {
+			start = rga_time_us();
+			rga_bw.throttles++;
+			ctx->stats.bw_throttles++;
+		}
+
+		end = rga_bw.start + RGA_BW_WINDOW_US;
+		pthread_mutex_unlock(&rga_bw.lock);
+
+		ts.tv_sec = end / 1000000;
+		ts.tv_nsec = end % 1000000 * 1000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR)
+			;
+
+		pthread_mutex_lock(&rga_bw.lock);
+	}
+
+	if (start) {
+		start = rga_time_us() - start;
+		rga_bw.throttle_us += start;
+		rga_stats_hist(ctx->stats.bw_throttle_us, start);
+	}
+
+	pthread_mutex_unlock(&rga_bw.lock);
+}
+
+/**
+ * rga_set_bw_budget - limit the memory traffic of background jobs.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @bytes_per_sec: estimated DDR bytes all contexts of the process may
+ *	read and write per second before jobs of RGA_PRIORITY_BACKGROUND
+ *	contexts are held back until the next second, 0 for no limit.
+ *
+ * The budget is shared by all contexts of the process. Jobs of the other
+ * classes are never held back but count against it.
+ */
+int rga_set_bw_budget(struct rga_context *ctx, unsigned long long bytes_per_sec)
+{
+	pthread_mutex_lock(&rga_bw.lock);
+	rga_bw.budget = bytes_per_sec;
+	pthread_mutex_unlock(&rga_bw.lock);
+
+	return 0;
+}
+
+/**
+ * rga_get_bw_stats - report the memory traffic of all contexts.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @stats: filled with the traffic of the process, see struct rga_bw_stats.
+ */
+int rga_get_bw_stats(struct rga_context *ctx, struct rga_bw_stats *stats)
+{
+	pthread_mutex_lock(&rga_bw.lock);
+	rga_bw_roll(rga_time_us());
+	stats->budget = rga_bw.budget;
+	stats->read = rga_bw.read;
+	stats->written = rga_bw.written;
+	stats->last_read = rga_bw.last_read;
+	stats->last_written = rga_bw.last_written;
+	stats->peak = rga_bw.peak;
+	stats->throttles = rga_bw.throttles;
+	stats->throttle_us = rga_bw.throttle_us;
+	pthread_mutex_unlock(&rga_bw.lock);
+
+	return 0;
+}
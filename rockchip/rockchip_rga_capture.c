@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "drm_fourcc.h"
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * A scanout framebuffer exported as dma-buf, kept as long as it is among
+ * the RGA_CAPTURE_MAX_FBS most recently captured ones.
+ */
+struct rga_capture_fb {
+	uint32_t		fb_id;
+	int			fd;
+	struct rga_image	img;
+	unsigned int		used;
+};
+
+struct rga_capture {
+	struct rga_context	*ctx;
+	uint32_t		crtc_id;
+	unsigned int		vbl_flags;
+	unsigned int		interval;
+
+	struct rga_capture_fb	fbs[RGA_CAPTURE_MAX_FBS];
+	unsigned int		frame_nr;
+
+	struct rga_image	source;
+	int			has_source;
+
+	struct rga_buf		*ring[RGA_CAPTURE_MAX_RING];
+	struct rga_image	ring_img[RGA_CAPTURE_MAX_RING];
+	unsigned int		ring_nr;
+	unsigned int		next;
+
+	int			started;
+	unsigned int		sequence;
+	uint64_t		epoch_us;
+};
+
+static uint32_t rga_capture_fb_format(uint32_t bpp, uint32_t depth)
+{
+	switch (bpp << 8 | depth) {
+	case 32 << 8 | 24:
+		return DRM_FORMAT_XRGB8888;
+	case 32 << 8 | 32:
+		return DRM_FORMAT_ARGB8888;
+	case 24 << 8 | 24:
+		return DRM_FORMAT_RGB888;
+	case 16 << 8 | 16:
+		return DRM_FORMAT_RGB565;
+	case 16 << 8 | 15:
+		return DRM_FORMAT_XRGB1555;
+	default:
+		return 0;
+	}
+}
+
+static void rga_capture_fb_drop(struct rga_capture *cap,
+				struct rga_capture_fb *fb)
+{
+	if (fb->fd < 0)
+		return;
+
+	rga_import_release(cap->ctx->import, fb->fd);
+	close(fb->fd);
+	fb->fd = -1;
+	fb->fb_id = 0;
+}
+
+/*
+ * rga_capture_fb_get - the exported framebuffer @fb_id, resolving it
+ *	through drmModeGetFB() the first time it is scanned out.
+ */
+static int rga_capture_fb_get(struct rga_capture *cap, uint32_t fb_id,
+			      struct rga_capture_fb **fbp)
+{
+	struct rga_context *ctx = cap->ctx;
+	struct rga_capture_fb *fb = NULL;
+	struct drm_gem_close req;
+	drmModeFBPtr info;
+	uint32_t format;
+	unsigned int i;
+	int fd, ret = 0;
+
+	for (i = 0; i < RGA_CAPTURE_MAX_FBS; i++) {
+		if (cap->fbs[i].fd >= 0 && cap->fbs[i].fb_id == fb_id) {
+			fb = &cap->fbs[i];
+			goto out;
+		}
+	}
+
+	info = drmModeGetFB(ctx->fd, fb_id);
+	if (!info) {
+		ret = -errno;
+		fprintf(stderr, "failed to get framebuffer %u.\n", fb_id);
+		return ret;
+	}
+
+	if (!info->handle) {
+		fprintf(stderr, "no access to the buffer of framebuffer %u.\n",
+			fb_id);
+		drmModeFreeFB(info);
+		return -EACCES;
+	}
+
+	format = rga_capture_fb_format(info->bpp, info->depth);
+	if (!format || !rga_format_lookup(format)) {
+		fprintf(stderr, "unsupported framebuffer format %u/%u.\n",
+			info->bpp, info->depth);
+		ret = -EINVAL;
+		goto close;
+	}
+
+	if (drmPrimeHandleToFD(ctx->fd, info->handle, DRM_CLOEXEC, &fd)) {
+		ret = -errno;
+		fprintf(stderr, "failed to export framebuffer %u.\n", fb_id);
+		goto close;
+	}
+
+	/* Reuse a free slot or the least recently captured framebuffer */
+	fb = &cap->fbs[0];
+	for (i = 0; i < RGA_CAPTURE_MAX_FBS; i++) {
+		if (cap->fbs[i].fd < 0) {
+			fb = &cap->fbs[i];
+			break;
+		}
+		if (cap->fbs[i].used < fb->used)
+			fb = &cap->fbs[i];
+	}
+	rga_capture_fb_drop(cap, fb);
+
+	fb->fb_id = fb_id;
+	fb->fd = fd;
+	memset(&fb->img, 0, sizeof(fb->img));
+	fb->img.color_mode = format;
+	fb->img.width = info->width;
+	fb->img.height = info->height;
+	fb->img.stride = info->pitch;
+	fb->img.buf_type = RGA_IMGBUF_GEM;
+	fb->img.bo[0] = fd;
+
+close:
+	/* drmModeGetFB() gave us a handle of our own */
+	memset(&req, 0, sizeof(req));
+	req.handle = info->handle;
+	drmIoctl(ctx->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	drmModeFreeFB(info);
+
+	if (ret)
+		return ret;
+
+out:
+	fb->used = ++cap->frame_nr;
+	*fbp = fb;
+
+	return 0;
+}
+
+/*
+ * rga_capture_wait - wait for the vblank the next frame is due at.
+ *
+ * Like DRM_VBLANK_NEXTONMISS, a frame that is late is taken at the next
+ * vblank rather than right away, so frames stay aligned to vblanks.
+ */
+static int rga_capture_wait(struct rga_capture *cap,
+			    struct rga_capture_frame *frame)
+{
+	int paced = cap->started && cap->interval;
+	unsigned int target = cap->sequence + cap->interval;
+
+	if (cap->crtc_id) {
+		drmVBlank vbl;
+
+		memset(&vbl, 0, sizeof(vbl));
+		if (paced) {
+			vbl.request.type = DRM_VBLANK_ABSOLUTE |
+					   DRM_VBLANK_NEXTONMISS;
+			vbl.request.sequence = target;
+		} else {
+			vbl.request.type = DRM_VBLANK_RELATIVE;
+		}
+		vbl.request.type |= cap->vbl_flags;
+
+		if (drmWaitVBlank(cap->ctx->fd, &vbl)) {
+			int ret = -errno;
+
+			fprintf(stderr, "failed to wait for vblank.\n");
+			return ret;
+		}
+
+		cap->sequence = vbl.reply.sequence;
+		frame->timestamp_us = (uint64_t)vbl.reply.tval_sec * 1000000 +
+				      vbl.reply.tval_usec;
+	} else {
+		uint64_t now = rga_time_us(), at;
+		struct timespec ts;
+		unsigned int seq;
+
+		/* No display, emulate vblanks from the first frame on */
+		if (!cap->started)
+			cap->epoch_us = now;
+
+		seq = (now - cap->epoch_us) / RGA_CAPTURE_HEADLESS_US;
+		if (paced) {
+			if ((int)(seq - target) >= 0)
+				seq++;
+			else
+				seq = target;
+		}
+
+		at = cap->epoch_us + (uint64_t)seq * RGA_CAPTURE_HEADLESS_US;
+		if (at > now) {
+			ts.tv_sec = at / 1000000;
+			ts.tv_nsec = at % 1000000 * 1000;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &ts, NULL) == EINTR)
+				;
+		}
+
+		cap->sequence = seq;
+		frame->timestamp_us = at;
+	}
+
+	frame->sequence = cap->sequence;
+	frame->missed = paced ? cap->sequence - target : 0;
+	cap->started = 1;
+
+	return 0;
+}
+
+/*
+ * rga_capture_crtc_flags - vblank request flags selecting the pipe of
+ *	@crtc_id, its index among the CRTCs of the device.
+ */
+static int rga_capture_crtc_flags(int fd, uint32_t crtc_id,
+				  unsigned int *flags)
+{
+	drmModeResPtr res;
+	int i, pipe = -1;
+
+	res = drmModeGetResources(fd);
+	if (!res)
+		return -errno;
+
+	for (i = 0; i < res->count_crtcs; i++)
+		if (res->crtcs[i] == crtc_id)
+			pipe = i;
+	drmModeFreeResources(res);
+
+	if (pipe < 0)
+		return -ENOENT;
+
+	if (pipe == 1)
+		*flags = DRM_VBLANK_SECONDARY;
+	else if (pipe > 1)
+		*flags = (pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) &
+			 DRM_VBLANK_HIGH_CRTC_MASK;
+	else
+		*flags = 0;
+
+	return 0;
+}
+
+/**
+ * rga_capture_create - set up capturing the scanout of a CRTC into a ring
+ *	of NV12 buffers.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @crtc_id: the CRTC, or 0 to capture an image set with
+ *	rga_capture_set_source() paced by emulated 60Hz vblanks, e.g. in
+ *	tests without a display.
+ * @width, @height: size of the NV12 frames, even.
+ * @ring_nr: number of output buffers, at most RGA_CAPTURE_MAX_RING.
+ */
+struct rga_capture *rga_capture_create(struct rga_context *ctx,
+				       unsigned int crtc_id, unsigned int width,
+				       unsigned int height,
+				       unsigned int ring_nr)
+{
+	struct rga_capture *cap;
+	unsigned int i;
+
+	if (!width || !height || (width | height) & 1 || !ring_nr ||
+	    ring_nr > RGA_CAPTURE_MAX_RING) {
+		fprintf(stderr, "invalid capture size.\n");
+		return NULL;
+	}
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap) {
+		fprintf(stderr, "failed to allocate capture.\n");
+		return NULL;
+	}
+
+	cap->ctx = ctx;
+	cap->crtc_id = crtc_id;
+	cap->interval = 1;
+	for (i = 0; i < RGA_CAPTURE_MAX_FBS; i++)
+		cap->fbs[i].fd = -1;
+
+	if (crtc_id && rga_capture_crtc_flags(ctx->fd, crtc_id,
+					      &cap->vbl_flags)) {
+		fprintf(stderr, "failed to find crtc %u.\n", crtc_id);
+		goto err;
+	}
+
+	for (i = 0; i < ring_nr; i++) {
+		struct rga_image *img = &cap->ring_img[i];
+
+		if (rga_buf_alloc(ctx, (size_t)width * height * 3 / 2,
+				  &cap->ring[i]))
+			goto err;
+		cap->ring_nr++;
+
+		img->color_mode = DRM_FORMAT_NV12;
+		img->width = width;
+		img->height = height;
+		img->stride = width;
+		rga_buf_bind(cap->ring[i], img);
+	}
+
+	return cap;
+
+err:
+	rga_capture_destroy(cap);
+	return NULL;
+}
+
+void rga_capture_destroy(struct rga_capture *cap)
+{
+	unsigned int i;
+
+	if (!cap)
+		return;
+
+	rga_capture_flush(cap);
+	for (i = 0; i < cap->ring_nr; i++)
+		rga_buf_free(cap->ctx, cap->ring[i]);
+	free(cap);
+}
+
+/**
+ * rga_capture_set_source - capture an image instead of the scanout.
+ *
+ * @cap: a pointer to rga_capture structure.
+ * @img: the image, copied, or NULL to capture the CRTC again.
+ */
+int rga_capture_set_source(struct rga_capture *cap, struct rga_image *img)
+{
+	cap->has_source = !!img;
+	if (img)
+		cap->source = *img;
+
+	return 0;
+}
+
+/**
+ * rga_capture_set_interval - capture a frame every @vblanks vblanks, 1 by
+ *	default. 0 captures right away without waiting.
+ *
+ * @cap: a pointer to rga_capture structure.
+ */
+int rga_capture_set_interval(struct rga_capture *cap, unsigned int vblanks)
+{
+	cap->interval = vblanks;
+
+	return 0;
+}
+
+/**
+ * rga_capture_flush - forget the exported framebuffers.
+ *
+ * @cap: a pointer to rga_capture structure.
+ *
+ * Framebuffers are looked up by id, call this after the display
+ * configuration changed so that a new framebuffer reusing the id of a
+ * removed one is resolved again.
+ */
+void rga_capture_flush(struct rga_capture *cap)
+{
+	unsigned int i;
+
+	for (i = 0; i < RGA_CAPTURE_MAX_FBS; i++)
+		rga_capture_fb_drop(cap, &cap->fbs[i]);
+}
+
+/**
+ * rga_capture_frame - wait for the next frame to be due and capture it.
+ *
+ * @cap: a pointer to rga_capture structure.
+ * @frame: returns the NV12 frame and the vblank it was taken at.
+ *
+ * The part of the framebuffer the CRTC scans out is scaled to the size of
+ * the capture. Returns -ENOENT while the CRTC is off.
+ */
+int rga_capture_frame(struct rga_capture *cap, struct rga_capture_frame *frame)
+{
+	struct rga_context *ctx = cap->ctx;
+	struct rga_image *src, *dst;
+	struct rga_rect win;
+	int ret;
+
+	if (!cap->crtc_id && !cap->has_source)
+		return -ENODEV;
+
+	memset(frame, 0, sizeof(*frame));
+
+	ret = rga_capture_wait(cap, frame);
+	if (ret)
+		return ret;
+
+	if (cap->has_source) {
+		src = &cap->source;
+		win.x = 0;
+		win.y = 0;
+		win.w = src->width;
+		win.h = src->height;
+	} else {
+		struct rga_capture_fb *fb = NULL;
+		drmModeCrtcPtr crtc;
+
+		crtc = drmModeGetCrtc(ctx->fd, cap->crtc_id);
+		if (!crtc)
+			return -errno;
+
+		if (!crtc->mode_valid || !crtc->buffer_id) {
+			drmModeFreeCrtc(crtc);
+			return -ENOENT;
+		}
+
+		ret = rga_capture_fb_get(cap, crtc->buffer_id, &fb);
+		if (ret) {
+			drmModeFreeCrtc(crtc);
+			return ret;
+		}
+
+		src = &fb->img;
+		win.x = crtc->x;
+		win.y = crtc->y;
+		win.w = crtc->width;
+		win.h = crtc->height;
+		drmModeFreeCrtc(crtc);
+
+		if (win.x >= src->width || win.y >= src->height)
+			return -EINVAL;
+		if (win.w > src->width - win.x)
+			win.w = src->width - win.x;
+		if (win.h > src->height - win.y)
+			win.h = src->height - win.y;
+	}
+
+	dst = &cap->ring_img[cap->next];
+
+	ret = rga_multiple_transform(ctx, src, dst, win.x, win.y, win.w, win.h,
+				     0, 0, dst->width, dst->height, 0, 0, 0);
+	if (ret)
+		return ret;
+
+	ret = rga_exec(ctx);
+	if (ret)
+		return ret;
+
+	frame->img = dst;
+	cap->next = (cap->next + 1) % cap->ring_nr;
+
+	return 0;
+}
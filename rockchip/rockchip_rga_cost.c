@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <xf86drm.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * One bucket of the cost model. For each backend (0: RGA, 1: CPU) it keeps
+ * a moving average of the time per operation and of the pixel count of
+ * those operations, the estimate for a new operation scales the average
+ * time by its own pixel count.
+ */
+struct rga_cost_entry {
+	double			us[2];
+	double			px[2];
+	unsigned int		samples[2];
+	unsigned int		decisions;
+};
+
+/*
+ * @seed: fixed and per pixel cost of each backend, for fills and for
+ *	transforms, indexed by enum rga_op_type.
+ */
+struct rga_cost {
+	void			*table;
+	struct {
+		double		fixed_us;
+		double		ps_per_px;
+	} seed[2][2];
+	struct rga_dispatch_stats stats;
+};
+
+static int rga_cost_side(enum e_rga_backend backend)
+{
+	return backend == RGA_BACKEND_CPU;
+}
+
+drm_private struct rga_cost *rga_cost_create(void)
+{
+	struct rga_cost *cost;
+	int i;
+
+	cost = calloc(1, sizeof(*cost));
+	if (!cost)
+		return NULL;
+
+	cost->table = drmHashCreate();
+	if (!cost->table) {
+		free(cost);
+		return NULL;
+	}
+
+	for (i = RGA_OP_FILL; i <= RGA_OP_TRANSFORM; i++) {
+		cost->seed[0][i].fixed_us = RGA_COST_HW_FIXED_US;
+		cost->seed[0][i].ps_per_px = RGA_COST_HW_PS_PER_PX;
+		cost->seed[1][i].fixed_us = RGA_COST_CPU_FIXED_US;
+		cost->seed[1][i].ps_per_px = RGA_COST_CPU_PS_PER_PX;
+	}
+
+	return cost;
+}
+
+drm_private void rga_cost_destroy(struct rga_cost *cost)
+{
+	unsigned long key;
+	void *value;
+
+	if (!cost)
+		return;
+
+	/* drmHashNext() visits the first bucket twice, drain it instead */
+	while (drmHashFirst(cost->table, &key, &value) == 1) {
+		drmHashDelete(cost->table, key);
+		free(value);
+	}
+
+	drmHashDestroy(cost->table);
+	free(cost);
+}
+
+/*
+ * rga_cost_pixels - pixels an operation reads or writes, whichever is more.
+ */
+drm_private unsigned int rga_cost_pixels(const struct rga_op *op)
+{
+	unsigned int dst = op->dst_w * op->dst_h;
+	unsigned int src = op->src_w * op->src_h;
+
+	if (op->type == RGA_OP_FILL || dst > src)
+		return dst;
+
+	return src;
+}
+
+static int rga_cost_scaled(const struct rga_op *op)
+{
+	int rot = (op->degree == 90 || op->degree == 270);
+
+	if (op->type == RGA_OP_FILL)
+		return 0;
+
+	return op->src_w != (rot ? op->dst_h : op->dst_w) ||
+	       op->src_h != (rot ? op->dst_w : op->dst_h);
+}
+
+/*
+ * The CPU works much harder on anything that is not a straight fill or
+ * copy, scale the per pixel seed so unmeasured buckets start sensibly.
+ */
+static unsigned int rga_cost_cpu_work(const struct rga_op *op)
+{
+	if (op->type == RGA_OP_FILL)
+		return 1;
+
+	if (op->src.color_mode == op->dst.color_mode && !op->degree &&
+	    !op->x_mirr && !op->y_mirr && !rga_cost_scaled(op))
+		return 1;
+
+	return 4;
+}
+
+static unsigned long rga_cost_key(const struct rga_op *op)
+{
+	const struct rga_format *src = rga_format_lookup(op->src.color_mode);
+	const struct rga_format *dst = rga_format_lookup(op->dst.color_mode);
+	unsigned int px = rga_cost_pixels(op);
+	unsigned long key = 0;
+
+	while (px >>= 1)
+		key++;
+	if (key >= RGA_COST_SIZE_BUCKETS)
+		key = RGA_COST_SIZE_BUCKETS - 1;
+
+	key |= (dst ? rga_format_index(dst) + 1 : 0) << 5;
+	if (op->type == RGA_OP_TRANSFORM) {
+		key |= (src ? rga_format_index(src) + 1 : 0) << 11;
+		key |= 1 << 17;
+		key |= (op->degree != 0) << 18;
+		key |= rga_cost_scaled(op) << 19;
+	}
+
+	return key;
+}
+
+static struct rga_cost_entry *rga_cost_entry(struct rga_cost *cost,
+					     const struct rga_op *op)
+{
+	unsigned long key = rga_cost_key(op);
+	void *value;
+
+	if (!drmHashLookup(cost->table, key, &value))
+		return value;
+
+	value = calloc(1, sizeof(struct rga_cost_entry));
+	if (!value)
+		return NULL;
+
+	drmHashInsert(cost->table, key, value);
+
+	return value;
+}
+
+static double rga_cost_estimate(struct rga_cost *cost,
+				struct rga_cost_entry *entry,
+				const struct rga_op *op, int side)
+{
+	unsigned int px = rga_cost_pixels(op);
+	double ps_per_px = cost->seed[side][op->type].ps_per_px;
+
+	if (entry && entry->samples[side])
+		return entry->us[side] * px / entry->px[side];
+
+	if (side)
+		ps_per_px *= rga_cost_cpu_work(op);
+
+	return cost->seed[side][op->type].fixed_us + px * ps_per_px / 1000000;
+}
+
+/*
+ * rga_cost_choose - pick the cheaper backend for an operation both can run.
+ *
+ * Every RGA_COST_EXPLORE decisions of a bucket go to the other backend, so
+ * its estimate follows changes in load instead of going stale.
+ */
+drm_private int rga_cost_choose(struct rga_cost *cost,
+				const struct rga_op *op)
+{
+	struct rga_cost_entry *entry = rga_cost_entry(cost, op);
+	int cpu;
+
+	cpu = rga_cost_estimate(cost, entry, op, 1) <
+	      rga_cost_estimate(cost, entry, op, 0);
+
+	if (entry && ++entry->decisions % RGA_COST_EXPLORE == 0) {
+		cost->stats.explored++;
+		cpu = !cpu;
+	} else if (cpu) {
+		cost->stats.model_cpu++;
+	} else {
+		cost->stats.model_hw++;
+	}
+
+	return cpu ? RGA_BACKEND_CPU : RGA_BACKEND_HW;
+}
+
+/*
+ * rga_cost_update - account a measured execution time.
+ *
+ * The first sample of a bucket replaces the seed, later ones are folded in
+ * with a 1/8 weight.
+ */
+drm_private void rga_cost_update(struct rga_cost *cost,
+				 const struct rga_op *op,
+				 enum e_rga_backend backend, uint64_t us)
+{
+	struct rga_cost_entry *entry = rga_cost_entry(cost, op);
+	int side = rga_cost_side(backend);
+	unsigned int px = rga_cost_pixels(op);
+
+	if (side)
+		cost->stats.cpu_ops++;
+	else
+		cost->stats.hw_ops++;
+
+	if (!entry || !px)
+		return;
+
+	if (entry->samples[side]++ == 0) {
+		entry->us[side] = us;
+		entry->px[side] = px;
+		return;
+	}
+
+	entry->us[side] += (us - entry->us[side]) / 8;
+	entry->px[side] += (px - entry->px[side]) / 8;
+}
+
+/*
+ * rga_cost_seed - derive the fixed and per pixel cost of a backend for
+ * operations of @type from a small and a large measurement.
+ */
+drm_private void rga_cost_seed(struct rga_cost *cost,
+			       enum e_rga_backend backend,
+			       enum rga_op_type type,
+			       unsigned int small_px, uint64_t small_us,
+			       unsigned int large_px, uint64_t large_us)
+{
+	int side = rga_cost_side(backend);
+	double ps_per_px;
+
+	if (large_px <= small_px || large_us <= small_us)
+		return;
+
+	ps_per_px = (double)(large_us - small_us) * 1000000 /
+		    (large_px - small_px);
+
+	cost->seed[side][type].ps_per_px = ps_per_px;
+	cost->seed[side][type].fixed_us = small_us -
+					  small_px * ps_per_px / 1000000;
+	if (cost->seed[side][type].fixed_us < 0)
+		cost->seed[side][type].fixed_us = 0;
+}
+
+drm_private struct rga_dispatch_stats *rga_cost_stats(struct rga_cost *cost)
+{
+	return &cost->stats;
+}
@@ -0,0 +1,873 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "drm_fourcc.h"
+
+#include "rockchip_rga_priv.h"
+
+#define RGB_FMT(fourcc, cpp, rs, rz, gs, gz, bs, bz, as, az)	\
+	{ fourcc, cpp, 1, 1, 1, 0,				\
+	  { rs, rz }, { gs, gz }, { bs, bz }, { as, az } }
+
+#define YUV_FMT(fourcc, planes, xsub, ysub, uv_swap)		\
+	{ fourcc, 1, planes, xsub, ysub, uv_swap,		\
+	  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } }
+
+#define PACKED_FMT(fourcc, y_odd, uv_swap)			\
+	{ fourcc, 2, 1, 2, 1, uv_swap,				\
+	  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, 1, y_odd }
+
+static const struct rga_format rga_formats[] = {
+	RGB_FMT(DRM_FORMAT_ARGB8888, 4, 16, 8,  8, 8,  0, 8, 24, 8),
+	RGB_FMT(DRM_FORMAT_XRGB8888, 4, 16, 8,  8, 8,  0, 8, 24, 0),
+	RGB_FMT(DRM_FORMAT_ABGR8888, 4,  0, 8,  8, 8, 16, 8, 24, 8),
+	RGB_FMT(DRM_FORMAT_XBGR8888, 4,  0, 8,  8, 8, 16, 8, 24, 0),
+	RGB_FMT(DRM_FORMAT_RGBA8888, 4, 24, 8, 16, 8,  8, 8,  0, 8),
+	RGB_FMT(DRM_FORMAT_RGBX8888, 4, 24, 8, 16, 8,  8, 8,  0, 0),
+	RGB_FMT(DRM_FORMAT_BGRA8888, 4,  8, 8, 16, 8, 24, 8,  0, 8),
+	RGB_FMT(DRM_FORMAT_BGRX8888, 4,  8, 8, 16, 8, 24, 8,  0, 0),
+	RGB_FMT(DRM_FORMAT_RGB888,   3, 16, 8,  8, 8,  0, 8,  0, 0),
+	RGB_FMT(DRM_FORMAT_BGR888,   3,  0, 8,  8, 8, 16, 8,  0, 0),
+	RGB_FMT(DRM_FORMAT_RGB565,   2, 11, 5,  5, 6,  0, 5,  0, 0),
+	RGB_FMT(DRM_FORMAT_BGR565,   2,  0, 5,  5, 6, 11, 5,  0, 0),
+	RGB_FMT(DRM_FORMAT_ARGB1555, 2, 10, 5,  5, 5,  0, 5, 15, 1),
+	RGB_FMT(DRM_FORMAT_ABGR1555, 2,  0, 5,  5, 5, 10, 5, 15, 1),
+	RGB_FMT(DRM_FORMAT_RGBA5551, 2, 11, 5,  6, 5,  1, 5,  0, 1),
+	RGB_FMT(DRM_FORMAT_BGRA5551, 2,  1, 5,  6, 5, 11, 5,  0, 1),
+	RGB_FMT(DRM_FORMAT_ARGB4444, 2,  8, 4,  4, 4,  0, 4, 12, 4),
+	RGB_FMT(DRM_FORMAT_ABGR4444, 2,  0, 4,  4, 4,  8, 4, 12, 4),
+	RGB_FMT(DRM_FORMAT_RGBA4444, 2, 12, 4,  8, 4,  4, 4,  0, 4),
+	RGB_FMT(DRM_FORMAT_BGRA4444, 2,  4, 4,  8, 4, 12, 4,  0, 4),
+	YUV_FMT(DRM_FORMAT_NV12,   2, 2, 2, 0),
+	YUV_FMT(DRM_FORMAT_NV21,   2, 2, 2, 1),
+	YUV_FMT(DRM_FORMAT_NV16,   2, 2, 1, 0),
+	YUV_FMT(DRM_FORMAT_NV61,   2, 2, 1, 1),
+	YUV_FMT(DRM_FORMAT_YUV420, 3, 2, 2, 0),
+	YUV_FMT(DRM_FORMAT_YVU420, 3, 2, 2, 1),
+	YUV_FMT(DRM_FORMAT_YUV422, 3, 2, 1, 0),
+	YUV_FMT(DRM_FORMAT_YVU422, 3, 2, 1, 1),
+	PACKED_FMT(DRM_FORMAT_YUYV, 0, 0),
+	PACKED_FMT(DRM_FORMAT_YVYU, 0, 1),
+	PACKED_FMT(DRM_FORMAT_UYVY, 1, 0),
+	PACKED_FMT(DRM_FORMAT_VYUY, 1, 1),
+};
+
+drm_private const struct rga_format *rga_format_lookup(uint32_t fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(rga_formats) / sizeof(rga_formats[0]); i++)
+		if (rga_formats[i].fourcc == fourcc)
+			return &rga_formats[i];
+
+	return NULL;
+}
+
+/*
+ * rga_format_index - small dense number of a format from rga_format_lookup().
+ */
+drm_private unsigned int rga_format_index(const struct rga_format *fmt)
+{
+	return fmt - rga_formats;
+}
+
+/*
+ * A pixel in the working color space of an operation: R, G, B when the
+ * destination is RGB, Y, U, V when the destination is YUV.
+ */
+struct rga_px {
+	uint8_t c[3];
+	uint8_t a;
+};
+
+/*
+ * CPU view of an rga_image.
+ *
+ * @base: start of the mapping.
+ * @size: usable size of the mapping.
+ * @map_size: length to munmap(), zero for user pointers and cached maps.
+ * @fd: dma-buf to bracket the access with, -1 for user pointers.
+ * @import, @entry: import cache entry the mapping was borrowed from.
+ * @plane: start of Y/RGB, U and V, V is NULL for semi-planar formats.
+ * @pitch: stride of every plane in bytes.
+ */
+struct rga_cpu_buf {
+	const struct rga_format	*fmt;
+	uint8_t			*base;
+	size_t			size;
+	size_t			map_size;
+	int			fd;
+	struct rga_import	*import;
+	struct rga_import_entry	*entry;
+	uint8_t			*plane[3];
+	unsigned int		pitch[3];
+};
+
+static void rga_cpu_sync(struct rga_cpu_buf *buf, uint64_t flags)
+{
+	struct rockchip_dma_buf_sync sync = {
+		.flags = flags,
+	};
+
+	if (buf->fd < 0)
+		return;
+
+	/* Older kernels lack the ioctl, mmap is coherent there anyway */
+	ioctl(buf->fd, ROCKCHIP_DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+static void rga_cpu_unmap(struct rga_cpu_buf *buf, int write)
+{
+	rga_cpu_sync(buf, ROCKCHIP_DMA_BUF_SYNC_END |
+		     ROCKCHIP_DMA_BUF_SYNC_READ |
+		     (write ? ROCKCHIP_DMA_BUF_SYNC_WRITE : 0));
+
+	if (buf->entry)
+		rga_import_put(buf->import, buf->entry);
+	if (buf->map_size)
+		munmap(buf->base, buf->map_size);
+	buf->entry = NULL;
+	buf->map_size = 0;
+}
+
+/*
+ * rga_cpu_map - map an rga_image for CPU access.
+ *
+ * The plane layout follows rga_get_addr_offset(): the image starts at its
+ * offset, the chroma planes at width * height past that, semi-planar
+ * chroma uses the luma stride and planar chroma half of it. dma-bufs are
+ * mapped through the import cache when there is one.
+ */
+static int rga_cpu_map(struct rga_import *import, const struct rga_image *img,
+		       int write, struct rga_cpu_buf *buf)
+{
+	const struct rga_format *fmt = rga_format_lookup(img->color_mode);
+	size_t need, luma = (size_t)img->width * img->height;
+	unsigned int uv_pitch;
+	uint8_t *start;
+
+	memset(buf, 0, sizeof(*buf));
+	buf->fd = -1;
+
+	if (!fmt) {
+		fprintf(stderr, "Unsupport color format %08x for cpu.\n",
+			img->color_mode);
+		return -EINVAL;
+	}
+	buf->fmt = fmt;
+
+	if (img->buf_type == RGA_IMGBUF_USERPTR) {
+		buf->base = (uint8_t *)img->user_ptr[0].userptr;
+		buf->size = img->user_ptr[0].size;
+	} else if (import && (buf->base = rga_import_map(import, img->bo[0],
+							 &buf->size,
+							 &buf->entry))) {
+		buf->import = import;
+		buf->fd = img->bo[0];
+	} else {
+		off_t size = lseek(img->bo[0], 0, SEEK_END);
+
+		if (size <= 0) {
+			fprintf(stderr, "failed to size dma-buf %d.\n",
+				img->bo[0]);
+			return -EINVAL;
+		}
+
+		buf->base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED, img->bo[0], 0);
+		if (buf->base == MAP_FAILED) {
+			fprintf(stderr, "failed to mmap dma-buf[%s].\n",
+				strerror(errno));
+			return -errno;
+		}
+
+		buf->size = size;
+		buf->map_size = size;
+		buf->fd = img->bo[0];
+	}
+
+	start = buf->base + img->offset;
+	buf->plane[0] = start;
+	buf->pitch[0] = img->stride;
+	need = (size_t)img->stride * img->height;
+
+	if (fmt->planes == 2) {
+		buf->plane[1] = start + luma;
+		buf->pitch[1] = img->stride;
+		need = luma + (size_t)img->stride * (img->height / fmt->ysub);
+	} else if (fmt->planes == 3) {
+		uv_pitch = img->stride / 2;
+		buf->plane[1] = start + luma;
+		buf->plane[2] = start + luma + luma / 4;
+		buf->pitch[1] = buf->pitch[2] = uv_pitch;
+		need = luma + luma / 4 +
+		       (size_t)uv_pitch * (img->height / fmt->ysub);
+		if (fmt->uv_swap) {
+			uint8_t *tmp = buf->plane[1];
+
+			buf->plane[1] = buf->plane[2];
+			buf->plane[2] = tmp;
+		}
+	}
+
+	need += img->offset;
+	if (!buf->base || need > buf->size) {
+		fprintf(stderr, "image exceeds its buffer (%zu > %zu).\n",
+			need, buf->size);
+		rga_cpu_unmap(buf, 0);
+		return -EINVAL;
+	}
+
+	rga_cpu_sync(buf, ROCKCHIP_DMA_BUF_SYNC_START |
+		     ROCKCHIP_DMA_BUF_SYNC_READ |
+		     (write ? ROCKCHIP_DMA_BUF_SYNC_WRITE : 0));
+
+	return 0;
+}
+
+static inline uint8_t rga_expand(uint32_t v, unsigned int bits)
+{
+	switch (bits) {
+	case 0:
+		return 0xff;
+	case 1:
+		return v ? 0xff : 0;
+	case 4:
+		return v * 0x11;
+	case 5:
+		return (v << 3) | (v >> 2);
+	case 6:
+		return (v << 2) | (v >> 4);
+	default:
+		return v;
+	}
+}
+
+static inline uint32_t rga_load(const uint8_t *p, unsigned int cpp)
+{
+	switch (cpp) {
+	case 4:
+		return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+	case 3:
+		return p[0] | p[1] << 8 | p[2] << 16;
+	default:
+		return p[0] | p[1] << 8;
+	}
+}
+
+static inline void rga_store(uint8_t *p, unsigned int cpp, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	if (cpp > 2)
+		p[2] = v >> 16;
+	if (cpp > 3)
+		p[3] = v >> 24;
+}
+
+#define CH_GET(fmt, v, ch) \
+	rga_expand(((v) >> (fmt)->ch.shift) & ((1u << (fmt)->ch.size) - 1), \
+		   (fmt)->ch.size)
+#define CH_PUT(fmt, c, ch) \
+	((fmt)->ch.size ? ((uint32_t)(c) >> (8 - (fmt)->ch.size)) << (fmt)->ch.shift : 0)
+
+static inline uint32_t rga_pack_rgb(const struct rga_format *fmt,
+				    const struct rga_px *px)
+{
+	return CH_PUT(fmt, px->c[0], r) | CH_PUT(fmt, px->c[1], g) |
+	       CH_PUT(fmt, px->c[2], b) | CH_PUT(fmt, px->a, a);
+}
+
+static inline uint8_t clamp8(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline void rga_rgb_to_yuv(struct rga_px *px)
+{
+	int r = px->c[0], g = px->c[1], b = px->c[2];
+
+	px->c[0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+	px->c[1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+	px->c[2] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+static inline void rga_yuv_to_rgb(struct rga_px *px)
+{
+	int c = px->c[0] - 16, d = px->c[1] - 128, e = px->c[2] - 128;
+
+	px->c[0] = clamp8((298 * c + 409 * e + 128) >> 8);
+	px->c[1] = clamp8((298 * c - 100 * d - 208 * e + 128) >> 8);
+	px->c[2] = clamp8((298 * c + 516 * d + 128) >> 8);
+}
+
+static inline void rga_fetch(const struct rga_cpu_buf *buf, unsigned int x,
+			     unsigned int y, int to_yuv, struct rga_px *px)
+{
+	const struct rga_format *fmt = buf->fmt;
+
+	if (fmt->packed) {
+		const uint8_t *p = buf->plane[0] + (size_t)y * buf->pitch[0] +
+				   (x & ~1) * 2;
+
+		px->c[0] = p[fmt->y_odd + (x & 1) * 2];
+		px->c[1] = p[!fmt->y_odd + (fmt->uv_swap ? 2 : 0)];
+		px->c[2] = p[!fmt->y_odd + (fmt->uv_swap ? 0 : 2)];
+		px->a = 0xff;
+		if (!to_yuv)
+			rga_yuv_to_rgb(px);
+		return;
+	}
+
+	if (fmt->planes == 1) {
+		uint32_t v = rga_load(buf->plane[0] + (size_t)y * buf->pitch[0] +
+				      x * fmt->cpp, fmt->cpp);
+
+		px->c[0] = CH_GET(fmt, v, r);
+		px->c[1] = CH_GET(fmt, v, g);
+		px->c[2] = CH_GET(fmt, v, b);
+		px->a = CH_GET(fmt, v, a);
+		if (to_yuv)
+			rga_rgb_to_yuv(px);
+		return;
+	}
+
+	px->c[0] = buf->plane[0][(size_t)y * buf->pitch[0] + x];
+	px->a = 0xff;
+	y /= fmt->ysub;
+	x /= fmt->xsub;
+	if (fmt->planes == 2) {
+		const uint8_t *uv = buf->plane[1] + (size_t)y * buf->pitch[1] + 2 * x;
+
+		px->c[1] = uv[fmt->uv_swap ? 1 : 0];
+		px->c[2] = uv[fmt->uv_swap ? 0 : 1];
+	} else {
+		px->c[1] = buf->plane[1][(size_t)y * buf->pitch[1] + x];
+		px->c[2] = buf->plane[2][(size_t)y * buf->pitch[2] + x];
+	}
+	if (!to_yuv)
+		rga_yuv_to_rgb(px);
+}
+
+/*
+ * rga_put_row - store a row of working-space pixels at (x, y).
+ *
+ * Chroma is point sampled: each subsampled chroma position takes the
+ * value of the pixel at its top-left corner, if that pixel is part of
+ * the row.
+ */
+static void rga_put_row(struct rga_cpu_buf *buf, unsigned int x,
+			unsigned int y, const struct rga_px *row,
+			unsigned int w)
+{
+	const struct rga_format *fmt = buf->fmt;
+	unsigned int i;
+
+	if (fmt->planes == 1) {
+		uint8_t *p = buf->plane[0] + (size_t)y * buf->pitch[0] +
+			     x * fmt->cpp;
+
+		for (i = 0; i < w; i++, p += fmt->cpp)
+			rga_store(p, fmt->cpp, rga_pack_rgb(fmt, &row[i]));
+		return;
+	}
+
+	for (i = 0; i < w; i++)
+		buf->plane[0][(size_t)y * buf->pitch[0] + x + i] = row[i].c[0];
+
+	if (y % fmt->ysub)
+		return;
+
+	y /= fmt->ysub;
+	for (i = (x % fmt->xsub) ? fmt->xsub - x % fmt->xsub : 0; i < w;
+	     i += fmt->xsub) {
+		unsigned int cx = (x + i) / fmt->xsub;
+
+		if (fmt->planes == 2) {
+			uint8_t *uv = buf->plane[1] + (size_t)y * buf->pitch[1] + 2 * cx;
+
+			uv[fmt->uv_swap ? 1 : 0] = row[i].c[1];
+			uv[fmt->uv_swap ? 0 : 1] = row[i].c[2];
+		} else {
+			buf->plane[1][(size_t)y * buf->pitch[1] + cx] = row[i].c[1];
+			buf->plane[2][(size_t)y * buf->pitch[2] + cx] = row[i].c[2];
+		}
+	}
+}
+
+static int rga_cpu_fill(struct rga_import *import, const struct rga_op *op)
+{
+	const struct rga_cpu_kernels *k = rga_cpu_get_kernels();
+	const struct rga_image *img = &op->dst;
+	struct rga_cpu_buf dst;
+	struct rga_px px;
+	unsigned int i;
+	int ret;
+
+	ret = rga_cpu_map(import, img, 1, &dst);
+	if (ret)
+		return ret;
+
+	/* fill_color is always given as ARGB8888 */
+	px.a = img->fill_color >> 24;
+	px.c[0] = img->fill_color >> 16;
+	px.c[1] = img->fill_color >> 8;
+	px.c[2] = img->fill_color;
+
+	if (dst.fmt->planes == 1 && dst.fmt->cpp == 4) {
+		uint32_t v = rga_pack_rgb(dst.fmt, &px);
+
+		for (i = 0; i < op->dst_h; i++)
+			k->fill32((uint32_t *)(dst.plane[0] +
+					       (size_t)(op->dst_y + i) * dst.pitch[0]) +
+				  op->dst_x, v, op->dst_w);
+	} else {
+		struct rga_px *row = malloc(op->dst_w * sizeof(*row));
+
+		if (!row) {
+			rga_cpu_unmap(&dst, 1);
+			return -ENOMEM;
+		}
+
+		if (dst.fmt->planes > 1)
+			rga_rgb_to_yuv(&px);
+		for (i = 0; i < op->dst_w; i++)
+			row[i] = px;
+		for (i = 0; i < op->dst_h; i++)
+			rga_put_row(&dst, op->dst_x, op->dst_y + i, row,
+				    op->dst_w);
+		free(row);
+	}
+
+	rga_cpu_unmap(&dst, 1);
+
+	return 0;
+}
+
+/*
+ * Straight copy between identical formats: one memcpy per row and plane.
+ */
+static void rga_cpu_copy(const struct rga_op *op, struct rga_cpu_buf *src,
+			 struct rga_cpu_buf *dst)
+{
+	const struct rga_format *fmt = dst->fmt;
+	unsigned int i, p;
+
+	for (i = 0; i < op->dst_h; i++)
+		memcpy(dst->plane[0] + (size_t)(op->dst_y + i) * dst->pitch[0] +
+		       op->dst_x * fmt->cpp,
+		       src->plane[0] + (size_t)(op->src_y + i) * src->pitch[0] +
+		       op->src_x * fmt->cpp, op->dst_w * fmt->cpp);
+
+	for (p = 1; p < fmt->planes; p++) {
+		unsigned int cpp = (fmt->planes == 2) ? 2 : 1;
+
+		for (i = 0; i < op->dst_h / fmt->ysub; i++)
+			memcpy(dst->plane[p] +
+			       (size_t)(op->dst_y / fmt->ysub + i) * dst->pitch[p] +
+			       op->dst_x / fmt->xsub * cpp,
+			       src->plane[p] +
+			       (size_t)(op->src_y / fmt->ysub + i) * src->pitch[p] +
+			       op->src_x / fmt->xsub * cpp,
+			       op->dst_w / fmt->xsub * cpp);
+	}
+}
+
+#define ROW32(buf, x, y) \
+	((uint32_t *)((buf)->plane[0] + (size_t)(y) * (buf)->pitch[0]) + (x))
+
+/*
+ * Rotation and mirroring of 32-bit pixels without scaling.
+ */
+static void rga_cpu_rotate32(const struct rga_op *op, struct rga_cpu_buf *src,
+			     struct rga_cpu_buf *dst)
+{
+	const struct rga_cpu_kernels *k = rga_cpu_get_kernels();
+	int dst_stride = dst->pitch[0] / 4, src_stride = src->pitch[0] / 4;
+	unsigned int i;
+
+	if (op->degree == 90) {
+		k->rotate32(ROW32(dst, op->dst_x, op->dst_y), dst_stride,
+			    ROW32(src, op->src_x, op->src_y), src_stride,
+			    op->src_w, op->src_h, 1);
+	} else if (op->degree == 270) {
+		k->rotate32(ROW32(dst, op->dst_x, op->dst_y + op->dst_h - 1),
+			    -dst_stride, ROW32(src, op->src_x, op->src_y),
+			    src_stride, op->src_w, op->src_h, 0);
+	} else {
+		int hflip = (op->degree == 180) ^ !!op->x_mirr;
+		int vflip = (op->degree == 180) ^ !!op->y_mirr;
+
+		for (i = 0; i < op->dst_h; i++) {
+			uint32_t *d = ROW32(dst, op->dst_x, op->dst_y + i);
+			uint32_t *s = ROW32(src, op->src_x, op->src_y +
+					    (vflip ? op->src_h - 1 - i : i));
+
+			if (hflip)
+				k->reverse32(d, s, op->dst_w);
+			else
+				memcpy(d, s, op->dst_w * 4);
+		}
+	}
+}
+
+static void rga_cpu_yuv_to_rgb32(const struct rga_op *op,
+				 struct rga_cpu_buf *src,
+				 struct rga_cpu_buf *dst)
+{
+	const struct rga_cpu_kernels *k = rga_cpu_get_kernels();
+	const uint8_t shifts[4] = {
+		dst->fmt->r.shift, dst->fmt->g.shift,
+		dst->fmt->b.shift, dst->fmt->a.shift,
+	};
+	unsigned int i;
+
+	for (i = 0; i < op->dst_h; i++) {
+		unsigned int sy = op->src_y + i;
+
+		k->yuv_to_rgb32(ROW32(dst, op->dst_x, op->dst_y + i),
+				src->plane[0] + (size_t)sy * src->pitch[0] + op->src_x,
+				src->plane[1] + (size_t)(sy / 2) * src->pitch[1] + op->src_x,
+				op->dst_w, src->fmt->uv_swap, shifts);
+	}
+}
+
+static void rga_cpu_rgb32_to_yuv(const struct rga_op *op,
+				 struct rga_cpu_buf *src,
+				 struct rga_cpu_buf *dst)
+{
+	const struct rga_cpu_kernels *k = rga_cpu_get_kernels();
+	const uint8_t shifts[3] = {
+		src->fmt->r.shift, src->fmt->g.shift, src->fmt->b.shift,
+	};
+	unsigned int i;
+
+	for (i = 0; i < op->dst_h; i += 2) {
+		unsigned int dy = op->dst_y + i;
+		int last = (i + 1 == op->dst_h);
+
+		k->rgb32_to_yuv(dst->plane[0] + (size_t)dy * dst->pitch[0] + op->dst_x,
+				last ? NULL : dst->plane[0] + (size_t)(dy + 1) * dst->pitch[0] + op->dst_x,
+				dst->plane[1] + (size_t)(dy / 2) * dst->pitch[1] + op->dst_x,
+				ROW32(src, op->src_x, op->src_y + i),
+				ROW32(src, op->src_x, op->src_y + i + (last ? 0 : 1)),
+				op->dst_w, dst->fmt->uv_swap, shifts);
+	}
+}
+
+/*
+ * Packed 4:2:2 YUV to semi-planar YUV, chroma of 4:2:0 destinations is
+ * taken from the even rows like rga_put_row() does.
+ */
+static void rga_cpu_packed_to_yuv(const struct rga_op *op,
+				  struct rga_cpu_buf *src,
+				  struct rga_cpu_buf *dst)
+{
+	const struct rga_cpu_kernels *k = rga_cpu_get_kernels();
+	const struct rga_format *sf = src->fmt, *df = dst->fmt;
+	unsigned int i;
+
+	for (i = 0; i < op->dst_h; i++) {
+		unsigned int dy = op->dst_y + i;
+		uint8_t *uv = NULL;
+
+		if (dy % df->ysub == 0)
+			uv = dst->plane[1] + (size_t)(dy / df->ysub) * dst->pitch[1] +
+			     op->dst_x;
+
+		k->packed_to_yuv(dst->plane[0] + (size_t)dy * dst->pitch[0] + op->dst_x,
+				 uv, src->plane[0] + (size_t)(op->src_y + i) * src->pitch[0] +
+				 op->src_x * 2, op->dst_w, sf->y_odd,
+				 sf->uv_swap != df->uv_swap);
+	}
+}
+
+/*
+ * Packed 4:2:2 YUV to 32-bit RGB, one row at a time through a semi-planar
+ * scratch row that stays in the L1 cache.
+ */
+static int rga_cpu_packed_to_rgb32(const struct rga_op *op,
+				   struct rga_cpu_buf *src,
+				   struct rga_cpu_buf *dst)
+{
+	const struct rga_cpu_kernels *k = rga_cpu_get_kernels();
+	const uint8_t shifts[4] = {
+		dst->fmt->r.shift, dst->fmt->g.shift,
+		dst->fmt->b.shift, dst->fmt->a.shift,
+	};
+	unsigned int i;
+	uint8_t *y;
+
+	y = malloc(2 * op->dst_w);
+	if (!y)
+		return -ENOMEM;
+
+	for (i = 0; i < op->dst_h; i++) {
+		k->packed_to_yuv(y, y + op->dst_w,
+				 src->plane[0] + (size_t)(op->src_y + i) * src->pitch[0] +
+				 op->src_x * 2, op->dst_w, src->fmt->y_odd,
+				 src->fmt->uv_swap);
+		k->yuv_to_rgb32(ROW32(dst, op->dst_x, op->dst_y + i), y,
+				y + op->dst_w, op->dst_w, 0, shifts);
+	}
+
+	free(y);
+
+	return 0;
+}
+
+/*
+ * Nearest neighbour scaling of 32-bit pixels, rows that sample the same
+ * source row are copied from the previous output row.
+ */
+static int rga_cpu_scale32(const struct rga_op *op, struct rga_cpu_buf *src,
+			   struct rga_cpu_buf *dst)
+{
+	unsigned int *xmap, i, j, prev = ~0u;
+
+	xmap = malloc(op->dst_w * sizeof(*xmap));
+	if (!xmap)
+		return -ENOMEM;
+
+	for (j = 0; j < op->dst_w; j++)
+		xmap[j] = (unsigned int)(((2ull * j + 1) * op->src_w) /
+					 (2ull * op->dst_w));
+
+	for (i = 0; i < op->dst_h; i++) {
+		unsigned int sy = (unsigned int)(((2ull * i + 1) * op->src_h) /
+						 (2ull * op->dst_h));
+		uint32_t *d = ROW32(dst, op->dst_x, op->dst_y + i);
+		const uint32_t *s = ROW32(src, op->src_x, op->src_y + sy);
+
+		if (sy == prev) {
+			memcpy(d, ROW32(dst, op->dst_x, op->dst_y + i - 1),
+			       op->dst_w * 4);
+			continue;
+		}
+
+		for (j = 0; j < op->dst_w; j++)
+			d[j] = s[xmap[j]];
+		prev = sy;
+	}
+
+	free(xmap);
+
+	return 0;
+}
+
+static inline unsigned int rga_scale_pos(unsigned int pos, unsigned int from,
+					 unsigned int to)
+{
+	return (unsigned int)(((2ull * pos + 1) * to) / (2ull * from));
+}
+
+/*
+ * rga_cpu_generic - reference implementation of rga_multiple_transform().
+ *
+ * The output is rotated clockwise by @degree and then mirrored, which is
+ * the order rga_lookup_draw_pos() programs the hardware start point in.
+ * Scaling is nearest neighbour; the RGA filters, so scaled output may
+ * differ from the hardware by the filter kernel but never by geometry.
+ */
+static int rga_cpu_generic(const struct rga_op *op, struct rga_cpu_buf *src,
+			   struct rga_cpu_buf *dst)
+{
+	int rot = (op->degree == 90 || op->degree == 270);
+	unsigned int sw = rot ? op->dst_h : op->dst_w;
+	unsigned int sh = rot ? op->dst_w : op->dst_h;
+	int to_yuv = dst->fmt->planes > 1;
+	unsigned int *umap, *vmap, i, j;
+	struct rga_px *row;
+
+	umap = malloc(op->dst_w * sizeof(*umap));
+	vmap = malloc(op->dst_h * sizeof(*vmap));
+	row = malloc(op->dst_w * sizeof(*row));
+	if (!umap || !vmap || !row) {
+		free(umap);
+		free(vmap);
+		free(row);
+		return -ENOMEM;
+	}
+
+	/*
+	 * For 0/180 degree umap holds source columns and vmap source rows,
+	 * for 90/270 degree it is the other way around.
+	 */
+	for (j = 0; j < op->dst_w; j++) {
+		unsigned int u = op->x_mirr ? op->dst_w - 1 - j : j;
+
+		switch (op->degree) {
+		case 90:
+			umap[j] = rga_scale_pos(sh - 1 - u, sh, op->src_h);
+			break;
+		case 180:
+			umap[j] = rga_scale_pos(sw - 1 - u, sw, op->src_w);
+			break;
+		case 270:
+			umap[j] = rga_scale_pos(u, sh, op->src_h);
+			break;
+		default:
+			umap[j] = rga_scale_pos(u, sw, op->src_w);
+			break;
+		}
+	}
+
+	for (i = 0; i < op->dst_h; i++) {
+		unsigned int v = op->y_mirr ? op->dst_h - 1 - i : i;
+
+		switch (op->degree) {
+		case 90:
+			vmap[i] = rga_scale_pos(v, sw, op->src_w);
+			break;
+		case 180:
+			vmap[i] = rga_scale_pos(sh - 1 - v, sh, op->src_h);
+			break;
+		case 270:
+			vmap[i] = rga_scale_pos(sw - 1 - v, sw, op->src_w);
+			break;
+		default:
+			vmap[i] = rga_scale_pos(v, sh, op->src_h);
+			break;
+		}
+	}
+
+	for (i = 0; i < op->dst_h; i++) {
+		for (j = 0; j < op->dst_w; j++) {
+			unsigned int sx = rot ? vmap[i] : umap[j];
+			unsigned int sy = rot ? umap[j] : vmap[i];
+
+			rga_fetch(src, op->src_x + sx, op->src_y + sy, to_yuv,
+				  &row[j]);
+		}
+		rga_put_row(dst, op->dst_x, op->dst_y + i, row, op->dst_w);
+	}
+
+	free(umap);
+	free(vmap);
+	free(row);
+
+	return 0;
+}
+
+static int rga_is_rgb32(const struct rga_format *fmt)
+{
+	return fmt->planes == 1 && fmt->cpp == 4;
+}
+
+static int rga_cpu_transform(struct rga_import *import,
+			     const struct rga_op *op)
+{
+	struct rga_cpu_buf src, dst;
+	const struct rga_format *sf, *df;
+	int rot = (op->degree == 90 || op->degree == 270);
+	int scaled, even, ret;
+
+	ret = rga_cpu_map(import, &op->src, 0, &src);
+	if (ret)
+		return ret;
+
+	ret = rga_cpu_map(import, &op->dst, 1, &dst);
+	if (ret) {
+		rga_cpu_unmap(&src, 0);
+		return ret;
+	}
+
+	sf = src.fmt;
+	df = dst.fmt;
+	scaled = rot ? (op->src_w != op->dst_h || op->src_h != op->dst_w) :
+		       (op->src_w != op->dst_w || op->src_h != op->dst_h);
+	even = !((op->src_x | op->src_y | op->dst_x | op->dst_y |
+		  op->dst_w | op->dst_h) & 1);
+
+	if (sf == df && !scaled && !op->degree && !op->x_mirr &&
+	    !op->y_mirr && (sf->planes == 1 || even))
+		rga_cpu_copy(op, &src, &dst);
+	else if (sf == df && rga_is_rgb32(sf) && !scaled &&
+		 (!rot || (!op->x_mirr && !op->y_mirr)))
+		rga_cpu_rotate32(op, &src, &dst);
+	else if (sf == df && rga_is_rgb32(sf) && !op->degree &&
+		 !op->x_mirr && !op->y_mirr)
+		ret = rga_cpu_scale32(op, &src, &dst);
+	else if (sf->planes == 2 && sf->ysub == 2 && rga_is_rgb32(df) &&
+		 !scaled && !op->degree && !op->x_mirr && !op->y_mirr &&
+		 !((op->src_x | op->src_y) & 1))
+		rga_cpu_yuv_to_rgb32(op, &src, &dst);
+	else if (sf->packed && df->planes == 2 && df->xsub == 2 &&
+		 !scaled && !op->degree && !op->x_mirr && !op->y_mirr &&
+		 !((op->src_x | op->dst_x | op->dst_w) & 1))
+		rga_cpu_packed_to_yuv(op, &src, &dst);
+	else if (sf->packed && rga_is_rgb32(df) && !scaled && !op->degree &&
+		 !op->x_mirr && !op->y_mirr && !((op->src_x | op->dst_w) & 1))
+		ret = rga_cpu_packed_to_rgb32(op, &src, &dst);
+	else if (rga_is_rgb32(sf) && df->planes == 2 && df->ysub == 2 &&
+		 !scaled && !op->degree && !op->x_mirr && !op->y_mirr &&
+		 !((op->dst_x | op->dst_y) & 1))
+		rga_cpu_rgb32_to_yuv(op, &src, &dst);
+	else
+		ret = rga_cpu_generic(op, &src, &dst);
+
+	rga_cpu_unmap(&dst, 1);
+	rga_cpu_unmap(&src, 0);
+
+	return ret;
+}
+
+/*
+ * rga_cpu_supported - check whether the CPU engine can run an operation.
+ *
+ * @op: a queued operation.
+ */
+drm_private int rga_cpu_supported(const struct rga_op *op)
+{
+	const struct rga_format *fmt = rga_format_lookup(op->dst.color_mode);
+
+	/* Packed YUV is a source format only */
+	if (!fmt || fmt->packed)
+		return 0;
+
+	if (op->type == RGA_OP_TRANSFORM &&
+	    !rga_format_lookup(op->src.color_mode))
+		return 0;
+
+	return 1;
+}
+
+/*
+ * rga_cpu_exec_op - run an operation on the CPU.
+ *
+ * @import: import cache to map dma-bufs through, may be NULL.
+ * @op: a queued operation.
+ */
+drm_private int rga_cpu_exec_op(struct rga_import *import,
+				const struct rga_op *op)
+{
+	if (op->dst_w == 0 || op->dst_h == 0)
+		return 0;
+
+	if (op->type == RGA_OP_FILL)
+		return rga_cpu_fill(import, op);
+
+	return rga_cpu_transform(import, op);
+}
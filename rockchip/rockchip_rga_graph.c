@@ -0,0 +1,650 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * @img: the image, for intermediates filled in when a buffer is assigned.
+ * @intermediate: owned by the graph, backed by a pool buffer while live.
+ * @size: bytes an intermediate needs.
+ * @buf: pool buffer of a live intermediate.
+ */
+struct rga_graph_image {
+	struct rga_image	img;
+	int			intermediate;
+	size_t			size;
+	struct rga_buf		*buf;
+};
+
+struct rga_graph_node {
+	enum rga_op_type	type;
+	int			src, dst;
+	struct rga_rect		src_rect, dst_rect;
+	unsigned int		degree;
+	unsigned int		x_mirr, y_mirr;
+	unsigned int		fill_color;
+};
+
+struct rga_graph {
+	struct rga_context	*ctx;
+
+	struct rga_graph_image	images[RGA_GRAPH_MAX_IMAGES];
+	unsigned int		image_nr;
+	struct rga_graph_node	nodes[RGA_GRAPH_MAX_NODES];
+	unsigned int		node_nr;
+
+	struct rga_buf		*pool[RGA_GRAPH_POOL_MAX];
+	unsigned int		pool_nr;
+	/* buffers the pool had no room for, freed once nothing queued uses them */
+	struct rga_buf		*spill[RGA_GRAPH_MAX_IMAGES];
+	unsigned int		spill_nr;
+};
+
+/*
+ * rga_graph_buf_get - the smallest pooled buffer of at least @size bytes,
+ *	or a new one.
+ */
+static int rga_graph_buf_get(struct rga_graph *graph, size_t size,
+			     struct rga_buf **bufp)
+{
+	unsigned int i, best = graph->pool_nr;
+
+	for (i = 0; i < graph->pool_nr; i++) {
+		if (graph->pool[i]->size < size)
+			continue;
+		if (best == graph->pool_nr ||
+		    graph->pool[i]->size < graph->pool[best]->size)
+			best = i;
+	}
+
+	if (best == graph->pool_nr)
+		return rga_buf_alloc(graph->ctx, size, bufp);
+
+	*bufp = graph->pool[best];
+	graph->pool[best] = graph->pool[--graph->pool_nr];
+
+	return 0;
+}
+
+/*
+ * rga_graph_buf_put - return a buffer to the pool. Queued operations may
+ *	still use it, so one the pool drops is only freed by
+ *	rga_graph_buf_flush().
+ */
+static void rga_graph_buf_put(struct rga_graph *graph,
+			      struct rga_buf *buf)
+{
+	unsigned int i, smallest = 0;
+
+	if (graph->pool_nr < RGA_GRAPH_POOL_MAX) {
+		graph->pool[graph->pool_nr++] = buf;
+		return;
+	}
+
+	/* Full, keep the larger buffers as they can back more images */
+	for (i = 1; i < graph->pool_nr; i++)
+		if (graph->pool[i]->size < graph->pool[smallest]->size)
+			smallest = i;
+
+	if (graph->pool[smallest]->size < buf->size) {
+		graph->spill[graph->spill_nr++] = graph->pool[smallest];
+		graph->pool[smallest] = buf;
+	} else {
+		graph->spill[graph->spill_nr++] = buf;
+	}
+}
+
+/*
+ * rga_graph_buf_flush - free the buffers the pool dropped, once the
+ *	operations queued with them were executed or discarded.
+ */
+static void rga_graph_buf_flush(struct rga_graph *graph)
+{
+	while (graph->spill_nr)
+		rga_buf_free(graph->ctx, graph->spill[--graph->spill_nr]);
+}
+
+/*
+ * Orientations as 2x2 matrices on y-down coordinates: an operation first
+ * rotates clockwise, then mirrors, like rga_lookup_draw_pos() does.
+ */
+struct rga_orient {
+	int			m[2][2];
+};
+
+static void rga_orient_mul(const struct rga_orient *a,
+			   const struct rga_orient *b, struct rga_orient *out)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < 2; j++)
+			out->m[i][j] = a->m[i][0] * b->m[0][j] +
+				       a->m[i][1] * b->m[1][j];
+}
+
+static void rga_orient_get(unsigned int degree, unsigned int x_mirr,
+			   unsigned int y_mirr, struct rga_orient *out)
+{
+	static const struct rga_orient rot90 = { { { 0, -1 }, { 1, 0 } } };
+	struct rga_orient o = { { { 1, 0 }, { 0, 1 } } }, tmp;
+	unsigned int i;
+
+	for (i = 0; i < degree / 90; i++) {
+		rga_orient_mul(&rot90, &o, &tmp);
+		o = tmp;
+	}
+
+	if (x_mirr) {
+		o.m[0][0] = -o.m[0][0];
+		o.m[0][1] = -o.m[0][1];
+	}
+	if (y_mirr) {
+		o.m[1][0] = -o.m[1][0];
+		o.m[1][1] = -o.m[1][1];
+	}
+
+	*out = o;
+}
+
+/*
+ * rga_graph_compose - orientation of @b applied after @a, as one rotation
+ *	and an optional horizontal mirror.
+ */
+static void rga_graph_compose(const struct rga_graph_node *a,
+			      const struct rga_graph_node *b,
+			      struct rga_graph_node *out)
+{
+	struct rga_orient oa, ob, o, c;
+	unsigned int degree, x_mirr;
+
+	rga_orient_get(a->degree, a->x_mirr, a->y_mirr, &oa);
+	rga_orient_get(b->degree, b->x_mirr, b->y_mirr, &ob);
+	rga_orient_mul(&ob, &oa, &o);
+
+	for (x_mirr = 0; x_mirr < 2; x_mirr++) {
+		for (degree = 0; degree < 360; degree += 90) {
+			rga_orient_get(degree, x_mirr, 0, &c);
+			if (!memcmp(&c, &o, sizeof(c))) {
+				out->degree = degree;
+				out->x_mirr = x_mirr;
+				out->y_mirr = 0;
+				return;
+			}
+		}
+	}
+}
+
+static int rga_graph_writes(const struct rga_graph_node *node, int image)
+{
+	return node->dst == image;
+}
+
+static int rga_graph_reads(const struct rga_graph_node *node, int image)
+{
+	return node->type == RGA_OP_TRANSFORM && node->src == image;
+}
+
+/*
+ * rga_graph_fuse - merge a transform into an intermediate with the only
+ *	transform reading all of it back, so the intermediate is never
+ *	written. Scaling, rotation, mirroring and format conversion of both
+ *	are done by one pass of the RGA.
+ *
+ * Returns the number of nodes removed.
+ */
+static unsigned int rga_graph_fuse(struct rga_graph *graph,
+				   struct rga_graph_node *nodes,
+				   unsigned int *nr)
+{
+	unsigned int i, a = 0, b = 0, k, fused = 0;
+	int image;
+
+again:
+	for (image = 0; image < (int)graph->image_nr; image++) {
+		unsigned int writers = 0, readers = 0;
+
+		if (!graph->images[image].intermediate)
+			continue;
+
+		for (i = 0; i < *nr; i++) {
+			if (rga_graph_writes(&nodes[i], image)) {
+				writers++;
+				a = i;
+			}
+			if (rga_graph_reads(&nodes[i], image)) {
+				readers++;
+				b = i;
+			}
+		}
+
+		if (writers != 1 || readers != 1 || b < a ||
+		    nodes[a].type != RGA_OP_TRANSFORM ||
+		    memcmp(&nodes[a].dst_rect, &nodes[b].src_rect,
+			   sizeof(nodes[a].dst_rect)))
+			continue;
+
+		/* The source of the first one must not change in between */
+		for (k = a + 1; k < b; k++)
+			if (rga_graph_writes(&nodes[k], nodes[a].src))
+				break;
+		if (k < b)
+			continue;
+
+		rga_graph_compose(&nodes[a], &nodes[b], &nodes[b]);
+		nodes[b].src = nodes[a].src;
+		nodes[b].src_rect = nodes[a].src_rect;
+
+		memmove(&nodes[a], &nodes[a + 1],
+			(*nr - a - 1) * sizeof(nodes[0]));
+		(*nr)--;
+		fused++;
+		goto again;
+	}
+
+	return fused;
+}
+
+/*
+ * rga_graph_order - sort nodes by dependency level, keeping the order
+ *	within a level. A node depends on the last writer of its source and
+ *	destination and on the readers of its destination since.
+ */
+static void rga_graph_order(struct rga_graph_node *nodes, unsigned int nr)
+{
+	struct rga_graph_node sorted[RGA_GRAPH_MAX_NODES];
+	unsigned int level[RGA_GRAPH_MAX_NODES];
+	unsigned int i, j, n = 0, max = 0, l;
+
+	for (i = 0; i < nr; i++) {
+		level[i] = 0;
+
+		for (j = 0; j < i; j++) {
+			if (!rga_graph_writes(&nodes[j], nodes[i].dst) &&
+			    !rga_graph_reads(&nodes[j], nodes[i].dst) &&
+			    !(nodes[i].type == RGA_OP_TRANSFORM &&
+			      rga_graph_writes(&nodes[j], nodes[i].src)))
+				continue;
+
+			if (level[j] + 1 > level[i])
+				level[i] = level[j] + 1;
+		}
+
+		if (level[i] > max)
+			max = level[i];
+	}
+
+	for (l = 0; l <= max; l++)
+		for (i = 0; i < nr; i++)
+			if (level[i] == l)
+				sorted[n++] = nodes[i];
+
+	memcpy(nodes, sorted, nr * sizeof(nodes[0]));
+}
+
+static int rga_graph_queue(struct rga_graph *graph,
+			   const struct rga_graph_node *node)
+{
+	struct rga_context *ctx = graph->ctx;
+	struct rga_image *dst = &graph->images[node->dst].img;
+	int ret;
+
+	if (ctx->op_nr >= RGA_MAX_CMD_LIST_NR) {
+		ret = rga_exec(ctx);
+		if (ret)
+			return ret;
+
+		rga_graph_buf_flush(graph);
+	}
+
+	if (node->type == RGA_OP_FILL) {
+		dst->fill_color = node->fill_color;
+		return rga_solid_fill(ctx, dst, node->dst_rect.x,
+				      node->dst_rect.y, node->dst_rect.w,
+				      node->dst_rect.h);
+	}
+
+	return rga_multiple_transform(ctx, &graph->images[node->src].img, dst,
+				      node->src_rect.x, node->src_rect.y,
+				      node->src_rect.w, node->src_rect.h,
+				      node->dst_rect.x, node->dst_rect.y,
+				      node->dst_rect.w, node->dst_rect.h,
+				      node->degree, node->x_mirr,
+				      node->y_mirr);
+}
+
+static int rga_graph_rect_check(const struct rga_graph *graph, int image,
+				const struct rga_rect *rect)
+{
+	const struct rga_image *img;
+
+	if (image < 0 || image >= (int)graph->image_nr)
+		return -EINVAL;
+
+	img = &graph->images[image].img;
+	if (!rect->w || !rect->h || rect->x + rect->w > img->width ||
+	    rect->y + rect->h > img->height)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int rga_graph_add_node(struct rga_graph *graph,
+			      const struct rga_graph_node *node)
+{
+	if (graph->node_nr >= RGA_GRAPH_MAX_NODES) {
+		fprintf(stderr, "Overflow graph nodes.\n");
+		return -ENOSPC;
+	}
+
+	graph->nodes[graph->node_nr] = *node;
+
+	return graph->node_nr++;
+}
+
+/**
+ * rga_graph_create - create an empty job graph.
+ *
+ * @ctx: a pointer to rga_context structure the graph runs on.
+ */
+struct rga_graph *rga_graph_create(struct rga_context *ctx)
+{
+	struct rga_graph *graph;
+
+	graph = calloc(1, sizeof(*graph));
+	if (!graph) {
+		fprintf(stderr, "failed to allocate graph.\n");
+		return NULL;
+	}
+
+	graph->ctx = ctx;
+
+	return graph;
+}
+
+void rga_graph_destroy(struct rga_graph *graph)
+{
+	unsigned int i;
+
+	if (!graph)
+		return;
+
+	for (i = 0; i < graph->pool_nr; i++)
+		rga_buf_free(graph->ctx, graph->pool[i]);
+	free(graph);
+}
+
+/**
+ * rga_graph_reset - remove all images and nodes, keeping the buffers the
+ *	graph allocated for reuse.
+ *
+ * @graph: a pointer to rga_graph structure.
+ */
+void rga_graph_reset(struct rga_graph *graph)
+{
+	graph->image_nr = 0;
+	graph->node_nr = 0;
+}
+
+/**
+ * rga_graph_add_image - make an application image part of the graph.
+ *
+ * @graph: a pointer to rga_graph structure.
+ * @img: the image, copied.
+ *
+ * Returns the image id or a negative errno.
+ */
+int rga_graph_add_image(struct rga_graph *graph, struct rga_image *img)
+{
+	struct rga_graph_image *gi;
+
+	if (graph->image_nr >= RGA_GRAPH_MAX_IMAGES) {
+		fprintf(stderr, "Overflow graph images.\n");
+		return -ENOSPC;
+	}
+
+	gi = &graph->images[graph->image_nr];
+	memset(gi, 0, sizeof(*gi));
+	gi->img = *img;
+
+	return graph->image_nr++;
+}
+
+/**
+ * rga_graph_add_intermediate - add an image the graph allocates itself.
+ *
+ * @graph: a pointer to rga_graph structure.
+ * @color_mode: DRM fourcc of the image.
+ * @width, @height: size of the image.
+ *
+ * Its contents only live while rga_graph_run() executes, and it may share
+ * memory with other intermediates whose lifetimes do not overlap.
+ */
+int rga_graph_add_intermediate(struct rga_graph *graph,
+			       unsigned int color_mode, unsigned int width,
+			       unsigned int height)
+{
+	const struct rga_format *fmt = rga_format_lookup(color_mode);
+	struct rga_graph_image *gi;
+
+	if (!fmt || !width || !height) {
+		fprintf(stderr, "invalid intermediate image.\n");
+		return -EINVAL;
+	}
+
+	if (graph->image_nr >= RGA_GRAPH_MAX_IMAGES) {
+		fprintf(stderr, "Overflow graph images.\n");
+		return -ENOSPC;
+	}
+
+	gi = &graph->images[graph->image_nr];
+	memset(gi, 0, sizeof(*gi));
+	gi->intermediate = 1;
+	gi->img.color_mode = color_mode;
+	gi->img.width = width;
+	gi->img.height = height;
+	gi->img.stride = width * fmt->cpp;
+	gi->size = (size_t)gi->img.stride * height;
+	if (fmt->planes > 1)
+		gi->size += 2 * (size_t)((width + fmt->xsub - 1) / fmt->xsub) *
+			    ((height + fmt->ysub - 1) / fmt->ysub);
+
+	return graph->image_nr++;
+}
+
+/**
+ * rga_graph_add_fill - add a node filling a window of an image.
+ *
+ * @graph: a pointer to rga_graph structure.
+ * @dst: destination image id.
+ * @rect: window of @dst to fill.
+ * @color: ARGB8888 fill color.
+ *
+ * Returns the node id or a negative errno.
+ */
+int rga_graph_add_fill(struct rga_graph *graph, int dst,
+		       const struct rga_rect *rect, unsigned int color)
+{
+	struct rga_graph_node node;
+
+	if (rga_graph_rect_check(graph, dst, rect)) {
+		fprintf(stderr, "invalid graph fill.\n");
+		return -EINVAL;
+	}
+
+	memset(&node, 0, sizeof(node));
+	node.type = RGA_OP_FILL;
+	node.src = -1;
+	node.dst = dst;
+	node.dst_rect = *rect;
+	node.fill_color = color;
+
+	return rga_graph_add_node(graph, &node);
+}
+
+/**
+ * rga_graph_add_transform - add a node drawing a window of one image
+ *	into a window of another, like rga_multiple_transform().
+ *
+ * @graph: a pointer to rga_graph structure.
+ * @src, @dst: source and destination image ids.
+ * @src_rect, @dst_rect: source and destination windows.
+ * @degree, @x_mirr, @y_mirr: as for rga_multiple_transform().
+ *
+ * Nodes run as if in the order they were added. Returns the node id or a
+ * negative errno.
+ */
+int rga_graph_add_transform(struct rga_graph *graph, int src,
+			    const struct rga_rect *src_rect, int dst,
+			    const struct rga_rect *dst_rect,
+			    unsigned int degree, unsigned int x_mirr,
+			    unsigned int y_mirr)
+{
+	struct rga_graph_node node;
+
+	if (rga_graph_rect_check(graph, src, src_rect) ||
+	    rga_graph_rect_check(graph, dst, dst_rect) || src == dst ||
+	    (degree != 0 && degree != 90 && degree != 180 && degree != 270)) {
+		fprintf(stderr, "invalid graph transform.\n");
+		return -EINVAL;
+	}
+
+	memset(&node, 0, sizeof(node));
+	node.type = RGA_OP_TRANSFORM;
+	node.src = src;
+	node.dst = dst;
+	node.src_rect = *src_rect;
+	node.dst_rect = *dst_rect;
+	node.degree = degree;
+	node.x_mirr = !!x_mirr;
+	node.y_mirr = !!y_mirr;
+
+	return rga_graph_add_node(graph, &node);
+}
+
+/**
+ * rga_graph_run - execute every node of the graph.
+ *
+ * @graph: a pointer to rga_graph structure.
+ *
+ * Chains of transforms through intermediates are fused where possible,
+ * the remaining nodes are queued by dependency level and submitted in as
+ * few rga_exec() calls as the command queue allows. Intermediates get a
+ * pooled buffer from their first writer to their last reader. The graph
+ * can be run again, e.g. once per frame.
+ *
+ * Operations queued on the context before are not part of the graph, so
+ * the queue must be empty. On failure the operations of the graph that
+ * were not executed yet are discarded.
+ *
+ * Returns the number of operations executed or a negative errno.
+ */
+int rga_graph_run(struct rga_graph *graph)
+{
+	struct rga_graph_node nodes[RGA_GRAPH_MAX_NODES];
+	unsigned int last[RGA_GRAPH_MAX_IMAGES];
+	unsigned int i, nr = graph->node_nr;
+	int ret = 0, image;
+
+	if (!nr)
+		return 0;
+
+	if (graph->ctx->op_nr) {
+		fprintf(stderr, "graph run with operations queued.\n");
+		return -EBUSY;
+	}
+
+	memcpy(nodes, graph->nodes, nr * sizeof(nodes[0]));
+	rga_graph_fuse(graph, nodes, &nr);
+	rga_graph_order(nodes, nr);
+
+	memset(last, 0, sizeof(last));
+	for (i = 0; i < nr; i++) {
+		last[nodes[i].dst] = i;
+		if (nodes[i].type == RGA_OP_TRANSFORM)
+			last[nodes[i].src] = i;
+	}
+
+	for (i = 0; i < nr && !ret; i++) {
+		int used[2] = { nodes[i].dst, -1 };
+		unsigned int j;
+
+		if (nodes[i].type == RGA_OP_TRANSFORM)
+			used[1] = nodes[i].src;
+
+		for (j = 0; j < 2 && !ret; j++) {
+			struct rga_graph_image *gi;
+			struct rga_buf *buf;
+
+			if (used[j] < 0)
+				continue;
+
+			gi = &graph->images[used[j]];
+			if (!gi->intermediate || gi->buf)
+				continue;
+
+			ret = rga_graph_buf_get(graph, gi->size, &buf);
+			if (!ret) {
+				gi->buf = buf;
+				rga_buf_bind(buf, &gi->img);
+			}
+		}
+
+		if (!ret)
+			ret = rga_graph_queue(graph, &nodes[i]);
+
+		/*
+		 * Operations run in queue order, so a buffer can back the
+		 * next intermediate even before this batch was executed.
+		 */
+		for (image = 0; image < (int)graph->image_nr; image++) {
+			struct rga_graph_image *gi = &graph->images[image];
+
+			if (gi->buf && last[image] == i) {
+				rga_graph_buf_put(graph, gi->buf);
+				gi->buf = NULL;
+			}
+		}
+	}
+
+	if (!ret && graph->ctx->op_nr)
+		ret = rga_exec(graph->ctx);
+
+	/* Return what an error left bound */
+	for (image = 0; image < (int)graph->image_nr; image++) {
+		struct rga_graph_image *gi = &graph->images[image];
+
+		if (gi->buf) {
+			rga_graph_buf_put(graph, gi->buf);
+			gi->buf = NULL;
+		}
+	}
+
+	/* The queue only holds operations of the graph, see above */
+	if (ret)
+		graph->ctx->op_nr = 0;
+
+	rga_graph_buf_flush(graph);
+
+	return ret ? ret : (int)nr;
+}
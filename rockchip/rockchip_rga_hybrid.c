@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * Worker pool running the CPU bands of a hybrid operation. The caller
+ * posts one band per worker, submits the RGA band itself and then joins
+ * the pool in rga_hybrid_wait().
+ */
+struct rga_hybrid {
+	struct rga_import	*import;
+	pthread_mutex_t		lock;
+	pthread_cond_t		work_cond;
+	pthread_cond_t		done_cond;
+	pthread_t		threads[RGA_HYBRID_MAX_THREADS];
+	unsigned int		nr_threads;
+	int			quit;
+
+	struct rga_op		jobs[RGA_HYBRID_MAX_THREADS];
+	unsigned int		job_nr;
+	unsigned int		job_next;
+	unsigned int		pending;
+	int			job_ret;
+	uint64_t		cpu_start;
+	uint64_t		cpu_end;
+
+	unsigned int		ratio;
+};
+
+static void *rga_hybrid_worker(void *arg)
+{
+	struct rga_hybrid *hybrid = arg;
+	struct rga_op *op;
+	int ret;
+
+	pthread_mutex_lock(&hybrid->lock);
+
+	for (;;) {
+		while (!hybrid->quit && hybrid->job_next == hybrid->job_nr)
+			pthread_cond_wait(&hybrid->work_cond, &hybrid->lock);
+
+		if (hybrid->quit)
+			break;
+
+		op = &hybrid->jobs[hybrid->job_next++];
+		pthread_mutex_unlock(&hybrid->lock);
+
+		ret = rga_cpu_exec_op(hybrid->import, op);
+
+		pthread_mutex_lock(&hybrid->lock);
+		if (ret && !hybrid->job_ret)
+			hybrid->job_ret = ret;
+
+		if (--hybrid->pending == 0) {
+			hybrid->cpu_end = rga_time_us();
+			pthread_cond_signal(&hybrid->done_cond);
+		}
+	}
+
+	pthread_mutex_unlock(&hybrid->lock);
+
+	return NULL;
+}
+
+drm_private struct rga_hybrid *rga_hybrid_create(struct rga_import *import,
+					       unsigned int threads)
+{
+	struct rga_hybrid *hybrid;
+	unsigned int i;
+
+	if (threads > RGA_HYBRID_MAX_THREADS)
+		threads = RGA_HYBRID_MAX_THREADS;
+
+	hybrid = calloc(1, sizeof(*hybrid));
+	if (!hybrid)
+		return NULL;
+
+	hybrid->import = import;
+	pthread_mutex_init(&hybrid->lock, NULL);
+	pthread_cond_init(&hybrid->work_cond, NULL);
+	pthread_cond_init(&hybrid->done_cond, NULL);
+	hybrid->ratio = RGA_HYBRID_RATIO_INIT;
+
+	/* Pick the kernels before the workers can race on the choice */
+	rga_cpu_get_kernels();
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&hybrid->threads[i], NULL,
+				   rga_hybrid_worker, hybrid))
+			break;
+		hybrid->nr_threads++;
+	}
+
+	if (hybrid->nr_threads == 0) {
+		fprintf(stderr, "failed to create hybrid workers.\n");
+		rga_hybrid_destroy(hybrid);
+		return NULL;
+	}
+
+	return hybrid;
+}
+
+drm_private void rga_hybrid_destroy(struct rga_hybrid *hybrid)
+{
+	unsigned int i;
+
+	if (!hybrid)
+		return;
+
+	pthread_mutex_lock(&hybrid->lock);
+	hybrid->quit = 1;
+	pthread_cond_broadcast(&hybrid->work_cond);
+	pthread_mutex_unlock(&hybrid->lock);
+
+	for (i = 0; i < hybrid->nr_threads; i++)
+		pthread_join(hybrid->threads[i], NULL);
+
+	pthread_cond_destroy(&hybrid->done_cond);
+	pthread_cond_destroy(&hybrid->work_cond);
+	pthread_mutex_destroy(&hybrid->lock);
+	free(hybrid);
+}
+
+drm_private unsigned int rga_hybrid_threads(struct rga_hybrid *hybrid)
+{
+	return hybrid->nr_threads;
+}
+
+/*
+ * rga_hybrid_candidate - check whether an operation can be split.
+ *
+ * Bands are cut along destination rows, so the source axis those rows come
+ * from must not be scaled. Nor may the other one, as the CPU engine samples
+ * the nearest pixel where the RGA filters, which would show at the band
+ * edges. Even offsets keep 4:2:0 chroma rows inside one band for every
+ * format.
+ */
+drm_private int rga_hybrid_candidate(struct rga_hybrid *hybrid,
+				     const struct rga_op *op)
+{
+	int rot = (op->degree == 90 || op->degree == 270);
+	unsigned int min_h;
+
+	if (op->type != RGA_OP_TRANSFORM)
+		return 0;
+
+	if (op->dst_w * op->dst_h < RGA_HYBRID_MIN_PIXELS)
+		return 0;
+
+	if ((rot ? op->src_w : op->src_h) != op->dst_h ||
+	    (rot ? op->src_h : op->src_w) != op->dst_w)
+		return 0;
+
+	if ((op->src_x | op->src_y | op->dst_y | op->dst_h) & 1)
+		return 0;
+
+	min_h = RGA_HW_MIN_HEIGHT + RGA_HYBRID_BAND_ALIGN * (hybrid->nr_threads + 1);
+
+	return op->dst_h >= min_h;
+}
+
+/*
+ * rga_hybrid_hw_rows - number of destination rows given to the RGA.
+ */
+drm_private unsigned int rga_hybrid_hw_rows(struct rga_hybrid *hybrid,
+					    const struct rga_op *op)
+{
+	unsigned int max = op->dst_h - RGA_HYBRID_BAND_ALIGN * hybrid->nr_threads;
+	unsigned int rows;
+
+	rows = (op->dst_h * hybrid->ratio) >> 10;
+	rows &= ~(RGA_HYBRID_BAND_ALIGN - 1);
+
+	if (rows < RGA_HW_MIN_HEIGHT)
+		rows = (RGA_HW_MIN_HEIGHT + RGA_HYBRID_BAND_ALIGN - 1) &
+		       ~(RGA_HYBRID_BAND_ALIGN - 1);
+	if (rows > max)
+		rows = max & ~(RGA_HYBRID_BAND_ALIGN - 1);
+
+	return rows;
+}
+
+/*
+ * rga_op_band - restrict an operation to destination rows [first, last).
+ *
+ * The source window is narrowed to the rows (0/180 degree) or columns
+ * (90/270 degree) those destination rows are read from, following the
+ * rotate-then-mirror order of rga_lookup_draw_pos().
+ */
+drm_private void rga_op_band(const struct rga_op *op, unsigned int first,
+			     unsigned int last, struct rga_op *band)
+{
+	unsigned int v0 = op->y_mirr ? op->dst_h - last : first;
+	unsigned int v1 = op->y_mirr ? op->dst_h - first : last;
+
+	*band = *op;
+	band->dst_y = op->dst_y + first;
+	band->dst_h = last - first;
+
+	switch (op->degree) {
+	case 90:
+		band->src_x = op->src_x + v0;
+		band->src_w = v1 - v0;
+		break;
+	case 180:
+		band->src_y = op->src_y + op->src_h - v1;
+		band->src_h = v1 - v0;
+		break;
+	case 270:
+		band->src_x = op->src_x + op->src_w - v1;
+		band->src_w = v1 - v0;
+		break;
+	default:
+		band->src_y = op->src_y + v0;
+		band->src_h = v1 - v0;
+		break;
+	}
+}
+
+/*
+ * rga_hybrid_post - hand destination rows [first, dst_h) to the workers.
+ */
+drm_private void rga_hybrid_post(struct rga_hybrid *hybrid,
+				 const struct rga_op *op, unsigned int first)
+{
+	unsigned int rows = op->dst_h - first;
+	unsigned int step, i;
+
+	step = (rows / hybrid->nr_threads) & ~(RGA_HYBRID_BAND_ALIGN - 1);
+
+	pthread_mutex_lock(&hybrid->lock);
+
+	for (i = 0; i < hybrid->nr_threads; i++) {
+		unsigned int last = first + step;
+
+		if (i == hybrid->nr_threads - 1 || !step)
+			last = op->dst_h;
+
+		rga_op_band(op, first, last, &hybrid->jobs[i]);
+		first = last;
+
+		if (first == op->dst_h) {
+			i++;
+			break;
+		}
+	}
+
+	hybrid->job_nr = i;
+	hybrid->job_next = 0;
+	hybrid->pending = i;
+	hybrid->job_ret = 0;
+	hybrid->cpu_start = rga_time_us();
+	hybrid->cpu_end = hybrid->cpu_start;
+
+	pthread_cond_broadcast(&hybrid->work_cond);
+	pthread_mutex_unlock(&hybrid->lock);
+}
+
+/*
+ * rga_hybrid_wait - join point of a hybrid operation.
+ *
+ * @cpu_us: set to the wall time the workers needed for all bands.
+ *
+ * Returns the first error of any CPU band.
+ */
+drm_private int rga_hybrid_wait(struct rga_hybrid *hybrid, uint64_t *cpu_us)
+{
+	int ret;
+
+	pthread_mutex_lock(&hybrid->lock);
+
+	while (hybrid->pending)
+		pthread_cond_wait(&hybrid->done_cond, &hybrid->lock);
+
+	ret = hybrid->job_ret;
+	*cpu_us = hybrid->cpu_end - hybrid->cpu_start;
+	hybrid->job_nr = 0;
+	hybrid->job_next = 0;
+
+	pthread_mutex_unlock(&hybrid->lock);
+
+	return ret;
+}
+
+/*
+ * rga_hybrid_update - move the split towards equal finishing times.
+ *
+ * The ideal RGA share is its throughput over the combined throughput,
+ * the ratio follows it with an exponential moving average (1/4 weight)
+ * so one noisy frame does not swing the split.
+ */
+drm_private void rga_hybrid_update(struct rga_hybrid *hybrid,
+				   unsigned int hw_rows, uint64_t hw_us,
+				   unsigned int cpu_rows, uint64_t cpu_us)
+{
+	double hw_rate, cpu_rate;
+	int ideal, ratio;
+
+	if (!hw_us || !cpu_us)
+		return;
+
+	hw_rate = (double)hw_rows / hw_us;
+	cpu_rate = (double)cpu_rows / cpu_us;
+	ideal = 1024 * hw_rate / (hw_rate + cpu_rate);
+
+	ratio = hybrid->ratio;
+	ratio += (ideal - ratio) / 4;
+
+	if (ratio < RGA_HYBRID_RATIO_MIN)
+		ratio = RGA_HYBRID_RATIO_MIN;
+	if (ratio > RGA_HYBRID_RATIO_MAX)
+		ratio = RGA_HYBRID_RATIO_MAX;
+
+	hybrid->ratio = ratio;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <xf86drm.h>
+
+#include "libdrm_macros.h"
+#include "libdrm_lists.h"
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * One imported dma-buf, identified by the inode behind its fds: every fd
+ * of a dma-buf, dup()ed, passed over a socket or exported again, shares
+ * it. The mapping holds a reference on the dma-buf, so the inode cannot
+ * be reused while the entry exists. Kernels before 5.3 have one inode for
+ * all dma-bufs, nothing is cached there.
+ *
+ * @users: rga_cpu_map()s currently using @map, such an entry is never
+ *	evicted.
+ */
+struct rga_import_entry {
+	drmMMListHead		lru;
+	unsigned long		ino;
+	dev_t			dev;
+	size_t			size;
+	void			*map;
+	unsigned int		users;
+};
+
+struct rga_import {
+	pthread_mutex_t		lock;
+	void			*table;
+	drmMMListHead		lru;
+	unsigned int		nr;
+	size_t			bytes;
+	unsigned long long	hits;
+	unsigned long long	misses;
+	unsigned long long	evictions;
+};
+
+drm_private struct rga_import *rga_import_create(void)
+{
+	struct rga_import *import;
+
+	import = calloc(1, sizeof(*import));
+	if (!import)
+		return NULL;
+
+	import->table = drmHashCreate();
+	if (!import->table) {
+		free(import);
+		return NULL;
+	}
+
+	pthread_mutex_init(&import->lock, NULL);
+	DRMINITLISTHEAD(&import->lru);
+
+	return import;
+}
+
+static void rga_import_drop(struct rga_import *import,
+			    struct rga_import_entry *entry)
+{
+	drmHashDelete(import->table, entry->ino);
+	DRMLISTDEL(&entry->lru);
+	import->nr--;
+	import->bytes -= entry->size;
+
+	munmap(entry->map, entry->size);
+	free(entry);
+}
+
+drm_private void rga_import_destroy(struct rga_import *import)
+{
+	struct rga_import_entry *entry, *tmp;
+
+	if (!import)
+		return;
+
+	DRMLISTFOREACHENTRYSAFE(entry, tmp, &import->lru, lru)
+		rga_import_drop(import, entry);
+
+	drmHashDestroy(import->table);
+	pthread_mutex_destroy(&import->lock);
+	free(import);
+}
+
+/*
+ * rga_import_evict - drop least recently used entries until both limits
+ *	leave room for @size more bytes.
+ */
+static void rga_import_evict(struct rga_import *import, size_t size)
+{
+	struct rga_import_entry *entry, *tmp;
+
+	DRMLISTFOREACHENTRYSAFE(entry, tmp, &import->lru, lru) {
+		if (import->nr < RGA_IMPORT_MAX_ENTRIES &&
+		    import->bytes + size <= RGA_IMPORT_MAX_BYTES)
+			break;
+		if (entry->users)
+			continue;
+
+		rga_import_drop(import, entry);
+		import->evictions++;
+	}
+}
+
+/*
+ * rga_import_map - CPU mapping of a whole dma-buf, kept across calls.
+ *
+ * @import: the cache of the context.
+ * @fd: any fd of the dma-buf.
+ * @size: returns the size of the dma-buf.
+ * @entryp: returns the entry to hand back to rga_import_put() once the
+ *	mapping is no longer accessed.
+ *
+ * Returns NULL if the dma-buf can't be cached, e.g. when it has no inode
+ * of its own, the caller maps it by itself then.
+ */
+drm_private void *rga_import_map(struct rga_import *import, int fd,
+				 size_t *size, struct rga_import_entry **entryp)
+{
+	struct rga_import_entry *entry;
+	struct stat st;
+	void *value;
+	off_t len;
+
+	if (rockchip_dma_buf_stat(fd, &st))
+		return NULL;
+
+	pthread_mutex_lock(&import->lock);
+
+	if (!drmHashLookup(import->table, st.st_ino, &value)) {
+		entry = value;
+		if (entry->dev == st.st_dev) {
+			DRMLISTDEL(&entry->lru);
+			DRMLISTADDTAIL(&entry->lru, &import->lru);
+			entry->users++;
+			import->hits++;
+			pthread_mutex_unlock(&import->lock);
+
+			*size = entry->size;
+			*entryp = entry;
+			return entry->map;
+		}
+
+		/* Another filesystem, leave the cached one alone */
+		pthread_mutex_unlock(&import->lock);
+		return NULL;
+	}
+
+	import->misses++;
+	pthread_mutex_unlock(&import->lock);
+
+	len = lseek(fd, 0, SEEK_END);
+	if (len <= 0)
+		return NULL;
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return NULL;
+
+	entry->map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			  fd, 0);
+	if (entry->map == MAP_FAILED) {
+		free(entry);
+		return NULL;
+	}
+
+	entry->ino = st.st_ino;
+	entry->dev = st.st_dev;
+	entry->size = len;
+	entry->users = 1;
+
+	pthread_mutex_lock(&import->lock);
+
+	/* A worker may have mapped the same dma-buf meanwhile */
+	if (!drmHashLookup(import->table, entry->ino, &value)) {
+		struct rga_import_entry *other = value;
+
+		other->users++;
+		pthread_mutex_unlock(&import->lock);
+
+		munmap(entry->map, entry->size);
+		free(entry);
+
+		*size = other->size;
+		*entryp = other;
+		return other->map;
+	}
+
+	rga_import_evict(import, entry->size);
+	drmHashInsert(import->table, entry->ino, entry);
+	DRMLISTADDTAIL(&entry->lru, &import->lru);
+	import->nr++;
+	import->bytes += entry->size;
+
+	pthread_mutex_unlock(&import->lock);
+
+	*size = entry->size;
+	*entryp = entry;
+
+	return entry->map;
+}
+
+drm_private void rga_import_put(struct rga_import *import,
+				struct rga_import_entry *entry)
+{
+	pthread_mutex_lock(&import->lock);
+	entry->users--;
+	pthread_mutex_unlock(&import->lock);
+}
+
+/*
+ * rga_import_release - forget a dma-buf, so that closing its last fd
+ *	frees the buffer.
+ */
+drm_private void rga_import_release(struct rga_import *import, int fd)
+{
+	struct stat st;
+	void *value;
+
+	if (!import || rockchip_dma_buf_stat(fd, &st))
+		return;
+
+	pthread_mutex_lock(&import->lock);
+
+	if (!drmHashLookup(import->table, st.st_ino, &value)) {
+		struct rga_import_entry *entry = value;
+
+		if (entry->dev == st.st_dev && !entry->users)
+			rga_import_drop(import, entry);
+	}
+
+	pthread_mutex_unlock(&import->lock);
+}
+
+drm_private void rga_import_stats(struct rga_import *import,
+				  struct rga_stats *stats, int reset)
+{
+	pthread_mutex_lock(&import->lock);
+
+	if (stats) {
+		stats->import_hits = import->hits;
+		stats->import_misses = import->misses;
+		stats->import_evictions = import->evictions;
+		stats->imports = import->nr;
+		stats->import_bytes = import->bytes;
+	}
+
+	if (reset) {
+		import->hits = 0;
+		import->misses = 0;
+		import->evictions = 0;
+	}
+
+	pthread_mutex_unlock(&import->lock);
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "drm_fourcc.h"
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * Staging buffers holding converted sources until the RGA batch reading
+ * them was executed, kept and grown across rga_exec() calls.
+ */
+struct rga_preconv {
+	struct rga_buf		*bufs[RGA_PRECONV_SLOTS];
+};
+
+/*
+ * rga_preconv_needed - check whether the RGA can only run @op on a
+ *	converted copy of its source.
+ */
+drm_private int rga_preconv_needed(const struct rga_op *op)
+{
+	const struct rga_format *fmt;
+
+	if (op->type != RGA_OP_TRANSFORM)
+		return 0;
+
+	fmt = rga_format_lookup(op->src.color_mode);
+
+	return fmt && fmt->packed;
+}
+
+/*
+ * rga_preconv_run - run an unscaled conversion, split in bands of rows
+ *	between this thread and the hybrid workers when there are any.
+ */
+static int rga_preconv_run(struct rga_context *ctx, const struct rga_op *conv)
+{
+	unsigned int threads = ctx->hybrid ? rga_hybrid_threads(ctx->hybrid) : 0;
+	unsigned int first;
+	struct rga_op band;
+	uint64_t cpu_us;
+	int ret, cpu_ret;
+
+	if (!threads || conv->dst_h < RGA_PRECONV_BAND_ROWS * (threads + 1))
+		return rga_cpu_exec_op(ctx->import, conv);
+
+	first = (conv->dst_h / (threads + 1)) & ~(RGA_HYBRID_BAND_ALIGN - 1);
+
+	rga_hybrid_post(ctx->hybrid, conv, first);
+	rga_op_band(conv, 0, first, &band);
+	ret = rga_cpu_exec_op(ctx->import, &band);
+	cpu_ret = rga_hybrid_wait(ctx->hybrid, &cpu_us);
+
+	return ret ? ret : cpu_ret;
+}
+
+/*
+ * rga_preconv_op - convert the source window of @op to NV16 and make @op
+ *	read the converted copy.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @op: a queued operation with a packed YUV source.
+ * @slot: staging buffer to use, which must not be read by any operation
+ *	still queued for the RGA.
+ *
+ * NV16 keeps the full 4:2:2 chroma, so the result is the one the CPU
+ * engine computes from the packed source.
+ */
+drm_private int rga_preconv_op(struct rga_context *ctx, struct rga_op *op,
+			       unsigned int slot)
+{
+	struct rga_preconv *preconv = ctx->preconv;
+	unsigned int x0 = op->src_x & ~1;
+	unsigned int w = ((op->src_x + op->src_w + 1) & ~1) - x0;
+	unsigned int stride = (w + 15) & ~15;
+	size_t size = (size_t)stride * op->src_h * 2;
+	unsigned long long read, written;
+	struct rga_buf **buf;
+	struct rga_op conv;
+	uint64_t start;
+	int ret;
+
+	if (!preconv) {
+		preconv = calloc(1, sizeof(*preconv));
+		if (!preconv)
+			return -ENOMEM;
+		ctx->preconv = preconv;
+	}
+
+	buf = &preconv->bufs[slot];
+	if (*buf && (*buf)->size < size) {
+		rga_buf_free(ctx, *buf);
+		*buf = NULL;
+	}
+	if (!*buf) {
+		ret = rga_buf_alloc(ctx, size, buf);
+		if (ret)
+			return ret;
+	}
+
+	memset(&conv, 0, sizeof(conv));
+	conv.type = RGA_OP_TRANSFORM;
+	conv.src = op->src;
+	conv.dst.color_mode = DRM_FORMAT_NV16;
+	conv.dst.width = stride;
+	conv.dst.height = op->src_h;
+	conv.dst.stride = stride;
+	rga_buf_bind(*buf, &conv.dst);
+	conv.src_x = x0;
+	conv.src_y = op->src_y;
+	conv.src_w = w;
+	conv.src_h = op->src_h;
+	conv.dst_w = w;
+	conv.dst_h = op->src_h;
+
+	start = rga_time_us();
+	ret = rga_preconv_run(ctx, &conv);
+	if (ret) {
+		fprintf(stderr, "failed to convert packed yuv source.\n");
+		return ret;
+	}
+
+	rga_stats_hist(ctx->stats.preconv_us, rga_time_us() - start);
+	ctx->stats.preconv_ops++;
+
+	rga_bw_op_bytes(&conv, &read, &written);
+	ctx->stats.bytes_read += read;
+	ctx->stats.bytes_written += written;
+	rga_bw_charge(read, written);
+
+	rga_record_staging(ctx->record, &conv.dst);
+
+	op->src = conv.dst;
+	op->src_x -= x0;
+	op->src_y = 0;
+
+	return 0;
+}
+
+drm_private void rga_preconv_destroy(struct rga_context *ctx)
+{
+	unsigned int i;
+
+	if (!ctx->preconv)
+		return;
+
+	for (i = 0; i < RGA_PRECONV_SLOTS; i++)
+		if (ctx->preconv->bufs[i])
+			rga_buf_free(ctx, ctx->preconv->bufs[i]);
+
+	free(ctx->preconv);
+	ctx->preconv = NULL;
+}
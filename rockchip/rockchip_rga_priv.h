@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifndef _ROCKCHIP_RGA_PRIV_H_
+#define _ROCKCHIP_RGA_PRIV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_drm.h"
+#include "rockchip_dma_buf.h"
+#include "rockchip_rga.h"
+
+/*
+ * The smallest source/destination window the RGA accepts for a
+ * bitblt operation. Anything smaller is handled by the CPU engine.
+ */
+#define RGA_HW_MIN_WIDTH	32
+#define RGA_HW_MIN_HEIGHT	34
+
+enum rga_op_type {
+	RGA_OP_FILL,
+	RGA_OP_TRANSFORM,
+};
+
+/*
+ * A queued RGA operation. The rga_* helpers only validate their arguments
+ * and record an operation; rga_exec() decides for every operation whether
+ * it runs on the RGA or on the CPU engine.
+ *
+ * @type: fill or transform (copy / scale / rotate / mirror / csc).
+ * @src: source image, unused for fills.
+ * @dst: destination image.
+ * @src_x, @src_y, @src_w, @src_h: source window, already clipped.
+ * @dst_x, @dst_y, @dst_w, @dst_h: destination window, already clipped.
+ * @degree: clockwise rotation (0, 90, 180, 270).
+ * @x_mirr, @y_mirr: mirror the rotated output horizontally / vertically.
+ */
+struct rga_op {
+	enum rga_op_type	type;
+	struct rga_image	src;
+	struct rga_image	dst;
+	unsigned int		src_x, src_y, src_w, src_h;
+	unsigned int		dst_x, dst_y, dst_w, dst_h;
+	unsigned int		degree;
+	unsigned int		x_mirr, y_mirr;
+};
+
+/*
+ * Pixel format description used by the CPU engine.
+ *
+ * @fourcc: DRM fourcc code.
+ * @cpp: bytes per pixel of the first plane.
+ * @planes: 1 for packed RGB and packed YUV, 2 for semi-planar and 3 for
+ *	planar YUV.
+ * @xsub, @ysub: chroma subsampling factors.
+ * @uv_swap: V is stored before U.
+ * @r, @g, @b, @a: bit position and size of each channel for RGB formats,
+ *	a size of zero means the channel is absent.
+ * @packed: packed 4:2:2 YUV, which only the CPU engine reads.
+ * @y_odd: packed luma is stored in the odd bytes.
+ */
+struct rga_format {
+	uint32_t		fourcc;
+	uint8_t			cpp;
+	uint8_t			planes;
+	uint8_t			xsub, ysub;
+	uint8_t			uv_swap;
+	struct {
+		uint8_t		shift;
+		uint8_t		size;
+	} r, g, b, a;
+	uint8_t			packed;
+	uint8_t			y_odd;
+};
+
+drm_private const struct rga_format *rga_format_lookup(uint32_t fourcc);
+drm_private unsigned int rga_format_index(const struct rga_format *fmt);
+
+/*
+ * SIMD row kernels, selected once for the running CPU.
+ *
+ * @fill32: store @n copies of a 32-bit pixel.
+ * @reverse32: copy @n 32-bit pixels in reverse order.
+ * @rotate32: write the transpose of a @w x @h block of 32-bit pixels, with
+ *	every transposed row reversed when @reverse is set. Strides are in
+ *	pixels, a negative @dst_stride walks the destination upwards.
+ * @yuv_to_rgb32: convert one row of semi-planar YUV to 32-bit RGB, where
+ *	@shifts gives the bit position of R, G, B and A in the output pixel.
+ * @rgb32_to_yuv: convert two rows of 32-bit RGB to two luma rows and one
+ *	row of interleaved chroma, @shifts gives the R, G, B input positions.
+ * @packed_to_yuv: split one row of @n pixels of packed 4:2:2 YUV into a
+ *	luma row and, unless @uv is NULL, a row of interleaved chroma. @y_odd
+ *	is set when luma is stored in the odd bytes, @uv_swap swaps the two
+ *	bytes of every chroma pair. @n is even.
+ */
+struct rga_cpu_kernels {
+	const char *name;
+	void (*fill32)(uint32_t *dst, uint32_t val, unsigned int n);
+	void (*reverse32)(uint32_t *dst, const uint32_t *src, unsigned int n);
+	void (*rotate32)(uint32_t *dst, int dst_stride, const uint32_t *src,
+			 int src_stride, unsigned int w, unsigned int h,
+			 int reverse);
+	void (*yuv_to_rgb32)(uint32_t *dst, const uint8_t *y,
+			     const uint8_t *uv, unsigned int n, int uv_swap,
+			     const uint8_t shifts[4]);
+	void (*rgb32_to_yuv)(uint8_t *y0, uint8_t *y1, uint8_t *uv,
+			     const uint32_t *src0, const uint32_t *src1,
+			     unsigned int n, int uv_swap,
+			     const uint8_t shifts[3]);
+	void (*packed_to_yuv)(uint8_t *y, uint8_t *uv, const uint8_t *src,
+			      unsigned int n, int y_odd, int uv_swap);
+};
+
+drm_private const struct rga_cpu_kernels *rga_cpu_get_kernels(void);
+
+/*
+ * CPU engine entry points, both return 0 or a negative errno.
+ */
+struct rga_import;
+
+drm_private int rga_cpu_supported(const struct rga_op *op);
+drm_private int rga_cpu_exec_op(struct rga_import *import,
+				const struct rga_op *op);
+
+static inline uint64_t rga_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Hybrid execution: a large transform is cut into horizontal bands of the
+ * destination, the top band runs on the RGA while the CPU workers convert
+ * the remaining bands. Band boundaries are aligned so that subsampled
+ * chroma rows never straddle two bands.
+ */
+#define RGA_HYBRID_MAX_THREADS	8
+#define RGA_HYBRID_MIN_PIXELS	(1280 * 720)
+#define RGA_HYBRID_BAND_ALIGN	16
+
+/* Share of the rows given to the RGA, in 1/1024 units */
+#define RGA_HYBRID_RATIO_INIT	512
+#define RGA_HYBRID_RATIO_MIN	64
+#define RGA_HYBRID_RATIO_MAX	960
+
+struct rga_hybrid;
+
+drm_private struct rga_hybrid *rga_hybrid_create(struct rga_import *import,
+					       unsigned int threads);
+drm_private void rga_hybrid_destroy(struct rga_hybrid *hybrid);
+drm_private unsigned int rga_hybrid_threads(struct rga_hybrid *hybrid);
+drm_private int rga_hybrid_candidate(struct rga_hybrid *hybrid,
+				     const struct rga_op *op);
+drm_private unsigned int rga_hybrid_hw_rows(struct rga_hybrid *hybrid,
+					    const struct rga_op *op);
+drm_private void rga_op_band(const struct rga_op *op, unsigned int first,
+			     unsigned int last, struct rga_op *band);
+drm_private void rga_hybrid_post(struct rga_hybrid *hybrid,
+				 const struct rga_op *op, unsigned int first);
+drm_private int rga_hybrid_wait(struct rga_hybrid *hybrid, uint64_t *cpu_us);
+drm_private void rga_hybrid_update(struct rga_hybrid *hybrid,
+				   unsigned int hw_rows, uint64_t hw_us,
+				   unsigned int cpu_rows, uint64_t cpu_us);
+
+/*
+ * Cost model: per (operation kind, formats, log2 pixel count) bucket, the
+ * library keeps a moving average of the time each backend needed and
+ * routes RGA_BACKEND_AUTO operations to the cheaper one. Buckets without
+ * samples are estimated from a fixed + per-pixel seed, which
+ * rga_calibrate() measures on the running system.
+ */
+#define RGA_COST_SIZE_BUCKETS	25
+#define RGA_COST_EXPLORE	64
+
+#define RGA_COST_HW_FIXED_US	150
+#define RGA_COST_HW_PS_PER_PX	2000
+#define RGA_COST_CPU_FIXED_US	5
+#define RGA_COST_CPU_PS_PER_PX	1000
+
+struct rga_cost;
+
+drm_private struct rga_cost *rga_cost_create(void);
+drm_private void rga_cost_destroy(struct rga_cost *cost);
+drm_private unsigned int rga_cost_pixels(const struct rga_op *op);
+drm_private int rga_cost_choose(struct rga_cost *cost,
+				const struct rga_op *op);
+drm_private void rga_cost_update(struct rga_cost *cost,
+				 const struct rga_op *op,
+				 enum e_rga_backend backend, uint64_t us);
+drm_private void rga_cost_seed(struct rga_cost *cost,
+			       enum e_rga_backend backend,
+			       enum rga_op_type type,
+			       unsigned int small_px, uint64_t small_us,
+			       unsigned int large_px, uint64_t large_us);
+drm_private struct rga_dispatch_stats *rga_cost_stats(struct rga_cost *cost);
+
+/*
+ * Performance counters and trace points, see struct rga_stats.
+ */
+drm_private void rga_stats_hist(unsigned long long *hist, uint64_t us);
+drm_private void rga_stats_op(struct rga_context *ctx,
+			      const struct rga_op *op);
+drm_private void rga_trace(struct rga_context *ctx,
+			   enum e_rga_trace_event event, unsigned int ops,
+			   uint64_t us, int ret);
+
+/*
+ * Import cache: CPU mappings of the dma-bufs an application keeps handing
+ * to the context, e.g. a ring of decoder buffers, looked up by inode and
+ * kept until they are least recently used, the application releases them
+ * with rga_release_image() or the context goes away. Every cached mapping
+ * holds a reference on its dma-buf, hence the limits.
+ */
+#define RGA_IMPORT_MAX_ENTRIES	32
+#define RGA_IMPORT_MAX_BYTES	(128 << 20)
+
+struct rga_import_entry;
+
+drm_private struct rga_import *rga_import_create(void);
+drm_private void rga_import_destroy(struct rga_import *import);
+drm_private void *rga_import_map(struct rga_import *import, int fd,
+				 size_t *size, struct rga_import_entry **entryp);
+drm_private void rga_import_put(struct rga_import *import,
+				struct rga_import_entry *entry);
+drm_private void rga_import_release(struct rga_import *import, int fd);
+drm_private void rga_import_stats(struct rga_import *import,
+				  struct rga_stats *stats, int reset);
+
+/*
+ * Priority scheduling: background operations above RGA_SCHED_SLICE_PIXELS
+ * are submitted as slices of destination rows, and at most
+ * RGA_SCHED_BG_OPS background operations share one submission, so that a
+ * realtime job waits at most about a slice for the RGA.
+ */
+#define RGA_SCHED_SLICE_PIXELS	(256 * 1024)
+#define RGA_SCHED_BG_OPS	4
+
+drm_private void rga_sched_hold(struct rga_context *ctx);
+drm_private void rga_sched_drop(struct rga_context *ctx);
+drm_private int rga_sched_contended(struct rga_context *ctx);
+drm_private unsigned int rga_sched_slice_rows(const struct rga_op *op);
+
+/*
+ * Asynchronous execution: rga_exec_async() hands the queued operations
+ * over to a thread of the context, which runs them with rga_exec_ops()
+ * while the next ones are queued. One submission is in flight at a time.
+ */
+struct rga_async;
+
+drm_private int rga_exec_ops(struct rga_context *ctx, unsigned int op_nr);
+drm_private int rga_async_create(struct rga_context *ctx);
+drm_private void rga_async_destroy(struct rga_async *async);
+drm_private void rga_async_queue(struct rga_context *ctx, unsigned int op_nr,
+				 uint64_t seq);
+drm_private int rga_async_idle(struct rga_context *ctx, int clear);
+
+/*
+ * Bandwidth accounting: traffic is estimated in bursts of RGA_BW_BURST
+ * bytes, with sources rotated by 90 or 270 degrees fetched in pieces of
+ * RGA_BW_ROT_TILE pixels per row, and summed over windows of
+ * RGA_BW_WINDOW_US.
+ */
+#define RGA_BW_BURST		64
+#define RGA_BW_ROT_TILE		8
+#define RGA_BW_WINDOW_US	1000000
+
+drm_private void rga_bw_op_bytes(const struct rga_op *op,
+				 unsigned long long *read,
+				 unsigned long long *written);
+drm_private void rga_bw_charge(unsigned long long read,
+			       unsigned long long written);
+drm_private void rga_bw_throttle(struct rga_context *ctx);
+
+/*
+ * Packed YUV pre-conversion: the RGA cannot read packed 4:2:2 YUV, so such
+ * sources are converted to NV16 on the CPU first, spread over the hybrid
+ * workers in bands of at least RGA_PRECONV_BAND_ROWS rows. Up to
+ * RGA_PRECONV_SLOTS converted sources can be queued at the same time.
+ */
+#define RGA_PRECONV_SLOTS	4
+#define RGA_PRECONV_BAND_ROWS	32
+
+drm_private int rga_preconv_needed(const struct rga_op *op);
+drm_private int rga_preconv_op(struct rga_context *ctx, struct rga_op *op,
+			       unsigned int slot);
+drm_private void rga_preconv_destroy(struct rga_context *ctx);
+
+/*
+ * Scene compositor limits: layers per scene, rectangles per damage region
+ * before they get merged, and the oldest buffer age that is tracked.
+ */
+#define RGA_SCENE_MAX_LAYERS	16
+#define RGA_SCENE_MAX_RECTS	16
+#define RGA_SCENE_MAX_AGE	4
+
+/*
+ * A buffer the library allocates for itself: a GEM object exported as
+ * dma-buf when the RGA is present, plain memory for the CPU engine
+ * otherwise.
+ */
+struct rga_buf {
+	size_t			size;
+	uint32_t		handle;
+	int			fd;
+	void			*ptr;
+};
+
+drm_private int rga_buf_alloc(struct rga_context *ctx, size_t size,
+			      struct rga_buf **bufp);
+drm_private void rga_buf_free(struct rga_context *ctx, struct rga_buf *buf);
+drm_private void rga_buf_bind(struct rga_buf *buf, struct rga_image *img);
+
+/*
+ * Job graph limits; at most RGA_GRAPH_POOL_MAX intermediate buffers are
+ * kept for reuse between runs.
+ */
+#define RGA_GRAPH_MAX_NODES	64
+#define RGA_GRAPH_MAX_IMAGES	32
+#define RGA_GRAPH_POOL_MAX	8
+
+/*
+ * Capture limits: framebuffers whose dma-buf stays exported, e.g. the
+ * buffers a compositor flips between, output ring length, and the vblank
+ * period emulated without a CRTC.
+ */
+#define RGA_CAPTURE_MAX_FBS	4
+#define RGA_CAPTURE_MAX_RING	8
+#define RGA_CAPTURE_HEADLESS_US	16667
+
+/*
+ * Upload ring limits: reservations tracked at once, and the alignment of
+ * each one, a multiple of the RGA burst and of the cache line.
+ */
+#define RGA_UPLOAD_MAX_REGIONS	64
+#define RGA_UPLOAD_ALIGN	64
+
+/*
+ * Submission recorder, enabled by RGA_TRACE_FILE, see rockchip_rga_record.h.
+ */
+struct rga_record;
+
+drm_private struct rga_record *rga_record_open(struct rga_context *ctx);
+drm_private void rga_record_close(struct rga_record *record);
+drm_private void rga_record_ops(struct rga_record *record,
+				const struct rga_op *ops, unsigned int nr);
+drm_private void rga_record_staging(struct rga_record *record,
+				    const struct rga_image *img);
+drm_private void rga_record_cmdlist(struct rga_record *record,
+			const struct drm_rockchip_rga_set_cmdlist *cmdlist,
+			int ret);
+drm_private void rga_record_exec(struct rga_record *record, int done,
+				 unsigned int ops, uint64_t us, int ret);
+
+#endif /* _ROCKCHIP_RGA_PRIV_H_ */
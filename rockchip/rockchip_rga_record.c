@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+#include "rockchip_rga_record.h"
+
+/*
+ * Id given to a buffer on first sight. dma-bufs are known by inode where
+ * each has its own, else by fd, and a different size means another buffer.
+ */
+struct rga_record_id {
+	uint32_t		buf_type;
+	int			by_fd;
+	uint64_t		key;
+	uint64_t		size;
+	uint64_t		id;
+};
+
+struct rga_record {
+	FILE			*file;
+	int			contents;
+	struct rga_record_id	*ids;
+	unsigned int		id_nr;
+	unsigned int		id_max;
+	uint64_t		last_id;
+};
+
+static pthread_mutex_t rga_record_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int rga_record_count;
+
+static void rga_record_packet(struct rga_record *record, uint32_t type,
+			      const void *data, uint32_t size,
+			      const void *extra, uint32_t extra_size)
+{
+	struct rga_record_packet packet = {
+		.type = type,
+		.size = size + extra_size,
+	};
+
+	fwrite(&packet, sizeof(packet), 1, record->file);
+	fwrite(data, size, 1, record->file);
+	if (extra_size)
+		fwrite(extra, extra_size, 1, record->file);
+}
+
+/*
+ * rga_record_open - start a trace for a new context if RGA_TRACE_FILE is
+ *	set. The first context writes to that path, later ones append a
+ *	sequence number to it.
+ */
+drm_private struct rga_record *rga_record_open(struct rga_context *ctx)
+{
+	struct rga_record_header header = {
+		.magic = RGA_RECORD_MAGIC,
+		.version = RGA_RECORD_VERSION,
+		.major = ctx->major,
+		.minor = ctx->minor,
+	};
+	const char *path = getenv("RGA_TRACE_FILE");
+	const char *contents = getenv("RGA_TRACE_CONTENTS");
+	struct rga_record *record;
+	char name[256];
+	unsigned int seq;
+
+	if (!path || !*path)
+		return NULL;
+
+	pthread_mutex_lock(&rga_record_lock);
+	seq = rga_record_count++;
+	pthread_mutex_unlock(&rga_record_lock);
+
+	if (seq)
+		snprintf(name, sizeof(name), "%s.%u", path, seq);
+	else
+		snprintf(name, sizeof(name), "%s", path);
+
+	record = calloc(1, sizeof(*record));
+	if (!record)
+		return NULL;
+
+	record->file = fopen(name, "wb");
+	if (!record->file) {
+		fprintf(stderr, "failed to open trace file %s.\n", name);
+		free(record);
+		return NULL;
+	}
+
+	record->contents = contents && atoi(contents);
+
+	fwrite(&header, sizeof(header), 1, record->file);
+
+	return record;
+}
+
+drm_private void rga_record_close(struct rga_record *record)
+{
+	if (!record)
+		return;
+
+	fclose(record->file);
+	free(record->ids);
+	free(record);
+}
+
+static uint64_t rga_record_id(struct rga_record *record, uint32_t buf_type,
+			      int by_fd, uint64_t key, uint64_t size)
+{
+	struct rga_record_id *ids, *id = NULL;
+	unsigned int i;
+
+	for (i = 0; i < record->id_nr; i++) {
+		if (record->ids[i].buf_type == buf_type &&
+		    record->ids[i].by_fd == by_fd &&
+		    record->ids[i].key == key) {
+			id = &record->ids[i];
+			break;
+		}
+	}
+
+	if (!id) {
+		if (record->id_nr == record->id_max) {
+			ids = realloc(record->ids, (record->id_max * 2 + 16) *
+					   sizeof(*ids));
+			if (!ids)
+				return 0;
+			record->ids = ids;
+			record->id_max = record->id_max * 2 + 16;
+		}
+
+		id = &record->ids[record->id_nr++];
+		id->buf_type = buf_type;
+		id->by_fd = by_fd;
+		id->key = key;
+	} else if (id->size == size) {
+		return id->id;
+	}
+
+	/* A new buffer, or one whose fd or address was reused */
+	id->size = size;
+	id->id = ++record->last_id;
+
+	return id->id;
+}
+
+static void rga_record_describe(struct rga_record *record,
+				const struct rga_image *img,
+				struct rga_record_buffer *buf)
+{
+	struct stat st;
+	off_t size;
+
+	memset(buf, 0, sizeof(*buf));
+
+	if (img->buf_type == RGA_IMGBUF_USERPTR) {
+		buf->size = img->user_ptr[0].size;
+		buf->fd = -1;
+		buf->id = rga_record_id(record, img->buf_type, 0,
+					img->user_ptr[0].userptr, buf->size);
+		return;
+	}
+
+	buf->fd = img->bo[0];
+
+	size = lseek(buf->fd, 0, SEEK_END);
+	if (size > 0)
+		buf->size = size;
+	lseek(buf->fd, 0, SEEK_SET);
+
+	if (!rockchip_dma_buf_stat(buf->fd, &st))
+		buf->id = rga_record_id(record, img->buf_type, 0, st.st_ino,
+					buf->size);
+	else
+		buf->id = rga_record_id(record, img->buf_type, 1, buf->fd,
+					buf->size);
+}
+
+static void rga_record_image(struct rga_record *record,
+			     const struct rga_image *img,
+			     struct rga_record_image *rec)
+{
+	struct rga_record_buffer buf;
+
+	rga_record_describe(record, img, &buf);
+
+	rec->buffer = buf.id;
+	rec->color_mode = img->color_mode;
+	rec->width = img->width;
+	rec->height = img->height;
+	rec->stride = img->stride;
+	rec->fill_color = img->fill_color;
+	rec->buf_type = img->buf_type;
+	rec->offset = img->offset;
+}
+
+static void rga_record_buffer(struct rga_record *record,
+			      const struct rga_image *img)
+{
+	struct rga_record_buffer buf;
+	struct rockchip_dma_buf_sync sync;
+	void *ptr = NULL;
+
+	rga_record_describe(record, img, &buf);
+
+	if (record->contents && buf.size) {
+		if (buf.fd < 0) {
+			ptr = (void *)(uintptr_t)img->user_ptr[0].userptr;
+		} else {
+			ptr = mmap(NULL, buf.size, PROT_READ, MAP_SHARED,
+				   buf.fd, 0);
+			if (ptr == MAP_FAILED) {
+				ptr = NULL;
+			} else {
+				sync.flags = ROCKCHIP_DMA_BUF_SYNC_START |
+					     ROCKCHIP_DMA_BUF_SYNC_READ;
+				ioctl(buf.fd, ROCKCHIP_DMA_BUF_IOCTL_SYNC,
+				      &sync);
+			}
+		}
+	}
+
+	buf.contents = !!ptr;
+	rga_record_packet(record, RGA_RECORD_BUFFER, &buf, sizeof(buf),
+			  ptr, ptr ? buf.size : 0);
+
+	if (ptr && buf.fd >= 0) {
+		sync.flags = ROCKCHIP_DMA_BUF_SYNC_END |
+			     ROCKCHIP_DMA_BUF_SYNC_READ;
+		ioctl(buf.fd, ROCKCHIP_DMA_BUF_IOCTL_SYNC, &sync);
+		munmap(ptr, buf.size);
+	}
+}
+
+static int rga_record_seen(const struct rga_image **seen, unsigned int nr,
+			   const struct rga_image *img)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		if (seen[i]->buf_type != img->buf_type)
+			continue;
+		if (img->buf_type == RGA_IMGBUF_USERPTR ?
+		    seen[i]->user_ptr[0].userptr == img->user_ptr[0].userptr :
+		    seen[i]->bo[0] == img->bo[0])
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * rga_record_ops - record the operations an rga_exec() is about to run,
+ *	preceded by every buffer they reference.
+ */
+drm_private void rga_record_ops(struct rga_record *record,
+				const struct rga_op *ops, unsigned int nr)
+{
+	const struct rga_image *seen[2 * RGA_MAX_CMD_LIST_NR];
+	struct rga_record_op rec;
+	unsigned int i, seen_nr = 0;
+
+	if (!record)
+		return;
+
+	for (i = 0; i < nr; i++) {
+		const struct rga_image *imgs[2] = { &ops[i].dst, &ops[i].src };
+		unsigned int j;
+
+		for (j = 0; j < (ops[i].type == RGA_OP_FILL ? 1 : 2); j++) {
+			if (rga_record_seen(seen, seen_nr, imgs[j]))
+				continue;
+
+			seen[seen_nr++] = imgs[j];
+			rga_record_buffer(record, imgs[j]);
+		}
+	}
+
+	for (i = 0; i < nr; i++) {
+		memset(&rec, 0, sizeof(rec));
+		rec.type = ops[i].type;
+		rec.degree = ops[i].degree;
+		if (ops[i].type == RGA_OP_TRANSFORM)
+			rga_record_image(record, &ops[i].src, &rec.src);
+		rga_record_image(record, &ops[i].dst, &rec.dst);
+		rec.src_x = ops[i].src_x;
+		rec.src_y = ops[i].src_y;
+		rec.src_w = ops[i].src_w;
+		rec.src_h = ops[i].src_h;
+		rec.dst_x = ops[i].dst_x;
+		rec.dst_y = ops[i].dst_y;
+		rec.dst_w = ops[i].dst_w;
+		rec.dst_h = ops[i].dst_h;
+		rec.x_mirr = ops[i].x_mirr;
+		rec.y_mirr = ops[i].y_mirr;
+
+		rga_record_packet(record, RGA_RECORD_OP, &rec, sizeof(rec),
+				  NULL, 0);
+	}
+}
+
+/*
+ * rga_record_staging - record a buffer the library filled itself for the
+ *	operations being executed, e.g. a converted source, so cmdlists
+ *	reading it can be replayed.
+ */
+drm_private void rga_record_staging(struct rga_record *record,
+				    const struct rga_image *img)
+{
+	if (!record)
+		return;
+
+	rga_record_buffer(record, img);
+}
+
+drm_private void rga_record_cmdlist(struct rga_record *record,
+			const struct drm_rockchip_rga_set_cmdlist *cmdlist,
+			int ret)
+{
+	struct drm_rockchip_rga_cmd cmds[RGA_MAX_CMD_NR + RGA_MAX_GEM_CMD_NR];
+	struct rga_record_cmdlist rec;
+	unsigned int size;
+
+	if (!record)
+		return;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.cmd_nr = cmdlist->cmd_nr;
+	rec.cmd_buf_nr = cmdlist->cmd_buf_nr;
+	rec.ret = ret;
+
+	size = rec.cmd_nr * sizeof(cmds[0]);
+	memcpy(cmds, (void *)(uintptr_t)cmdlist->cmd, size);
+	memcpy((char *)cmds + size, (void *)(uintptr_t)cmdlist->cmd_buf,
+	       rec.cmd_buf_nr * sizeof(cmds[0]));
+	size += rec.cmd_buf_nr * sizeof(cmds[0]);
+
+	rga_record_packet(record, RGA_RECORD_CMDLIST, &rec, sizeof(rec),
+			  cmds, size);
+}
+
+/*
+ * rga_record_exec - record an EXEC ioctl, or with @done the end of an
+ *	rga_exec() call.
+ */
+drm_private void rga_record_exec(struct rga_record *record, int done,
+				 unsigned int ops, uint64_t us, int ret)
+{
+	struct rga_record_exec rec;
+
+	if (!record)
+		return;
+
+	rec.us = us;
+	rec.ret = ret;
+	rec.ops = ops;
+
+	rga_record_packet(record, done ? RGA_RECORD_DONE : RGA_RECORD_EXEC,
+			  &rec, sizeof(rec), NULL, 0);
+
+	if (done)
+		fflush(record->file);
+}
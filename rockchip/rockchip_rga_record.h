@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Layout of the RGA submission traces written when RGA_TRACE_FILE is set
+ * and read by tests/rockchip/rga_replay. All fields are in host byte order.
+ *
+ * A trace is a struct rga_record_header followed by packets, each a
+ * struct rga_record_packet and @size bytes of payload:
+ *
+ *   BUFFER   buffer referenced by the following operations, with its
+ *            contents before rga_exec() ran when RGA_TRACE_CONTENTS=1,
+ *            or a staging buffer of the library, e.g. a pre-converted
+ *            source, before the cmdlists reading it
+ *   OP       one operation queued for rga_exec()
+ *   CMDLIST  one SET_CMDLIST ioctl, the cmd[] and cmd_buf[] arrays follow
+ *   EXEC     one EXEC ioctl
+ *   DONE     rga_exec() returned, closes the operations recorded before
+ *
+ * cmd[] and cmd_buf[] entries flagged RGA_GEM_BUF_FD carry the dma-buf fd
+ * of the recording process, BUFFER packets map those fds to buffer ids.
+ */
+
+#ifndef _ROCKCHIP_RGA_RECORD_H_
+#define _ROCKCHIP_RGA_RECORD_H_
+
+#include <stdint.h>
+
+#define RGA_RECORD_MAGIC	0x54414752	/* "RGAT" */
+#define RGA_RECORD_VERSION	2
+
+enum rga_record_type {
+	RGA_RECORD_BUFFER = 1,
+	RGA_RECORD_OP,
+	RGA_RECORD_CMDLIST,
+	RGA_RECORD_EXEC,
+	RGA_RECORD_DONE,
+};
+
+struct rga_record_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	major;
+	uint32_t	minor;
+};
+
+struct rga_record_packet {
+	uint32_t	type;
+	uint32_t	size;
+};
+
+/*
+ * @id: number of the buffer within the trace, from 1.
+ * @size: size of the buffer in bytes.
+ * @fd: dma-buf fd in the recording process, -1 for userptr buffers.
+ * @contents: @size bytes of buffer contents follow.
+ */
+struct rga_record_buffer {
+	uint64_t	id;
+	uint64_t	size;
+	int32_t		fd;
+	uint32_t	contents;
+};
+
+struct rga_record_image {
+	uint64_t	buffer;
+	uint32_t	color_mode;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	stride;
+	uint32_t	fill_color;
+	uint32_t	buf_type;
+	uint32_t	offset;
+	uint32_t	pad;
+};
+
+/*
+ * @type: 0 for a fill, 1 for a transform; @src is unused for fills.
+ */
+struct rga_record_op {
+	uint32_t		type;
+	uint32_t		degree;
+	struct rga_record_image	src;
+	struct rga_record_image	dst;
+	uint32_t		src_x, src_y, src_w, src_h;
+	uint32_t		dst_x, dst_y, dst_w, dst_h;
+	uint32_t		x_mirr, y_mirr;
+};
+
+struct rga_record_cmdlist {
+	uint32_t	cmd_nr;
+	uint32_t	cmd_buf_nr;
+	int32_t		ret;
+	uint32_t	pad;
+};
+
+/*
+ * @us: time the ioctl (EXEC) or the whole rga_exec() call (DONE) took.
+ */
+struct rga_record_exec {
+	uint64_t	us;
+	int32_t		ret;
+	uint32_t	ops;
+};
+
+#endif /* _ROCKCHIP_RGA_RECORD_H_ */
@@ -0,0 +1,693 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * A region is a short list of rectangles; once it is full a new
+ * rectangle is merged into the one whose bounding box grows the least.
+ */
+struct rga_region {
+	struct rga_rect		rects[RGA_SCENE_MAX_RECTS];
+	unsigned int		nr;
+};
+
+struct rga_scene_layer {
+	int			used;
+	int			fill;
+	struct rga_image	src;
+	struct rga_layer	layer;
+};
+
+/*
+ * @damage: changes since the last rga_scene_render().
+ * @history: damage of the frames rendered before, [0] being the latest.
+ * @frames: frames rendered so far, caps the usable buffer age.
+ * @clips: @damage of the latest frame, for drmModeDirtyFB().
+ */
+struct rga_scene {
+	struct rga_context	*ctx;
+	unsigned int		width, height;
+	unsigned int		bg_color;
+	struct rga_scene_layer	layers[RGA_SCENE_MAX_LAYERS];
+	unsigned int		layer_nr;
+
+	struct rga_region	damage;
+	struct rga_region	history[RGA_SCENE_MAX_AGE];
+	unsigned int		frames;
+
+	struct drm_clip_rect	clips[RGA_SCENE_MAX_RECTS];
+	unsigned int		clip_nr;
+};
+
+static unsigned int rga_rect_area(const struct rga_rect *r)
+{
+	return r->w * r->h;
+}
+
+static int rga_rect_intersect(const struct rga_rect *a,
+			      const struct rga_rect *b, struct rga_rect *out)
+{
+	unsigned int x1 = a->x > b->x ? a->x : b->x;
+	unsigned int y1 = a->y > b->y ? a->y : b->y;
+	unsigned int x2 = a->x + a->w < b->x + b->w ? a->x + a->w : b->x + b->w;
+	unsigned int y2 = a->y + a->h < b->y + b->h ? a->y + a->h : b->y + b->h;
+
+	if (x1 >= x2 || y1 >= y2)
+		return 0;
+
+	out->x = x1;
+	out->y = y1;
+	out->w = x2 - x1;
+	out->h = y2 - y1;
+
+	return 1;
+}
+
+static void rga_rect_union(const struct rga_rect *a, const struct rga_rect *b,
+			   struct rga_rect *out)
+{
+	unsigned int x1 = a->x < b->x ? a->x : b->x;
+	unsigned int y1 = a->y < b->y ? a->y : b->y;
+	unsigned int x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+	unsigned int y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+	out->x = x1;
+	out->y = y1;
+	out->w = x2 - x1;
+	out->h = y2 - y1;
+}
+
+static int rga_rect_contains(const struct rga_rect *a,
+			     const struct rga_rect *b)
+{
+	return b->x >= a->x && b->y >= a->y &&
+	       b->x + b->w <= a->x + a->w && b->y + b->h <= a->y + a->h;
+}
+
+static void rga_region_add(struct rga_region *region,
+			   const struct rga_rect *rect)
+{
+	unsigned int i, best = 0, best_growth = ~0U;
+	struct rga_rect merged;
+
+	if (!rect->w || !rect->h)
+		return;
+
+	for (i = 0; i < region->nr; i++)
+		if (rga_rect_contains(&region->rects[i], rect))
+			return;
+
+	if (region->nr < RGA_SCENE_MAX_RECTS) {
+		region->rects[region->nr++] = *rect;
+		return;
+	}
+
+	for (i = 0; i < region->nr; i++) {
+		unsigned int growth;
+
+		rga_rect_union(&region->rects[i], rect, &merged);
+		growth = rga_rect_area(&merged) -
+			 rga_rect_area(&region->rects[i]);
+		if (growth < best_growth) {
+			best_growth = growth;
+			best = i;
+		}
+	}
+
+	rga_rect_union(&region->rects[best], rect, &region->rects[best]);
+}
+
+static void rga_region_join(struct rga_region *region,
+			    const struct rga_region *other)
+{
+	unsigned int i;
+
+	for (i = 0; i < other->nr; i++)
+		rga_region_add(region, &other->rects[i]);
+}
+
+static void rga_scene_damage_rect(struct rga_scene *scene,
+				  const struct rga_rect *rect)
+{
+	struct rga_rect screen = { 0, 0, scene->width, scene->height };
+	struct rga_rect clipped;
+
+	if (rga_rect_intersect(&screen, rect, &clipped))
+		rga_region_add(&scene->damage, &clipped);
+}
+
+/*
+ * Scale @len units at @pos of a @from long axis to a @to long one, rounding
+ * outwards so the result covers every pixel the input touches.
+ */
+static void rga_scale_span(unsigned int pos, unsigned int len,
+			   unsigned int from, unsigned int to,
+			   unsigned int *out_pos, unsigned int *out_len)
+{
+	unsigned int start = (unsigned long long)pos * to / from;
+	unsigned int end = ((unsigned long long)(pos + len) * to + from - 1) /
+			   from;
+
+	*out_pos = start;
+	*out_len = end - start;
+}
+
+/*
+ * rga_layer_to_src - source window feeding a part of a layer.
+ *
+ * @l: the layer.
+ * @r: part of the destination window, relative to it.
+ * @out: returns the source window, relative to the source window.
+ *
+ * Undoes the mirroring, then the clockwise rotation, then the scaling
+ * rga_multiple_transform() applies.
+ */
+static void rga_layer_to_src(const struct rga_layer *l,
+			     const struct rga_rect *r, struct rga_rect *out)
+{
+	unsigned int dw = l->dst_rect.w, dh = l->dst_rect.h;
+	int rot = (l->degree == 90 || l->degree == 270);
+	struct rga_rect m = *r, p;
+
+	if (l->x_mirr)
+		m.x = dw - m.x - m.w;
+	if (l->y_mirr)
+		m.y = dh - m.y - m.h;
+
+	switch (l->degree) {
+	case 90:
+		p.x = m.y;
+		p.y = dw - m.x - m.w;
+		p.w = m.h;
+		p.h = m.w;
+		break;
+	case 180:
+		p.x = dw - m.x - m.w;
+		p.y = dh - m.y - m.h;
+		p.w = m.w;
+		p.h = m.h;
+		break;
+	case 270:
+		p.x = dh - m.y - m.h;
+		p.y = m.x;
+		p.w = m.h;
+		p.h = m.w;
+		break;
+	default:
+		p = m;
+		break;
+	}
+
+	rga_scale_span(p.x, p.w, rot ? dh : dw, l->src_rect.w, &out->x,
+		       &out->w);
+	rga_scale_span(p.y, p.h, rot ? dw : dh, l->src_rect.h, &out->y,
+		       &out->h);
+}
+
+/*
+ * rga_layer_to_dst - the forward direction of rga_layer_to_src().
+ */
+static void rga_layer_to_dst(const struct rga_layer *l,
+			     const struct rga_rect *r, struct rga_rect *out)
+{
+	unsigned int dw = l->dst_rect.w, dh = l->dst_rect.h;
+	int rot = (l->degree == 90 || l->degree == 270);
+	struct rga_rect p, m;
+
+	rga_scale_span(r->x, r->w, l->src_rect.w, rot ? dh : dw, &p.x, &p.w);
+	rga_scale_span(r->y, r->h, l->src_rect.h, rot ? dw : dh, &p.y, &p.h);
+
+	switch (l->degree) {
+	case 90:
+		m.x = dw - p.y - p.h;
+		m.y = p.x;
+		m.w = p.h;
+		m.h = p.w;
+		break;
+	case 180:
+		m.x = dw - p.x - p.w;
+		m.y = dh - p.y - p.h;
+		m.w = p.w;
+		m.h = p.h;
+		break;
+	case 270:
+		m.x = p.y;
+		m.y = dh - p.x - p.w;
+		m.w = p.h;
+		m.h = p.w;
+		break;
+	default:
+		m = p;
+		break;
+	}
+
+	if (l->x_mirr)
+		m.x = dw - m.x - m.w;
+	if (l->y_mirr)
+		m.y = dh - m.y - m.h;
+
+	*out = m;
+}
+
+static struct rga_scene_layer *rga_scene_layer_get(struct rga_scene *scene,
+						   int id)
+{
+	if (id < 0 || id >= RGA_SCENE_MAX_LAYERS || !scene->layers[id].used)
+		return NULL;
+
+	return &scene->layers[id];
+}
+
+static int rga_scene_layer_check(const struct rga_layer *layer)
+{
+	const struct rga_rect *s = &layer->src_rect, *d = &layer->dst_rect;
+
+	if (layer->degree != 0 && layer->degree != 90 &&
+	    layer->degree != 180 && layer->degree != 270)
+		return -EINVAL;
+
+	if (!d->w || !d->h)
+		return -EINVAL;
+
+	if (layer->src && (!s->w || !s->h ||
+			   s->x + s->w > layer->src->width ||
+			   s->y + s->h > layer->src->height))
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * rga_scene_create - create a damage tracking compositor.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @width, @height: size of the images the scene is rendered to.
+ * @bg_color: ARGB8888 color of the parts no layer covers.
+ */
+struct rga_scene *rga_scene_create(struct rga_context *ctx,
+				   unsigned int width, unsigned int height,
+				   unsigned int bg_color)
+{
+	struct rga_scene *scene;
+
+	scene = calloc(1, sizeof(*scene));
+	if (!scene) {
+		fprintf(stderr, "failed to allocate scene.\n");
+		return NULL;
+	}
+
+	scene->ctx = ctx;
+	scene->width = width;
+	scene->height = height;
+	scene->bg_color = bg_color;
+
+	return scene;
+}
+
+void rga_scene_destroy(struct rga_scene *scene)
+{
+	free(scene);
+}
+
+/**
+ * rga_scene_add_layer - put a layer on top of the scene.
+ *
+ * @scene: a pointer to rga_scene structure.
+ * @layer: what to draw where, @layer->src is copied.
+ *
+ * Returns the id of the new layer or a negative errno.
+ */
+int rga_scene_add_layer(struct rga_scene *scene, const struct rga_layer *layer)
+{
+	unsigned int id;
+	int ret;
+
+	if (scene->layer_nr >= RGA_SCENE_MAX_LAYERS) {
+		fprintf(stderr, "Overflow scene layers.\n");
+		return -ENOSPC;
+	}
+
+	id = scene->layer_nr++;
+	ret = rga_scene_set_layer(scene, id, layer);
+	if (ret) {
+		scene->layer_nr--;
+		return ret;
+	}
+
+	return id;
+}
+
+/**
+ * rga_scene_set_layer - change what a layer draws, or where.
+ *
+ * @scene: a pointer to rga_scene structure.
+ * @id: a layer id returned by rga_scene_add_layer().
+ * @layer: the new layer state, NULL hides the layer.
+ *
+ * Both the old and the new destination windows are damaged.
+ */
+int rga_scene_set_layer(struct rga_scene *scene, int id,
+			const struct rga_layer *layer)
+{
+	struct rga_scene_layer *sl;
+
+	if (id < 0 || (unsigned int)id >= scene->layer_nr)
+		return -EINVAL;
+
+	if (layer && rga_scene_layer_check(layer)) {
+		fprintf(stderr, "invalid scene layer.\n");
+		return -EINVAL;
+	}
+
+	sl = &scene->layers[id];
+	if (sl->used)
+		rga_scene_damage_rect(scene, &sl->layer.dst_rect);
+
+	sl->used = !!layer;
+	if (!layer)
+		return 0;
+
+	sl->layer = *layer;
+	sl->fill = !layer->src;
+	if (layer->src)
+		sl->src = *layer->src;
+	sl->layer.src = sl->fill ? NULL : &sl->src;
+
+	rga_scene_damage_rect(scene, &sl->layer.dst_rect);
+
+	return 0;
+}
+
+/**
+ * rga_scene_damage_layer - mark part of a layer as changed.
+ *
+ * @scene: a pointer to rga_scene structure.
+ * @id: a layer id returned by rga_scene_add_layer().
+ * @rect: changed part of the source image, NULL for the whole layer.
+ */
+int rga_scene_damage_layer(struct rga_scene *scene, int id,
+			   const struct rga_rect *rect)
+{
+	struct rga_scene_layer *sl = rga_scene_layer_get(scene, id);
+	const struct rga_layer *l;
+	struct rga_rect part, dst;
+
+	if (!sl)
+		return -EINVAL;
+
+	l = &sl->layer;
+	if (!rect || sl->fill) {
+		rga_scene_damage_rect(scene, &l->dst_rect);
+		return 0;
+	}
+
+	if (!rga_rect_intersect(&l->src_rect, rect, &part))
+		return 0;
+
+	part.x -= l->src_rect.x;
+	part.y -= l->src_rect.y;
+	rga_layer_to_dst(l, &part, &dst);
+	dst.x += l->dst_rect.x;
+	dst.y += l->dst_rect.y;
+
+	rga_scene_damage_rect(scene, &dst);
+
+	return 0;
+}
+
+/**
+ * rga_scene_damage - mark part of the output as changed.
+ *
+ * @scene: a pointer to rga_scene structure.
+ * @rect: changed part of the output, NULL for all of it.
+ */
+int rga_scene_damage(struct rga_scene *scene, const struct rga_rect *rect)
+{
+	struct rga_rect all = { 0, 0, scene->width, scene->height };
+
+	rga_scene_damage_rect(scene, rect ? rect : &all);
+
+	return 0;
+}
+
+static int rga_layer_scaled(const struct rga_layer *l)
+{
+	int rot = (l->degree == 90 || l->degree == 270);
+
+	return l->src_rect.w != (rot ? l->dst_rect.h : l->dst_rect.w) ||
+	       l->src_rect.h != (rot ? l->dst_rect.w : l->dst_rect.h);
+}
+
+/*
+ * rga_scene_expand - grow the rectangles of @region touching a scaled
+ *	layer to hold all of it that is on screen. Scaling a part of a
+ *	layer on its own rounds differently, so scaled layers are only
+ *	drawn in one piece.
+ */
+static void rga_scene_expand(struct rga_scene *scene,
+			     struct rga_region *region)
+{
+	struct rga_rect screen = { 0, 0, scene->width, scene->height };
+	struct rga_rect shown, part, *r;
+	unsigned int i, j;
+	int grown;
+
+	do {
+		grown = 0;
+
+		for (i = 0; i < scene->layer_nr; i++) {
+			const struct rga_scene_layer *sl = &scene->layers[i];
+
+			if (!sl->used || sl->fill ||
+			    !rga_layer_scaled(&sl->layer) ||
+			    !rga_rect_intersect(&screen, &sl->layer.dst_rect,
+						&shown))
+				continue;
+
+			for (j = 0; j < region->nr; j++) {
+				r = &region->rects[j];
+				if (rga_rect_intersect(r, &shown, &part) &&
+				    !rga_rect_contains(r, &shown)) {
+					rga_rect_union(r, &shown, r);
+					grown = 1;
+				}
+			}
+		}
+	} while (grown);
+}
+
+static int rga_scene_queue(struct rga_scene *scene)
+{
+	struct rga_context *ctx = scene->ctx;
+
+	if (ctx->op_nr < RGA_MAX_CMD_LIST_NR)
+		return 0;
+
+	return rga_exec(ctx);
+}
+
+static int rga_scene_draw(struct rga_scene *scene, struct rga_image *dst,
+			  struct rga_scene_layer *sl,
+			  const struct rga_rect *clip)
+{
+	const struct rga_layer *l = &sl->layer;
+	struct rga_rect part, src;
+	int ret;
+
+	if (!rga_rect_intersect(&l->dst_rect, clip, &part))
+		return 0;
+
+	ret = rga_scene_queue(scene);
+	if (ret)
+		return ret;
+
+	if (sl->fill) {
+		dst->fill_color = l->fill_color;
+		return rga_solid_fill(scene->ctx, dst, part.x, part.y,
+				      part.w, part.h);
+	}
+
+	part.x -= l->dst_rect.x;
+	part.y -= l->dst_rect.y;
+	rga_layer_to_src(l, &part, &src);
+
+	return rga_multiple_transform(scene->ctx, &sl->src, dst,
+				      l->src_rect.x + src.x,
+				      l->src_rect.y + src.y, src.w, src.h,
+				      l->dst_rect.x + part.x,
+				      l->dst_rect.y + part.y, part.w, part.h,
+				      l->degree, l->x_mirr, l->y_mirr);
+}
+
+/*
+ * rga_scene_draw_clip - redraw one rectangle of the output, starting from
+ *	the topmost layer that covers all of it.
+ */
+static int rga_scene_draw_clip(struct rga_scene *scene,
+			       struct rga_image *dst,
+			       const struct rga_rect *clip)
+{
+	unsigned int i, first = 0;
+	int ret, covered = 0;
+
+	for (i = scene->layer_nr; i-- > 0;) {
+		const struct rga_scene_layer *sl = &scene->layers[i];
+
+		if (sl->used && rga_rect_contains(&sl->layer.dst_rect, clip)) {
+			first = i;
+			covered = 1;
+			break;
+		}
+	}
+
+	if (!covered) {
+		ret = rga_scene_queue(scene);
+		if (ret)
+			return ret;
+
+		dst->fill_color = scene->bg_color;
+		ret = rga_solid_fill(scene->ctx, dst, clip->x, clip->y,
+				     clip->w, clip->h);
+		if (ret)
+			return ret;
+	}
+
+	for (i = first; i < scene->layer_nr; i++) {
+		if (!scene->layers[i].used)
+			continue;
+
+		ret = rga_scene_draw(scene, dst, &scene->layers[i], clip);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * rga_scene_render - bring an image up to date with the scene.
+ *
+ * @scene: a pointer to rga_scene structure.
+ * @dst: the image to render to, @scene sized.
+ * @age: buffer age of @dst: 1 if it holds the previous frame, 2 for the
+ *	one before, and so on; 0 if its contents are unknown.
+ *
+ * Only the parts that changed in the last @age frames are redrawn, along
+ * with all of any scaled layer they touch. The damage of this frame then
+ * becomes available to rga_scene_dirty_fb().
+ *
+ * Returns the number of rectangles redrawn or a negative errno.
+ */
+int rga_scene_render(struct rga_scene *scene, struct rga_image *dst,
+		     unsigned int age)
+{
+	struct rga_rect all = { 0, 0, scene->width, scene->height };
+	struct rga_image target = *dst;
+	struct rga_region region;
+	unsigned int i;
+	int ret = 0;
+
+	if (dst->width < scene->width || dst->height < scene->height) {
+		fprintf(stderr, "scene exceeds its target.\n");
+		return -EINVAL;
+	}
+
+	region = scene->damage;
+	if (age == 0 || age > RGA_SCENE_MAX_AGE || age > scene->frames) {
+		region.nr = 0;
+		rga_region_add(&region, &all);
+	} else {
+		for (i = 0; i < age - 1; i++)
+			rga_region_join(&region, &scene->history[i]);
+		rga_scene_expand(scene, &region);
+	}
+
+	for (i = 0; i < region.nr && !ret; i++)
+		ret = rga_scene_draw_clip(scene, &target, &region.rects[i]);
+
+	if (!ret && scene->ctx->op_nr)
+		ret = rga_exec(scene->ctx);
+	if (ret)
+		return ret;
+
+	memmove(&scene->history[1], &scene->history[0],
+		(RGA_SCENE_MAX_AGE - 1) * sizeof(scene->history[0]));
+	scene->history[0] = scene->damage;
+	if (scene->frames < RGA_SCENE_MAX_AGE)
+		scene->frames++;
+
+	scene->clip_nr = scene->damage.nr;
+	for (i = 0; i < scene->damage.nr; i++) {
+		const struct rga_rect *r = &scene->damage.rects[i];
+
+		scene->clips[i].x1 = r->x;
+		scene->clips[i].y1 = r->y;
+		scene->clips[i].x2 = r->x + r->w;
+		scene->clips[i].y2 = r->y + r->h;
+	}
+
+	scene->damage.nr = 0;
+
+	return region.nr;
+}
+
+/**
+ * rga_scene_get_clips - changed rectangles of the latest rendered frame.
+ *
+ * @scene: a pointer to rga_scene structure.
+ * @clips: returns an array valid until the next rga_scene_render().
+ */
+unsigned int rga_scene_get_clips(struct rga_scene *scene,
+				 struct drm_clip_rect **clips)
+{
+	*clips = scene->clips;
+
+	return scene->clip_nr;
+}
+
+/**
+ * rga_scene_dirty_fb - report the changes of the latest frame to KMS.
+ *
+ * @scene: a pointer to rga_scene structure.
+ * @fd: a file descriptor to an opened drm device.
+ * @fb_id: the framebuffer rga_scene_render() drew to.
+ */
+int rga_scene_dirty_fb(struct rga_scene *scene, int fd, unsigned int fb_id)
+{
+	int ret;
+
+	if (!scene->clip_nr)
+		return 0;
+
+	ret = drmModeDirtyFB(fd, fb_id, scene->clips, scene->clip_nr);
+
+	/* Drivers without dirty tracking scan out continuously */
+	if (ret == -ENOSYS)
+		return 0;
+
+	return ret;
+}
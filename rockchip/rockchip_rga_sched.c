@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * Process-wide owner of the RGA. A context holds it from its first
+ * SET_CMDLIST until the EXEC running those cmdlists returned, which also
+ * keeps contexts sharing a drm fd from executing each other's cmdlists.
+ * Waiters of a higher class always go first.
+ */
+static struct {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	int			busy;
+	unsigned int		waiting[RGA_PRIORITY_NR];
+} rga_sched = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Must be called with rga_sched.lock held */
+static int rga_sched_waiting_above(enum e_rga_priority prio)
+{
+	unsigned int i;
+
+	for (i = 0; i < prio; i++)
+		if (rga_sched.waiting[i])
+			return 1;
+
+	return 0;
+}
+
+/*
+ * rga_sched_hold - make @ctx the owner of the RGA, if it isn't already.
+ */
+drm_private void rga_sched_hold(struct rga_context *ctx)
+{
+	uint64_t start;
+
+	if (ctx->sched_held)
+		return;
+
+	start = rga_time_us();
+
+	pthread_mutex_lock(&rga_sched.lock);
+	rga_sched.waiting[ctx->priority]++;
+	while (rga_sched.busy || rga_sched_waiting_above(ctx->priority))
+		pthread_cond_wait(&rga_sched.cond, &rga_sched.lock);
+	rga_sched.waiting[ctx->priority]--;
+	rga_sched.busy = 1;
+	pthread_mutex_unlock(&rga_sched.lock);
+
+	rga_stats_hist(ctx->stats.sched_wait_us, rga_time_us() - start);
+	ctx->sched_held = 1;
+}
+
+/*
+ * rga_sched_drop - give the RGA up once the EXEC of @ctx returned.
+ */
+drm_private void rga_sched_drop(struct rga_context *ctx)
+{
+	if (!ctx->sched_held)
+		return;
+
+	pthread_mutex_lock(&rga_sched.lock);
+	if (rga_sched_waiting_above(ctx->priority))
+		ctx->stats.sched_yields++;
+	rga_sched.busy = 0;
+	pthread_cond_broadcast(&rga_sched.cond);
+	pthread_mutex_unlock(&rga_sched.lock);
+
+	ctx->sched_held = 0;
+}
+
+/*
+ * rga_sched_contended - check whether a job of a higher class than @ctx
+ *	waits for the RGA.
+ */
+drm_private int rga_sched_contended(struct rga_context *ctx)
+{
+	int ret;
+
+	pthread_mutex_lock(&rga_sched.lock);
+	ret = rga_sched_waiting_above(ctx->priority);
+	pthread_mutex_unlock(&rga_sched.lock);
+
+	return ret;
+}
+
+/*
+ * rga_sched_slice_rows - destination rows per slice of a background
+ *	operation, or 0 if it is small enough or cannot be cut.
+ *
+ * Slices are cut like hybrid bands, so the same restrictions apply: the
+ * axis the destination rows come from must not be scaled and offsets must
+ * be even.
+ */
+drm_private unsigned int rga_sched_slice_rows(const struct rga_op *op)
+{
+	int rot = (op->degree == 90 || op->degree == 270);
+	unsigned int rows, min;
+
+	if (op->dst_w * op->dst_h <= RGA_SCHED_SLICE_PIXELS)
+		return 0;
+
+	if (op->type == RGA_OP_TRANSFORM &&
+	    ((rot ? op->src_w : op->src_h) != op->dst_h ||
+	     (op->src_x | op->src_y) & 1))
+		return 0;
+
+	if ((op->dst_y | op->dst_h) & 1)
+		return 0;
+
+	min = (RGA_HW_MIN_HEIGHT + RGA_HYBRID_BAND_ALIGN - 1) &
+	      ~(RGA_HYBRID_BAND_ALIGN - 1);
+	rows = (RGA_SCHED_SLICE_PIXELS / op->dst_w) &
+	       ~(RGA_HYBRID_BAND_ALIGN - 1);
+	if (rows < min)
+		rows = min;
+
+	return op->dst_h >= 2 * rows ? rows : 0;
+}
+
+/**
+ * rga_set_priority - set the class of the jobs of a context.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @priority: RGA_PRIORITY_REALTIME jobs get the RGA before NORMAL ones,
+ *	which get it before BACKGROUND ones. Background jobs are submitted
+ *	in small slices and give the RGA up between them.
+ * @deadline_us: rga_exec() calls taking longer count as deadline misses,
+ *	0 for none.
+ */
+int rga_set_priority(struct rga_context *ctx, enum e_rga_priority priority,
+		     unsigned int deadline_us)
+{
+	if (priority >= RGA_PRIORITY_NR)
+		return -EINVAL;
+
+	ctx->priority = priority;
+	ctx->deadline_us = deadline_us;
+
+	return 0;
+}
@@ -0,0 +1,806 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RGA_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__)
+#define RGA_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RGA_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#include "rockchip_rga_priv.h"
+
+/*
+ * All YUV <-> RGB conversions use BT.601 limited range, the mode the RGA
+ * is programmed with (RGA_DST_CSC_MODE_BT601_R0). The SIMD kernels use the
+ * same fixed point constants so every backend produces identical output.
+ */
+
+static inline uint8_t clamp8(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static void c_fill32(uint32_t *dst, uint32_t val, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = val;
+}
+
+static void c_reverse32(uint32_t *dst, const uint32_t *src, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = src[n - 1 - i];
+}
+
+static void c_rotate32(uint32_t *dst, int dst_stride, const uint32_t *src,
+		       int src_stride, unsigned int w, unsigned int h,
+		       int reverse)
+{
+	unsigned int x, y;
+
+	for (y = 0; y < h; y++) {
+		const uint32_t *s = src + (ptrdiff_t)y * src_stride;
+		unsigned int col = reverse ? h - 1 - y : y;
+
+		for (x = 0; x < w; x++)
+			dst[(ptrdiff_t)x * dst_stride + col] = s[x];
+	}
+}
+
+static void c_yuv_to_rgb32(uint32_t *dst, const uint8_t *y,
+			   const uint8_t *uv, unsigned int n, int uv_swap,
+			   const uint8_t shifts[4])
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		int c = y[i] - 16;
+		int d = uv[(i & ~1) + (uv_swap ? 1 : 0)] - 128;
+		int e = uv[(i & ~1) + (uv_swap ? 0 : 1)] - 128;
+
+		dst[i] = (uint32_t)clamp8((298 * c + 409 * e + 128) >> 8) << shifts[0] |
+			 (uint32_t)clamp8((298 * c - 100 * d - 208 * e + 128) >> 8) << shifts[1] |
+			 (uint32_t)clamp8((298 * c + 516 * d + 128) >> 8) << shifts[2] |
+			 (uint32_t)0xff << shifts[3];
+	}
+}
+
+static void c_rgb32_to_yuv(uint8_t *y0, uint8_t *y1, uint8_t *uv,
+			   const uint32_t *src0, const uint32_t *src1,
+			   unsigned int n, int uv_swap, const uint8_t shifts[3])
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i += 2) {
+		unsigned int j = (i + 1 < n) ? i + 1 : i;
+		int r[4], g[4], b[4], k, rs = 0, gs = 0, bs = 0;
+		const uint32_t px[4] = { src0[i], src0[j], src1[i], src1[j] };
+
+		for (k = 0; k < 4; k++) {
+			r[k] = (px[k] >> shifts[0]) & 0xff;
+			g[k] = (px[k] >> shifts[1]) & 0xff;
+			b[k] = (px[k] >> shifts[2]) & 0xff;
+			rs += r[k];
+			gs += g[k];
+			bs += b[k];
+		}
+
+		y0[i] = ((66 * r[0] + 129 * g[0] + 25 * b[0] + 128) >> 8) + 16;
+		if (j != i)
+			y0[j] = ((66 * r[1] + 129 * g[1] + 25 * b[1] + 128) >> 8) + 16;
+		if (y1) {
+			y1[i] = ((66 * r[2] + 129 * g[2] + 25 * b[2] + 128) >> 8) + 16;
+			if (j != i)
+				y1[j] = ((66 * r[3] + 129 * g[3] + 25 * b[3] + 128) >> 8) + 16;
+		}
+
+		rs = (rs + 2) >> 2;
+		gs = (gs + 2) >> 2;
+		bs = (bs + 2) >> 2;
+
+		uv[i + (uv_swap ? 1 : 0)] =
+			((-38 * rs - 74 * gs + 112 * bs + 128) >> 8) + 128;
+		uv[i + (uv_swap ? 0 : 1)] =
+			((112 * rs - 94 * gs - 18 * bs + 128) >> 8) + 128;
+	}
+}
+
+static void c_packed_to_yuv(uint8_t *y, uint8_t *uv, const uint8_t *src,
+			    unsigned int n, int y_odd, int uv_swap)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		y[i] = src[2 * i + y_odd];
+
+	if (!uv)
+		return;
+
+	for (i = 0; i < n; i += 2) {
+		uv[i] = src[2 * i + !y_odd + (uv_swap ? 2 : 0)];
+		uv[i + 1] = src[2 * i + !y_odd + (uv_swap ? 0 : 2)];
+	}
+}
+
+static const struct rga_cpu_kernels c_kernels = {
+	.name = "c",
+	.fill32 = c_fill32,
+	.reverse32 = c_reverse32,
+	.rotate32 = c_rotate32,
+	.yuv_to_rgb32 = c_yuv_to_rgb32,
+	.rgb32_to_yuv = c_rgb32_to_yuv,
+	.packed_to_yuv = c_packed_to_yuv,
+};
+
+#ifdef RGA_HAVE_SSE2
+static void sse2_fill32(uint32_t *dst, uint32_t val, unsigned int n)
+{
+	__m128i v = _mm_set1_epi32(val);
+	unsigned int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+		_mm_storeu_si128((__m128i *)(dst + i + 4), v);
+		_mm_storeu_si128((__m128i *)(dst + i + 8), v);
+		_mm_storeu_si128((__m128i *)(dst + i + 12), v);
+	}
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+
+	c_fill32(dst + i, val, n - i);
+}
+
+static void sse2_reverse32(uint32_t *dst, const uint32_t *src, unsigned int n)
+{
+	unsigned int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + n - 4 - i));
+
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+	}
+
+	c_reverse32(dst + i, src, n - i);
+}
+
+static void sse2_rotate32(uint32_t *dst, int dst_stride, const uint32_t *src,
+			  int src_stride, unsigned int w, unsigned int h,
+			  int reverse)
+{
+	unsigned int x, y, bw = w & ~3, bh = h & ~3;
+
+	for (y = 0; y < bh; y += 4) {
+		const uint32_t *s = src + (ptrdiff_t)y * src_stride;
+		unsigned int col = reverse ? h - 4 - y : y;
+
+		for (x = 0; x < bw; x += 4) {
+			__m128i r0, r1, r2, r3, t0, t1, t2, t3, c[4];
+			uint32_t *d = dst + (ptrdiff_t)x * dst_stride + col;
+			int k;
+
+			r0 = _mm_loadu_si128((const __m128i *)(s + x));
+			r1 = _mm_loadu_si128((const __m128i *)(s + src_stride + x));
+			r2 = _mm_loadu_si128((const __m128i *)(s + 2 * src_stride + x));
+			r3 = _mm_loadu_si128((const __m128i *)(s + 3 * src_stride + x));
+
+			t0 = _mm_unpacklo_epi32(r0, r1);
+			t1 = _mm_unpacklo_epi32(r2, r3);
+			t2 = _mm_unpackhi_epi32(r0, r1);
+			t3 = _mm_unpackhi_epi32(r2, r3);
+
+			c[0] = _mm_unpacklo_epi64(t0, t1);
+			c[1] = _mm_unpackhi_epi64(t0, t1);
+			c[2] = _mm_unpacklo_epi64(t2, t3);
+			c[3] = _mm_unpackhi_epi64(t2, t3);
+
+			for (k = 0; k < 4; k++) {
+				if (reverse)
+					c[k] = _mm_shuffle_epi32(c[k], _MM_SHUFFLE(0, 1, 2, 3));
+				_mm_storeu_si128((__m128i *)(d + (ptrdiff_t)k * dst_stride), c[k]);
+			}
+		}
+	}
+
+	/* Right and bottom edges that do not fill a whole 4x4 block */
+	if (bw < w)
+		c_rotate32(dst + (ptrdiff_t)bw * dst_stride, dst_stride,
+			   src + bw, src_stride, w - bw, h, reverse);
+	if (bh < h)
+		c_rotate32(dst + (reverse ? 0 : bh), dst_stride,
+			   src + (ptrdiff_t)bh * src_stride, src_stride,
+			   bw, h - bh, reverse);
+}
+
+static inline __m128i sse2_madd_pair(__m128i a, __m128i b, int ca, int cb)
+{
+	return _mm_madd_epi16(_mm_unpacklo_epi16(a, b),
+			      _mm_set1_epi32((ca & 0xffff) | ((unsigned int)cb << 16)));
+}
+
+static inline __m128i sse2_madd_pair_hi(__m128i a, __m128i b, int ca, int cb)
+{
+	return _mm_madd_epi16(_mm_unpackhi_epi16(a, b),
+			      _mm_set1_epi32((ca & 0xffff) | ((unsigned int)cb << 16)));
+}
+
+static inline __m128i sse2_descale(__m128i lo, __m128i hi)
+{
+	const __m128i round = _mm_set1_epi32(128);
+
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 8);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 8);
+
+	/* saturate to 16 bit, then to 0..255 */
+	return _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128());
+}
+
+static void sse2_yuv_to_rgb32(uint32_t *dst, const uint8_t *y,
+			      const uint8_t *uv, unsigned int n, int uv_swap,
+			      const uint8_t shifts[4])
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha = _mm_set1_epi32((uint32_t)0xff << shifts[3]);
+	const __m128i sr = _mm_cvtsi32_si128(shifts[0]);
+	const __m128i sg = _mm_cvtsi32_si128(shifts[1]);
+	const __m128i sb = _mm_cvtsi32_si128(shifts[2]);
+	unsigned int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i c, uv16, u32, v32, d, e, r, g, b, t;
+		__m128i ch[3];
+		int k;
+
+		c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + i)), zero);
+		c = _mm_sub_epi16(c, _mm_set1_epi16(16));
+
+		uv16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(uv + i)), zero);
+		uv16 = _mm_sub_epi16(uv16, _mm_set1_epi16(128));
+
+		/* split the interleaved pairs and duplicate them per pixel */
+		u32 = _mm_srai_epi32(_mm_slli_epi32(uv16, 16), 16);
+		v32 = _mm_srai_epi32(uv16, 16);
+		if (uv_swap) {
+			t = u32;
+			u32 = v32;
+			v32 = t;
+		}
+		d = _mm_packs_epi32(u32, u32);
+		d = _mm_unpacklo_epi16(d, d);
+		e = _mm_packs_epi32(v32, v32);
+		e = _mm_unpacklo_epi16(e, e);
+
+		r = sse2_descale(sse2_madd_pair(c, e, 298, 409),
+				 sse2_madd_pair_hi(c, e, 298, 409));
+		g = sse2_descale(_mm_add_epi32(sse2_madd_pair(c, d, 298, -100),
+					       sse2_madd_pair(e, zero, -208, 0)),
+				 _mm_add_epi32(sse2_madd_pair_hi(c, d, 298, -100),
+					       sse2_madd_pair_hi(e, zero, -208, 0)));
+		b = sse2_descale(sse2_madd_pair(c, d, 298, 516),
+				 sse2_madd_pair_hi(c, d, 298, 516));
+
+		ch[0] = _mm_unpacklo_epi8(r, zero);
+		ch[1] = _mm_unpacklo_epi8(g, zero);
+		ch[2] = _mm_unpacklo_epi8(b, zero);
+
+		for (k = 0; k < 2; k++) {
+			__m128i px = alpha;
+
+			if (k == 0) {
+				r = _mm_unpacklo_epi16(ch[0], zero);
+				g = _mm_unpacklo_epi16(ch[1], zero);
+				b = _mm_unpacklo_epi16(ch[2], zero);
+			} else {
+				r = _mm_unpackhi_epi16(ch[0], zero);
+				g = _mm_unpackhi_epi16(ch[1], zero);
+				b = _mm_unpackhi_epi16(ch[2], zero);
+			}
+
+			px = _mm_or_si128(px, _mm_sll_epi32(r, sr));
+			px = _mm_or_si128(px, _mm_sll_epi32(g, sg));
+			px = _mm_or_si128(px, _mm_sll_epi32(b, sb));
+			_mm_storeu_si128((__m128i *)(dst + i + 4 * k), px);
+		}
+	}
+
+	c_yuv_to_rgb32(dst + i, y + i, uv + i, n - i, uv_swap, shifts);
+}
+
+static void sse2_rgb32_to_yuv(uint8_t *y0, uint8_t *y1, uint8_t *uv,
+			      const uint32_t *src0, const uint32_t *src1,
+			      unsigned int n, int uv_swap,
+			      const uint8_t shifts[3])
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	const __m128i sr = _mm_cvtsi32_si128(shifts[0]);
+	const __m128i sg = _mm_cvtsi32_si128(shifts[1]);
+	const __m128i sb = _mm_cvtsi32_si128(shifts[2]);
+	unsigned int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i s0, s1, r, g, b, yv, u, v, uvv;
+		uint32_t tmp;
+
+		s0 = _mm_loadu_si128((const __m128i *)(src0 + i));
+		s1 = _mm_loadu_si128((const __m128i *)(src1 + i));
+
+		/* 16-bit lanes: 4 pixels of row 0 followed by 4 of row 1 */
+		r = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(s0, sr), mask),
+				    _mm_and_si128(_mm_srl_epi32(s1, sr), mask));
+		g = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(s0, sg), mask),
+				    _mm_and_si128(_mm_srl_epi32(s1, sg), mask));
+		b = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(s0, sb), mask),
+				    _mm_and_si128(_mm_srl_epi32(s1, sb), mask));
+
+		/* the sums fit in 16 unsigned bits, so logical shifts are fine */
+		yv = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+				   _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+		yv = _mm_add_epi16(yv, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+		yv = _mm_srli_epi16(_mm_add_epi16(yv, _mm_set1_epi16(128)), 8);
+		yv = _mm_add_epi16(yv, _mm_set1_epi16(16));
+		yv = _mm_packus_epi16(yv, yv);
+
+		tmp = _mm_cvtsi128_si32(yv);
+		memcpy(y0 + i, &tmp, 4);
+		if (y1) {
+			tmp = _mm_cvtsi128_si32(_mm_srli_si128(yv, 4));
+			memcpy(y1 + i, &tmp, 4);
+		}
+
+		/* 2x2 box average, results land in 16-bit lanes 0 and 2 */
+		r = _mm_add_epi16(r, _mm_srli_si128(r, 8));
+		g = _mm_add_epi16(g, _mm_srli_si128(g, 8));
+		b = _mm_add_epi16(b, _mm_srli_si128(b, 8));
+		r = _mm_add_epi16(r, _mm_srli_epi32(r, 16));
+		g = _mm_add_epi16(g, _mm_srli_epi32(g, 16));
+		b = _mm_add_epi16(b, _mm_srli_epi32(b, 16));
+		r = _mm_srli_epi16(_mm_add_epi16(r, _mm_set1_epi16(2)), 2);
+		g = _mm_srli_epi16(_mm_add_epi16(g, _mm_set1_epi16(2)), 2);
+		b = _mm_srli_epi16(_mm_add_epi16(b, _mm_set1_epi16(2)), 2);
+
+		/*
+		 * Bias by 128 << 8 so the intermediate stays positive, the
+		 * wrap-around of the 16-bit arithmetic cancels out.
+		 */
+		u = _mm_sub_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)),
+				  _mm_mullo_epi16(r, _mm_set1_epi16(38)));
+		u = _mm_sub_epi16(u, _mm_mullo_epi16(g, _mm_set1_epi16(74)));
+		u = _mm_srli_epi16(_mm_add_epi16(u, _mm_set1_epi16(0x8080)), 8);
+		v = _mm_sub_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)),
+				  _mm_mullo_epi16(g, _mm_set1_epi16(94)));
+		v = _mm_sub_epi16(v, _mm_mullo_epi16(b, _mm_set1_epi16(18)));
+		v = _mm_srli_epi16(_mm_add_epi16(v, _mm_set1_epi16(0x8080)), 8);
+
+		uvv = uv_swap ? _mm_unpacklo_epi16(v, u) : _mm_unpacklo_epi16(u, v);
+		uvv = _mm_shuffle_epi32(uvv, _MM_SHUFFLE(3, 1, 2, 0));
+		uvv = _mm_packus_epi16(uvv, uvv);
+
+		tmp = _mm_cvtsi128_si32(uvv);
+		memcpy(uv + i, &tmp, 4);
+	}
+
+	if (i < n)
+		c_rgb32_to_yuv(y0 + i, y1 ? y1 + i : NULL, uv + i, src0 + i,
+			       src1 + i, n - i, uv_swap, shifts);
+}
+
+static void sse2_packed_to_yuv(uint8_t *y, uint8_t *uv, const uint8_t *src,
+			       unsigned int n, int y_odd, int uv_swap)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	unsigned int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+		__m128i lo_a = _mm_and_si128(a, mask);
+		__m128i lo_b = _mm_and_si128(b, mask);
+		__m128i hi_a = _mm_srli_epi16(a, 8);
+		__m128i hi_b = _mm_srli_epi16(b, 8);
+		__m128i c;
+
+		if (y_odd) {
+			_mm_storeu_si128((__m128i *)(y + i),
+					 _mm_packus_epi16(hi_a, hi_b));
+			c = _mm_packus_epi16(lo_a, lo_b);
+		} else {
+			_mm_storeu_si128((__m128i *)(y + i),
+					 _mm_packus_epi16(lo_a, lo_b));
+			c = _mm_packus_epi16(hi_a, hi_b);
+		}
+
+		if (!uv)
+			continue;
+		if (uv_swap)
+			c = _mm_or_si128(_mm_slli_epi16(c, 8),
+					 _mm_srli_epi16(c, 8));
+		_mm_storeu_si128((__m128i *)(uv + i), c);
+	}
+
+	c_packed_to_yuv(y + i, uv ? uv + i : NULL, src + 2 * i, n - i, y_odd,
+			uv_swap);
+}
+
+static const struct rga_cpu_kernels sse2_kernels = {
+	.name = "sse2",
+	.fill32 = sse2_fill32,
+	.reverse32 = sse2_reverse32,
+	.rotate32 = sse2_rotate32,
+	.yuv_to_rgb32 = sse2_yuv_to_rgb32,
+	.rgb32_to_yuv = sse2_rgb32_to_yuv,
+	.packed_to_yuv = sse2_packed_to_yuv,
+};
+#endif
+
+#ifdef RGA_HAVE_AVX2
+__attribute__((target("avx2")))
+static void avx2_fill32(uint32_t *dst, uint32_t val, unsigned int n)
+{
+	__m256i v = _mm256_set1_epi32(val);
+	unsigned int i = 0;
+
+	for (; i + 32 <= n; i += 32) {
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+		_mm256_storeu_si256((__m256i *)(dst + i + 8), v);
+		_mm256_storeu_si256((__m256i *)(dst + i + 16), v);
+		_mm256_storeu_si256((__m256i *)(dst + i + 24), v);
+	}
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+
+	c_fill32(dst + i, val, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_reverse32(uint32_t *dst, const uint32_t *src, unsigned int n)
+{
+	const __m256i idx = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	unsigned int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + n - 8 - i));
+
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_permutevar8x32_epi32(v, idx));
+	}
+
+	c_reverse32(dst + i, src, n - i);
+}
+
+/*
+ * The conversion and transpose kernels are bound by the 4-wide shuffles,
+ * AVX2 only replaces the pure store / permute loops.
+ */
+static const struct rga_cpu_kernels avx2_kernels = {
+	.name = "avx2",
+	.fill32 = avx2_fill32,
+	.reverse32 = avx2_reverse32,
+	.rotate32 = sse2_rotate32,
+	.yuv_to_rgb32 = sse2_yuv_to_rgb32,
+	.rgb32_to_yuv = sse2_rgb32_to_yuv,
+	.packed_to_yuv = sse2_packed_to_yuv,
+};
+#endif
+
+#ifdef RGA_HAVE_NEON
+static void neon_fill32(uint32_t *dst, uint32_t val, unsigned int n)
+{
+	uint32x4_t v = vdupq_n_u32(val);
+	unsigned int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		vst1q_u32(dst + i, v);
+		vst1q_u32(dst + i + 4, v);
+		vst1q_u32(dst + i + 8, v);
+		vst1q_u32(dst + i + 12, v);
+	}
+	for (; i + 4 <= n; i += 4)
+		vst1q_u32(dst + i, v);
+
+	c_fill32(dst + i, val, n - i);
+}
+
+static inline uint32x4_t neon_rev128_u32(uint32x4_t v)
+{
+	v = vrev64q_u32(v);
+	return vcombine_u32(vget_high_u32(v), vget_low_u32(v));
+}
+
+static void neon_reverse32(uint32_t *dst, const uint32_t *src, unsigned int n)
+{
+	unsigned int i = 0;
+
+	for (; i + 4 <= n; i += 4)
+		vst1q_u32(dst + i, neon_rev128_u32(vld1q_u32(src + n - 4 - i)));
+
+	c_reverse32(dst + i, src, n - i);
+}
+
+static void neon_rotate32(uint32_t *dst, int dst_stride, const uint32_t *src,
+			  int src_stride, unsigned int w, unsigned int h,
+			  int reverse)
+{
+	unsigned int x, y, bw = w & ~3, bh = h & ~3;
+
+	for (y = 0; y < bh; y += 4) {
+		const uint32_t *s = src + (ptrdiff_t)y * src_stride;
+		unsigned int col = reverse ? h - 4 - y : y;
+
+		for (x = 0; x < bw; x += 4) {
+			uint32_t *d = dst + (ptrdiff_t)x * dst_stride + col;
+			uint32x4x2_t t01, t23;
+			uint32x4_t c[4];
+			int k;
+
+			t01 = vtrnq_u32(vld1q_u32(s + x),
+					vld1q_u32(s + src_stride + x));
+			t23 = vtrnq_u32(vld1q_u32(s + 2 * src_stride + x),
+					vld1q_u32(s + 3 * src_stride + x));
+
+			c[0] = vcombine_u32(vget_low_u32(t01.val[0]),
+					    vget_low_u32(t23.val[0]));
+			c[1] = vcombine_u32(vget_low_u32(t01.val[1]),
+					    vget_low_u32(t23.val[1]));
+			c[2] = vcombine_u32(vget_high_u32(t01.val[0]),
+					    vget_high_u32(t23.val[0]));
+			c[3] = vcombine_u32(vget_high_u32(t01.val[1]),
+					    vget_high_u32(t23.val[1]));
+
+			for (k = 0; k < 4; k++)
+				vst1q_u32(d + (ptrdiff_t)k * dst_stride,
+					  reverse ? neon_rev128_u32(c[k]) : c[k]);
+		}
+	}
+
+	if (bw < w)
+		c_rotate32(dst + (ptrdiff_t)bw * dst_stride, dst_stride,
+			   src + bw, src_stride, w - bw, h, reverse);
+	if (bh < h)
+		c_rotate32(dst + (reverse ? 0 : bh), dst_stride,
+			   src + (ptrdiff_t)bh * src_stride, src_stride,
+			   bw, h - bh, reverse);
+}
+
+static inline uint8x8_t neon_descale(int32x4_t lo, int32x4_t hi)
+{
+	return vqmovun_s16(vcombine_s16(vqrshrn_n_s32(lo, 8),
+					vqrshrn_n_s32(hi, 8)));
+}
+
+static void neon_yuv_to_rgb32(uint32_t *dst, const uint8_t *y,
+			      const uint8_t *uv, unsigned int n, int uv_swap,
+			      const uint8_t shifts[4])
+{
+	const uint32x4_t alpha = vdupq_n_u32((uint32_t)0xff << shifts[3]);
+	const int32x4_t sr = vdupq_n_s32(shifts[0]);
+	const int32x4_t sg = vdupq_n_s32(shifts[1]);
+	const int32x4_t sb = vdupq_n_s32(shifts[2]);
+	unsigned int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		uint8x8x2_t split = vuzp_u8(vld1_u8(uv + i), vld1_u8(uv + i));
+		uint8x8_t u8 = vzip_u8(split.val[uv_swap ? 1 : 0],
+				       split.val[uv_swap ? 1 : 0]).val[0];
+		uint8x8_t v8 = vzip_u8(split.val[uv_swap ? 0 : 1],
+				       split.val[uv_swap ? 0 : 1]).val[0];
+		int16x8_t c, d, e;
+		int32x4_t lo, hi;
+		uint8x8_t r, g, b;
+		uint16x8_t r16, g16, b16;
+		int k;
+
+		c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + i))),
+			      vdupq_n_s16(16));
+		d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)),
+			      vdupq_n_s16(128));
+		e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)),
+			      vdupq_n_s16(128));
+
+		lo = vmull_n_s16(vget_low_s16(c), 298);
+		hi = vmull_n_s16(vget_high_s16(c), 298);
+		r = neon_descale(vmlal_n_s16(lo, vget_low_s16(e), 409),
+				 vmlal_n_s16(hi, vget_high_s16(e), 409));
+		g = neon_descale(vmlal_n_s16(vmlal_n_s16(lo, vget_low_s16(d), -100),
+					     vget_low_s16(e), -208),
+				 vmlal_n_s16(vmlal_n_s16(hi, vget_high_s16(d), -100),
+					     vget_high_s16(e), -208));
+		b = neon_descale(vmlal_n_s16(lo, vget_low_s16(d), 516),
+				 vmlal_n_s16(hi, vget_high_s16(d), 516));
+
+		r16 = vmovl_u8(r);
+		g16 = vmovl_u8(g);
+		b16 = vmovl_u8(b);
+
+		for (k = 0; k < 2; k++) {
+			uint32x4_t px = alpha;
+
+			px = vorrq_u32(px, vshlq_u32(vmovl_u16(k ? vget_high_u16(r16) : vget_low_u16(r16)), sr));
+			px = vorrq_u32(px, vshlq_u32(vmovl_u16(k ? vget_high_u16(g16) : vget_low_u16(g16)), sg));
+			px = vorrq_u32(px, vshlq_u32(vmovl_u16(k ? vget_high_u16(b16) : vget_low_u16(b16)), sb));
+			vst1q_u32(dst + i + 4 * k, px);
+		}
+	}
+
+	c_yuv_to_rgb32(dst + i, y + i, uv + i, n - i, uv_swap, shifts);
+}
+
+static void neon_rgb32_to_yuv(uint8_t *y0, uint8_t *y1, uint8_t *uv,
+			      const uint32_t *src0, const uint32_t *src1,
+			      unsigned int n, int uv_swap,
+			      const uint8_t shifts[3])
+{
+	const uint32x4_t mask = vdupq_n_u32(0xff);
+	const int32x4_t sr = vdupq_n_s32(-(int)shifts[0]);
+	const int32x4_t sg = vdupq_n_s32(-(int)shifts[1]);
+	const int32x4_t sb = vdupq_n_s32(-(int)shifts[2]);
+	unsigned int i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		uint32x4_t s0 = vld1q_u32(src0 + i), s1 = vld1q_u32(src1 + i);
+		uint32x4_t r0, g0, b0, r1, g1, b1, y;
+		uint32x2_t rs, gs, bs;
+		int32x2_t u, v;
+		uint8_t ytmp[8];
+		int32_t utmp[2], vtmp[2];
+
+		r0 = vandq_u32(vshlq_u32(s0, sr), mask);
+		g0 = vandq_u32(vshlq_u32(s0, sg), mask);
+		b0 = vandq_u32(vshlq_u32(s0, sb), mask);
+		r1 = vandq_u32(vshlq_u32(s1, sr), mask);
+		g1 = vandq_u32(vshlq_u32(s1, sg), mask);
+		b1 = vandq_u32(vshlq_u32(s1, sb), mask);
+
+		y = vmlaq_n_u32(vmlaq_n_u32(vmulq_n_u32(r0, 66), g0, 129), b0, 25);
+		y = vaddq_u32(vshrq_n_u32(vaddq_u32(y, vdupq_n_u32(128)), 8),
+			      vdupq_n_u32(16));
+		r0 = vaddq_u32(r0, r1);
+		g0 = vaddq_u32(g0, g1);
+		b0 = vaddq_u32(b0, b1);
+		r1 = vmlaq_n_u32(vmlaq_n_u32(vmulq_n_u32(r1, 66), g1, 129), b1, 25);
+		r1 = vaddq_u32(vshrq_n_u32(vaddq_u32(r1, vdupq_n_u32(128)), 8),
+			       vdupq_n_u32(16));
+
+		vst1_u8(ytmp, vmovn_u16(vcombine_u16(vmovn_u32(y), vmovn_u32(r1))));
+		memcpy(y0 + i, ytmp, 4);
+		if (y1)
+			memcpy(y1 + i, ytmp + 4, 4);
+
+		/* 2x2 box average of the two pixel pairs */
+		rs = vshr_n_u32(vadd_u32(vpadd_u32(vget_low_u32(r0), vget_high_u32(r0)),
+					 vdup_n_u32(2)), 2);
+		gs = vshr_n_u32(vadd_u32(vpadd_u32(vget_low_u32(g0), vget_high_u32(g0)),
+					 vdup_n_u32(2)), 2);
+		bs = vshr_n_u32(vadd_u32(vpadd_u32(vget_low_u32(b0), vget_high_u32(b0)),
+					 vdup_n_u32(2)), 2);
+
+		u = vmul_n_s32(vreinterpret_s32_u32(bs), 112);
+		u = vmls_n_s32(u, vreinterpret_s32_u32(rs), 38);
+		u = vmls_n_s32(u, vreinterpret_s32_u32(gs), 74);
+		u = vadd_s32(vshr_n_s32(vadd_s32(u, vdup_n_s32(128)), 8),
+			     vdup_n_s32(128));
+		v = vmul_n_s32(vreinterpret_s32_u32(rs), 112);
+		v = vmls_n_s32(v, vreinterpret_s32_u32(gs), 94);
+		v = vmls_n_s32(v, vreinterpret_s32_u32(bs), 18);
+		v = vadd_s32(vshr_n_s32(vadd_s32(v, vdup_n_s32(128)), 8),
+			     vdup_n_s32(128));
+
+		vst1_s32(utmp, u);
+		vst1_s32(vtmp, v);
+		uv[i + (uv_swap ? 1 : 0)] = utmp[0];
+		uv[i + (uv_swap ? 0 : 1)] = vtmp[0];
+		uv[i + (uv_swap ? 3 : 2)] = utmp[1];
+		uv[i + (uv_swap ? 2 : 3)] = vtmp[1];
+	}
+
+	if (i < n)
+		c_rgb32_to_yuv(y0 + i, y1 ? y1 + i : NULL, uv + i, src0 + i,
+			       src1 + i, n - i, uv_swap, shifts);
+}
+
+static void neon_packed_to_yuv(uint8_t *y, uint8_t *uv, const uint8_t *src,
+			       unsigned int n, int y_odd, int uv_swap)
+{
+	unsigned int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x2_t v = vld2q_u8(src + 2 * i);
+		uint8x16_t c = y_odd ? v.val[0] : v.val[1];
+
+		vst1q_u8(y + i, y_odd ? v.val[1] : v.val[0]);
+		if (!uv)
+			continue;
+		if (uv_swap)
+			c = vrev16q_u8(c);
+		vst1q_u8(uv + i, c);
+	}
+
+	c_packed_to_yuv(y + i, uv ? uv + i : NULL, src + 2 * i, n - i, y_odd,
+			uv_swap);
+}
+
+static const struct rga_cpu_kernels neon_kernels = {
+	.name = "neon",
+	.fill32 = neon_fill32,
+	.reverse32 = neon_reverse32,
+	.rotate32 = neon_rotate32,
+	.yuv_to_rgb32 = neon_yuv_to_rgb32,
+	.rgb32_to_yuv = neon_rgb32_to_yuv,
+	.packed_to_yuv = neon_packed_to_yuv,
+};
+#endif
+
+/*
+ * rga_cpu_get_kernels - pick the best kernel set for the running CPU.
+ *
+ * Setting RGA_CPU_SIMD=0 in the environment forces the plain C kernels,
+ * and RGA_CPU_SIMD=sse2, avx2 or neon one of the SIMD sets the CPU runs,
+ * which is handy when comparing or bisecting the SIMD paths.
+ */
+drm_private const struct rga_cpu_kernels *rga_cpu_get_kernels(void)
+{
+	static const struct rga_cpu_kernels *kernels;
+	const struct rga_cpu_kernels *sets[4];
+	unsigned int i, nr = 0;
+	const char *env;
+
+	if (kernels)
+		return kernels;
+
+	/* Best first */
+#if defined(RGA_HAVE_NEON)
+	sets[nr++] = &neon_kernels;
+#endif
+#if defined(RGA_HAVE_AVX2)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		sets[nr++] = &avx2_kernels;
+#endif
+#if defined(RGA_HAVE_SSE2)
+	sets[nr++] = &sse2_kernels;
+#endif
+	sets[nr++] = &c_kernels;
+
+	env = getenv("RGA_CPU_SIMD");
+	if (env && !strcmp(env, "0"))
+		env = c_kernels.name;
+
+	for (i = 0; env && i < nr; i++) {
+		if (!strcmp(env, sets[i]->name)) {
+			kernels = sets[i];
+			return kernels;
+		}
+	}
+
+	kernels = sets[0];
+
+	return kernels;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+
+drm_private void rga_stats_hist(unsigned long long *hist, uint64_t us)
+{
+	unsigned int i = 0;
+
+	while ((us >>= 1) && i < RGA_STATS_HIST_NR - 1)
+		i++;
+
+	hist[i]++;
+}
+
+static enum e_rga_stats_op rga_stats_kind(const struct rga_op *op)
+{
+	int rot = (op->degree == 90 || op->degree == 270);
+
+	if (op->type == RGA_OP_FILL)
+		return RGA_STATS_FILL;
+
+	if (op->src.color_mode != op->dst.color_mode)
+		return RGA_STATS_CSC;
+
+	if (op->degree || op->x_mirr || op->y_mirr)
+		return RGA_STATS_ROTATE;
+
+	if (op->src_w != (rot ? op->dst_h : op->dst_w) ||
+	    op->src_h != (rot ? op->dst_w : op->dst_h))
+		return RGA_STATS_SCALE;
+
+	return RGA_STATS_COPY;
+}
+
+/*
+ * rga_stats_op - account one completed operation.
+ */
+drm_private void rga_stats_op(struct rga_context *ctx,
+			      const struct rga_op *op)
+{
+	struct rga_stats *stats = &ctx->stats;
+	unsigned long long read, written;
+
+	stats->ops[rga_stats_kind(op)]++;
+
+	rga_bw_op_bytes(op, &read, &written);
+	stats->bytes_read += read;
+	stats->bytes_written += written;
+	rga_bw_charge(read, written);
+}
+
+#ifdef HAVE_SYS_SDT_H
+static void rga_trace_probe(enum e_rga_trace_event event, unsigned int ops,
+			    uint64_t us, int ret)
+{
+	switch (event) {
+	case RGA_TRACE_EXEC_BEGIN:
+		DTRACE_PROBE1(libdrm_rockchip, exec_begin, ops);
+		break;
+	case RGA_TRACE_EXEC_END:
+		DTRACE_PROBE3(libdrm_rockchip, exec_end, ops, us, ret);
+		break;
+	case RGA_TRACE_SUBMIT:
+		DTRACE_PROBE2(libdrm_rockchip, submit, us, ret);
+		break;
+	case RGA_TRACE_HW_EXEC:
+		DTRACE_PROBE3(libdrm_rockchip, hw_exec, ops, us, ret);
+		break;
+	case RGA_TRACE_CPU_OP:
+		DTRACE_PROBE2(libdrm_rockchip, cpu_op, us, ret);
+		break;
+	case RGA_TRACE_FALLBACK:
+		DTRACE_PROBE1(libdrm_rockchip, fallback, ops);
+		break;
+	}
+}
+#else
+static void rga_trace_probe(enum e_rga_trace_event event, unsigned int ops,
+			    uint64_t us, int ret)
+{
+}
+#endif
+
+drm_private void rga_trace(struct rga_context *ctx,
+			   enum e_rga_trace_event event, unsigned int ops,
+			   uint64_t us, int ret)
+{
+	struct rga_trace_info info;
+
+	rga_trace_probe(event, ops, us, ret);
+
+	if (!ctx->trace_hook)
+		return;
+
+	info.event = event;
+	info.ops = ops;
+	info.us = us;
+	info.ret = ret;
+
+	ctx->trace_hook(ctx->trace_data, &info);
+}
+
+/**
+ * rga_get_stats - copy the performance counters of a context.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @stats: filled with the counters since rga_init() or rga_reset_stats().
+ */
+int rga_get_stats(struct rga_context *ctx, struct rga_stats *stats)
+{
+	*stats = ctx->stats;
+	rga_import_stats(ctx->import, stats, 0);
+
+	return 0;
+}
+
+/**
+ * rga_reset_stats - clear the performance counters of a context.
+ *
+ * @ctx: a pointer to rga_context structure.
+ */
+void rga_reset_stats(struct rga_context *ctx)
+{
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	rga_import_stats(ctx->import, NULL, 1);
+}
+
+/**
+ * rga_set_trace_hook - report trace points of a context to a callback.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @hook: called from the thread running rga_exec(), NULL to remove it.
+ * @data: passed to every call of @hook.
+ */
+int rga_set_trace_hook(struct rga_context *ctx, rga_trace_hook_t hook,
+		       void *data)
+{
+	ctx->trace_hook = hook;
+	ctx->trace_data = data;
+
+	return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+
+#include "libdrm_macros.h"
+
+#include "rockchip_rga_priv.h"
+#include "rockchip_timeline.h"
+
+/*
+ * A reserved part of the ring, in use until the first rga_exec() or
+ * rga_exec_async() after the reservation is done.
+ *
+ * @offset, @size: the part of the ring.
+ * @fence: ctx->submit_seq when it was reserved, so the RGA is done with
+ *	it once the submission after that one is.
+ */
+struct rga_upload_region {
+	size_t			offset;
+	size_t			size;
+	unsigned long long	fence;
+};
+
+/*
+ * @buf: the ring, mapped once at @map for its whole lifetime.
+ * @head: where the next reservation goes, if there is room.
+ * @regions: reservations still in use, oldest first from @first.
+ */
+struct rga_upload {
+	struct rga_context		*ctx;
+	struct rga_buf			*buf;
+	void				*map;
+	size_t				head;
+
+	struct rga_upload_region	regions[RGA_UPLOAD_MAX_REGIONS];
+	unsigned int			first;
+	unsigned int			region_nr;
+};
+
+static void *rga_upload_map(struct rga_context *ctx, struct rga_buf *buf)
+{
+	struct drm_rockchip_gem_map_off req = {
+		.handle = buf->handle,
+	};
+	void *map;
+
+	if (buf->fd < 0)
+		return buf->ptr;
+
+	if (drmIoctl(ctx->fd, DRM_IOCTL_ROCKCHIP_GEM_MAP_OFFSET, &req))
+		return NULL;
+
+	map = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   ctx->fd, req.offset);
+
+	return map == MAP_FAILED ? NULL : map;
+}
+
+/*
+ * rga_upload_retire - forget the regions the RGA is done with.
+ */
+static void rga_upload_retire(struct rga_upload *up)
+{
+	uint64_t completed = rockchip_timeline_completed(up->ctx->timeline);
+
+	while (up->region_nr && up->regions[up->first].fence < completed) {
+		up->first = (up->first + 1) % RGA_UPLOAD_MAX_REGIONS;
+		up->region_nr--;
+	}
+
+	if (!up->region_nr)
+		up->head = 0;
+}
+
+/*
+ * rga_upload_reserve - find @size contiguous free bytes behind the regions
+ *	in use, wrapping to the start of the ring when the end is too short.
+ */
+static int rga_upload_reserve(struct rga_upload *up, size_t size,
+			      size_t *offset)
+{
+	size_t tail = up->regions[up->first].offset;
+
+	if (up->region_nr == RGA_UPLOAD_MAX_REGIONS)
+		return -ENOSPC;
+
+	/* Without regions in use head is 0 and the whole ring is free */
+	if (!up->region_nr || up->head > tail) {
+		if (size <= up->buf->size - up->head)
+			*offset = up->head;
+		else if (size <= tail)
+			*offset = 0;
+		else
+			return -ENOSPC;
+	} else {
+		if (size > tail - up->head)
+			return -ENOSPC;
+		*offset = up->head;
+	}
+
+	return 0;
+}
+
+/**
+ * rga_upload_create - create a ring for streaming data from the CPU to
+ *	the RGA.
+ *
+ * @ctx: a pointer to rga_context structure.
+ * @size: bytes of the ring.
+ *
+ * The ring is allocated and mapped once, uploads then only reserve a part
+ * of it, see rga_upload_image().
+ */
+struct rga_upload *rga_upload_create(struct rga_context *ctx,
+				     unsigned int size)
+{
+	struct rga_upload *up;
+
+	if (!size) {
+		fprintf(stderr, "invalid upload ring size.\n");
+		return NULL;
+	}
+
+	up = calloc(1, sizeof(*up));
+	if (!up)
+		return NULL;
+
+	up->ctx = ctx;
+	if (rga_buf_alloc(ctx, size, &up->buf))
+		goto err;
+
+	up->map = rga_upload_map(ctx, up->buf);
+	if (!up->map) {
+		fprintf(stderr, "failed to map upload ring.\n");
+		goto err;
+	}
+
+	return up;
+
+err:
+	if (up->buf)
+		rga_buf_free(ctx, up->buf);
+	free(up);
+	return NULL;
+}
+
+void rga_upload_destroy(struct rga_upload *up)
+{
+	if (!up)
+		return;
+
+	if (up->buf->fd >= 0)
+		munmap(up->map, up->buf->size);
+	rga_buf_free(up->ctx, up->buf);
+	free(up);
+}
+
+/**
+ * rga_upload_image - reserve an image in the upload ring.
+ *
+ * @up: a pointer to rga_upload structure.
+ * @color_mode: DRM_FORMAT_* of the image.
+ * @width, @height: size of the image.
+ * @img: returns the image, a window into the ring.
+ * @ptr: returns where the CPU writes the image, @img->stride bytes per
+ *	row, chroma planes following the luma plane.
+ *
+ * The image stays valid until the first rga_exec() or rga_exec_async()
+ * after this call is done. When the RGA may still read the part of the
+ * ring the image needs, the queued operations are run, or those in flight
+ * waited for, first, so an image must be written and its operations
+ * queued before the next rga_exec() or rga_upload_image(). Returns
+ * -ENOSPC when the ring is full of images reserved since the last
+ * submission, or the error of the queued operations it ran.
+ */
+int rga_upload_image(struct rga_upload *up, unsigned int color_mode,
+		     unsigned int width, unsigned int height,
+		     struct rga_image *img, void **ptr)
+{
+	const struct rga_format *fmt = rga_format_lookup(color_mode);
+	struct rga_context *ctx = up->ctx;
+	struct rga_upload_region *region;
+	size_t size, offset;
+	int ret;
+
+	if (!fmt || !width || !height) {
+		fprintf(stderr, "invalid upload image.\n");
+		return -EINVAL;
+	}
+
+	size = (size_t)width * fmt->cpp * height;
+	if (fmt->planes > 1)
+		size += 2 * (size_t)((width + fmt->xsub - 1) / fmt->xsub) *
+			((height + fmt->ysub - 1) / fmt->ysub);
+	size = (size + RGA_UPLOAD_ALIGN - 1) & ~(size_t)(RGA_UPLOAD_ALIGN - 1);
+
+	if (size > up->buf->size) {
+		fprintf(stderr, "upload image larger than the ring.\n");
+		return -EINVAL;
+	}
+
+	rga_upload_retire(up);
+	ret = rga_upload_reserve(up, size, &offset);
+	if (ret && (ctx->op_nr ||
+		    rockchip_timeline_completed(ctx->timeline) <
+		    ctx->submit_seq)) {
+		/* Both return once the RGA is done with the ring */
+		ctx->stats.upload_waits++;
+		if (ctx->op_nr) {
+			ret = rga_exec(ctx);
+			if (ret)
+				return ret;
+		} else {
+			/* Errors stay pending for rga_wait() */
+			rga_async_idle(ctx, 0);
+		}
+		rga_upload_retire(up);
+		ret = rga_upload_reserve(up, size, &offset);
+	}
+	if (ret) {
+		fprintf(stderr, "upload ring full.\n");
+		return ret;
+	}
+
+	region = &up->regions[(up->first + up->region_nr++) %
+			      RGA_UPLOAD_MAX_REGIONS];
+	region->offset = offset;
+	region->size = size;
+	region->fence = ctx->submit_seq;
+	up->head = offset + size;
+
+	memset(img, 0, sizeof(*img));
+	img->color_mode = color_mode;
+	img->width = width;
+	img->height = height;
+	img->stride = width * fmt->cpp;
+	rga_buf_bind(up->buf, img);
+	img->offset = offset;
+
+	*ptr = (char *)up->map + offset;
+
+	return 0;
+}
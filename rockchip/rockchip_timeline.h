@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) ROCKCHIP, Inc.
+ * Author:yzq<yzq@rock-chips.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _ROCKCHIP_TIMELINE_H_
+#define _ROCKCHIP_TIMELINE_H_
+
+#include <stdint.h>
+
+#include "libdrm_macros.h"
+
+/*
+ * Submissions of one RGA context, numbered from 1 and completed in order.
+ * Buffer objects the RGA reads or writes remember the number of the last
+ * submission doing so, and are busy until it is completed.
+ */
+struct rockchip_timeline;
+
+drm_private struct rockchip_timeline *rockchip_timeline_create(void);
+drm_private void rockchip_timeline_put(struct rockchip_timeline *tl);
+drm_private void rockchip_timeline_signal(struct rockchip_timeline *tl,
+					  uint64_t seq);
+drm_private uint64_t rockchip_timeline_completed(struct rockchip_timeline *tl);
+drm_private int rockchip_timeline_wait(struct rockchip_timeline *tl,
+				       uint64_t seq, int64_t timeout_ns);
+
+drm_private void rockchip_bo_mark_dmabuf(int fd, struct rockchip_timeline *tl,
+					 uint64_t seq, int write);
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Small buffer allocation benchmark.
+ *
+ * Allocates, touches and frees batches of small buffers, either as buffer
+ * objects of their own, with and without the buffer object cache, or
+ * carved out of shared ones by the suballocator, and prints one CSV row
+ * per case with the time per allocation and free and the memory the
+ * batch took from the kernel.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <xf86drm.h>
+
+#include "rockchip_drm.h"
+#include "rockchip_drmif.h"
+
+#define DRM_MODULE_NAME		"rockchip"
+#define BENCH_MAX_SIZES		8
+
+enum bench_method {
+	BENCH_BO,
+	BENCH_BO_CACHE,
+	BENCH_SLAB,
+};
+
+static const char *method_names[] = {
+	[BENCH_BO] = "bo",
+	[BENCH_BO_CACHE] = "bo-cache",
+	[BENCH_SLAB] = "slab",
+};
+
+static const size_t default_sizes[] = { 1024, 4096, 16384, 65536 };
+
+static unsigned long long time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * One batch of @nr buffers of @size bytes. A round of the batch is done
+ * first and thrown away, so that the cached cases start warm.
+ */
+static int run_case(struct rockchip_device *dev, enum bench_method method,
+		    size_t size, unsigned int nr)
+{
+	struct rockchip_bo_suballoc *subs;
+	struct rockchip_bo_slab_stats stats;
+	struct rockchip_bo_slab *slab = NULL;
+	unsigned long long start, alloc_us, free_us, bytes = 0;
+	unsigned int i, round;
+	int ret = 0;
+
+	subs = calloc(nr, sizeof(*subs));
+	if (!subs)
+		return -ENOMEM;
+
+	rockchip_device_set_bo_cache(dev, method == BENCH_BO_CACHE);
+	if (method == BENCH_SLAB) {
+		slab = rockchip_bo_slab_create(dev, 0);
+		if (!slab) {
+			free(subs);
+			return -ENOMEM;
+		}
+	}
+
+	for (round = 0; round < 2; round++) {
+		start = time_us();
+		for (i = 0; i < nr; i++) {
+			if (slab) {
+				ret = rockchip_bo_slab_alloc(slab, size,
+							     &subs[i]);
+			} else {
+				subs[i].bo = rockchip_bo_create(dev, size, 0);
+				if (subs[i].bo)
+					subs[i].vaddr =
+						rockchip_bo_map(subs[i].bo);
+				ret = subs[i].vaddr ? 0 : -ENOMEM;
+			}
+			if (ret)
+				break;
+			memset(subs[i].vaddr, 0, 64);
+		}
+		alloc_us = time_us() - start;
+		nr = i;
+
+		if (slab) {
+			rockchip_bo_slab_get_stats(slab, &stats);
+			bytes = stats.slab_bytes;
+		} else {
+			bytes = (unsigned long long)nr *
+				((size + getpagesize() - 1) &
+				 ~(size_t)(getpagesize() - 1));
+		}
+
+		start = time_us();
+		for (i = 0; i < nr; i++) {
+			if (slab)
+				rockchip_bo_slab_free(slab, &subs[i]);
+			else
+				rockchip_bo_destroy(subs[i].bo);
+		}
+		free_us = time_us() - start;
+
+		if (ret)
+			break;
+	}
+
+	if (!ret)
+		printf("%s,%zu,%u,%.3f,%.3f,%llu\n", method_names[method],
+		       size, nr, (double)alloc_us / nr, (double)free_us / nr,
+		       bytes);
+	else
+		fprintf(stderr, "%s: allocation %u of %zu bytes failed.\n",
+			method_names[method], nr, size);
+
+	rockchip_bo_slab_destroy(slab);
+	rockchip_device_set_bo_cache(dev, 0);
+	free(subs);
+
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n count] [-s size]...\n", name);
+	fprintf(stderr, "\t-n\tbuffers per batch (default 1000)\n");
+	fprintf(stderr, "\t-s\tbenchmark this buffer size, repeatable\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[BENCH_MAX_SIZES];
+	unsigned int size_nr = 0, nr = 1000, i, m;
+	struct rockchip_device *dev;
+	int fd, c, ret = 0;
+
+	while ((c = getopt(argc, argv, "n:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			nr = atoi(optarg);
+			break;
+		case 's':
+			if (size_nr == BENCH_MAX_SIZES)
+				usage(argv[0]);
+			sizes[size_nr++] = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!nr)
+		usage(argv[0]);
+
+	if (!size_nr) {
+		for (i = 0; i < sizeof(default_sizes) / sizeof(default_sizes[0]); i++)
+			sizes[i] = default_sizes[i];
+		size_nr = i;
+	}
+
+	fd = drmOpen(DRM_MODULE_NAME, NULL);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open rockchip device.\n");
+		return 1;
+	}
+
+	dev = rockchip_device_create(fd);
+	if (!dev)
+		return 1;
+
+	printf("method,size,count,alloc_us,free_us,kernel_bytes\n");
+
+	for (i = 0; i < size_nr && !ret; i++)
+		for (m = 0; m < sizeof(method_names) / sizeof(method_names[0]); m++)
+			ret |= run_case(dev, m, sizes[i], nr);
+
+	rockchip_device_destroy(dev);
+	drmClose(fd);
+
+	return !!ret;
+}
@@ -0,0 +1,515 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Non-interactive RGA benchmark.
+ *
+ * Sweeps fill, copy, scaling, rotation, mirroring and color space
+ * conversion over a set of sizes on every available backend, and prints
+ * one CSV row per case with throughput, latency percentiles and CPU time
+ * per operation. Summary counters follow as '#' comment lines.
+ *
+ * Without a rockchip device (or with -f) the images are backed by memfd
+ * buffers of a fake device and only the CPU engine runs, still going
+ * through the same dma-buf mapping path as with real GEM buffers.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <xf86drm.h>
+#include <drm_fourcc.h>
+
+#include "rockchip_drm.h"
+#include "rockchip_drmif.h"
+#include "rockchip_rga.h"
+
+#define DRM_MODULE_NAME		"rockchip"
+#define BENCH_MAX_SIZES		8
+#define BENCH_MAX_SAMPLES	1000
+#define BENCH_MIN_SAMPLES	5
+
+enum bench_kind {
+	BENCH_FILL,
+	BENCH_COPY,
+	BENCH_SCALE_UP,
+	BENCH_SCALE_DOWN,
+	BENCH_ROTATE,
+	BENCH_MIRROR,
+};
+
+struct bench_case {
+	const char *name;
+	enum bench_kind kind;
+	unsigned int src_fmt, dst_fmt;
+	unsigned int degree;
+	unsigned int x_mirr, y_mirr;
+};
+
+static const struct bench_case cases[] = {
+	{ "fill",       BENCH_FILL,       0, DRM_FORMAT_ARGB8888, 0, 0, 0 },
+	{ "copy",       BENCH_COPY,       DRM_FORMAT_ARGB8888, DRM_FORMAT_ARGB8888, 0, 0, 0 },
+	{ "copy",       BENCH_COPY,       DRM_FORMAT_RGB565, DRM_FORMAT_RGB565, 0, 0, 0 },
+	{ "copy",       BENCH_COPY,       DRM_FORMAT_NV12, DRM_FORMAT_NV12, 0, 0, 0 },
+	{ "scale-up",   BENCH_SCALE_UP,   DRM_FORMAT_ARGB8888, DRM_FORMAT_ARGB8888, 0, 0, 0 },
+	{ "scale-down", BENCH_SCALE_DOWN, DRM_FORMAT_ARGB8888, DRM_FORMAT_ARGB8888, 0, 0, 0 },
+	{ "scale-down", BENCH_SCALE_DOWN, DRM_FORMAT_NV12, DRM_FORMAT_NV12, 0, 0, 0 },
+	{ "rotate-90",  BENCH_ROTATE,     DRM_FORMAT_ARGB8888, DRM_FORMAT_ARGB8888, 90, 0, 0 },
+	{ "rotate-180", BENCH_ROTATE,     DRM_FORMAT_ARGB8888, DRM_FORMAT_ARGB8888, 180, 0, 0 },
+	{ "rotate-270", BENCH_ROTATE,     DRM_FORMAT_ARGB8888, DRM_FORMAT_ARGB8888, 270, 0, 0 },
+	{ "mirror-x",   BENCH_MIRROR,     DRM_FORMAT_ARGB8888, DRM_FORMAT_ARGB8888, 0, 1, 0 },
+	{ "mirror-y",   BENCH_MIRROR,     DRM_FORMAT_ARGB8888, DRM_FORMAT_ARGB8888, 0, 0, 1 },
+	{ "csc",        BENCH_COPY,       DRM_FORMAT_NV12, DRM_FORMAT_ARGB8888, 0, 0, 0 },
+	{ "csc",        BENCH_COPY,       DRM_FORMAT_ARGB8888, DRM_FORMAT_NV12, 0, 0, 0 },
+	{ "csc",        BENCH_COPY,       DRM_FORMAT_NV12, DRM_FORMAT_RGB565, 0, 0, 0 },
+	{ "packed",     BENCH_COPY,       DRM_FORMAT_YUYV, DRM_FORMAT_NV12, 0, 0, 0 },
+	{ "packed",     BENCH_COPY,       DRM_FORMAT_UYVY, DRM_FORMAT_ARGB8888, 0, 0, 0 },
+	{ "packed",     BENCH_SCALE_DOWN, DRM_FORMAT_YUYV, DRM_FORMAT_NV12, 0, 0, 0 },
+	{ "packed",     BENCH_ROTATE,     DRM_FORMAT_YUYV, DRM_FORMAT_ARGB8888, 90, 0, 0 },
+};
+
+static const struct {
+	unsigned int w, h;
+} default_sizes[] = {
+	{ 64, 64 },
+	{ 640, 480 },
+	{ 1920, 1080 },
+	{ 3840, 2160 },
+};
+
+static const struct {
+	enum e_rga_backend backend;
+	unsigned int threads;
+	int need_hw;
+	const char *name;
+} backends[] = {
+	{ RGA_BACKEND_HW, 0, 1, "rga" },
+	{ RGA_BACKEND_CPU, 0, 0, "cpu" },
+	{ RGA_BACKEND_AUTO, 0, 0, "auto" },
+	{ RGA_BACKEND_AUTO, 3, 1, "hybrid" },
+};
+
+struct bench_buf {
+	struct rockchip_bo *bo;
+	int fd;
+	size_t size;
+};
+
+struct bench {
+	struct rockchip_device *dev;
+	struct rga_context *ctx;
+	struct bench_buf src, dst;
+	unsigned int sizes[BENCH_MAX_SIZES][2];
+	unsigned int size_nr;
+	unsigned int budget_ms;
+	const char *filter;
+	unsigned long long samples[BENCH_MAX_SAMPLES];
+};
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static unsigned long long cpu_time_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+	       ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static const char *fmt_name(unsigned int fmt)
+{
+	switch (fmt) {
+	case DRM_FORMAT_ARGB8888:
+		return "ARGB8888";
+	case DRM_FORMAT_RGB565:
+		return "RGB565";
+	case DRM_FORMAT_NV12:
+		return "NV12";
+	case DRM_FORMAT_YUYV:
+		return "YUYV";
+	case DRM_FORMAT_UYVY:
+		return "UYVY";
+	default:
+		return "-";
+	}
+}
+
+/*
+ * Backing store of the fake device: a memfd where available, otherwise an
+ * unlinked temporary file. Both can be mmap()ed like a dma-buf.
+ */
+static int fake_fd(size_t size)
+{
+	char path[] = "/tmp/rga_bench.XXXXXX";
+	int fd = -1;
+
+#ifdef SYS_memfd_create
+	fd = syscall(SYS_memfd_create, "rga_bench", 0);
+#endif
+	if (fd < 0) {
+		fd = mkstemp(path);
+		if (fd < 0)
+			return -errno;
+		unlink(path);
+	}
+
+	if (ftruncate(fd, size)) {
+		close(fd);
+		return -errno;
+	}
+
+	return fd;
+}
+
+static int buf_alloc(struct rockchip_device *dev, size_t size,
+		     struct bench_buf *buf)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->size = size;
+
+	if (!dev) {
+		buf->fd = fake_fd(size);
+		return buf->fd < 0 ? buf->fd : 0;
+	}
+
+	buf->bo = rockchip_bo_create(dev, size, 0);
+	if (!buf->bo)
+		return -ENOMEM;
+
+	if (drmPrimeHandleToFD(dev->fd, buf->bo->handle, 0, &buf->fd)) {
+		rockchip_bo_destroy(buf->bo);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void buf_free(struct bench_buf *buf)
+{
+	close(buf->fd);
+	if (buf->bo)
+		rockchip_bo_destroy(buf->bo);
+}
+
+static void img_setup(struct rga_image *img, struct bench_buf *buf,
+		      unsigned int fmt, unsigned int w, unsigned int h)
+{
+	memset(img, 0, sizeof(*img));
+	img->color_mode = fmt;
+	img->width = w;
+	img->height = h;
+	img->fill_color = 0xff336699;
+	img->buf_type = RGA_IMGBUF_GEM;
+	img->bo[0] = buf->fd;
+
+	switch (fmt) {
+	case DRM_FORMAT_NV12:
+		img->stride = w;
+		break;
+	case DRM_FORMAT_RGB565:
+	case DRM_FORMAT_YUYV:
+	case DRM_FORMAT_UYVY:
+		img->stride = w * 2;
+		break;
+	default:
+		img->stride = w * 4;
+		break;
+	}
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	const unsigned long long *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+static unsigned long long percentile(unsigned long long *samples,
+				     unsigned int nr, unsigned int pct)
+{
+	unsigned int i = (nr * pct + 99) / 100;
+
+	return samples[i ? i - 1 : 0];
+}
+
+static int run_once(struct bench *b, const struct bench_case *c,
+		    struct rga_image *src, struct rga_image *dst)
+{
+	int ret;
+
+	if (c->kind == BENCH_FILL)
+		ret = rga_solid_fill(b->ctx, dst, 0, 0, dst->width,
+				     dst->height);
+	else
+		ret = rga_multiple_transform(b->ctx, src, dst, 0, 0,
+					     src->width, src->height, 0, 0,
+					     dst->width, dst->height,
+					     c->degree, c->x_mirr, c->y_mirr);
+	if (ret)
+		return ret;
+
+	return rga_exec(b->ctx);
+}
+
+static void run_case(struct bench *b, const struct bench_case *c,
+		     unsigned int w, unsigned int h, const char *backend)
+{
+	struct rga_image src, dst;
+	unsigned int sw = w, sh = h, dw = w, dh = h, nr = 0;
+	unsigned long long start, cpu, total = 0;
+
+	switch (c->kind) {
+	case BENCH_SCALE_UP:
+		sw = w / 2;
+		sh = h / 2;
+		break;
+	case BENCH_SCALE_DOWN:
+		dw = w / 2;
+		dh = h / 2;
+		break;
+	case BENCH_ROTATE:
+		if (c->degree != 180) {
+			dw = h;
+			dh = w;
+		}
+		break;
+	case BENCH_FILL:
+	case BENCH_COPY:
+	case BENCH_MIRROR:
+		break;
+	}
+
+	img_setup(&src, &b->src, c->src_fmt, sw, sh);
+	img_setup(&dst, &b->dst, c->dst_fmt, dw, dh);
+
+	printf("%s,%s,%s,%u,%u,%u,%u,%s,", c->name, fmt_name(c->src_fmt),
+	       fmt_name(c->dst_fmt), sw, sh, dw, dh, backend);
+
+	/* Warm up mappings, caches and the cost model */
+	if (run_once(b, c, &src, &dst)) {
+		printf("0,failed,,,,,\n");
+		return;
+	}
+
+	cpu = cpu_time_us();
+
+	while (nr < BENCH_MAX_SAMPLES &&
+	       (nr < BENCH_MIN_SAMPLES || total < b->budget_ms * 1000ULL)) {
+		start = now_us();
+		if (run_once(b, c, &src, &dst))
+			break;
+		b->samples[nr] = now_us() - start;
+		total += b->samples[nr++];
+	}
+
+	cpu = cpu_time_us() - cpu;
+
+	if (!nr) {
+		printf("0,failed,,,,,\n");
+		return;
+	}
+
+	qsort(b->samples, nr, sizeof(b->samples[0]), cmp_ull);
+
+	printf("%u,%.1f,%llu,%llu,%llu,%llu,%llu\n", nr,
+	       (double)dw * dh * nr / (total ? total : 1),
+	       percentile(b->samples, nr, 50), percentile(b->samples, nr, 90),
+	       percentile(b->samples, nr, 99), b->samples[nr - 1], cpu / nr);
+	fflush(stdout);
+}
+
+/* Upper bound of the histogram bucket holding the median sample */
+static unsigned long long hist_median(const unsigned long long *hist)
+{
+	unsigned long long nr = 0, sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < RGA_STATS_HIST_NR; i++)
+		nr += hist[i];
+
+	for (i = 0; i < RGA_STATS_HIST_NR - 1; i++) {
+		sum += hist[i];
+		if (2 * sum >= nr)
+			break;
+	}
+
+	return 2ULL << i;
+}
+
+static void print_summary(struct bench *b)
+{
+	struct rga_dispatch_stats stats;
+	struct rga_bw_stats bw;
+	struct rga_stats perf;
+
+	rga_get_stats(b->ctx, &perf);
+	printf("# stats: execs %llu cmdlists %llu regs %llu read %llu MiB "
+	       "written %llu MiB overflows %llu failures %llu/%llu/%llu\n",
+	       perf.execs, perf.cmdlists, perf.regs, perf.bytes_read >> 20,
+	       perf.bytes_written >> 20, perf.overflows, perf.submit_failures,
+	       perf.exec_failures, perf.cpu_failures);
+	printf("# imports: hits %llu misses %llu evictions %llu mapped %llu "
+	       "(%llu MiB)\n", perf.import_hits, perf.import_misses,
+	       perf.import_evictions, perf.imports, perf.import_bytes >> 20);
+
+	rga_get_dispatch_stats(b->ctx, &stats);
+	printf("# dispatch: hw %llu cpu %llu hybrid %llu model-hw %llu "
+	       "model-cpu %llu explored %llu hw-unsupported %llu "
+	       "hw-fallback %llu\n", stats.hw_ops, stats.cpu_ops,
+	       stats.hybrid_ops, stats.model_hw, stats.model_cpu,
+	       stats.explored, stats.hw_unsupported, stats.hw_fallback);
+	printf("# preconv: ops %llu p50 < %llu us\n", perf.preconv_ops,
+	       hist_median(perf.preconv_us));
+
+	rga_get_bw_stats(b->ctx, &bw);
+	printf("# bandwidth: peak %llu MiB/s\n", bw.peak >> 20);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-f] [-t ms] [-s WxH]... [-o case]\n",
+		name);
+	fprintf(stderr, "\t-f\tuse the fake device even if an RGA exists\n");
+	fprintf(stderr, "\t-t\ttime budget per case in ms (default 100)\n");
+	fprintf(stderr, "\t-s\tbenchmark this destination size, repeatable\n");
+	fprintf(stderr, "\t-o\tonly run cases with this name\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench *b;
+	size_t size = 0;
+	unsigned int i, j, k;
+	int fd = -1, fake = 0, c;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return 1;
+
+	b->budget_ms = 100;
+
+	while ((c = getopt(argc, argv, "ft:s:o:")) != -1) {
+		switch (c) {
+		case 'f':
+			fake = 1;
+			break;
+		case 't':
+			b->budget_ms = atoi(optarg);
+			break;
+		case 's':
+			if (b->size_nr == BENCH_MAX_SIZES ||
+			    sscanf(optarg, "%ux%u", &b->sizes[b->size_nr][0],
+				   &b->sizes[b->size_nr][1]) != 2)
+				usage(argv[0]);
+			b->size_nr++;
+			break;
+		case 'o':
+			b->filter = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!b->size_nr) {
+		for (i = 0; i < sizeof(default_sizes) / sizeof(default_sizes[0]); i++) {
+			b->sizes[i][0] = default_sizes[i].w;
+			b->sizes[i][1] = default_sizes[i].h;
+		}
+		b->size_nr = i;
+	}
+
+	for (i = 0; i < b->size_nr; i++)
+		if ((size_t)b->sizes[i][0] * b->sizes[i][1] * 4 > size)
+			size = (size_t)b->sizes[i][0] * b->sizes[i][1] * 4;
+
+	if (!fake) {
+		fd = drmOpen(DRM_MODULE_NAME, NULL);
+		if (fd >= 0)
+			b->dev = rockchip_device_create(fd);
+	}
+
+	b->ctx = rga_init(fd);
+	if (!b->ctx)
+		return 1;
+
+	if (buf_alloc(b->dev, size, &b->src) ||
+	    buf_alloc(b->dev, size, &b->dst)) {
+		fprintf(stderr, "failed to allocate buffers.\n");
+		return 1;
+	}
+
+	if (rga_calibrate(b->ctx))
+		return 1;
+
+	printf("# device: %s\n", b->dev ? "rockchip" : "fake");
+	printf("case,src_fmt,dst_fmt,src_w,src_h,dst_w,dst_h,backend,"
+	       "iterations,mpix_s,p50_us,p90_us,p99_us,max_us,cpu_us\n");
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		if (b->filter && strcmp(b->filter, cases[i].name))
+			continue;
+
+		for (j = 0; j < b->size_nr; j++) {
+			for (k = 0; k < sizeof(backends) / sizeof(backends[0]); k++) {
+				if (backends[k].need_hw && !b->dev)
+					continue;
+
+				if (rga_set_backend(b->ctx, backends[k].backend))
+					continue;
+
+				if (rga_set_hybrid(b->ctx, backends[k].threads) &&
+				    backends[k].threads)
+					continue;
+
+				run_case(b, &cases[i], b->sizes[j][0],
+					 b->sizes[j][1], backends[k].name);
+			}
+		}
+	}
+
+	print_summary(b);
+
+	buf_free(&b->src);
+	buf_free(&b->dst);
+	rga_fini(b->ctx);
+
+	if (b->dev) {
+		rockchip_device_destroy(b->dev);
+		drmClose(fd);
+	}
+	free(b);
+
+	return 0;
+}
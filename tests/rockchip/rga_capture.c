@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Captures the scanout of a CRTC as scaled NV12 frames, e.g. to feed an
+ * encoder, and optionally writes them to a file.
+ *
+ * With -H no device is opened: a stand-in framebuffer with a moving box
+ * is captured on the CPU engine at emulated 60Hz vblanks instead.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+
+#include "drm_fourcc.h"
+#include "rockchip_drm.h"
+#include "rockchip_rga.h"
+
+#define DRM_MODULE_NAME		"rockchip"
+
+#define STANDIN_WIDTH	1280
+#define STANDIN_HEIGHT	720
+#define STANDIN_BOX	128
+
+static int write_frame(FILE *file, struct rga_image *img)
+{
+	size_t size = (size_t)img->stride * img->height * 3 / 2;
+	void *ptr;
+	int ret;
+
+	if (img->buf_type == RGA_IMGBUF_USERPTR)
+		return fwrite((void *)(unsigned long)img->user_ptr[0].userptr,
+			      size, 1, file) == 1 ? 0 : -EIO;
+
+	ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, img->bo[0], 0);
+	if (ptr == MAP_FAILED)
+		return -errno;
+
+	ret = fwrite(ptr, size, 1, file) == 1 ? 0 : -EIO;
+	munmap(ptr, size);
+
+	return ret;
+}
+
+/* Redraw the stand-in framebuffer for frame @n */
+static int draw_standin(struct rga_context *ctx, struct rga_image *img,
+			unsigned int n)
+{
+	unsigned int x = n * 8 % (STANDIN_WIDTH - STANDIN_BOX);
+	unsigned int y = n * 4 % (STANDIN_HEIGHT - STANDIN_BOX);
+
+	img->fill_color = 0xff203040;
+	rga_solid_fill(ctx, img, 0, 0, STANDIN_WIDTH, STANDIN_HEIGHT);
+	img->fill_color = 0xffe0c020;
+	rga_solid_fill(ctx, img, x, y, STANDIN_BOX, STANDIN_BOX);
+
+	return rga_exec(ctx);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-H | -c crtc] [-s WxH] [-n frames] "
+		"[-i vblanks] [-o file]\n", name);
+	fprintf(stderr, "\t-H\tcapture a stand-in framebuffer, no device\n");
+	fprintf(stderr, "\t-c\tcapture the scanout of this crtc id\n");
+	fprintf(stderr, "\t-s\tsize of the NV12 frames, 320x180 by default\n");
+	fprintf(stderr, "\t-n\tnumber of frames, 60 by default\n");
+	fprintf(stderr, "\t-i\tcapture every this many vblanks\n");
+	fprintf(stderr, "\t-o\twrite the frames to this file\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int width = 320, height = 180, frames = 60, interval = 1;
+	unsigned int crtc_id = 0, i, missed = 0;
+	struct rga_capture_frame frame;
+	struct rga_context *ctx;
+	struct rga_capture *cap;
+	struct rga_image standin;
+	unsigned long long first = 0;
+	const char *path = NULL;
+	void *pixels = NULL;
+	FILE *file = NULL;
+	int c, headless = 0, fd = -1, ret = 0;
+
+	while ((c = getopt(argc, argv, "Hc:s:n:i:o:")) != -1) {
+		switch (c) {
+		case 'H':
+			headless = 1;
+			break;
+		case 'c':
+			crtc_id = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%ux%u", &width, &height) != 2)
+				usage(argv[0]);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'o':
+			path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc || headless == !!crtc_id)
+		usage(argv[0]);
+
+	if (!headless) {
+		fd = drmOpen(DRM_MODULE_NAME, NULL);
+		if (fd < 0) {
+			fprintf(stderr, "failed to open rockchip drm device.\n");
+			return 1;
+		}
+	}
+
+	ctx = rga_init(fd);
+	if (!ctx)
+		return 1;
+
+	cap = rga_capture_create(ctx, crtc_id, width, height, 3);
+	if (!cap) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	rga_capture_set_interval(cap, interval);
+
+	if (headless) {
+		pixels = calloc(STANDIN_WIDTH * STANDIN_HEIGHT, 4);
+		if (!pixels) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		memset(&standin, 0, sizeof(standin));
+		standin.color_mode = DRM_FORMAT_XRGB8888;
+		standin.width = STANDIN_WIDTH;
+		standin.height = STANDIN_HEIGHT;
+		standin.stride = STANDIN_WIDTH * 4;
+		standin.buf_type = RGA_IMGBUF_USERPTR;
+		standin.user_ptr[0].userptr = (unsigned long)pixels;
+		standin.user_ptr[0].size = STANDIN_WIDTH * STANDIN_HEIGHT * 4;
+		rga_capture_set_source(cap, &standin);
+	}
+
+	if (path) {
+		file = fopen(path, "wb");
+		if (!file) {
+			fprintf(stderr, "failed to open %s.\n", path);
+			ret = -errno;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < frames && !ret; i++) {
+		if (headless) {
+			ret = draw_standin(ctx, &standin, i);
+			if (ret)
+				break;
+		}
+
+		ret = rga_capture_frame(cap, &frame);
+		if (ret)
+			break;
+
+		if (!i)
+			first = frame.timestamp_us;
+		missed += frame.missed;
+
+		if (file)
+			ret = write_frame(file, frame.img);
+	}
+
+	if (ret)
+		fprintf(stderr, "capture failed: %s\n", strerror(-ret));
+	else
+		printf("captured %u %ux%u NV12 frames in %.3f ms, "
+		       "%u vblanks missed\n", frames, width, height,
+		       frames ? (frame.timestamp_us - first) / 1000.0 : 0.0,
+		       missed);
+
+out:
+	if (file)
+		fclose(file);
+	rga_capture_destroy(cap);
+	rga_fini(ctx);
+	free(pixels);
+	if (fd >= 0)
+		drmClose(fd);
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Checks the SIMD kernels of the CPU engine against the plain C ones.
+ *
+ * Every format is converted from and to ARGB8888 under each rotation and
+ * mirroring, scaled, and filled, on user pointer images, once per kernel
+ * set selected with RGA_CPU_SIMD. Each set runs in a child process, as the
+ * library picks its kernels once, and the outputs must match those of
+ * RGA_CPU_SIMD=0 byte for byte. No device is needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "drm_fourcc.h"
+
+#include "rockchip_drm.h"
+#include "rockchip_rga.h"
+
+#define SRC_W		66
+#define SRC_H		50
+#define DST_W		96
+#define DST_H		96
+#define BUF_SIZE	(DST_W * DST_H * 4 * 2)
+#define MAX_CASES	4096
+
+static const char * const sets[] = { "0", "sse2", "avx2", "neon" };
+
+static const uint32_t formats[] = {
+	DRM_FORMAT_ARGB8888, DRM_FORMAT_XRGB8888, DRM_FORMAT_ABGR8888,
+	DRM_FORMAT_XBGR8888, DRM_FORMAT_RGBA8888, DRM_FORMAT_RGBX8888,
+	DRM_FORMAT_BGRA8888, DRM_FORMAT_BGRX8888, DRM_FORMAT_RGB888,
+	DRM_FORMAT_BGR888, DRM_FORMAT_RGB565, DRM_FORMAT_BGR565,
+	DRM_FORMAT_ARGB1555, DRM_FORMAT_ABGR1555, DRM_FORMAT_RGBA5551,
+	DRM_FORMAT_BGRA5551, DRM_FORMAT_ARGB4444, DRM_FORMAT_ABGR4444,
+	DRM_FORMAT_RGBA4444, DRM_FORMAT_BGRA4444, DRM_FORMAT_NV12,
+	DRM_FORMAT_NV21, DRM_FORMAT_NV16, DRM_FORMAT_NV61,
+	DRM_FORMAT_YUV420, DRM_FORMAT_YVU420, DRM_FORMAT_YUV422,
+	DRM_FORMAT_YVU422, DRM_FORMAT_YUYV, DRM_FORMAT_YVYU,
+	DRM_FORMAT_UYVY, DRM_FORMAT_VYUY,
+};
+
+#define FORMAT_NR	(sizeof(formats) / sizeof(formats[0]))
+
+struct result {
+	unsigned int	nr;
+	uint32_t	hash[MAX_CASES];
+};
+
+static uint8_t src_buf[BUF_SIZE], dst_buf[BUF_SIZE];
+
+static unsigned int bytes_per_pixel(uint32_t format)
+{
+	switch (format) {
+	case DRM_FORMAT_RGB888:
+	case DRM_FORMAT_BGR888:
+		return 3;
+	case DRM_FORMAT_RGB565:
+	case DRM_FORMAT_BGR565:
+	case DRM_FORMAT_ARGB1555:
+	case DRM_FORMAT_ABGR1555:
+	case DRM_FORMAT_RGBA5551:
+	case DRM_FORMAT_BGRA5551:
+	case DRM_FORMAT_ARGB4444:
+	case DRM_FORMAT_ABGR4444:
+	case DRM_FORMAT_RGBA4444:
+	case DRM_FORMAT_BGRA4444:
+	case DRM_FORMAT_YUYV:
+	case DRM_FORMAT_YVYU:
+	case DRM_FORMAT_UYVY:
+	case DRM_FORMAT_VYUY:
+		return 2;
+	case DRM_FORMAT_NV12:
+	case DRM_FORMAT_NV21:
+	case DRM_FORMAT_NV16:
+	case DRM_FORMAT_NV61:
+	case DRM_FORMAT_YUV420:
+	case DRM_FORMAT_YVU420:
+	case DRM_FORMAT_YUV422:
+	case DRM_FORMAT_YVU422:
+		return 1;
+	default:
+		return 4;
+	}
+}
+
+static void image_init(struct rga_image *img, uint8_t *buf, uint32_t format,
+		       unsigned int width, unsigned int height)
+{
+	memset(img, 0, sizeof(*img));
+	img->color_mode = format;
+	img->width = width;
+	img->height = height;
+	img->stride = width * bytes_per_pixel(format);
+	img->buf_type = RGA_IMGBUF_USERPTR;
+	img->user_ptr[0].userptr = (unsigned long)buf;
+	img->user_ptr[0].size = BUF_SIZE;
+}
+
+/* FNV-1a over the destination and the result of the operation */
+static void record(struct result *res, int ret)
+{
+	uint32_t hash = 2166136261u ^ (uint32_t)ret;
+	unsigned int i;
+
+	for (i = 0; i < BUF_SIZE; i++)
+		hash = (hash ^ dst_buf[i]) * 16777619u;
+
+	if (res->nr < MAX_CASES)
+		res->hash[res->nr] = hash;
+	res->nr++;
+}
+
+static int run_op(struct rga_context *ctx, struct rga_image *src,
+		  struct rga_image *dst, unsigned int dst_w,
+		  unsigned int dst_h, unsigned int degree,
+		  unsigned int x_mirr, unsigned int y_mirr)
+{
+	int ret;
+
+	memset(dst_buf, 0x5a, sizeof(dst_buf));
+
+	ret = rga_multiple_transform(ctx, src, dst, 2, 2, SRC_W - 4,
+				     SRC_H - 4, 4, 2, dst_w, dst_h, degree,
+				     x_mirr, y_mirr);
+	if (!ret)
+		ret = rga_exec(ctx);
+
+	return ret;
+}
+
+static void run_cases(struct result *res)
+{
+	static const unsigned int degrees[] = { 0, 90, 180, 270 };
+	struct rga_image src, dst;
+	struct rga_context *ctx;
+	unsigned int f, d, m, w, h;
+	uint32_t seed = 1;
+	int ret;
+
+	for (f = 0; f < BUF_SIZE; f++) {
+		seed = seed * 1103515245 + 12345;
+		src_buf[f] = seed >> 16;
+	}
+
+	ctx = rga_init(-1);
+	if (!ctx || rga_set_backend(ctx, RGA_BACKEND_CPU))
+		exit(1);
+
+	for (f = 0; f < FORMAT_NR; f++) {
+		for (d = 0; d < 4; d++) {
+			w = degrees[d] % 180 ? SRC_H - 4 : SRC_W - 4;
+			h = degrees[d] % 180 ? SRC_W - 4 : SRC_H - 4;
+
+			for (m = 0; m < 4; m++) {
+				/* formats to ARGB8888 */
+				image_init(&src, src_buf, formats[f], SRC_W,
+					   SRC_H);
+				image_init(&dst, dst_buf, DRM_FORMAT_ARGB8888,
+					   DST_W, DST_H);
+				ret = run_op(ctx, &src, &dst, w, h, degrees[d],
+					     m & 1, m >> 1);
+				record(res, ret);
+
+				/* ARGB8888 to formats */
+				image_init(&src, src_buf, DRM_FORMAT_ARGB8888,
+					   SRC_W, SRC_H);
+				image_init(&dst, dst_buf, formats[f], DST_W,
+					   DST_H);
+				ret = run_op(ctx, &src, &dst, w, h, degrees[d],
+					     m & 1, m >> 1);
+				record(res, ret);
+			}
+		}
+
+		/* Scaling up and down, to and from the format */
+		image_init(&src, src_buf, formats[f], SRC_W, SRC_H);
+		image_init(&dst, dst_buf, DRM_FORMAT_XRGB8888, DST_W, DST_H);
+		record(res, run_op(ctx, &src, &dst, 90, 30, 0, 0, 0));
+		image_init(&src, src_buf, DRM_FORMAT_XRGB8888, SRC_W, SRC_H);
+		image_init(&dst, dst_buf, formats[f], DST_W, DST_H);
+		record(res, run_op(ctx, &src, &dst, 30, 90, 0, 0, 0));
+
+		/* Solid fill */
+		image_init(&dst, dst_buf, formats[f], DST_W, DST_H);
+		dst.fill_color = 0x80c04020;
+		memset(dst_buf, 0x5a, sizeof(dst_buf));
+		ret = rga_solid_fill(ctx, &dst, 3, 1, 61, 45);
+		if (!ret)
+			ret = rga_exec(ctx);
+		record(res, ret);
+	}
+
+	rga_fini(ctx);
+}
+
+int main(void)
+{
+	struct result *res;
+	unsigned int i, j, bad, failed = 0;
+	pid_t pid;
+	int status;
+
+	res = mmap(NULL, sizeof(*res) * 4, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED)
+		return 1;
+
+	/* Unsupported sets fall back to the best one, which is checked too */
+	for (i = 0; i < 4; i++) {
+		fflush(stdout);
+		pid = fork();
+		if (pid < 0)
+			return 1;
+		if (!pid) {
+			setenv("RGA_CPU_SIMD", sets[i], 1);
+			run_cases(&res[i]);
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status)) {
+			fprintf(stderr, "RGA_CPU_SIMD=%s crashed.\n", sets[i]);
+			return 1;
+		}
+	}
+
+	if (!res[0].nr || res[0].nr > MAX_CASES)
+		return 1;
+
+	for (i = 1; i < 4; i++) {
+		bad = 0;
+		for (j = 0; j < res[0].nr; j++)
+			bad += res[i].hash[j] != res[0].hash[j];
+		if (res[i].nr != res[0].nr)
+			bad++;
+
+		printf("RGA_CPU_SIMD=%s: %u cases, %u mismatches\n",
+		       sets[i], res[0].nr, bad);
+		failed |= !!bad;
+	}
+
+	return failed;
+}
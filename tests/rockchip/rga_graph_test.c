@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Checks rga_graph_run() against running the same nodes one by one.
+ *
+ * More intermediates than the graph pools are live at once, so buffers
+ * leave the pool while operations using them are still queued, and chains
+ * of unscaled transforms through an intermediate are fused. The graph is
+ * run twice to reuse its pool, and the output must match the one of each
+ * node executed on its own, with the intermediates in application memory.
+ * The CPU engine draws on user pointer images, no device is needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "drm_fourcc.h"
+
+#include "rockchip_drm.h"
+#include "rockchip_rga.h"
+
+#define SRC_W		160
+#define SRC_H		120
+#define DST_W		512
+#define DST_H		384
+#define TILE		64
+#define FAN_NR		12
+#define CHAIN_NR	8
+#define INTER_NR	(FAN_NR + CHAIN_NR)
+#define NODE_MAX	64
+
+struct node {
+	int			fill;
+	int			src, dst;
+	struct rga_rect		src_rect, dst_rect;
+	unsigned int		degree, x_mirr, y_mirr;
+	unsigned int		color;
+};
+
+/* Images by graph id: the source, the destination, then intermediates */
+static struct rga_image images[2 + INTER_NR];
+static uint8_t *bufs[2 + INTER_NR];
+static struct node nodes[NODE_MAX];
+static unsigned int node_nr;
+
+static void image_init(struct rga_image *img, uint8_t *buf, uint32_t format,
+		       unsigned int width, unsigned int height,
+		       unsigned int cpp)
+{
+	memset(img, 0, sizeof(*img));
+	img->color_mode = format;
+	img->width = width;
+	img->height = height;
+	img->stride = width * cpp;
+	img->buf_type = RGA_IMGBUF_USERPTR;
+	img->user_ptr[0].userptr = (unsigned long)buf;
+	img->user_ptr[0].size = img->stride * height;
+}
+
+static int add_intermediate(struct rga_graph *graph, uint32_t format,
+			    unsigned int width, unsigned int height,
+			    unsigned int cpp)
+{
+	int id;
+
+	id = rga_graph_add_intermediate(graph, format, width, height);
+	if (id < 0 || id >= 2 + INTER_NR)
+		exit(1);
+
+	/* Step by step, the intermediate lives in application memory */
+	bufs[id] = calloc(1, width * height * cpp);
+	if (!bufs[id])
+		exit(1);
+	image_init(&images[id], bufs[id], format, width, height, cpp);
+
+	return id;
+}
+
+static void add_fill(struct rga_graph *graph, int dst, unsigned int color)
+{
+	struct node *n = &nodes[node_nr++];
+
+	memset(n, 0, sizeof(*n));
+	n->fill = 1;
+	n->dst = dst;
+	n->dst_rect.w = images[dst].width;
+	n->dst_rect.h = images[dst].height;
+	n->color = color;
+
+	if (rga_graph_add_fill(graph, dst, &n->dst_rect, color) < 0)
+		exit(1);
+}
+
+static void add_transform(struct rga_graph *graph, int src,
+			  struct rga_rect *src_rect, int dst,
+			  struct rga_rect *dst_rect, unsigned int degree,
+			  unsigned int x_mirr, unsigned int y_mirr)
+{
+	struct node *n = &nodes[node_nr++];
+
+	memset(n, 0, sizeof(*n));
+	n->src = src;
+	n->dst = dst;
+	n->src_rect = *src_rect;
+	n->dst_rect = *dst_rect;
+	n->degree = degree;
+	n->x_mirr = x_mirr;
+	n->y_mirr = y_mirr;
+
+	if (rga_graph_add_transform(graph, src, src_rect, dst, dst_rect,
+				    degree, x_mirr, y_mirr) < 0)
+		exit(1);
+}
+
+static int run_node(struct rga_context *ctx, const struct node *n)
+{
+	struct rga_image *dst = &images[n->dst];
+	int ret;
+
+	if (n->fill) {
+		dst->fill_color = n->color;
+		ret = rga_solid_fill(ctx, dst, n->dst_rect.x, n->dst_rect.y,
+				     n->dst_rect.w, n->dst_rect.h);
+	} else {
+		ret = rga_multiple_transform(ctx, &images[n->src], dst,
+					     n->src_rect.x, n->src_rect.y,
+					     n->src_rect.w, n->src_rect.h,
+					     n->dst_rect.x, n->dst_rect.y,
+					     n->dst_rect.w, n->dst_rect.h,
+					     n->degree, n->x_mirr, n->y_mirr);
+	}
+
+	return ret ? ret : rga_exec(ctx);
+}
+
+/*
+ * A fan of intermediates, all written before any is read back, each by a
+ * fill and a rotated copy so they are not fused away, then scaled into a
+ * tile of the destination.
+ */
+static void build_fan(struct rga_graph *graph, int src, int dst)
+{
+	int inter[FAN_NR];
+	struct rga_rect s, d;
+	unsigned int i, size;
+
+	for (i = 0; i < FAN_NR; i++) {
+		size = 72 + 8 * i;
+		inter[i] = add_intermediate(graph, i % 3 ?
+					    DRM_FORMAT_ARGB8888 :
+					    DRM_FORMAT_RGB565, size, size,
+					    i % 3 ? 4 : 2);
+	}
+
+	for (i = 0; i < FAN_NR; i++) {
+		size = images[inter[i]].width;
+		add_fill(graph, inter[i], 0xff000000 | (i * 0x151515));
+
+		s.x = i * 4;
+		s.y = i * 2;
+		s.w = 64;
+		s.h = 48;
+		d.x = size - 56;
+		d.y = 4;
+		d.w = 48;
+		d.h = 64;
+		add_transform(graph, src, &s, inter[i], &d, 90 * (i % 4),
+			      i & 1, 0);
+	}
+
+	for (i = 0; i < FAN_NR; i++) {
+		size = images[inter[i]].width;
+		s.x = s.y = 0;
+		s.w = s.h = size;
+		d.x = (i % 8) * TILE;
+		d.y = (i / 8) * TILE;
+		d.w = d.h = TILE;
+		add_transform(graph, inter[i], &s, dst, &d, 0, 0, i & 1);
+	}
+}
+
+/* Unscaled chains through an intermediate, every orientation pair */
+static void build_chains(struct rga_graph *graph, int src, int dst)
+{
+	struct rga_rect s, m, d;
+	unsigned int i, rot;
+	int inter;
+
+	for (i = 0; i < CHAIN_NR; i++) {
+		rot = (i % 4) * 90;
+		inter = add_intermediate(graph, DRM_FORMAT_ARGB8888,
+					 rot % 180 ? 48 : 64,
+					 rot % 180 ? 64 : 48, 4);
+
+		s.x = 8 * i;
+		s.y = 4 * i;
+		s.w = 64;
+		s.h = 48;
+		m.x = m.y = 0;
+		m.w = images[inter].width;
+		m.h = images[inter].height;
+		add_transform(graph, src, &s, inter, &m, rot, i / 4, 0);
+
+		d.x = (i % 8) * TILE;
+		d.y = 3 * TILE;
+		d.w = (rot + 90 * i) % 180 ? 48 : 64;
+		d.h = (rot + 90 * i) % 180 ? 64 : 48;
+		add_transform(graph, inter, &m, dst, &d, (90 * i) % 360,
+			      0, i & 1);
+	}
+}
+
+int main(void)
+{
+	struct rga_image *dst_img;
+	struct rga_context *ctx;
+	struct rga_graph *graph;
+	uint8_t *expect;
+	unsigned int i, run;
+	uint32_t seed = 1;
+	int src, dst, ret;
+	size_t dst_size;
+
+	ctx = rga_init(-1);
+	if (!ctx || rga_set_backend(ctx, RGA_BACKEND_CPU))
+		return 1;
+
+	graph = rga_graph_create(ctx);
+	if (!graph)
+		return 1;
+
+	/* The application images, ids 0 and 1 */
+	src = 0;
+	bufs[src] = malloc(SRC_W * SRC_H * 4);
+	dst = 1;
+	bufs[dst] = malloc(DST_W * DST_H * 4);
+	if (!bufs[src] || !bufs[dst])
+		return 1;
+	image_init(&images[src], bufs[src], DRM_FORMAT_ARGB8888, SRC_W, SRC_H,
+		   4);
+	image_init(&images[dst], bufs[dst], DRM_FORMAT_XRGB8888, DST_W, DST_H,
+		   4);
+	if (rga_graph_add_image(graph, &images[src]) != src ||
+	    rga_graph_add_image(graph, &images[dst]) != dst)
+		return 1;
+
+	for (i = 0; i < SRC_W * SRC_H * 4; i++) {
+		seed = seed * 1103515245 + 12345;
+		bufs[src][i] = seed >> 16;
+	}
+
+	add_fill(graph, dst, 0xff102030);
+	build_fan(graph, src, dst);
+	build_chains(graph, src, dst);
+
+	/* The reference, one node at a time in the order they were added */
+	dst_size = DST_W * DST_H * 4;
+	for (i = 0; i < node_nr; i++) {
+		ret = run_node(ctx, &nodes[i]);
+		if (ret) {
+			fprintf(stderr, "node %u failed: %d\n", i, ret);
+			return 1;
+		}
+	}
+
+	expect = malloc(dst_size);
+	if (!expect)
+		return 1;
+	memcpy(expect, bufs[dst], dst_size);
+
+	/* Operations the graph does not own must not be run or dropped */
+	dst_img = &images[dst];
+	dst_img->fill_color = 0;
+	if (rga_solid_fill(ctx, dst_img, 0, 0, 1, 1) ||
+	    rga_graph_run(graph) != -EBUSY || rga_exec(ctx))
+		return 1;
+
+	for (run = 0; run < 2; run++) {
+		memset(bufs[dst], 0x5a, dst_size);
+
+		ret = rga_graph_run(graph);
+		if (ret <= 0 || (unsigned int)ret >= node_nr) {
+			fprintf(stderr, "run %u: graph failed: %d\n", run, ret);
+			return 1;
+		}
+
+		printf("run %u: %u nodes in %d operations\n", run, node_nr,
+		       ret);
+
+		if (memcmp(bufs[dst], expect, dst_size)) {
+			fprintf(stderr, "run %u: graph output differs\n", run);
+			return 1;
+		}
+	}
+
+	rga_graph_destroy(graph);
+	rga_fini(ctx);
+
+	for (i = 0; i < 2 + INTER_NR; i++)
+		free(bufs[i]);
+	free(expect);
+
+	return 0;
+}
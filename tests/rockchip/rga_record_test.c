@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Records a trace of RGA transforms from packed YUV, which the library
+ * pre-converts into staging buffers, and replays it with rga_replay on
+ * the RGA and on the CPU engine. Every buffer the recorded cmdlists use
+ * must be in the trace for the replay to succeed.
+ *
+ * Skipped without a rockchip device with an RGA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <xf86drm.h>
+
+#include "drm_fourcc.h"
+
+#include "rockchip_drm.h"
+#include "rockchip_drmif.h"
+#include "rockchip_rga.h"
+
+#define WIDTH		128
+#define HEIGHT		64
+
+struct test_buf {
+	struct rockchip_bo	*bo;
+	int			fd;
+};
+
+static int buf_create(struct rockchip_device *dev, struct test_buf *buf,
+		      size_t size)
+{
+	uint8_t *ptr;
+	size_t i;
+
+	buf->bo = rockchip_bo_create(dev, size, 0);
+	if (!buf->bo)
+		return -1;
+
+	ptr = rockchip_bo_map(buf->bo);
+	if (!ptr)
+		return -1;
+	for (i = 0; i < size; i++)
+		ptr[i] = i * 7 + (i >> 8);
+
+	return drmPrimeHandleToFD(dev->fd, buf->bo->handle, 0, &buf->fd);
+}
+
+static void image_init(struct rga_image *img, const struct test_buf *buf,
+		       uint32_t format, unsigned int stride)
+{
+	memset(img, 0, sizeof(*img));
+	img->color_mode = format;
+	img->width = WIDTH;
+	img->height = HEIGHT;
+	img->stride = stride;
+	img->buf_type = RGA_IMGBUF_GEM;
+	img->bo[0] = buf->fd;
+}
+
+static int replay(const char *trace, int cpu)
+{
+	int status;
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (!pid) {
+		if (cpu)
+			execl("./rga_replay", "rga_replay", "-c", trace, NULL);
+		else
+			execl("./rga_replay", "rga_replay", trace, NULL);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		return -1;
+
+	return WEXITSTATUS(status);
+}
+
+int main(void)
+{
+	static const uint32_t formats[] = {
+		DRM_FORMAT_YUYV, DRM_FORMAT_YVYU,
+		DRM_FORMAT_UYVY, DRM_FORMAT_VYUY,
+	};
+	char trace[] = "/tmp/rga_record_test.XXXXXX";
+	struct rockchip_device *dev;
+	struct test_buf src, dst;
+	struct rga_image s, d;
+	struct rga_context *ctx;
+	unsigned int i;
+	int fd, ret;
+
+	fd = drmOpen("rockchip", NULL);
+	if (fd < 0)
+		return 77;
+
+	dev = rockchip_device_create(fd);
+	if (!dev)
+		return 1;
+
+	if (buf_create(dev, &src, WIDTH * HEIGHT * 2) ||
+	    buf_create(dev, &dst, WIDTH * HEIGHT * 4))
+		return 1;
+
+	ret = mkstemp(trace);
+	if (ret < 0)
+		return 1;
+	close(ret);
+
+	setenv("RGA_TRACE_FILE", trace, 1);
+	setenv("RGA_TRACE_CONTENTS", "1", 1);
+
+	ctx = rga_init(fd);
+	if (!ctx)
+		return 1;
+
+	if (rga_set_backend(ctx, RGA_BACKEND_HW)) {
+		rga_fini(ctx);
+		unlink(trace);
+		return 77;
+	}
+
+	/* Rotated and scaled, from odd source positions */
+	for (i = 0; i < 4; i++) {
+		image_init(&s, &src, formats[i], WIDTH * 2);
+		image_init(&d, &dst, DRM_FORMAT_XRGB8888, WIDTH * 4);
+
+		ret = rga_multiple_transform(ctx, &s, &d, 1 + i, 3, 61, 40,
+					     0, 0, 40 + i, 61, 90 * (i % 2 + 1),
+					     i & 1, 0);
+		if (!ret)
+			ret = rga_exec(ctx);
+		if (ret) {
+			fprintf(stderr, "transform %u failed: %d\n", i, ret);
+			return 1;
+		}
+	}
+
+	/* Flushes and closes the trace */
+	rga_fini(ctx);
+
+	ret = replay(trace, 0);
+	if (ret) {
+		fprintf(stderr, "rga replay failed: %d\n", ret);
+		return 1;
+	}
+
+	ret = replay(trace, 1);
+	if (ret) {
+		fprintf(stderr, "cpu replay failed: %d\n", ret);
+		return 1;
+	}
+
+	unlink(trace);
+
+	close(src.fd);
+	close(dst.fd);
+	rockchip_bo_destroy(src.bo);
+	rockchip_bo_destroy(dst.bo);
+	rockchip_device_destroy(dev);
+	drmClose(fd);
+
+	return 0;
+}
@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Replays a trace written by libdrm_rockchip with RGA_TRACE_FILE set.
+ *
+ * By default the recorded cmdlists are submitted to the RGA again, with
+ * every recorded dma-buf replaced by a GEM buffer of the same size. With
+ * -c the recorded operations are run through the rga_* API on the CPU
+ * engine instead, which needs no device.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <xf86drm.h>
+
+#include "rockchip_drm.h"
+#include "rockchip_drmif.h"
+#include "rockchip_rga.h"
+#include "rockchip_rga_record.h"
+
+#define DRM_MODULE_NAME		"rockchip"
+#define REPLAY_MAX_BUFS		64
+
+struct replay_buf {
+	uint64_t		id;
+	int			rec_fd;
+	size_t			size;
+	struct rockchip_bo	*bo;
+	int			fd;
+	void			*ptr;
+};
+
+struct replay {
+	int			cpu;
+	int			fd;
+	struct rockchip_device	*dev;
+	struct rga_context	*ctx;
+	struct replay_buf	bufs[REPLAY_MAX_BUFS];
+	unsigned int		buf_nr;
+
+	unsigned long long	ops;
+	unsigned long long	execs;
+	unsigned long long	hw_execs;
+	unsigned long long	failures;
+	double			rec_ms;
+	double			replay_ms;
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static struct replay_buf *replay_find(struct replay *r, uint64_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < r->buf_nr; i++)
+		if (r->bufs[i].id == id)
+			return &r->bufs[i];
+
+	return NULL;
+}
+
+static struct replay_buf *replay_find_fd(struct replay *r, int rec_fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < r->buf_nr; i++)
+		if (r->bufs[i].rec_fd == rec_fd)
+			return &r->bufs[i];
+
+	return NULL;
+}
+
+static int replay_buffer(struct replay *r, const struct rga_record_buffer *rec,
+			 const void *contents)
+{
+	struct replay_buf *buf = replay_find(r, rec->id);
+	unsigned int i;
+
+	if (!buf) {
+		if (r->buf_nr == REPLAY_MAX_BUFS) {
+			fprintf(stderr, "too many buffers in trace.\n");
+			return -ENOMEM;
+		}
+
+		buf = &r->bufs[r->buf_nr++];
+		memset(buf, 0, sizeof(*buf));
+		buf->id = rec->id;
+		buf->size = rec->size;
+		buf->fd = -1;
+
+		if (r->cpu) {
+			buf->ptr = calloc(1, buf->size);
+		} else {
+			buf->bo = rockchip_bo_create(r->dev, buf->size, 0);
+			if (buf->bo &&
+			    drmPrimeHandleToFD(r->fd, buf->bo->handle, 0,
+					       &buf->fd) == 0)
+				buf->ptr = rockchip_bo_map(buf->bo);
+		}
+
+		if (!buf->ptr) {
+			fprintf(stderr, "failed to allocate %zu byte buffer.\n",
+				buf->size);
+			return -ENOMEM;
+		}
+	} else if (buf->size != rec->size) {
+		fprintf(stderr, "buffer %llu changed size.\n",
+			(unsigned long long)rec->id);
+		return -EINVAL;
+	}
+
+	/* A recorded fd number may have been reused for another buffer */
+	for (i = 0; i < r->buf_nr; i++)
+		if (r->bufs[i].rec_fd == rec->fd)
+			r->bufs[i].rec_fd = -1;
+	buf->rec_fd = rec->fd;
+
+	if (rec->contents)
+		memcpy(buf->ptr, contents, buf->size);
+
+	return 0;
+}
+
+static int replay_image(struct replay *r, const struct rga_record_image *rec,
+			struct rga_image *img)
+{
+	struct replay_buf *buf = replay_find(r, rec->buffer);
+
+	if (!buf) {
+		fprintf(stderr, "operation on unknown buffer.\n");
+		return -EINVAL;
+	}
+
+	memset(img, 0, sizeof(*img));
+	img->color_mode = rec->color_mode;
+	img->width = rec->width;
+	img->height = rec->height;
+	img->stride = rec->stride;
+	img->fill_color = rec->fill_color;
+	img->offset = rec->offset;
+	img->buf_type = RGA_IMGBUF_USERPTR;
+	img->user_ptr[0].userptr = (unsigned long)buf->ptr;
+	img->user_ptr[0].size = buf->size;
+
+	return 0;
+}
+
+static int replay_op(struct replay *r, const struct rga_record_op *rec)
+{
+	struct rga_image src, dst;
+	int ret;
+
+	r->ops++;
+
+	if (!r->cpu)
+		return 0;
+
+	ret = replay_image(r, &rec->dst, &dst);
+	if (ret)
+		return ret;
+
+	if (rec->type == 0)
+		return rga_solid_fill(r->ctx, &dst, rec->dst_x, rec->dst_y,
+				      rec->dst_w, rec->dst_h);
+
+	ret = replay_image(r, &rec->src, &src);
+	if (ret)
+		return ret;
+
+	return rga_multiple_transform(r->ctx, &src, &dst, rec->src_x,
+				      rec->src_y, rec->src_w, rec->src_h,
+				      rec->dst_x, rec->dst_y, rec->dst_w,
+				      rec->dst_h, rec->degree, rec->x_mirr,
+				      rec->y_mirr);
+}
+
+static int replay_cmdlist(struct replay *r,
+			  const struct rga_record_cmdlist *rec,
+			  const struct drm_rockchip_rga_cmd *recorded)
+{
+	struct drm_rockchip_rga_cmd cmds[RGA_MAX_CMD_NR + RGA_MAX_GEM_CMD_NR];
+	struct drm_rockchip_rga_set_cmdlist cmdlist = {0};
+	unsigned int i, nr = rec->cmd_nr + rec->cmd_buf_nr;
+
+	if (r->cpu || rec->ret)
+		return 0;
+
+	if (nr > RGA_MAX_CMD_NR + RGA_MAX_GEM_CMD_NR)
+		return -EINVAL;
+
+	memcpy(cmds, recorded, nr * sizeof(cmds[0]));
+
+	/* Base addresses carrying an fd may be in either array */
+	for (i = 0; i < nr; i++) {
+		struct replay_buf *buf;
+
+		if (!(cmds[i].offset & RGA_GEM_BUF_FD))
+			continue;
+
+		buf = replay_find_fd(r, cmds[i].data);
+		if (!buf) {
+			fprintf(stderr, "cmdlist uses unknown fd %u.\n",
+				cmds[i].data);
+			return -EINVAL;
+		}
+		cmds[i].data = buf->fd;
+	}
+
+	cmdlist.cmd = (uint64_t)(uintptr_t)&cmds[0];
+	cmdlist.cmd_buf = (uint64_t)(uintptr_t)&cmds[rec->cmd_nr];
+	cmdlist.cmd_nr = rec->cmd_nr;
+	cmdlist.cmd_buf_nr = rec->cmd_buf_nr;
+
+	return drmIoctl(r->fd, DRM_IOCTL_ROCKCHIP_RGA_SET_CMDLIST, &cmdlist);
+}
+
+static int replay_exec(struct replay *r, const struct rga_record_exec *rec,
+		       int done)
+{
+	struct drm_rockchip_rga_exec exec = {0};
+	double start;
+	int ret;
+
+	if (done) {
+		r->execs++;
+		r->rec_ms += rec->us / 1000.0;
+		if (!r->cpu)
+			return 0;
+	} else {
+		r->hw_execs++;
+		if (r->cpu || rec->ret)
+			return 0;
+	}
+
+	start = now_ms();
+	if (r->cpu)
+		ret = rga_exec(r->ctx);
+	else
+		ret = drmIoctl(r->fd, DRM_IOCTL_ROCKCHIP_RGA_EXEC, &exec);
+	r->replay_ms += now_ms() - start;
+
+	return ret;
+}
+
+static int replay_run(struct replay *r, const char *data, size_t size)
+{
+	const struct rga_record_header *header = (const void *)data;
+	size_t pos = sizeof(*header);
+	int ret;
+
+	if (size < sizeof(*header) || header->magic != RGA_RECORD_MAGIC ||
+	    header->version != RGA_RECORD_VERSION) {
+		fprintf(stderr, "not an rga trace.\n");
+		return -EINVAL;
+	}
+
+	while (pos + sizeof(struct rga_record_packet) <= size) {
+		const struct rga_record_packet *packet = (const void *)(data + pos);
+		const char *payload = data + pos + sizeof(*packet);
+
+		pos += sizeof(*packet) + packet->size;
+		if (pos > size) {
+			fprintf(stderr, "truncated trace.\n");
+			return -EINVAL;
+		}
+
+		switch (packet->type) {
+		case RGA_RECORD_BUFFER:
+			ret = replay_buffer(r, (const void *)payload,
+					    payload + sizeof(struct rga_record_buffer));
+			break;
+		case RGA_RECORD_OP:
+			ret = replay_op(r, (const void *)payload);
+			break;
+		case RGA_RECORD_CMDLIST:
+			ret = replay_cmdlist(r, (const void *)payload,
+					     (const void *)(payload +
+					     sizeof(struct rga_record_cmdlist)));
+			break;
+		case RGA_RECORD_EXEC:
+		case RGA_RECORD_DONE:
+			ret = replay_exec(r, (const void *)payload,
+					  packet->type == RGA_RECORD_DONE);
+			break;
+		default:
+			ret = 0;
+			break;
+		}
+
+		if (ret == -ENOMEM || ret == -EINVAL)
+			return ret;
+		if (ret)
+			r->failures++;
+	}
+
+	return 0;
+}
+
+static char *read_file(const char *path, size_t *size)
+{
+	FILE *file = fopen(path, "rb");
+	char *data;
+	long len;
+
+	if (!file)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data = malloc(len);
+	if (data && fread(data, 1, len, file) != (size_t)len) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+
+	*size = len;
+
+	return data;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-c] [-n loops] trace\n", name);
+	fprintf(stderr, "\t-c\treplay the operations on the CPU engine\n");
+	fprintf(stderr, "\t-n\treplay the trace this many times\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct replay r;
+	unsigned int i, loops = 1;
+	size_t size;
+	char *data;
+	int c, ret = 0;
+
+	memset(&r, 0, sizeof(r));
+	r.fd = -1;
+
+	while ((c = getopt(argc, argv, "cn:")) != -1) {
+		switch (c) {
+		case 'c':
+			r.cpu = 1;
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	data = read_file(argv[optind], &size);
+	if (!data) {
+		fprintf(stderr, "failed to read %s.\n", argv[optind]);
+		return 1;
+	}
+
+	if (!r.cpu) {
+		r.fd = drmOpen(DRM_MODULE_NAME, NULL);
+		if (r.fd < 0) {
+			fprintf(stderr, "failed to open rockchip drm device.\n");
+			return 1;
+		}
+		r.dev = rockchip_device_create(r.fd);
+		if (!r.dev)
+			return 1;
+	} else {
+		r.ctx = rga_init(r.fd);
+		if (!r.ctx)
+			return 1;
+		rga_set_backend(r.ctx, RGA_BACKEND_CPU);
+	}
+
+	for (i = 0; i < loops && ret == 0; i++)
+		ret = replay_run(&r, data, size);
+
+	printf("%s replay: %llu rga_exec, %llu ops, %llu rga batches, "
+	       "%llu failures\n", r.cpu ? "cpu" : "rga", r.execs, r.ops,
+	       r.hw_execs, r.failures);
+	printf("recorded %.3f ms, replayed %.3f ms\n", r.rec_ms, r.replay_ms);
+
+	for (i = 0; i < r.buf_nr; i++) {
+		if (r.bufs[i].bo) {
+			close(r.bufs[i].fd);
+			rockchip_bo_destroy(r.bufs[i].bo);
+		} else {
+			free(r.bufs[i].ptr);
+		}
+	}
+
+	if (r.ctx)
+		rga_fini(r.ctx);
+	if (r.dev) {
+		rockchip_device_destroy(r.dev);
+		drmClose(r.fd);
+	}
+	free(data);
+
+	return ret ? 1 : 0;
+}
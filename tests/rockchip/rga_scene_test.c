@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Checks that rga_scene_render() redrawing only the damage gives the same
+ * frames as redrawing everything.
+ *
+ * Two scenes get the same layers and changes. One renders to a ring of
+ * buffers, passing their age, the other renders each frame from scratch,
+ * and the results must match byte for byte. Layers move, rotate, mirror,
+ * change their fill color, hide, and get parts of their sources redrawn.
+ * Some layers are scaled, which are only correct if drawn in one piece.
+ * The CPU engine draws on user pointer images, no device is needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "drm_fourcc.h"
+
+#include "rockchip_drm.h"
+#include "rockchip_rga.h"
+
+#define WIDTH		128
+#define HEIGHT		96
+#define SRC_W		48
+#define SRC_H		40
+#define BUF_NR		3
+#define LAYER_NR	6
+#define FRAME_NR	200
+
+static uint8_t bufs[BUF_NR][WIDTH * HEIGHT * 4];
+static uint8_t ref_buf[WIDTH * HEIGHT * 4];
+static uint8_t src_bufs[LAYER_NR][SRC_W * SRC_H * 4];
+
+static uint32_t seed = 1;
+
+static unsigned int rnd(unsigned int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+static void image_init(struct rga_image *img, uint8_t *buf, uint32_t format,
+		       unsigned int width, unsigned int height,
+		       unsigned int cpp)
+{
+	memset(img, 0, sizeof(*img));
+	img->color_mode = format;
+	img->width = width;
+	img->height = height;
+	img->stride = width * cpp;
+	img->buf_type = RGA_IMGBUF_USERPTR;
+	img->user_ptr[0].userptr = (unsigned long)buf;
+	img->user_ptr[0].size = img->stride * height;
+}
+
+/* A random layer, sometimes scaled and always partly on screen */
+static void layer_init(struct rga_layer *layer, struct rga_image *src)
+{
+	static const unsigned int degrees[] = { 0, 90, 180, 270 };
+	struct rga_rect *s = &layer->src_rect, *d = &layer->dst_rect;
+	int scaled = 0;
+
+	memset(layer, 0, sizeof(*layer));
+
+	if (rnd(4) == 0) {
+		layer->fill_color = 0xff000000 | (rnd(256) << 16) |
+				    (rnd(256) << 8) | rnd(256);
+		d->w = 1 + rnd(WIDTH);
+		d->h = 1 + rnd(HEIGHT);
+	} else {
+		layer->src = src;
+		s->w = 1 + rnd(SRC_W);
+		s->h = 1 + rnd(SRC_H);
+		s->x = rnd(SRC_W - s->w + 1);
+		s->y = rnd(SRC_H - s->h + 1);
+		layer->degree = degrees[rnd(4)];
+		layer->x_mirr = rnd(2);
+		layer->y_mirr = rnd(2);
+		d->w = layer->degree % 180 ? s->h : s->w;
+		d->h = layer->degree % 180 ? s->w : s->h;
+
+		/* From half to twice the size */
+		if (rnd(3) == 0) {
+			scaled = 1;
+			d->w = d->w / 2 + 1 + rnd(d->w * 3 / 2);
+			d->h = d->h / 2 + 1 + rnd(d->h * 3 / 2);
+		}
+	}
+
+	d->x = rnd(WIDTH);
+	d->y = rnd(HEIGHT);
+	if (d->x + d->w > WIDTH)
+		d->w = WIDTH - d->x;
+	if (d->y + d->h > HEIGHT)
+		d->h = HEIGHT - d->y;
+
+	/* Clipping the window must not scale an unscaled layer */
+	if (layer->src && !scaled) {
+		if (layer->degree % 180) {
+			s->w = d->h;
+			s->h = d->w;
+		} else {
+			s->w = d->w;
+			s->h = d->h;
+		}
+	}
+}
+
+/* Redraw part of a source image, returning the rectangle */
+static void src_scribble(uint8_t *buf, struct rga_rect *rect)
+{
+	unsigned int x, y, color = rnd(0x1000000);
+
+	rect->w = 1 + rnd(SRC_W);
+	rect->h = 1 + rnd(SRC_H);
+	rect->x = rnd(SRC_W - rect->w + 1);
+	rect->y = rnd(SRC_H - rect->h + 1);
+
+	for (y = rect->y; y < rect->y + rect->h; y++)
+		for (x = rect->x; x < rect->x + rect->w; x++)
+			memcpy(&buf[(y * SRC_W + x) * 4], &color, 4);
+}
+
+int main(void)
+{
+	struct rga_image srcs[LAYER_NR], dsts[BUF_NR], ref;
+	unsigned int ages[BUF_NR] = { 0 };
+	struct rga_scene *scene, *full;
+	struct rga_layer layer;
+	struct rga_context *ctx;
+	unsigned int i, j, frame, back, redrawn = 0, bad = 0;
+	struct rga_rect rect;
+	int id, ret;
+
+	for (i = 0; i < LAYER_NR; i++)
+		for (j = 0; j < sizeof(src_bufs[i]); j++)
+			src_bufs[i][j] = rnd(256);
+
+	ctx = rga_init(-1);
+	if (!ctx || rga_set_backend(ctx, RGA_BACKEND_CPU))
+		return 1;
+
+	scene = rga_scene_create(ctx, WIDTH, HEIGHT, 0xff204060);
+	full = rga_scene_create(ctx, WIDTH, HEIGHT, 0xff204060);
+	if (!scene || !full)
+		return 1;
+
+	for (i = 0; i < LAYER_NR; i++) {
+		image_init(&srcs[i], src_bufs[i],
+			   i & 1 ? DRM_FORMAT_XRGB8888 : DRM_FORMAT_ARGB8888,
+			   SRC_W, SRC_H, 4);
+		layer_init(&layer, &srcs[i]);
+		if (rga_scene_add_layer(scene, &layer) != (int)i ||
+		    rga_scene_add_layer(full, &layer) != (int)i)
+			return 1;
+	}
+
+	for (i = 0; i < BUF_NR; i++)
+		image_init(&dsts[i], bufs[i], DRM_FORMAT_XRGB8888, WIDTH,
+			   HEIGHT, 4);
+	image_init(&ref, ref_buf, DRM_FORMAT_XRGB8888, WIDTH, HEIGHT, 4);
+
+	for (frame = 0; frame < FRAME_NR; frame++) {
+		for (i = rnd(3); i > 0; i--) {
+			id = rnd(LAYER_NR);
+
+			switch (rnd(4)) {
+			case 0:
+				src_scribble(src_bufs[id], &rect);
+				rga_scene_damage_layer(scene, id, &rect);
+				break;
+			case 1:
+				layer_init(&layer, &srcs[id]);
+				rga_scene_set_layer(scene, id, &layer);
+				rga_scene_set_layer(full, id, &layer);
+				break;
+			case 2:
+				rga_scene_set_layer(scene, id, NULL);
+				rga_scene_set_layer(full, id, NULL);
+				break;
+			default:
+				/* Damage the sources do not know about */
+				rect.x = rnd(WIDTH);
+				rect.y = rnd(HEIGHT);
+				rect.w = 1 + rnd(WIDTH);
+				rect.h = 1 + rnd(HEIGHT);
+				rga_scene_damage(scene, &rect);
+				break;
+			}
+		}
+
+		/* Mostly swap in order, sometimes reuse the latest buffer */
+		back = rnd(8) ? frame % BUF_NR : (frame + BUF_NR - 1) % BUF_NR;
+		if (frame == 0)
+			memset(bufs, 0x5a, sizeof(bufs));
+
+		ret = rga_scene_render(scene, &dsts[back], ages[back]);
+		if (ret < 0) {
+			fprintf(stderr, "frame %u: render failed: %d\n",
+				frame, ret);
+			return 1;
+		}
+		redrawn += ret;
+
+		for (i = 0; i < BUF_NR; i++)
+			if (ages[i])
+				ages[i]++;
+		ages[back] = 1;
+
+		memset(ref_buf, 0xa5, sizeof(ref_buf));
+		ret = rga_scene_render(full, &ref, 0);
+		if (ret < 0) {
+			fprintf(stderr, "frame %u: full render failed: %d\n",
+				frame, ret);
+			return 1;
+		}
+
+		if (memcmp(bufs[back], ref_buf, sizeof(ref_buf))) {
+			fprintf(stderr, "frame %u: partial redraw differs\n",
+				frame);
+			bad++;
+		}
+	}
+
+	printf("%u frames, %u rectangles redrawn, %u mismatches\n",
+	       FRAME_NR, redrawn, bad);
+
+	rga_scene_destroy(full);
+	rga_scene_destroy(scene);
+	rga_fini(ctx);
+
+	return !!bad;
+}
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Checks that the upload ring never hands out memory the RGA still reads.
+ *
+ * Images of random formats and sizes are uploaded through a ring much
+ * smaller than all of them and each is drawn into its own tile, submitted
+ * in groups with rga_exec() or rga_exec_async(). A second context
+ * draws the same data from application memory, and both destinations
+ * must match byte for byte. The ring wraps and waits for the RGA many
+ * times. The CPU engine draws on user pointer images, no device is needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "drm_fourcc.h"
+
+#include "rockchip_drm.h"
+#include "rockchip_rga.h"
+
+#define RING_SIZE	(32 * 1024)
+#define TILE		64
+#define TILES_X		16
+#define TILES_Y		16
+#define DST_W		(TILE * TILES_X)
+#define DST_H		(TILE * TILES_Y)
+#define DST_SIZE	(DST_W * DST_H * 4)
+
+static const struct {
+	uint32_t	format;
+	unsigned int	cpp;
+	int		nv12;
+} formats[] = {
+	{ DRM_FORMAT_ARGB8888, 4, 0 },
+	{ DRM_FORMAT_XRGB8888, 4, 0 },
+	{ DRM_FORMAT_RGB565, 2, 0 },
+	{ DRM_FORMAT_NV12, 1, 1 },
+};
+
+#define FORMAT_NR	(sizeof(formats) / sizeof(formats[0]))
+
+static uint8_t dst_buf[DST_SIZE], ref_dst_buf[DST_SIZE];
+static uint8_t ref_src_buf[TILE * TILE * 4];
+
+static uint32_t seed = 1;
+
+static unsigned int rnd(unsigned int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+static void image_init(struct rga_image *img, uint8_t *buf, uint32_t format,
+		       unsigned int width, unsigned int height,
+		       unsigned int stride, size_t size)
+{
+	memset(img, 0, sizeof(*img));
+	img->color_mode = format;
+	img->width = width;
+	img->height = height;
+	img->stride = stride;
+	img->buf_type = RGA_IMGBUF_USERPTR;
+	img->user_ptr[0].userptr = (unsigned long)buf;
+	img->user_ptr[0].size = size;
+}
+
+static int run(int async)
+{
+	struct rga_context *ctx, *ref_ctx;
+	struct rga_image img, src, dst, ref_dst;
+	struct rga_upload *up;
+	struct rga_stats stats;
+	unsigned int i, f, w, h, x, y, group = 0;
+	size_t size, j;
+	void *ptr;
+	int ret;
+
+	ctx = rga_init(-1);
+	ref_ctx = rga_init(-1);
+	if (!ctx || !ref_ctx || rga_set_backend(ctx, RGA_BACKEND_CPU) ||
+	    rga_set_backend(ref_ctx, RGA_BACKEND_CPU))
+		return -1;
+
+	up = rga_upload_create(ctx, RING_SIZE);
+	if (!up)
+		return -1;
+
+	memset(dst_buf, 0, sizeof(dst_buf));
+	memset(ref_dst_buf, 0, sizeof(ref_dst_buf));
+	image_init(&dst, dst_buf, DRM_FORMAT_XRGB8888, DST_W, DST_H, DST_W * 4,
+		   DST_SIZE);
+	image_init(&ref_dst, ref_dst_buf, DRM_FORMAT_XRGB8888, DST_W, DST_H,
+		   DST_W * 4, DST_SIZE);
+
+	for (i = 0; i < TILES_X * TILES_Y; i++) {
+		f = rnd(FORMAT_NR);
+		w = 8 + 2 * rnd(TILE / 2 - 3);
+		h = 8 + 2 * rnd(TILE / 2 - 3);
+		x = (i % TILES_X) * TILE;
+		y = (i / TILES_X) * TILE;
+
+		ret = rga_upload_image(up, formats[f].format, w, h, &img,
+				       &ptr);
+		if (ret) {
+			fprintf(stderr, "upload %u failed: %d\n", i, ret);
+			return -1;
+		}
+
+		/* The chroma plane follows the luma plane in both */
+		size = (size_t)w * h * formats[f].cpp;
+		if (formats[f].nv12)
+			size += size / 2;
+		for (j = 0; j < size; j++)
+			ref_src_buf[j] = rnd(256);
+		memcpy(ptr, ref_src_buf, size);
+
+		ret = rga_multiple_transform(ctx, &img, &dst, 0, 0, w, h,
+					     x, y, w, h, 0, 0, 0);
+		if (ret)
+			return -1;
+
+		image_init(&src, ref_src_buf, formats[f].format, w, h,
+			   w * formats[f].cpp, size);
+		ret = rga_multiple_transform(ref_ctx, &src, &ref_dst, 0, 0, w,
+					     h, x, y, w, h, 0, 0, 0);
+		if (!ret)
+			ret = rga_exec(ref_ctx);
+		if (ret)
+			return -1;
+
+		/* Groups of up to eight uploads may not fit in the ring */
+		if (!group)
+			group = 1 + rnd(8);
+		if (--group)
+			continue;
+
+		ret = async ? rga_exec_async(ctx) : rga_exec(ctx);
+		if (ret) {
+			fprintf(stderr, "submission failed: %d\n", ret);
+			return -1;
+		}
+	}
+
+	ret = ctx->op_nr ? rga_exec(ctx) : 0;
+	if (!ret && async)
+		ret = rga_wait(ctx);
+	if (ret) {
+		fprintf(stderr, "last submission failed: %d\n", ret);
+		return -1;
+	}
+
+	rga_get_stats(ctx, &stats);
+	printf("%s: %u uploads, %llu waits for the ring\n",
+	       async ? "async" : "sync", TILES_X * TILES_Y,
+	       stats.upload_waits);
+
+	if (memcmp(dst_buf, ref_dst_buf, DST_SIZE)) {
+		fprintf(stderr, "%s: uploaded images differ\n",
+			async ? "async" : "sync");
+		return -1;
+	}
+
+	/* Images reserved since the last submission are never reused */
+	for (i = 0; i <= RING_SIZE / (TILE * TILE); i++) {
+		ret = rga_upload_image(up, DRM_FORMAT_ARGB8888, TILE, TILE,
+				       &img, &ptr);
+		if (ret)
+			break;
+	}
+	if (ret != -ENOSPC || !i) {
+		fprintf(stderr, "full ring not reported: %d\n", ret);
+		return -1;
+	}
+
+	rga_upload_destroy(up);
+	rga_fini(ref_ctx);
+	rga_fini(ctx);
+
+	return stats.upload_waits ? 0 : -1;
+}
+
+int main(void)
+{
+	if (run(0) || run(1))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2016 Fuzhou Rockchip Electronics Co.Ltd
+ * Authors:
+ *	Yakir Yang <ykk@rock-chips.com>
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Buffer objects are created, shared between threads through a set of
+ * slots, referenced, looked up, exported, imported and destroyed from
+ * several threads at once, first without and then with the buffer object
+ * cache. A gem handle closed twice, or closed while another thread still
+ * uses it, shows up as a failing GEM_CLOSE or a failed lookup.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/ioctl.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "xf86drm.h"
+#include "rockchip_drm.h"
+#include "rockchip_drmif.h"
+
+#define NR_THREADS	4
+#define NR_SLOTS	16
+#define ITERATIONS	20000
+
+static typeof(ioctl) *old_ioctl;
+static int failed;
+static int use_names;
+
+static struct rockchip_bo *slots[NR_SLOTS];
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list va;
+	int ret;
+	void *arg;
+
+	va_start(va, request);
+	arg = va_arg(va, void *);
+	ret = old_ioctl(fd, request, arg);
+	va_end(va);
+
+	if (ret < 0 && request == DRM_IOCTL_GEM_CLOSE && errno == EINVAL)
+		failed = 1;
+
+	return ret;
+}
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "%s\n", what);
+	failed = 1;
+}
+
+/* Hand a reference over to a slot, dropping the one it held before */
+static void slot_put(unsigned int i, struct rockchip_bo *bo)
+{
+	rockchip_bo_destroy(__atomic_exchange_n(&slots[i % NR_SLOTS], bo,
+						__ATOMIC_ACQ_REL));
+}
+
+/* Take the reference a slot holds, if any */
+static struct rockchip_bo *slot_take(unsigned int i)
+{
+	return __atomic_exchange_n(&slots[i % NR_SLOTS], NULL, __ATOMIC_ACQ_REL);
+}
+
+static void check_lookup(struct rockchip_bo *bo)
+{
+	struct rockchip_bo *found;
+
+	found = rockchip_bo_lookup(bo->dev, bo->handle);
+	if (found != bo)
+		fail("lookup returned another buffer object");
+	rockchip_bo_destroy(found);
+}
+
+static void check_dmabuf(struct rockchip_bo *bo)
+{
+	struct rockchip_bo *imported;
+	int fd;
+
+	if (rockchip_bo_to_dmabuf(bo, &fd)) {
+		fail("export failed");
+		return;
+	}
+
+	imported = rockchip_bo_from_dmabuf(bo->dev, fd);
+	close(fd);
+	if (imported != bo)
+		fail("import returned another buffer object");
+	rockchip_bo_destroy(imported);
+}
+
+static void check_name(struct rockchip_bo *bo)
+{
+	struct rockchip_bo *opened;
+	uint32_t name;
+
+	if (rockchip_bo_get_name(bo, &name)) {
+		fail("flink failed");
+		return;
+	}
+
+	opened = rockchip_bo_from_name(bo->dev, name);
+	if (opened != bo)
+		fail("open by name returned another buffer object");
+	rockchip_bo_destroy(opened);
+}
+
+static void *stress(void *data)
+{
+	struct rockchip_device *dev = rockchip_device_ref(data);
+	unsigned int seed = (uintptr_t)&seed;
+	struct rockchip_bo *bo;
+	uint32_t *ptr;
+	int i;
+
+	for (i = 0; i < ITERATIONS && !failed; i++) {
+		unsigned int r = rand_r(&seed);
+
+		switch (r % 5) {
+		case 0:
+			bo = rockchip_bo_create(dev, 4096 * (1 + r / 5 % 64), 0);
+			if (!bo) {
+				fail("create failed");
+				break;
+			}
+			slot_put(r / 5, bo);
+			break;
+		case 1:
+			bo = slot_take(r / 5);
+			if (!bo)
+				break;
+			ptr = rockchip_bo_map(bo);
+			if (!ptr)
+				fail("map failed");
+			else
+				__sync_fetch_and_add(ptr, 1);
+			check_lookup(bo);
+			slot_put(r / 5, bo);
+			break;
+		case 2:
+			bo = slot_take(r / 5);
+			if (!bo)
+				break;
+			check_dmabuf(bo);
+			slot_put(r / 5, bo);
+			break;
+		case 3:
+			bo = slot_take(r / 5);
+			if (!bo)
+				break;
+			if (use_names)
+				check_name(bo);
+			/* Share it with another slot */
+			slot_put(r / 5 + 1, rockchip_bo_ref(bo));
+			slot_put(r / 5, bo);
+			break;
+		case 4:
+			rockchip_bo_destroy(slot_take(r / 5));
+			break;
+		}
+	}
+
+	rockchip_device_destroy(dev);
+
+	return NULL;
+}
+
+static void run(struct rockchip_device *dev)
+{
+	pthread_t threads[NR_THREADS];
+	uint32_t handles[NR_SLOTS];
+	struct rockchip_bo *bo;
+	int i;
+
+	for (i = 0; i < NR_THREADS; i++)
+		pthread_create(&threads[i], NULL, stress, dev);
+	for (i = 0; i < NR_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		bo = slot_take(i);
+		handles[i] = bo ? bo->handle : 0;
+		rockchip_bo_destroy(bo);
+	}
+
+	/* Nothing may be found once the last reference is gone */
+	for (i = 0; i < NR_SLOTS; i++) {
+		bo = rockchip_bo_lookup(dev, handles[i]);
+		if (bo) {
+			fail("destroyed buffer object still found");
+			rockchip_bo_destroy(bo);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct rockchip_device *dev;
+	struct rockchip_bo *bo;
+	const char *device = NULL;
+	uint32_t name;
+	int fd;
+
+	old_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+	if (argc < 2) {
+		fd = drmOpen("rockchip", NULL);
+	} else {
+		device = argv[1];
+		fd = open(device, O_RDWR);
+	}
+
+	if (fd < 0) {
+		fprintf(stderr, "Opening rockchip device failed with %i\n",
+			-errno);
+		return device ? 1 : 77;
+	}
+
+	dev = rockchip_device_create(fd);
+	if (!dev)
+		return 1;
+
+	/* Global names need an authenticated primary node */
+	bo = rockchip_bo_create(dev, 4096, 0);
+	if (!bo)
+		return 1;
+	use_names = !rockchip_bo_get_name(bo, &name);
+	rockchip_bo_destroy(bo);
+
+	run(dev);
+
+	if (!failed) {
+		rockchip_device_set_bo_cache(dev, 1);
+		run(dev);
+	}
+
+	rockchip_device_destroy(dev);
+	if (device)
+		close(fd);
+	else
+		drmClose(fd);
+
+	if (failed)
+		fprintf(stderr, "buffer object lifetime race detected.\n");
+
+	return failed;
+}